@@ -0,0 +1,657 @@
+/*
+  Contents: Benchmark of the computational kernels of the somsd package,
+            built by 'make bench'. For every combination of map size,
+            label dimension, outdegree and topology given on the command
+            line, a synthetic dataset and map are generated. The winner
+            searches, the adaptations, K_Step_Approximation(), and the
+            reading of the data and map files with LoadData() and LoadMap()
+            are then timed. Each kernel is reported with the minimum,
+            median, mean, 90th and 99th percentile, and maximum latency
+            per call, as CSV or as one JSON object per line.
+
+  Author: Markus Hagenbuchner
+
+  Comments and questions concerning this program package may be sent
+  to 'markus@artificial-neural.net'
+ */
+
+
+/************/
+/* Includes */
+/************/
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "data.h"
+#include "fileio.h"
+#include "system.h"
+#include "train.h"
+#include "utils.h"
+
+#define MAXSWEEP 32   /* Maximum number of values of a swept parameter */
+
+/* Formats of the report */
+#define REPORT_CSV  0
+#define REPORT_JSON 1
+
+struct BenchConfig{    /* A single point of the parameter sweep */
+  UNSIGNED xdim, ydim; /* Size of the map                       */
+  UNSIGNED ldim;       /* Dimension of the data label           */
+  UNSIGNED fanout;     /* Maximum outdegree of the nodes        */
+  UNSIGNED topology;   /* Topology of the map                   */
+};
+
+struct BenchOptions{
+  UNSIGNED numgraphs;  /* Number of graphs in the synthetic dataset */
+  UNSIGNED numnodes;   /* Number of nodes per graph                 */
+  UNSIGNED reps;       /* Number of timed samples per kernel        */
+  UNSIGNED batch;      /* Number of kernel calls per timed sample   */
+  UNSIGNED seed;       /* Seed for the random number generator      */
+  int format;          /* REPORT_CSV or REPORT_JSON                 */
+  int verbose;         /* Show the output of the package functions  */
+  char *tmpdir;        /* Directory for the temporary files         */
+  FILE *ofile;         /* Stream to which results are written       */
+};
+
+
+/* Begin functions... */
+
+/******************************************************************************
+Description: Print usage information to the screen
+
+Return value: The function does not return.
+******************************************************************************/
+void Usage()
+{
+  fprintf(stderr, "\n\
+Usage: bench [options]\n\n\
+Times the computational kernels of somsd on synthetic data for every\n\
+combination of the swept parameters. Lists are comma separated.\n\n\
+Options are:\n\
+    -map <list>        Sizes of the map as XDIMxYDIM. (default 10x8,20x16,40x32)\n\
+    -dim <list>        Dimensions of the data label. (default 2,16,64)\n\
+    -fanout <list>     Maximum outdegrees of the nodes. (default 2,6)\n\
+    -topol <list>      Topologies of the map: rectagonal, hexagonal,\n\
+                       octagonal, or vq. (default hexagonal,vq)\n\
+    -graphs <num>      Number of graphs in the dataset. (default 32)\n\
+    -nodes <num>       Number of nodes in each graph. (default 16)\n\
+    -reps <num>        Number of timed samples of each kernel. (default 21)\n\
+    -batch <num>       Number of calls of the search and adapt kernels per\n\
+                       sample. (default 64)\n\
+    -format <fmt>      Report as csv (default) or json (one object per line).\n\
+    -o <fname>         Write the report to <fname> instead of stdout.\n\
+    -seed <int>        Seed for the random number generator. (default 1)\n\
+    -tmpdir <dir>      Directory for temporary files. (default $TMPDIR or /tmp)\n\
+    -cachedir <dir>    Cache directory used by LoadData. Caching is disabled\n\
+                       by default, so that LoadData parses the dataset.\n\
+    -verbose           Show the progress messages of the timed functions.\n\
+    -help              Print this help.\n\
+\n\
+Latencies are per call in microseconds. Throughput is given in items per\n\
+second, where an item is a search or adaptation for a node, a node processed\n\
+by K_Step_Approximation or read by LoadData, or a codebook read by LoadMap.\n\
+ \n");
+  exit(0);
+}
+
+/******************************************************************************
+Description: Get the time of a monotonic clock.
+
+Return value: Time in seconds.
+******************************************************************************/
+static double GetSeconds()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/******************************************************************************
+Description: Parse a comma separated list of unsigned values. If pairs is
+             set, then each entry is a pair of the form AxB, and the second
+             values are stored in vals2.
+
+Return value: Number of values stored, or 0 on error.
+******************************************************************************/
+int ParseList(char *str, UNSIGNED *vals, UNSIGNED *vals2, int pairs)
+{
+  char *cptr, *end;
+  int num = 0;
+
+  if (str == NULL)
+    return 0;
+  for (cptr = str; *cptr != '\0' && num < MAXSWEEP; cptr = end){
+    vals[num] = (UNSIGNED)strtoul(cptr, &end, 10);
+    if (end == cptr)
+      return 0;
+    if (pairs){
+      if (*end != 'x' && *end != 'X')
+	return 0;
+      cptr = end + 1;
+      vals2[num] = (UNSIGNED)strtoul(cptr, &end, 10);
+      if (end == cptr)
+	return 0;
+    }
+    num++;
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      return 0;
+  }
+  return num;
+}
+
+/******************************************************************************
+Description: Parse a comma separated list of topology names.
+
+Return value: Number of topologies stored, or 0 on error.
+******************************************************************************/
+int ParseTopologies(char *str, UNSIGNED *vals)
+{
+  char *buf, *tok;
+  int num = 0;
+
+  if (str == NULL)
+    return 0;
+  buf = strdup(str);
+  for (tok = strtok(buf, ","); tok != NULL && num < MAXSWEEP; tok = strtok(NULL, ",")){
+    if ((vals[num] = GetTopologyID(tok, NULL)) == UNKNOWN){
+      num = 0;
+      break;
+    }
+    num++;
+  }
+  free(buf);
+  return num;
+}
+
+/******************************************************************************
+Description: Redirect stderr to /dev/null, so that the progress messages of
+             the timed functions do not clutter the output. Errors are still
+             collected with AddError().
+
+Return value: The descriptor of the original stderr, or -1.
+******************************************************************************/
+int Silence(struct BenchOptions *opts)
+{
+  int fd, saved;
+
+  if (opts->verbose)
+    return -1;
+  fflush(stderr);
+  if ((fd = open("/dev/null", O_WRONLY)) < 0)
+    return -1;
+  saved = dup(STDERR_FILENO);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+  return saved;
+}
+
+/******************************************************************************
+Description: Restore stderr after a call of Silence().
+
+Return value: This function does not return a value.
+******************************************************************************/
+void Unsilence(int saved)
+{
+  if (saved < 0)
+    return;
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+}
+
+/******************************************************************************
+Description: Write a synthetic dataset of random trees to the file fname.
+             Every node has a label of dimension ldim with values in [0,1),
+             and links to at most fanout children. The links of a tree are
+             assigned by attaching every node to a random earlier node which
+             has a free child slot.
+
+Return value: 0 on success, or nonzero on error.
+******************************************************************************/
+int WriteSyntheticData(char *fname, struct BenchConfig *cfg, struct BenchOptions *opts)
+{
+  UNSIGNED g, n, i, p, *numchildren, *children;
+  FILE *ofile;
+
+  if ((ofile = fopen(fname, "w")) == NULL){
+    AddError("Unable to write synthetic dataset.");
+    return 1;
+  }
+  numchildren = (UNSIGNED*)MyMalloc(opts->numnodes * sizeof(UNSIGNED));
+  children = (UNSIGNED*)MyMalloc((opts->numnodes * cfg->fanout + 1) * sizeof(UNSIGNED));
+
+  fprintf(ofile, "# Synthetic dataset generated by bench\n");
+  fprintf(ofile, "format=nodenumber,nodelabel,links\n");
+  fprintf(ofile, "indegree=0\noutdegree=%d\ndim_label=%d\n\n", cfg->fanout, cfg->ldim);
+  for (g = 0; g < opts->numgraphs; g++){
+    memset(numchildren, 0, opts->numnodes * sizeof(UNSIGNED));
+    for (n = 1; n < opts->numnodes && cfg->fanout > 0; n++){
+      do{                       /* Node 0 is the root, attach all others */
+	p = (UNSIGNED)(drand48() * n);
+      }while(numchildren[p] >= cfg->fanout);
+      children[p * cfg->fanout + numchildren[p]++] = n;
+    }
+
+    fprintf(ofile, "graph:g%d\n", g);
+    for (n = 0; n < opts->numnodes; n++){
+      fprintf(ofile, "%d", n);
+      for (i = 0; i < cfg->ldim; i++)
+	fprintf(ofile, " %f", drand48());
+      for (i = 0; i < cfg->fanout; i++){
+	if (i < numchildren[n])
+	  fprintf(ofile, " %d", children[n * cfg->fanout + i]);
+	else
+	  fprintf(ofile, " -");
+      }
+      fprintf(ofile, "\n");
+    }
+  }
+  free(numchildren);
+  free(children);
+  if (fclose(ofile) != 0){
+    AddError("Unable to write synthetic dataset.");
+    return 1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+Description: qsort() comparison function for an array of doubles.
+
+Return value: -1, 0, or 1.
+******************************************************************************/
+static int CompareDouble(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+/******************************************************************************
+Description: Get the q-quantile of a sorted array of num samples.
+
+Return value: The sample nearest to the quantile.
+******************************************************************************/
+static double Quantile(double *sorted, UNSIGNED num, double q)
+{
+  return sorted[(UNSIGNED)(q * (num - 1) + 0.5)];
+}
+
+/******************************************************************************
+Description: Write the statistics of the latency samples of a kernel to the
+             report. samples holds the time of a single call in seconds, and
+             items is the number of items processed by a call. The samples
+             are sorted by this function.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void Report(struct BenchOptions *opts, struct BenchConfig *cfg, const char *kernel, double *samples, UNSIGNED num, double items)
+{
+  static int header = 0;
+  double median, mean;
+  UNSIGNED i;
+
+  if (num == 0)
+    return;
+  qsort(samples, num, sizeof(double), CompareDouble);
+  median = Quantile(samples, num, 0.5);
+  mean = 0.0;
+  for (i = 0; i < num; i++)
+    mean += samples[i];
+  mean /= num;
+
+  if (opts->format == REPORT_JSON){
+    fprintf(opts->ofile, "{\"kernel\":\"%s\",\"topology\":\"%s\",\"xdim\":%d,\"ydim\":%d,\"ldim\":%d,\"fanout\":%d,\"nodes\":%d,\"reps\":%d,\"items\":%.0f,\"us\":{\"min\":%.3f,\"median\":%.3f,\"mean\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},\"items_per_sec\":%.1f}\n",
+	    kernel, GetTopologyName(cfg->topology), cfg->xdim, cfg->ydim, cfg->ldim, cfg->fanout, opts->numgraphs * opts->numnodes, num, items,
+	    samples[0] * 1e6, median * 1e6, mean * 1e6, Quantile(samples, num, 0.9) * 1e6, Quantile(samples, num, 0.99) * 1e6, samples[num-1] * 1e6,
+	    (median > 0.0) ? items / median : 0.0);
+  }
+  else{
+    if (!header)
+      fprintf(opts->ofile, "kernel,topology,xdim,ydim,ldim,fanout,nodes,reps,items,min_us,median_us,mean_us,p90_us,p99_us,max_us,items_per_sec\n");
+    fprintf(opts->ofile, "%s,%s,%d,%d,%d,%d,%d,%d,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f\n",
+	    kernel, GetTopologyName(cfg->topology), cfg->xdim, cfg->ydim, cfg->ldim, cfg->fanout, opts->numgraphs * opts->numnodes, num, items,
+	    samples[0] * 1e6, median * 1e6, mean * 1e6, Quantile(samples, num, 0.9) * 1e6, Quantile(samples, num, 0.99) * 1e6, samples[num-1] * 1e6,
+	    (median > 0.0) ? items / median : 0.0);
+  }
+  header = 1;
+  fflush(opts->ofile);
+}
+
+/******************************************************************************
+Description: Time the search kernel. Every sample times a batch of calls on
+             consecutive nodes of the dataset.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void BenchSearch(struct BenchOptions *opts, struct BenchConfig *cfg, struct Map *map, struct Node **nodes, struct Graph **graphs, UNSIGNED num, void (*FindWinner)(struct Map*, struct Node*, struct Graph*, struct Winner*), const char *name)
+{
+  struct Winner winner;
+  double *samples, t0;
+  UNSIGNED r, b, k = 0;
+
+  samples = (double*)MyMalloc(opts->reps * sizeof(double));
+  for (b = 0; b < opts->batch; b++, k = (k + 1) % num)    /* Warm up */
+    FindWinner(map, nodes[k], graphs[k], &winner);
+  for (r = 0; r < opts->reps; r++){
+    t0 = GetSeconds();
+    for (b = 0; b < opts->batch; b++, k = (k + 1) % num)
+      FindWinner(map, nodes[k], graphs[k], &winner);
+    samples[r] = (GetSeconds() - t0) / opts->batch;
+  }
+  Report(opts, cfg, name, samples, opts->reps, 1.0);
+  free(samples);
+}
+
+/******************************************************************************
+Description: Time an adaptation kernel. The winners are found before the
+             timing starts, and every sample times a batch of calls on
+             consecutive nodes of the dataset.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void BenchAdapt(struct BenchOptions *opts, struct BenchConfig *cfg, struct Map *map, struct Node **nodes, struct Graph **graphs, struct Winner *winners, UNSIGNED num, void (*Adapt)(struct Graph*, struct Map*, struct Node*, struct Winner*, FLOAT, FLOAT), const char *name)
+{
+  double *samples, t0;
+  FLOAT radius, alpha = 0.01;
+  UNSIGNED r, b, k = 0;
+
+  radius = max(cfg->xdim, cfg->ydim) / 2.0;  /* Radius early in training */
+  samples = (double*)MyMalloc(opts->reps * sizeof(double));
+  for (b = 0; b < opts->batch; b++, k = (k + 1) % num)    /* Warm up */
+    Adapt(graphs[k], map, nodes[k], &winners[k], radius, alpha);
+  for (r = 0; r < opts->reps; r++){
+    t0 = GetSeconds();
+    for (b = 0; b < opts->batch; b++, k = (k + 1) % num)
+      Adapt(graphs[k], map, nodes[k], &winners[k], radius, alpha);
+    samples[r] = (GetSeconds() - t0) / opts->batch;
+  }
+  Report(opts, cfg, name, samples, opts->reps, 1.0);
+  free(samples);
+}
+
+/******************************************************************************
+Description: Run all benchmarks for a single point of the parameter sweep.
+
+Return value: 0 on success, or nonzero on error.
+******************************************************************************/
+int RunConfig(struct BenchOptions *opts, struct BenchConfig *cfg)
+{
+  struct Parameters params, mparams;
+  struct Graph *gptr, **graphs;
+  struct Node **nodes;
+  struct Winner *winners;
+  char *dname, *mname;
+  double *samples, t0;
+  UNSIGNED r, i, num, steps;
+  int fd, saved;
+
+  memset(&params, 0, sizeof(struct Parameters));
+  memset(&mparams, 0, sizeof(struct Parameters));
+  samples = (double*)MyMalloc(opts->reps * sizeof(double));
+  dname = (char*)MyMalloc(strlen(opts->tmpdir) + 32);
+  mname = (char*)MyMalloc(strlen(opts->tmpdir) + 32);
+  sprintf(dname, "%s/somsd-bench-XXXXXX", opts->tmpdir);
+  sprintf(mname, "%s/somsd-bench-XXXXXX", opts->tmpdir);
+  if ((fd = mkstemp(dname)) < 0 || close(fd) != 0 || (fd = mkstemp(mname)) < 0 || close(fd) != 0){
+    AddError("Unable to create temporary files.");
+    free(dname);
+    free(mname);
+    free(samples);
+    return 1;
+  }
+
+  srand48(opts->seed);
+  WriteSyntheticData(dname, cfg, opts);
+
+  saved = Silence(opts);
+
+  /* LoadData */
+  for (r = 0; r < opts->reps && CheckErrors() == 0; r++){
+    FreeGraphs(params.train);
+    t0 = GetSeconds();
+    params.train = LoadData(dname);
+    samples[r] = GetSeconds() - t0;
+  }
+
+  /* Prepare the map and the data as for training */
+  if (CheckErrors() == 0){
+    params.map.xdim = cfg->xdim;
+    params.map.ydim = cfg->ydim;
+    params.map.topology = cfg->topology;
+    params.map.neighborhood = (cfg->topology == TOPOL_VQ) ? NEIGH_NONE : NEIGH_GAUSSIAN;
+    InitCodes(&params.map, params.train, INIT_DEFAULT);
+  }
+  if (CheckErrors() == 0){
+    if (cfg->topology == TOPOL_VQ)   /* GetMuValues() does not support VQ */
+      params.mu1 = params.mu2 = params.mu3 = params.mu4 = 1.0;
+    else
+      SuggestMu(&params);
+    ClearMessages();
+    PrepareData(&params);
+    if (cfg->topology == TOPOL_VQ)
+      VQSet_ab(&params);
+    SaveMapInFormat(&params, mname, MAPFORMAT_BINARY);
+  }
+  Unsilence(saved);
+  Report(opts, cfg, "LoadData", samples, CheckErrors() ? 0 : opts->reps, opts->numgraphs * opts->numnodes);
+
+  /* LoadMap */
+  saved = Silence(opts);
+  mparams.inetfile = mname;
+  for (r = 0; r < opts->reps && CheckErrors() == 0; r++){
+    FreeMap(&mparams.map);
+    t0 = GetSeconds();
+    LoadMap(&mparams);
+    samples[r] = GetSeconds() - t0;
+  }
+  FreeMap(&mparams.map);
+  Unsilence(saved);
+  Report(opts, cfg, "LoadMap", samples, CheckErrors() ? 0 : opts->reps, cfg->xdim * cfg->ydim);
+
+  if (CheckErrors()){
+    FreeGraphs(params.train);
+    FreeMap(&params.map);
+    unlink(dname);
+    unlink(mname);
+    free(dname);
+    free(mname);
+    free(samples);
+    return 1;
+  }
+
+  /* Collect all nodes in processing order */
+  num = 0;
+  steps = 0;
+  for (gptr = params.train; gptr != NULL; gptr = gptr->next){
+    num += gptr->numnodes;
+    steps += gptr->numnodes * (gptr->depth + 1);
+  }
+  nodes = (struct Node**)MyMalloc(num * sizeof(struct Node*));
+  graphs = (struct Graph**)MyMalloc(num * sizeof(struct Graph*));
+  winners = (struct Winner*)MyCalloc(num, sizeof(struct Winner));
+  i = 0;
+  for (gptr = params.train; gptr != NULL; gptr = gptr->next){
+    for (r = 0; r < gptr->numnodes; r++, i++){
+      nodes[i] = gptr->nodes[r];
+      graphs[i] = gptr;
+    }
+  }
+
+  if (cfg->topology == TOPOL_VQ){
+    BenchSearch(opts, cfg, &params.map, nodes, graphs, num, VQFindWinnerEucledian, "VQFindWinnerEucledian");
+    for (i = 0; i < num; i++)
+      VQFindWinnerEucledian(&params.map, nodes[i], graphs[i], &winners[i]);
+    BenchAdapt(opts, cfg, &params.map, nodes, graphs, winners, num, VQAdapt, "VQAdapt");
+  }
+  else{
+    /* K_Step_Approximation also sets the states of the offsprings */
+    saved = Silence(opts);
+    for (r = 0; r < opts->reps; r++){
+      t0 = GetSeconds();
+      K_Step_Approximation(&params.map, params.train, 0);
+      samples[r] = GetSeconds() - t0;
+    }
+    Unsilence(saved);
+    Report(opts, cfg, "K_Step_Approximation", samples, opts->reps, steps);
+
+    BenchSearch(opts, cfg, &params.map, nodes, graphs, num, FindWinnerEucledian, "FindWinnerEucledian");
+    for (i = 0; i < num; i++)
+      FindWinnerEucledian(&params.map, nodes[i], graphs[i], &winners[i]);
+    BenchAdapt(opts, cfg, &params.map, nodes, graphs, winners, num, GaussianAdapt, "GaussianAdapt");
+    BenchAdapt(opts, cfg, &params.map, nodes, graphs, winners, num, BubbleAdapt, "BubbleAdapt");
+  }
+
+  free(nodes);
+  free(graphs);
+  free(winners);
+  FreeGraphs(params.train);
+  FreeMap(&params.map);
+  unlink(dname);
+  unlink(mname);
+  free(dname);
+  free(mname);
+  free(samples);
+
+  return CheckErrors();
+}
+
+/******************************************************************************
+Description: main
+
+Return value: zero on success, nonzero otherwise.
+******************************************************************************/
+int main(int argc, char **argv)
+{
+  UNSIGNED xdims[MAXSWEEP] = {10, 20, 40}, ydims[MAXSWEEP] = {8, 16, 32};
+  UNSIGNED ldims[MAXSWEEP] = {2, 16, 64}, fanouts[MAXSWEEP] = {2, 6};
+  UNSIGNED topols[MAXSWEEP] = {TOPOL_HEXA, TOPOL_VQ};
+  int nmaps = 3, nldims = 3, nfanouts = 2, ntopols = 2;
+  int m, d, f, t, i;
+  char *cptr = NULL, *ofname = NULL;
+  struct BenchOptions opts;
+  struct BenchConfig cfg;
+
+  memset(&opts, 0, sizeof(struct BenchOptions));
+  opts.numgraphs = 32;
+  opts.numnodes = 16;
+  opts.reps = 21;
+  opts.batch = 64;
+  opts.seed = 1;
+  opts.format = REPORT_CSV;
+  SetCacheDir("none");             /* Time the parser, not the cache */
+  for (i = 1; i < argc; i++){
+    if (!strcmp(argv[i], "-map")){
+      if ((nmaps = ParseList(argv[++i], xdims, ydims, 1)) == 0)
+	AddError("Invalid list of map sizes for option -map.");
+    }
+    else if (!strcmp(argv[i], "-dim")){
+      if ((nldims = ParseList(argv[++i], ldims, NULL, 0)) == 0)
+	AddError("Invalid list of dimensions for option -dim.");
+    }
+    else if (!strcmp(argv[i], "-fanout")){
+      if ((nfanouts = ParseList(argv[++i], fanouts, NULL, 0)) == 0)
+	AddError("Invalid list of outdegrees for option -fanout.");
+    }
+    else if (!strcmp(argv[i], "-topol")){
+      if ((ntopols = ParseTopologies(argv[++i], topols)) == 0)
+	AddError("Invalid list of topologies for option -topol.");
+    }
+    else if (!strcmp(argv[i], "-graphs"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.numgraphs);
+    else if (!strcmp(argv[i], "-nodes"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.numnodes);
+    else if (!strcmp(argv[i], "-reps"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.reps);
+    else if (!strcmp(argv[i], "-batch"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.batch);
+    else if (!strcmp(argv[i], "-format")){
+      if (++i < argc && !strcasecmp(argv[i], "json"))
+	opts.format = REPORT_JSON;
+      else if (i < argc && !strcasecmp(argv[i], "csv"))
+	opts.format = REPORT_CSV;
+      else
+	AddError("Unrecognized value for option -format.");
+    }
+    else if (!strcmp(argv[i], "-o"))
+      GetArg(TYPE_STRING, argc, argv, i++, &ofname);
+    else if (!strcmp(argv[i], "-seed"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.seed);
+    else if (!strcmp(argv[i], "-tmpdir"))
+      GetArg(TYPE_STRING, argc, argv, i++, &opts.tmpdir);
+    else if (!strcmp(argv[i], "-cachedir")){
+      GetArg(TYPE_STRING, argc, argv, i++, &cptr);
+      SetCacheDir(cptr);
+      free(cptr);
+    }
+    else if (!strcmp(argv[i], "-verbose"))
+      opts.verbose = 1;
+    else if (!strcmp(argv[i], "-help") || !strcmp(argv[i], "-h") || !strcmp(argv[i], "-?"))
+      Usage();
+    else
+      fprintf(stderr, "Warning: Ignoring unrecognized command line option '%s'\n", argv[i]);
+
+    if (CheckErrors() != 0)
+      break;
+  }
+
+  if (CheckErrors() == 0){
+    if (opts.numgraphs == 0 || opts.numnodes == 0 || opts.reps == 0 || opts.batch == 0)
+      AddError("Values of options -graphs, -nodes, -reps, and -batch must be non-zero.");
+    for (m = 0; m < nmaps; m++)
+      if (xdims[m] * ydims[m] == 0)
+	AddError("Map dimension is zero.");
+    for (d = 0; d < nldims; d++)
+      for (f = 0; f < nfanouts; f++)
+	if (ldims[d] + fanouts[f] == 0)
+	  AddError("Dimension of the data is zero.");
+  }
+  if (CheckErrors() == 0 && opts.tmpdir == NULL)
+    opts.tmpdir = strdup((getenv("TMPDIR") != NULL) ? getenv("TMPDIR") : "/tmp");
+  if (CheckErrors() == 0){
+    if (ofname == NULL || !strcmp(ofname, "-"))
+      opts.ofile = stdout;
+    else if ((opts.ofile = fopen(ofname, "w")) == NULL)
+      AddError("Unable to open report file for writing.");
+  }
+
+  if (CheckErrors() == 0){
+    PrintSoftwareInfo(stderr);   /* Results depend on compiler options */
+    for (t = 0; t < ntopols && CheckErrors() == 0; t++){
+      for (m = 0; m < nmaps && CheckErrors() == 0; m++){
+	for (d = 0; d < nldims && CheckErrors() == 0; d++){
+	  for (f = 0; f < nfanouts && CheckErrors() == 0; f++){
+	    cfg.xdim = xdims[m];
+	    cfg.ydim = ydims[m];
+	    cfg.ldim = ldims[d];
+	    cfg.fanout = fanouts[f];
+	    cfg.topology = topols[t];
+	    fprintf(stderr, "Benchmarking %s %dx%d map, ldim=%d, fanout=%d\n", GetTopologyName(cfg.topology), cfg.xdim, cfg.ydim, cfg.ldim, cfg.fanout);
+	    RunConfig(&opts, &cfg);
+	  }
+	}
+      }
+    }
+  }
+  if (opts.ofile != NULL && opts.ofile != stdout)
+    fclose(opts.ofile);
+  free(ofname);
+  free(opts.tmpdir);
+
+  if (CheckErrors()){
+    PrintErrors();
+    return 1;
+  }
+  return 0;
+}
+
+/* End of file */
@@ -218,11 +218,12 @@ UNSIGNED InitCodes(struct Map *map, struct Graph *data, UNSIGNED mode)
 
   map->dim = dim;
 
-  /* allocate codebook vectors */
+  /* allocate codebook vectors in a single contiguous block */
+  map->block = (FLOAT*)MyMalloc(noc * map->dim * sizeof(FLOAT));
   i = 0u;
   for (y = 0u; y < map->ydim; y++){
     for (x = 0u; x < map->xdim; x++){
-      map->codes[i].points = (FLOAT*)MyMalloc(map->dim * sizeof(FLOAT));
+      map->codes[i].points = &map->block[i * map->dim];
       map->codes[i].x = x;
       map->codes[i].y = y;
       map->codes[i].label = MAX_UNSIGNED;
@@ -110,6 +110,8 @@ struct Graph{
   UNSIGNED FanIn;        /* Max. indegree of this graph     */
   UNSIGNED tdim;         /* Dimension of target vector      */
   UNSIGNED depth;        /* Max. depth of this graph        */
+  UNSIGNED *multiplicity;/* Number of identical nodes merged into every */
+                         /* node by CompressGraphs(), by nnum, or NULL  */
   struct Graph *next;    /* Pointer to next graph structure */
 };
 
@@ -135,6 +137,10 @@ struct Map{    /* Structure for the map data */
   UNSIGNED iter;           /* Iteration number the map is in*/
   UNSIGNED topology;       /* Typology of the map           */
   UNSIGNED neighborhood;   /* neighborhood type             */
+  FLOAT *block;            /* Contiguous storage of all codebook vectors */
+  void *mapping;           /* Memory mapped map file (if mapped)         */
+  size_t mapsize;          /* Size of the memory mapped region           */
+  struct WinnerCache *memo;/* Winners of known inputs while map is frozen */
 };
 
 struct Parameters{
@@ -144,6 +150,9 @@ struct Parameters{
   char *validfile;   /* File that contains validation data         */
   char *testfile;    /* File that contains test data               */
   char *logfile;     /* File to which to write logging information */
+  char *control;     /* Control file or FIFO read during training  */
+  char *metricsfile; /* File to which to write per iteration metrics */
+  char *tracefile;   /* File to which to write a timeline of the run */
   UNSIGNED rlen;     /* Number of training iterations              */
   UNSIGNED radius;   /* Size of initial neighborhood radius        */
   FLOAT alpha;       /* Initial learning rate                      */
@@ -158,6 +167,17 @@ struct Parameters{
     char *command;   /* Execute this command every time a snapshot is taken. */
   } snap;
 
+  struct{    /* Structure used for checkpoints of the training state */
+    int interval;    /* Write a checkpoint every so often   */
+    char *file;      /* Write checkpoints to this file      */
+    char *resume;    /* Resume training from this checkpoint */
+  } checkpoint;
+
+  struct{    /* Structure used when streaming training data from disk */
+    UNSIGNED window;   /* Number of graphs in the shuffle window      */
+    UNSIGNED numnodes; /* Total number of nodes in the training data  */
+  } stream;
+
   /* Bitfields & flags */
   unsigned batch:1;     /* Batch mode (0=no, 1=yes)                  */
   unsigned momentum:1;  /* With momentum term (0=no, 1=yes)          */
@@ -170,6 +190,10 @@ struct Parameters{
   unsigned nodeorder:1; /* Randomize order of nodes (0=no, 1=yes)    */
   unsigned graphorder:1;/* Randomize order of graphs (0=no, 1=yes)   */
   unsigned undirected:1; /* Temporary use until undirected graph file format is supported */
+  unsigned mapformat:2;  /* Format in which maps are saved (MAPFORMAT_*)    */
+  unsigned streaming:1;  /* Read training data from disk at every iteration */
+  unsigned perf:1;       /* Count hardware events in training kernels       */
+  unsigned compress:1;   /* Merge identical substructures of training data  */
 
   struct Graph *train;  /* Pointer to training data    */
   struct Graph *valid;  /* Pointer to validation data  */
@@ -180,6 +204,8 @@ struct Parameters{
 struct Winner { /* Structure used to store best matching codebook */
   UNSIGNED codeno;   /* Index number of best matching codebook */
   FLOAT diff;        /* The error value with this node    */
+  UNSIGNED evaluated;/* Number of vector components compared      */
+  UNSIGNED touched;  /* Number of codebooks changed by adaptation */
 };
 
 /* Macros */
@@ -192,6 +218,7 @@ struct Winner { /* Structure used to store best matching codebook */
 #ifndef SQR
 #define SQR(s)  ((s) * (s))             /* Compute the squared value         */
 #endif
+#define MULTIPLICITY(g, n) ((g)->multiplicity != NULL ? (g)->multiplicity[(n)->nnum] : 1) /* Nodes represented by node n of graph g */
 
 /* Prototypes */
 UNSIGNED GetTopologyID(char *cptr, UNSIGNED *uval);  /*Get ID of topology    */
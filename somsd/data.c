@@ -16,7 +16,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "common.h"
+#include "data.h"
+#include "fileio.h"
+#include "system.h"
+#include "trace.h"
 #include "train.h"
 #include "utils.h"
 
@@ -26,6 +32,7 @@
 /********************/
 UNSIGNED Number_Labels  = 0;
 char **Data_Labels = NULL;
+pthread_mutex_t Label_Lock = PTHREAD_MUTEX_INITIALIZER; /* Guards the labels */
 struct LabelArray {
   char *label;
   int pos;
@@ -48,14 +55,19 @@ UNSIGNED AddLabel(char *label)
   if (label == NULL)
     return MAX_UNSIGNED;
 
+  pthread_mutex_lock(&Label_Lock); /* Labels may be added by a prefetch thread */
   for (i = 0; i < Number_Labels; i++)
-    if (!strcmp(Data_Labels[i], label))
+    if (!strcmp(Data_Labels[i], label)){
+      pthread_mutex_unlock(&Label_Lock);
       return i+1;
+    }
 
   Number_Labels++;
   Data_Labels = MyRealloc(Data_Labels, Number_Labels * sizeof(char*));
   Data_Labels[Number_Labels-1] = strdup(label);
-  return Number_Labels;
+  i = Number_Labels;
+  pthread_mutex_unlock(&Label_Lock);
+  return i;
 }
 
 /*****************************************************************************
@@ -66,9 +78,13 @@ Return value: A pointer to a data label, or NULL if the index is undefined.
 *****************************************************************************/
 char* GetLabel(UNSIGNED index)
 {
-  if (index == 0 || index > Number_Labels)
-    return NULL;
-  return Data_Labels[index-1];
+  char *label = NULL;
+
+  pthread_mutex_lock(&Label_Lock);
+  if (index > 0 && index <= Number_Labels)
+    label = Data_Labels[index-1];
+  pthread_mutex_unlock(&Label_Lock);
+  return label;
 }
 
 /*****************************************************************************
@@ -322,7 +338,7 @@ FLOAT K_Step_Approximation(struct Map *map, struct Graph *graph, int mode)
       for (nnum = 0; nnum < gptr->numnodes; nnum++){
 	node = gptr->nodes[nnum];
 	UpdateStates(gptr, node);
-	FindWinner(map, node, gptr, &winner);
+	FindWinnerMemo(map, node, gptr, &winner, FindWinner);
 	gpr_qerror += winner.diff;
 
 	if (map->topology == TOPOL_VQ){
@@ -391,7 +407,7 @@ FLOAT GetNodeCoordinates(struct Map *map, struct Graph *gptr)
     for (nnum = 0; nnum < gptr->numnodes; nnum++){
       node = gptr->nodes[nnum];
       UpdateOffspringStates(gptr, node);
-      FindWinner(map, node, gptr, &winner);
+      FindWinnerMemo(map, node, gptr, &winner, FindWinner);
 
       if (map->topology == TOPOL_VQ)
 	node->winner = winner.codeno;
@@ -399,8 +415,8 @@ FLOAT GetNodeCoordinates(struct Map *map, struct Graph *gptr)
 	node->x = map->codes[winner.codeno].x;
 	node->y = map->codes[winner.codeno].y;
       }
-      qerror += winner.diff;
-      n++;
+      qerror += winner.diff * MULTIPLICITY(gptr, node);
+      n += MULTIPLICITY(gptr, node);
     }
   }
   return qerror/n;
@@ -680,6 +696,312 @@ void SetNodeDepth(struct Graph *graph)
     SetNodeDepthIteratively(graph); /* Slowest but needs little memory  */
 }
 
+/*****************************************************************************
+Description: Find the position of a node in a table built by
+             GetSignatures(). The table is an open addressing hash table
+             keyed by the address of the node.
+
+Return value: Position of the node in the nodes array of its graph.
+*****************************************************************************/
+static UNSIGNED LookupNode(struct Node **keys, UNSIGNED *vals, UNSIGNED mask, struct Node *node)
+{
+  UNSIGNED i;
+
+  i = (UNSIGNED)(((unsigned long long)(size_t)node * 0x9e3779b97f4a7c15ULL) >> 40) & mask;
+  while (keys[i] != node)
+    i = (i + 1) & mask;
+  return vals[i];
+}
+
+/*****************************************************************************
+Description: Add a node and its position to a table used by LookupNode().
+
+Return value: This function does not return a value.
+*****************************************************************************/
+static void InsertNode(struct Node **keys, UNSIGNED *vals, UNSIGNED mask, struct Node *node, UNSIGNED val)
+{
+  UNSIGNED i;
+
+  i = (UNSIGNED)(((unsigned long long)(size_t)node * 0x9e3779b97f4a7c15ULL) >> 40) & mask;
+  while (keys[i] != NULL)
+    i = (i + 1) & mask;
+  keys[i] = node;
+  vals[i] = val;
+}
+
+/*****************************************************************************
+Description: Compute a canonical signature of the substructure rooted at
+             every node of every graph. Two nodes have the same signature if
+             the sequences of their present offsprings have the same
+             signatures, so that the signature identifies the shape of the
+             subtree, or of the sub-DAG, below a node. With mode SIG_LABEL
+             the data label and target of every node in the substructure
+             are included, and with SIG_SLOTS the position of each offspring
+             in the list of offsprings of its parent.
+             Signatures are computed bottom up with an explicit stack, so
+             that each node is visited once and deep graphs do not overflow
+             the call stack. A link back to a node that is still being
+             processed, i.e. a cycle, is given a fixed signature.
+
+Return value: An array holding the signatures of all nodes of all graphs in
+              order of graphs and nodes. The caller has to free it.
+*****************************************************************************/
+struct Signature *GetSignatures(struct Graph *graph, int mode)
+{
+  struct Signature *sigs, *sig, *csig, cycle = {SIG_SEED1 ^ 1, SIG_SEED2 ^ 1};
+  struct Node **keys = NULL, *node, *child;
+  struct Graph *gptr;
+  UNSIGNED *vals = NULL, *stack = NULL, *slot = NULL;
+  UNSIGNED n, i, c, top, num, size, mask, offset, present;
+  char *state = NULL;
+
+  num = 0;
+  size = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next){
+    num += gptr->numnodes;
+    if (size < gptr->numnodes)
+      size = gptr->numnodes;
+  }
+  sigs = (struct Signature*)MyMalloc(num * sizeof(struct Signature) + 1);
+  for (mask = 1; mask < 2 * size; mask <<= 1);
+  keys = (struct Node**)MyMalloc(mask * sizeof(struct Node*));
+  vals = (UNSIGNED*)MyMalloc(mask * sizeof(UNSIGNED));
+  stack = (UNSIGNED*)MyMalloc(size * sizeof(UNSIGNED) + 1);
+  slot = (UNSIGNED*)MyMalloc(size * sizeof(UNSIGNED) + 1);
+  state = (char*)MyMalloc(size * sizeof(char) + 1);
+  mask--;
+
+  offset = 0;
+  for (gptr = graph; gptr != NULL; offset += gptr->numnodes, gptr = gptr->next){
+    memset(keys, 0, (mask + 1) * sizeof(struct Node*));
+    for (n = 0; n < gptr->numnodes; n++)
+      InsertNode(keys, vals, mask, gptr->nodes[n], n);
+    memset(state, 0, gptr->numnodes); /* 0: new, 1: on stack, 2: done */
+
+    for (n = 0; n < gptr->numnodes; n++){
+      if (state[n] != 0)
+	continue;
+      top = 0;
+      stack[top++] = n;
+      state[n] = 1;
+      slot[n] = 0;
+      while (top > 0){
+	node = gptr->nodes[stack[top-1]];
+	for (i = 0, c = slot[stack[top-1]]; c < gptr->FanOut; c++){
+	  if ((child = node->children[c]) == NULL)
+	    continue;
+	  i = LookupNode(keys, vals, mask, child);
+	  if (state[i] == 0)
+	    break;
+	}
+	slot[stack[top-1]] = c;
+	if (c < gptr->FanOut){           /* Descend to unvisited offspring */
+	  stack[top++] = i;
+	  state[i] = 1;
+	  slot[i] = 0;
+	  continue;
+	}
+
+	/* All offsprings are done, compute the signature of this node */
+	sig = &sigs[offset + stack[top-1]];
+	sig->h1 = SIG_SEED1;
+	sig->h2 = SIG_SEED2;
+	if (mode & SIG_LABEL){
+	  sig->h1 = HashBytes(node->points, gptr->ldim * sizeof(FLOAT), sig->h1);
+	  sig->h2 = HashBytes(node->points, gptr->ldim * sizeof(FLOAT), sig->h2);
+	  sig->h1 = HashBytes(node->points + gptr->dimension - gptr->tdim, gptr->tdim * sizeof(FLOAT), sig->h1);
+	  sig->h2 = HashBytes(node->points + gptr->dimension - gptr->tdim, gptr->tdim * sizeof(FLOAT), sig->h2);
+	}
+	present = 0;
+	for (c = 0; c < gptr->FanOut; c++){
+	  if ((child = node->children[c]) == NULL)
+	    continue;
+	  i = LookupNode(keys, vals, mask, child);
+	  csig = (state[i] == 2) ? &sigs[offset + i] : &cycle;
+	  if (mode & SIG_SLOTS){
+	    sig->h1 = HashBytes(&c, sizeof(UNSIGNED), sig->h1);
+	    sig->h2 = HashBytes(&c, sizeof(UNSIGNED), sig->h2);
+	  }
+	  sig->h1 = HashBytes(csig, sizeof(struct Signature), sig->h1);
+	  sig->h2 = HashBytes(csig, sizeof(struct Signature), sig->h2);
+	  present++;
+	}
+	sig->h1 = HashBytes(&present, sizeof(UNSIGNED), sig->h1);
+	sig->h2 = HashBytes(&present, sizeof(UNSIGNED), sig->h2);
+	state[stack[--top]] = 2;
+      }
+    }
+  }
+
+  free(keys);
+  free(vals);
+  free(stack);
+  free(slot);
+  free(state);
+  return sigs;
+}
+
+/*****************************************************************************
+Description: Order two signatures. Can be used with qsort().
+
+Return value: -1, 0, or 1 if the first signature is smaller, equal, or larger
+              than the second.
+*****************************************************************************/
+int CompareSignatures(const void *v1, const void *v2)
+{
+  const struct Signature *s1 = (const struct Signature*)v1;
+  const struct Signature *s2 = (const struct Signature*)v2;
+
+  if (s1->h1 != s2->h1)
+    return (s1->h1 < s2->h1) ? -1 : 1;
+  if (s1->h2 != s2->h2)
+    return (s1->h2 < s2->h2) ? -1 : 1;
+  return 0;
+}
+
+/*****************************************************************************
+Description: Merge identical substructures of all graphs into a single graph,
+             which is a DAG in which every distinct substructure occurs once.
+             Nodes are identical if they have the same data label and target,
+             and identical offsprings at the same positions. The nodes of the
+             shared graph are numbered in order, and its multiplicity array
+             counts the nodes every one of them replaces, so that training
+             and the quantization error can weight them accordingly. Parents
+             of the merged nodes are rebuilt, so a root which is identical to
+             a substructure of another graph is no longer a root. Graphs with
+             parent states (contextual data) are not compressed.
+
+Return value: The compressed dataset. The given graphs are released.
+*****************************************************************************/
+struct Graph *CompressGraphs(struct Graph *graph)
+{
+  struct Signature *sigs;
+  struct Graph *gptr, *next, *shared;
+  struct Node **nodes, **keys, *node, *child;
+  UNSIGNED *vals, *canon, *first, *count;
+  UNSIGNED n, i, c, num, numgraphs, unique, mask;
+
+  if (graph == NULL)
+    return NULL;
+  num = numgraphs = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next){
+    if (gptr->FanIn > 0){
+      AddMessage("WARNING: Graphs with parent states cannot be compressed.");
+      return graph;
+    }
+    if (gptr->ldim != graph->ldim || gptr->tdim != graph->tdim ||
+	gptr->FanOut != graph->FanOut || gptr->dimension != graph->dimension){
+      AddMessage("WARNING: Graphs of different dimensions cannot be compressed.");
+      return graph;
+    }
+    num += gptr->numnodes;
+    numgraphs++;
+  }
+
+  /* Number the nodes in order of graphs and nodes */
+  sigs = GetSignatures(graph, SIG_LABEL | SIG_SLOTS);
+  nodes = (struct Node**)MyMalloc(num * sizeof(struct Node*) + 1);
+  for (mask = 1; mask < 2 * num; mask <<= 1);
+  keys = (struct Node**)MyCalloc(mask, sizeof(struct Node*));
+  vals = (UNSIGNED*)MyMalloc(mask * sizeof(UNSIGNED));
+  first = (UNSIGNED*)MyMalloc(mask * sizeof(UNSIGNED));
+  canon = (UNSIGNED*)MyMalloc(num * sizeof(UNSIGNED) + 1);
+  count = (UNSIGNED*)MyMalloc(num * sizeof(UNSIGNED) + 1);
+  mask--;
+  n = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    for (i = 0; i < gptr->numnodes; i++, n++){
+      nodes[n] = gptr->nodes[i];
+      InsertNode(keys, vals, mask, nodes[n], n);
+    }
+
+  /* The first node with a given signature represents all others */
+  memset(first, 0xff, (mask + 1) * sizeof(UNSIGNED));
+  unique = 0;
+  for (n = 0; n < num; n++){
+    i = (UNSIGNED)sigs[n].h1 & mask;
+    while (first[i] != (UNSIGNED)-1 && CompareSignatures(&sigs[first[i]], &sigs[n]))
+      i = (i + 1) & mask;
+    if (first[i] == (UNSIGNED)-1){
+      first[i] = n;
+      count[n] = 0;
+      unique++;
+    }
+    count[first[i]]++;
+    canon[n] = first[i];
+  }
+
+  /* Build the shared graph from representatives, linked to representatives */
+  shared = (struct Graph*)MyCalloc(1, sizeof(struct Graph));
+  shared->gname = strdup("shared");
+  shared->ldim = graph->ldim;
+  shared->dimension = graph->dimension;
+  shared->FanOut = graph->FanOut;
+  shared->tdim = graph->tdim;
+  shared->nodes = (struct Node**)MyMalloc(unique * sizeof(struct Node*) + 1);
+  shared->multiplicity = (UNSIGNED*)MyMalloc(unique * sizeof(UNSIGNED) + 1);
+  for (n = 0; n < num; n++){
+    if (canon[n] != n)
+      continue;
+    node = nodes[n];
+    for (c = 0; c < shared->FanOut; c++)
+      if ((child = node->children[c]) != NULL)
+	node->children[c] = nodes[canon[LookupNode(keys, vals, mask, child)]];
+    if (node->parents != NULL)
+      free(node->parents);
+    node->parents = NULL;
+    node->numparents = 0;
+    if (node->depth > shared->depth)
+      shared->depth = node->depth;
+    node->nnum = shared->numnodes;
+    shared->multiplicity[shared->numnodes] = count[n];
+    shared->nodes[shared->numnodes++] = node;
+  }
+  for (n = 0; n < shared->numnodes; n++){
+    node = shared->nodes[n];
+    for (c = 0; c < shared->FanOut; c++){
+      if ((child = node->children[c]) == NULL)
+	continue;
+      child->numparents += 1;
+      child->parents = MyRealloc(child->parents, child->numparents * sizeof(struct Node*));
+      child->parents[child->numparents-1] = node;
+    }
+  }
+
+  /* Release the merged nodes and the original graphs */
+  for (n = 0; n < num; n++){
+    if (canon[n] == n)
+      continue;
+    node = nodes[n];
+    if (node->points != NULL)
+      free(node->points);
+    if (node->mu != NULL)
+      free(node->mu);
+    if (node->parents != NULL)
+      free(node->parents);
+    if (node->children != NULL)
+      free(node->children);
+    free(node);
+  }
+  for (gptr = graph; gptr != NULL; gptr = next){
+    next = gptr->next;
+    if (gptr->gname != NULL)
+      free(gptr->gname);
+    free(gptr->nodes);
+    free(gptr);
+  }
+  fprintf(stderr, "Compressed %d nodes in %d graphs to %d distinct nodes\n", num, numgraphs, unique);
+
+  free(sigs);
+  free(nodes);
+  free(keys);
+  free(vals);
+  free(first);
+  free(canon);
+  free(count);
+  return shared;
+}
+
 /*****************************************************************************
 Description: Increase the size of a given vector component for every node in
              a given graph.
@@ -1034,6 +1356,8 @@ void PrepareData(struct Parameters *param)
   GList[2] = param->test;
 
   Padding(*param); /* Ensure that all nodes are of the same dimension */
+  if (param->compress)  /* Merge identical substructures of training data */
+    param->train = GList[0] = CompressGraphs(param->train);
   for (i = 0; i < 3; i++){
     if (GList[i] == NULL)
       continue;
@@ -1053,6 +1377,189 @@ void PrepareData(struct Parameters *param)
   }
 }
 
+/*****************************************************************************
+Description: Prepare a single graph for training in the same way as
+             PrepareData() prepares a dataset, except that the order of
+             graphs is left unchanged.
+
+Return value: The function does not return a value.
+*****************************************************************************/
+void PrepareGraph(struct Parameters *param, struct Graph *gptr)
+{
+  SetWeightValues(param->mu1, param->mu2, param->mu3, param->mu4, gptr);
+
+  if (param->nodeorder == 1)
+    RandomizeNodeOrder(gptr); /* Randomize the order of nodes */
+  else
+    SortNodesByDepth(gptr);   /* Ensure bottom up processing of nodes */
+
+  if (param->map.topology == TOPOL_VQ)              /* In VQ mode only... */
+    VQInitWinner(gptr);
+}
+
+/*****************************************************************************
+Description: The body of the thread which reads the graphs of a dataset from
+             disk. The dataset is read npasses times, and the graphs are put
+             into a bounded queue. A NULL entry marks the end of a pass.
+
+Return value: This function always returns NULL.
+*****************************************************************************/
+void *PrefetchThread(void *arg)
+{
+  struct Prefetch *pf = (struct Prefetch*)arg;
+  struct GraphStream *stream;
+  struct Graph *gptr;
+  UNSIGNED pass;
+  int stop = 0;
+
+  TraceThreadName("prefetch");
+  for (pass = 0; pass < pf->npasses && !stop; pass++){
+    TraceBeginNum("ReadPass", pass);
+    stream = OpenGraphStream(pf->fname);
+    do{
+      PROFILE_BEGIN(tload);
+      gptr = ReadNextGraph(stream);      /* NULL at end of pass or on error */
+      PROFILE_END(PHASE_LOAD, tload);
+
+      pthread_mutex_lock(&pf->lock);
+      if (pf->count == pf->qsize && !pf->stop){
+	TraceBegin("WaitForSpace");
+	while (pf->count == pf->qsize && !pf->stop)  /* Wait for free space */
+	  pthread_cond_wait(&pf->cond, &pf->lock);
+	TraceEnd();
+      }
+      if (!(stop = pf->stop)){
+	pf->queue[(pf->first + pf->count) % pf->qsize] = gptr;
+	pf->count++;
+	pthread_cond_broadcast(&pf->cond);
+      }
+      pthread_mutex_unlock(&pf->lock);
+    }while (gptr != NULL && !stop);
+    CloseGraphStream(stream);
+    TraceEnd();
+    if (CheckErrors())                   /* Do not continue after errors */
+      break;
+  }
+  if (stop)
+    FreeGraphs(gptr);
+  return NULL;
+}
+
+/*****************************************************************************
+Description: Start a thread which reads the graphs of the dataset in file
+             fname from disk npasses times. At most qsize graphs are read
+             ahead. If window is larger than one then graphs are returned in
+             random order within a sliding window of that many graphs.
+
+Return value: Pointer to the state of the prefetch thread.
+*****************************************************************************/
+struct Prefetch *StartPrefetch(char *fname, UNSIGNED npasses, UNSIGNED qsize, UNSIGNED window)
+{
+  struct Prefetch *pf;
+
+  pf = (struct Prefetch*)MyCalloc(1, sizeof(struct Prefetch));
+  pf->fname = fname;
+  pf->npasses = npasses;
+  pf->qsize = max(qsize, 2);
+  pf->queue = (struct Graph**)MyCalloc(pf->qsize, sizeof(struct Graph*));
+  pf->wsize = max(window, 1);
+  pf->window = (struct Graph**)MyCalloc(pf->wsize, sizeof(struct Graph*));
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->cond, NULL);
+  pthread_create(&pf->thread, NULL, PrefetchThread, pf);
+
+  return pf;
+}
+
+/*****************************************************************************
+Description: Take the next entry from the queue of the prefetch thread.
+
+Return value: Pointer to a graph, or NULL at the end of a pass.
+*****************************************************************************/
+struct Graph *PopPrefetched(struct Prefetch *pf)
+{
+  struct Graph *gptr;
+
+  pthread_mutex_lock(&pf->lock);
+  if (pf->count == 0){
+    TraceBegin("WaitForData");
+    while (pf->count == 0)           /* Wait for the next graph */
+      pthread_cond_wait(&pf->cond, &pf->lock);
+    TraceEnd();
+  }
+  gptr = pf->queue[pf->first];
+  pf->first = (pf->first + 1) % pf->qsize;
+  pf->count--;
+  pthread_cond_broadcast(&pf->cond);
+  pthread_mutex_unlock(&pf->lock);
+
+  return gptr;
+}
+
+/*****************************************************************************
+Description: Return the next graph of the current pass through the dataset.
+             The shuffle window is topped up from the queue, and a graph is
+             drawn from it at random. The window is drained at the end of a
+             pass so that every graph is returned exactly once per pass.
+
+Return value: Pointer to a graph, or NULL at the end of a pass (or if reading
+              the data failed). The caller owns the graph.
+*****************************************************************************/
+struct Graph *GetPrefetchedGraph(struct Prefetch *pf)
+{
+  struct Graph *gptr;
+  UNSIGNED n;
+
+  while (!pf->endofpass && pf->wcount < pf->wsize){
+    if ((gptr = PopPrefetched(pf)) == NULL)
+      pf->endofpass = 1;
+    else
+      pf->window[pf->wcount++] = gptr;
+  }
+  if (pf->wcount == 0){       /* Window is drained, the pass is complete */
+    pf->endofpass = 0;
+    return NULL;
+  }
+
+  n = (pf->wsize > 1) ? (UNSIGNED)(drand48() * pf->wcount) : 0;
+  gptr = pf->window[n];
+  if (pf->wsize > 1)
+    pf->window[n] = pf->window[--pf->wcount];
+  else
+    pf->wcount = 0;
+  return gptr;
+}
+
+/*****************************************************************************
+Description: Stop the prefetch thread and free all graphs which were read but
+             not yet consumed.
+
+Return value: The function does not return a value.
+*****************************************************************************/
+void StopPrefetch(struct Prefetch *pf)
+{
+  UNSIGNED n;
+
+  if (pf == NULL)
+    return;
+
+  pthread_mutex_lock(&pf->lock);
+  pf->stop = 1;
+  pthread_cond_broadcast(&pf->cond);
+  pthread_mutex_unlock(&pf->lock);
+  pthread_join(pf->thread, NULL);
+  pthread_mutex_destroy(&pf->lock);
+  pthread_cond_destroy(&pf->cond);
+
+  for (n = 0; n < pf->count; n++)
+    FreeGraphs(pf->queue[(pf->first + n) % pf->qsize]);
+  for (n = 0; n < pf->wcount; n++)
+    FreeGraphs(pf->window[n]);
+  free(pf->queue);
+  free(pf->window);
+  free(pf);
+}
+
 /*****************************************************************************
 Description: Free all memory allocated to the list of graphs starting from
              the pointer graph.
@@ -1075,6 +1582,8 @@ void FreeGraphs(struct Graph *graph)
 	  continue;
 	if (node->points != NULL)
 	  free(node->points);
+	if (node->mu != NULL)
+	  free(node->mu);
 	if (node->parents != NULL)
 	  free(node->parents);
 	if (node->children != NULL)
@@ -1083,6 +1592,8 @@ void FreeGraphs(struct Graph *graph)
       }
       free(gptr->nodes);
     }
+    if (gptr->multiplicity != NULL)
+      free(gptr->multiplicity);
     prev = gptr;
     gptr = gptr->next;
     memset(prev, 0, sizeof(struct Graph));  /* Reset the graph */
@@ -1099,12 +1610,19 @@ void FreeMap(struct Map *map)
 {
   UNSIGNED i, noc;
 
-  if (map->codes != NULL){
+  if (map->mapping != NULL)          /* Codebooks live in a mapped file */
+    munmap(map->mapping, map->mapsize);
+  else if (map->block != NULL)       /* Codebooks live in a single block */
+    free(map->block);
+  else if (map->codes != NULL){      /* Codebooks were allocated one by one */
     noc = map->xdim * map->ydim;
     for (i = 0; i < noc; i++)
       if (map->codes[i].points != NULL)
 	free(map->codes[i].points);
   }
+  if (map->codes != NULL)
+    free(map->codes);
+  FreeWinnerCache(map->memo);
 
   memset(map, 0, sizeof(struct Map));  /* Reset the map */
 }
@@ -1131,6 +1649,16 @@ void ClearParameters(struct Parameters* parameters)
     free(parameters->snap.command);
   if (parameters->snap.file)
     free(parameters->snap.file);
+  if (parameters->control)
+    free(parameters->control);
+  if (parameters->metricsfile)
+    free(parameters->metricsfile);
+  if (parameters->tracefile)
+    free(parameters->tracefile);
+  if (parameters->checkpoint.file)
+    free(parameters->checkpoint.file);
+  if (parameters->checkpoint.resume)
+    free(parameters->checkpoint.resume);
 
   FreeGraphs(parameters->train);
   FreeGraphs(parameters->valid);
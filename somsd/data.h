@@ -1,6 +1,34 @@
 #ifndef DATA_H_DEFINED
 #define DATA_H_DEFINED
 
+#include <pthread.h>
+
+struct Prefetch{  /* State of a thread which reads graphs ahead of training */
+  char *fname;            /* Name of the data file                       */
+  UNSIGNED npasses;       /* Number of passes through the dataset        */
+  struct Graph **queue;   /* Graphs read ahead (NULL marks end of pass)  */
+  UNSIGNED qsize, first, count; /* Capacity, head, and fill of the queue */
+  struct Graph **window;  /* Shuffle window                              */
+  UNSIGNED wsize, wcount; /* Capacity and fill of the shuffle window     */
+  int endofpass;          /* Set when the end of a pass was dequeued     */
+  int stop;               /* Set to ask the thread to terminate          */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Signature modes */
+#define SIG_STRUCT  0x00  /* Structure of a substructure only       */
+#define SIG_LABEL   0x01  /* Structure, data labels and targets     */
+#define SIG_SLOTS   0x02  /* Position of offsprings is significant  */
+
+#define SIG_SEED1   0x736f6d7364536967ULL  /* Initial hash values of the */
+#define SIG_SEED2   0x2d6d65726b6c6521ULL  /* two halves of a signature  */
+
+struct Signature{  /* 128-bit canonical hash of the substructure at a node */
+  unsigned long long h1, h2;
+};
+
 UNSIGNED AddLabel(char *label);
 char* GetLabel(UNSIGNED index);
 UNSIGNED GetNumLabels();
@@ -11,10 +39,17 @@ void UpdateChildrensLocationVQ(struct Graph *gptr, struct Node *node);
 void UpdateChildrenAndParentLocation(struct Graph *gptr, struct Node *node);
 void UpdateAllChildrensLocation(struct Graph *graphs);
 void PrepareData(struct Parameters *parameters);
+void PrepareGraph(struct Parameters *param, struct Graph *gptr);
+struct Prefetch *StartPrefetch(char *fname, UNSIGNED npasses, UNSIGNED qsize, UNSIGNED window);
+struct Graph *GetPrefetchedGraph(struct Prefetch *pf);
+void StopPrefetch(struct Prefetch *pf);
 struct Graph *RandomizeGraphOrder(struct Graph *graph);
 FLOAT K_Step_Approximation(struct Map *map, struct Graph *gptr, int mode);
 FLOAT GetNodeCoordinates(struct Map *map, struct Graph *gptr);
 void SetNodeDepth(struct Graph *gptr);
+struct Signature *GetSignatures(struct Graph *graph, int mode);
+int CompareSignatures(const void *v1, const void *v2);
+struct Graph *CompressGraphs(struct Graph *graph);
 void IncreaseDimension(struct Graph *graph, int newdim, int component);
 void ConvertToUndirectedLinks(struct Graph *train);
 UNSIGNED IsRoot(struct Node *node);
@@ -0,0 +1,757 @@
+/*
+  Contents: Differential test of the optimised kernels of the somsd
+            package, run by 'make check'. The winner searches of train.c
+            and GaussianAdapt(), BubbleAdapt() and VQAdapt() are run next
+            to plain reference versions written for clarity, on random maps
+            and nodes or on the nodes of a dataset. The references adapt a
+            node with multiplicity k by k literal updates. Winners must
+            agree up to near ties, and distances and adapted codebooks must
+            agree within a relative tolerance. Each random trial has its
+            own seed, so that a divergence can be repeated alone. The exit
+            status is non-zero if any trial diverged.
+
+  Author: Markus Hagenbuchner
+
+  Comments and questions concerning this program package may be sent
+  to 'markus@artificial-neural.net'
+ */
+
+
+/************/
+/* Includes */
+/************/
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "data.h"
+#include "fileio.h"
+#include "system.h"
+#include "train.h"
+#include "utils.h"
+
+typedef void (*SearchFunc)(struct Map*, struct Node*, struct Graph*, struct Winner*);
+typedef void (*AdaptFunc)(struct Graph*, struct Map*, struct Node*, struct Winner*, FLOAT, FLOAT);
+typedef void (*RefSearchFunc)(struct Map*, struct Node*, struct Graph*, double*);
+
+struct SearchKernel{   /* A search kernel and its reference */
+  const char *name;
+  SearchFunc Search;   /* Kernel under test                         */
+  RefSearchFunc Ref;   /* Computes the distance to every codebook   */
+  int vq;              /* Set if the kernel works on maps in VQ mode */
+};
+
+struct AdaptKernel{    /* An adaptation kernel and its reference */
+  const char *name;
+  AdaptFunc Adapt;     /* Kernel under test                         */
+  AdaptFunc Ref;       /* Reference implementation                  */
+  int vq;              /* Set if the kernel works on maps in VQ mode */
+};
+
+struct DiffOptions{
+  UNSIGNED trials;     /* Number of random trials                   */
+  UNSIGNED seed;       /* Seed of the first trial                   */
+  UNSIGNED maxmap;     /* Maximum extension of random maps          */
+  UNSIGNED maxdim;     /* Maximum dimension of random labels        */
+  UNSIGNED maxfanout;  /* Maximum outdegree of random nodes         */
+  UNSIGNED numnodes;   /* Number of random nodes per trial          */
+  double tol;          /* Relative tolerance of float comparisons   */
+  int strict;          /* Fail on winners which are near ties       */
+  int all;             /* Continue after the first divergence       */
+};
+
+struct DiffStats{
+  unsigned long searches;   /* Number of winner searches compared    */
+  unsigned long ties;       /* Different winners with equal distance */
+  unsigned long adapts;     /* Number of adaptations compared        */
+  unsigned long failures;   /* Number of divergences                 */
+};
+
+/* Description of the current trial, printed with a divergence */
+static char TrialInfo[256];
+
+
+/* Begin functions... */
+
+/******************************************************************************
+Description: Print usage information to the screen
+
+Return value: The function does not return.
+******************************************************************************/
+void Usage()
+{
+  fprintf(stderr, "\n\
+Usage: difftest [options]\n\n\
+Compares the winner search and adaptation kernels against reference\n\
+implementations. Winners must agree, where exact ties are resolved in favour\n\
+of the codebook with the lowest index. Different winners whose distances\n\
+differ by less than the tolerance are accepted as near ties. Distances and\n\
+adapted codebooks must agree within the tolerance. The first divergence is\n\
+reported.\n\n\
+Options are:\n\
+    -trials <num>      Number of random trials. (default 200)\n\
+    -seed <int>        Seed of the first trial. Trial t uses seed+t, so that\n\
+                       a failing trial can be repeated with -trials 1.\n\
+                       (default 1)\n\
+    -maxmap <num>      Maximum width and height of random maps. (default 16)\n\
+    -maxdim <num>      Maximum dimension of random labels. (default 64)\n\
+    -maxfanout <num>   Maximum outdegree of random nodes. (default 6)\n\
+    -nodes <num>       Number of random nodes per trial. (default 32)\n\
+    -din <fname>       Compare on the nodes of a dataset instead of random\n\
+                       inputs, with a map given by -xdim, -ydim, -topol.\n\
+    -xdim <num>        Width of the map for -din. (default 10)\n\
+    -ydim <num>        Height of the map for -din. (default 8)\n\
+    -topol <type>      Topology of the map for -din. (default hexagonal)\n\
+    -tol <float>       Relative tolerance of float comparisons. (default 1e-4)\n\
+    -strict            Also fail if different winners are within tolerance.\n\
+    -all               Continue after a divergence.\n\
+    -help              Print this help.\n\
+ \n");
+  exit(0);
+}
+
+/******************************************************************************
+Description: Reference distances of a node to every codebook as computed by
+             FindWinnerEucledian, without early termination, accumulated in
+             double precision.
+
+Return value: The distances are stored in dist.
+******************************************************************************/
+void RefDistances(struct Map *map, struct Node *node, struct Graph *gptr, double *dist)
+{
+  UNSIGNED n, i, noc;
+  double diff, sum;
+
+  noc = map->xdim * map->ydim;
+  for (n = 0; n < noc; n++){
+    sum = 0.0;
+    for (i = 0; i < gptr->dimension; i++){
+      diff = (double)map->codes[n].points[i] - node->points[i];
+      sum += diff * diff * node->mu[i];
+    }
+    dist[n] = sum;
+  }
+}
+
+/******************************************************************************
+Description: Reference distances of a node to every codebook as computed by
+             VQFindWinnerEucledian, without early termination. The label and
+             target components are compared by the Euclidean distance. The
+             child and parent components are compared with a one-hot coding
+             of the winner ID of the offsprings and parents, using the weights
+             which VQFindWinnerEucledian uses.
+
+Return value: The distances are stored in dist.
+******************************************************************************/
+void RefVQDistances(struct Map *map, struct Node *node, struct Graph *gptr, double *dist)
+{
+  UNSIGNED n, i, noc, ldim, fanout, fanin;
+  FLOAT *codebook, *mu;
+  double diff, sum;
+  int id;
+
+  noc = map->xdim * map->ydim;
+  ldim = gptr->ldim;
+  fanout = gptr->FanOut;
+  fanin = gptr->FanIn;
+  mu = node->mu;
+  for (n = 0; n < noc; n++){
+    codebook = map->codes[n].points;
+    sum = 0.0;
+    for (i = 0; i < ldim; i++){
+      diff = (double)codebook[i] - node->points[i];
+      sum += diff * diff * mu[i];
+    }
+    diff = map->codes[n].a;
+    for (i = 0; i < fanout; i++){
+      if ((id = (int)node->points[ldim + i*2]) >= 0)
+	diff += 1.0 - 2.0 * codebook[ldim + noc*i + id];
+    }
+    if (fanout > 0)
+      sum += diff * mu[fanout-1];
+    diff = map->codes[n].b;
+    for (i = 0; i < fanin; i++){
+      if ((id = (int)node->points[ldim + 2 + fanout + i*2]) >= 0)
+	diff += 1.0 - 2.0 * codebook[ldim + noc*fanout + noc*i + id];
+    }
+    if (fanin > 0)
+      sum += diff * mu[fanin-1];
+    for (i = ldim + 2*(fanin+fanout); i < gptr->dimension; i++){
+      diff = (double)codebook[i] - node->points[i];
+      sum += diff * diff * mu[i];
+    }
+    dist[n] = sum;
+  }
+}
+
+/******************************************************************************
+Description: Reference of GaussianAdapt(): every codebook moves towards the
+             node by alpha weighted with a Gaussian of its distance from the
+             winner on a hexagonal grid. A node which stands for several
+             identical nodes is applied once for each of them.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void RefGaussianAdapt(struct Graph *gptr, struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha)
+{
+  UNSIGNED n, i, k, noc;
+  FLOAT dist, h, *codebook;
+  int wx, wy;
+
+  noc = map->xdim * map->ydim;
+  wx = map->codes[winner->codeno].x;
+  wy = map->codes[winner->codeno].y;
+  for (n = 0; n < noc; n++){
+    dist = ComputeHexaDistance(wx, wy, map->codes[n].x, map->codes[n].y);
+    h = alpha * expf(dist / (-2.0 * radius * radius));
+    codebook = map->codes[n].points;
+    for (k = 0; k < MULTIPLICITY(gptr, node); k++)
+      for (i = 0; i < map->dim; i++)
+	codebook[i] += h * (node->points[i] - codebook[i]);
+  }
+  node->x = wx;
+  node->y = wy;
+}
+
+/******************************************************************************
+Description: Reference of BubbleAdapt(): codebooks within radius of the
+             winner on a hexagonal grid move towards the node by alpha, once
+             for each node the node stands for.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void RefBubbleAdapt(struct Graph *gptr, struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha)
+{
+  UNSIGNED n, i, k, noc;
+  FLOAT *codebook;
+  int wx, wy;
+
+  noc = map->xdim * map->ydim;
+  wx = map->codes[winner->codeno].x;
+  wy = map->codes[winner->codeno].y;
+  for (n = 0; n < noc; n++){
+    if (ComputeHexaDistance(wx, wy, map->codes[n].x, map->codes[n].y) > radius * radius)
+      continue;
+    codebook = map->codes[n].points;
+    for (k = 0; k < MULTIPLICITY(gptr, node); k++)
+      for (i = 0; i < map->dim; i++)
+	codebook[i] += alpha * (node->points[i] - codebook[i]);
+  }
+  node->x = wx;
+  node->y = wy;
+}
+
+/******************************************************************************
+Description: Reference of VQAdapt(): only the winner moves towards the node.
+             The child components move towards a one-hot coding of the winner
+             IDs of the offsprings, and the summary a is recomputed. Parents
+             are not supported in VQ mode. The update is repeated once for
+             each node the node stands for.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void RefVQAdapt(struct Graph *gptr, struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha)
+{
+  UNSIGNED n, i, k, noc, ldim, off;
+  FLOAT *codebook, target, a;
+  int id;
+
+  noc = map->xdim * map->ydim;
+  ldim = gptr->ldim;
+  codebook = map->codes[winner->codeno].points;
+  for (k = 0; k < MULTIPLICITY(gptr, node); k++){
+    for (i = 0; i < ldim; i++)
+      codebook[i] += alpha * (node->points[i] - codebook[i]);
+    a = 0.0;
+    for (i = 0; i < gptr->FanOut; i++){
+      id = (int)node->points[ldim + 2*i];
+      for (n = 0; n < noc; n++){
+	target = (n == id) ? 1.0 : 0.0;
+	codebook[ldim + i*noc + n] += alpha * (target - codebook[ldim + i*noc + n]);
+	a += SQR(codebook[ldim + i*noc + n]);
+      }
+    }
+    map->codes[winner->codeno].a = a;
+    off = ldim + noc * (gptr->FanOut + gptr->FanIn);
+    for (i = 0; i < gptr->tdim; i++)
+      codebook[off+i] += alpha * (node->points[ldim + 2*(gptr->FanOut+gptr->FanIn) + i] - codebook[off+i]);
+  }
+  node->winner = winner->codeno;
+}
+
+/******************************************************************************
+Description: The best match of the search for the NUM_WINNERS best matching
+             codebooks, which must agree with the search for the winner.
+
+Return value: The best matching codebook is returned to parameter "winner".
+******************************************************************************/
+static void FindBestOfWinners(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winner)
+{
+  struct Winner winners[NUM_WINNERS];
+
+  FindWinnersEucledian(map, node, gptr, winners, NUM_WINNERS);
+  *winner = winners[0];
+}
+
+static void VQFindBestOfWinners(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winner)
+{
+  struct Winner winners[NUM_WINNERS];
+
+  VQFindWinnersEucledian(map, node, gptr, winners, NUM_WINNERS);
+  *winner = winners[0];
+}
+
+/* The kernels under test. Optimised variants of the kernels are added here,
+   next to the reference they must agree with. */
+static struct SearchKernel SearchKernels[] = {
+  {"FindWinnerEucledian", FindWinnerEucledian, RefDistances, 0},
+  {"VQFindWinnerEucledian", VQFindWinnerEucledian, RefVQDistances, 1},
+  {"FindWinnersEucledian", FindBestOfWinners, RefDistances, 0},
+  {"VQFindWinnersEucledian", VQFindBestOfWinners, RefVQDistances, 1},
+  {NULL, NULL, NULL, 0}
+};
+
+static struct AdaptKernel AdaptKernels[] = {
+  {"GaussianAdapt", GaussianAdapt, RefGaussianAdapt, 0},
+  {"BubbleAdapt", BubbleAdapt, RefBubbleAdapt, 0},
+  {"VQAdapt", VQAdapt, RefVQAdapt, 1},
+  {NULL, NULL, NULL, 0}
+};
+
+/******************************************************************************
+Description: Check whether two values agree within the relative tolerance.
+
+Return value: Nonzero if the values agree.
+******************************************************************************/
+static int Agree(double val, double ref, double tol)
+{
+  if (isnan(val) || isnan(ref))
+    return 0;
+  return fabs(val - ref) <= tol * fmax(1.0, fabs(ref));
+}
+
+/******************************************************************************
+Description: Compare a search kernel with its reference for a single node.
+             The reference winner is the codebook with the smallest distance,
+             and the one with the lowest index among exact ties. A different
+             winner whose distance is within the tolerance of the smallest
+             distance is counted as a near tie.
+
+Return value: 0 if the kernel agrees, 1 on divergence. The reference winner
+              is stored in ref.
+******************************************************************************/
+int CheckSearch(struct SearchKernel *k, struct Map *map, struct Node *node, struct Graph *gptr, UNSIGNED nnum, double *dist, struct Winner *ref, struct DiffOptions *opts, struct DiffStats *stats)
+{
+  struct Winner winner;
+  UNSIGNED n, noc;
+  double best;
+
+  noc = map->xdim * map->ydim;
+  k->Ref(map, node, gptr, dist);
+  best = DBL_MAX;
+  ref->codeno = 0;
+  for (n = 0; n < noc; n++){
+    if (dist[n] < best){
+      best = dist[n];
+      ref->codeno = n;
+    }
+  }
+  ref->diff = best;
+
+  memset(&winner, 0, sizeof(struct Winner));
+  winner.codeno = -1;
+  k->Search(map, node, gptr, &winner);
+  stats->searches++;
+
+  if (winner.codeno == ref->codeno && Agree(winner.diff, best, opts->tol))
+    return 0;
+  if (winner.codeno != ref->codeno && winner.codeno >= 0 && winner.codeno < noc &&
+      dist[winner.codeno] != best &&   /* Exact ties go to the lowest index */
+      Agree(dist[winner.codeno], best, opts->tol) && Agree(winner.diff, best, opts->tol)){
+    stats->ties++;               /* Near tie, rounding decides the winner */
+    if (!opts->strict)
+      return 0;
+  }
+
+  if (stats->failures++ == 0 || opts->all){
+    fprintf(stderr, "Divergence in %s: %s, node %d\n", k->name, TrialInfo, nnum);
+    fprintf(stderr, "  reference: winner %d distance %.9g\n", ref->codeno, best);
+    if (winner.codeno >= 0 && winner.codeno < noc)
+      fprintf(stderr, "  %-10s winner %d distance %.9g (reference distance %.9g)\n", "kernel:", winner.codeno, winner.diff, dist[winner.codeno]);
+    else
+      fprintf(stderr, "  %-10s winner %d distance %.9g (no such codebook)\n", "kernel:", winner.codeno, winner.diff);
+  }
+  return 1;
+}
+
+/******************************************************************************
+Description: Allocate a copy of a map with codebooks in a single block.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void CopyMap(struct Map *dst, struct Map *src)
+{
+  UNSIGNED n, noc;
+
+  noc = src->xdim * src->ydim;
+  memcpy(dst, src, sizeof(struct Map));
+  dst->mapping = NULL;
+  dst->codes = (struct Codebook*)memdup(src->codes, noc * sizeof(struct Codebook));
+  dst->block = (FLOAT*)MyMalloc(noc * src->dim * sizeof(FLOAT));
+  for (n = 0; n < noc; n++){
+    dst->codes[n].points = &dst->block[n * src->dim];
+    memcpy(dst->codes[n].points, src->codes[n].points, src->dim * sizeof(FLOAT));
+  }
+}
+
+/******************************************************************************
+Description: Compare the codebooks of a map adapted by a kernel with those of
+             a map adapted by the reference.
+
+Return value: 0 if the maps agree, 1 on divergence.
+******************************************************************************/
+int CheckMaps(struct AdaptKernel *k, struct Map *map, struct Map *ref, UNSIGNED nnum, struct DiffOptions *opts, struct DiffStats *stats)
+{
+  UNSIGNED n, i, noc;
+
+  noc = map->xdim * map->ydim;
+  stats->adapts++;
+  for (n = 0; n < noc; n++){
+    for (i = 0; i < map->dim; i++)
+      if (!Agree(map->codes[n].points[i], ref->codes[n].points[i], opts->tol))
+	break;
+    if (i < map->dim || (k->vq && !Agree(map->codes[n].a, ref->codes[n].a, opts->tol))){
+      if (stats->failures++ == 0 || opts->all){
+	fprintf(stderr, "Divergence in %s: %s, after adapting to node %d\n", k->name, TrialInfo, nnum);
+	if (i < map->dim)
+	  fprintf(stderr, "  codebook %d component %d: reference %.9g, kernel %.9g\n", n, i, ref->codes[n].points[i], map->codes[n].points[i]);
+	else
+	  fprintf(stderr, "  codebook %d summary a: reference %.9g, kernel %.9g\n", n, ref->codes[n].a, map->codes[n].a);
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/******************************************************************************
+Description: Compare all kernels which apply to the topology of the map on
+             the given nodes. Every adaptation kernel is applied to a copy of
+             the map, in turn for every node, using the reference winner.
+
+Return value: Number of divergences found.
+******************************************************************************/
+int CompareKernels(struct Map *map, struct Node **nodes, struct Graph **graphs, UNSIGNED num, FLOAT radius, FLOAT alpha, struct DiffOptions *opts, struct DiffStats *stats)
+{
+  struct Winner *winners, wk, wr;
+  struct Map kmap, rmap;
+  struct SearchKernel *sk;
+  struct AdaptKernel *ak;
+  UNSIGNED i, noc;
+  double *dist;
+  int vq, fail = 0;
+
+  noc = map->xdim * map->ydim;
+  vq = (map->topology == TOPOL_VQ);
+  dist = (double*)MyMalloc(noc * sizeof(double));
+  winners = (struct Winner*)MyCalloc(num, sizeof(struct Winner));
+  for (sk = SearchKernels; sk->name != NULL; sk++){
+    if (sk->vq != vq)
+      continue;
+    for (i = 0; i < num; i++){
+      fail += CheckSearch(sk, map, nodes[i], graphs[i], i, dist, &winners[i], opts, stats);
+      if (fail && !opts->all)
+	goto done;
+    }
+  }
+
+  for (ak = AdaptKernels; ak->name != NULL; ak++){
+    if (ak->vq != vq)
+      continue;
+    CopyMap(&kmap, map);
+    CopyMap(&rmap, map);
+    for (i = 0; i < num; i++){
+      wk = wr = winners[i];
+      ak->Adapt(graphs[i], &kmap, nodes[i], &wk, radius, alpha);
+      ak->Ref(graphs[i], &rmap, nodes[i], &wr, radius, alpha);
+      if (CheckMaps(ak, &kmap, &rmap, i, opts, stats)){
+	fail++;
+	break;
+      }
+    }
+    FreeMap(&kmap);
+    FreeMap(&rmap);
+    if (fail && !opts->all)
+      break;
+  }
+ done:
+  free(dist);
+  free(winners);
+  return fail;
+}
+
+/******************************************************************************
+Description: Run a single trial on a random map and random nodes. Some
+             codebooks are duplicates of others, and some nodes coincide
+             with a codebook, so that tie breaking is exercised.
+
+Return value: Number of divergences found.
+******************************************************************************/
+int RandomTrial(UNSIGNED trial, struct DiffOptions *opts, struct DiffStats *stats)
+{
+  struct Graph graph, **graphs;
+  struct Node *nodes, **nptrs;
+  struct Map map;
+  FLOAT mu[4], *points, *weights, radius, alpha;
+  UNSIGNED n, i, j, noc, cdim, x, y;
+  int fail;
+
+  srand48(opts->seed + trial);
+  memset(&graph, 0, sizeof(struct Graph));
+  memset(&map, 0, sizeof(struct Map));
+  map.xdim = 1 + (UNSIGNED)(drand48() * opts->maxmap);
+  map.ydim = 1 + (UNSIGNED)(drand48() * opts->maxmap);
+  map.topology = 1 + (UNSIGNED)(drand48() * 4);   /* TOPOL_RECT..TOPOL_VQ */
+  graph.ldim = (UNSIGNED)(drand48() * (opts->maxdim + 1));
+  graph.FanOut = (UNSIGNED)(drand48() * (opts->maxfanout + 1));
+  graph.FanIn = (map.topology == TOPOL_VQ) ? 0 : (UNSIGNED)(drand48() * 3);
+  graph.tdim = (UNSIGNED)(drand48() * 3);
+  if (graph.ldim + graph.FanOut + graph.FanIn + graph.tdim == 0)
+    graph.ldim = 1;
+  graph.dimension = graph.ldim + 2*(graph.FanOut + graph.FanIn) + graph.tdim;
+  noc = map.xdim * map.ydim;
+  map.dim = (map.topology == TOPOL_VQ) ? graph.ldim + (graph.FanOut + graph.FanIn) * noc + graph.tdim : graph.dimension;
+  cdim = graph.ldim + 2*(graph.FanOut + graph.FanIn);  /* Start of target */
+
+  snprintf(TrialInfo, sizeof(TrialInfo), "trial %d (-seed %d -trials 1), %s %dx%d map, ldim=%d, fanout=%d, fanin=%d, tdim=%d", trial, opts->seed + trial, GetTopologyName(map.topology), map.xdim, map.ydim, graph.ldim, graph.FanOut, graph.FanIn, graph.tdim);
+
+  /* Random codebooks, laid out as by InitCodes() */
+  map.codes = (struct Codebook*)MyCalloc(noc, sizeof(struct Codebook));
+  map.block = (FLOAT*)MyMalloc(noc * map.dim * sizeof(FLOAT));
+  for (n = 0; n < noc; n++){
+    map.codes[n].points = &map.block[n * map.dim];
+    for (i = 0; i < map.dim; i++)
+      map.codes[n].points[i] = (map.topology != TOPOL_VQ && i >= graph.ldim && i < cdim) ? drand48() * max(map.xdim, map.ydim) : drand48();
+  }
+  for (i = (UNSIGNED)(drand48() * 4); i > 0 && noc > 1; i--){ /* Duplicates */
+    n = (UNSIGNED)(drand48() * noc);
+    j = (UNSIGNED)(drand48() * noc);
+    memcpy(map.codes[j].points, map.codes[n].points, map.dim * sizeof(FLOAT));
+  }
+  if (map.topology == TOPOL_VQ){
+    for (n = 0; n < noc; n++){     /* Summaries, as by VQSet_ab() */
+      map.codes[n].a = 0.0;
+      for (i = 0; i < graph.FanOut * noc; i++)
+	map.codes[n].a += SQR(map.codes[n].points[graph.ldim + i]);
+      map.codes[n].b = 0.0;
+    }
+  }
+  else{
+    n = 0;
+    for (y = 0; y < map.ydim; y++)
+      for (x = 0; x < map.xdim; x++, n++){
+	map.codes[n].x = x;
+	map.codes[n].y = y;
+      }
+  }
+
+  /* Random nodes with weights as set by SetWeightValues() */
+  for (i = 0; i < 4; i++)
+    mu[i] = (drand48() < 0.1) ? 0.0 : 0.01 + drand48();
+  nodes = (struct Node*)MyCalloc(opts->numnodes, sizeof(struct Node));
+  nptrs = (struct Node**)MyMalloc(opts->numnodes * sizeof(struct Node*));
+  graphs = (struct Graph**)MyMalloc(opts->numnodes * sizeof(struct Graph*));
+  points = (FLOAT*)MyMalloc(opts->numnodes * graph.dimension * sizeof(FLOAT) + 1);
+  weights = (FLOAT*)MyMalloc(opts->numnodes * graph.dimension * sizeof(FLOAT) + 1);
+  graph.multiplicity = (UNSIGNED*)MyMalloc(opts->numnodes * sizeof(UNSIGNED) + 1);
+  for (n = 0; n < opts->numnodes; n++){
+    nptrs[n] = &nodes[n];
+    nodes[n].nnum = n;
+    graph.multiplicity[n] = 1;
+    graphs[n] = &graph;
+    nodes[n].points = &points[n * graph.dimension];
+    nodes[n].mu = &weights[n * graph.dimension];
+    for (i = 0; i < graph.dimension; i++){
+      if (i < graph.ldim || i >= cdim){
+	nodes[n].points[i] = drand48();
+	nodes[n].mu[i] = (i < graph.ldim) ? mu[0] : mu[3];
+      }
+      else{
+	nodes[n].mu[i] = (i < graph.ldim + 2*graph.FanOut) ? mu[1] : mu[2];
+	if (map.topology == TOPOL_VQ)  /* Winner ID of offspring, or -1 */
+	  nodes[n].points[i] = ((i - graph.ldim) % 2 || drand48() < 0.2) ? -1.0 : (FLOAT)(UNSIGNED)(drand48() * noc);
+	else if (drand48() < 0.2)      /* Coordinates, or -1 if missing */
+	  nodes[n].points[i] = -1.0;
+	else
+	  nodes[n].points[i] = (FLOAT)(UNSIGNED)(drand48() * (((i - graph.ldim) % 2) ? map.ydim : map.xdim));
+      }
+    }
+    if (drand48() < 0.3)  /* Node which stands for identical nodes */
+      graph.multiplicity[n] = 2 + (UNSIGNED)(drand48() * 3);
+    if (map.topology != TOPOL_VQ && drand48() < 0.1) /* Exact match */
+      memcpy(nodes[n].points, map.codes[(UNSIGNED)(drand48() * noc)].points, graph.dimension * sizeof(FLOAT));
+  }
+  radius = 0.5 + drand48() * max(map.xdim, map.ydim);
+  alpha = 0.01 + 0.99 * drand48();
+
+  fail = CompareKernels(&map, nptrs, graphs, opts->numnodes, radius, alpha, opts, stats);
+
+  FreeMap(&map);
+  free(nodes);
+  free(nptrs);
+  free(graphs);
+  free(points);
+  free(weights);
+  free(graph.multiplicity);
+  return fail;
+}
+
+/******************************************************************************
+Description: Compare the kernels on the nodes of a dataset with a map
+             initialized as by initsom. Node states are computed by
+             K_Step_Approximation() as in training.
+
+Return value: Number of divergences found.
+******************************************************************************/
+int DatasetTrial(char *fname, struct Parameters *params, struct DiffOptions *opts, struct DiffStats *stats)
+{
+  struct Graph *gptr, **graphs;
+  struct Node **nodes;
+  UNSIGNED i, j, num;
+  int fail;
+
+  if ((params->train = LoadData(fname)) == NULL || CheckErrors())
+    return 0;
+  srand48(opts->seed);
+  params->map.neighborhood = (params->map.topology == TOPOL_VQ) ? NEIGH_NONE : NEIGH_GAUSSIAN;
+  InitCodes(&params->map, params->train, INIT_DEFAULT);
+  if (CheckErrors())
+    return 0;
+  if (params->map.topology == TOPOL_VQ)  /* GetMuValues() does not support VQ */
+    params->mu1 = params->mu2 = params->mu3 = params->mu4 = 1.0;
+  else
+    SuggestMu(params);
+  ClearMessages();
+  PrepareData(params);
+  if (params->map.topology == TOPOL_VQ)
+    VQSet_ab(params);
+  else
+    K_Step_Approximation(&params->map, params->train, 0);
+
+  num = 0;
+  for (gptr = params->train; gptr != NULL; gptr = gptr->next)
+    num += gptr->numnodes;
+  nodes = (struct Node**)MyMalloc(num * sizeof(struct Node*));
+  graphs = (struct Graph**)MyMalloc(num * sizeof(struct Graph*));
+  i = 0;
+  for (gptr = params->train; gptr != NULL; gptr = gptr->next){
+    for (j = 0; j < gptr->numnodes; j++, i++){
+      nodes[i] = gptr->nodes[j];
+      graphs[i] = gptr;
+    }
+  }
+  snprintf(TrialInfo, sizeof(TrialInfo), "dataset '%s', %s %dx%d map", fname, GetTopologyName(params->map.topology), params->map.xdim, params->map.ydim);
+  fail = CompareKernels(&params->map, nodes, graphs, num, max(params->map.xdim, params->map.ydim) / 2.0, 0.5, opts, stats);
+
+  free(nodes);
+  free(graphs);
+  return fail;
+}
+
+/******************************************************************************
+Description: main
+
+Return value: zero if all kernels agree, nonzero otherwise.
+******************************************************************************/
+int main(int argc, char **argv)
+{
+  struct DiffOptions opts;
+  struct DiffStats stats;
+  struct Parameters params;
+  UNSIGNED t;
+  char *dfile = NULL;
+  float tol = 1e-4;
+  int i;
+
+  memset(&opts, 0, sizeof(struct DiffOptions));
+  memset(&stats, 0, sizeof(struct DiffStats));
+  memset(&params, 0, sizeof(struct Parameters));
+  opts.trials = 200;
+  opts.seed = 1;
+  opts.maxmap = 16;
+  opts.maxdim = 64;
+  opts.maxfanout = 6;
+  opts.numnodes = 32;
+  params.map.xdim = 10;
+  params.map.ydim = 8;
+  params.map.topology = TOPOL_HEXA;
+  for (i = 1; i < argc; i++){
+    if (!strcmp(argv[i], "-trials"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.trials);
+    else if (!strcmp(argv[i], "-seed"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.seed);
+    else if (!strcmp(argv[i], "-maxmap"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.maxmap);
+    else if (!strcmp(argv[i], "-maxdim"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.maxdim);
+    else if (!strcmp(argv[i], "-maxfanout"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.maxfanout);
+    else if (!strcmp(argv[i], "-nodes"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.numnodes);
+    else if (!strcmp(argv[i], "-din"))
+      GetArg(TYPE_STRING, argc, argv, i++, &dfile);
+    else if (!strcmp(argv[i], "-xdim"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &params.map.xdim);
+    else if (!strcmp(argv[i], "-ydim"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &params.map.ydim);
+    else if (!strcmp(argv[i], "-topol")){
+      if ((params.map.topology = GetTopologyID((i+1 < argc) ? argv[++i] : NULL, NULL)) == UNKNOWN)
+	AddError("Unrecognized value for option -topol.");
+    }
+    else if (!strcmp(argv[i], "-tol")){
+      GetArg(TYPE_FLOAT, argc, argv, i++, &tol);
+      opts.tol = tol;
+    }
+    else if (!strcmp(argv[i], "-strict"))
+      opts.strict = 1;
+    else if (!strcmp(argv[i], "-all"))
+      opts.all = 1;
+    else if (!strcmp(argv[i], "-help") || !strcmp(argv[i], "-h") || !strcmp(argv[i], "-?"))
+      Usage();
+    else
+      fprintf(stderr, "Warning: Ignoring unrecognized command line option '%s'\n", argv[i]);
+
+    if (CheckErrors() != 0)
+      break;
+  }
+  opts.tol = tol;
+  if (CheckErrors() == 0 && (opts.maxmap == 0 || opts.numnodes == 0))
+    AddError("Values of options -maxmap and -nodes must be non-zero.");
+  if (CheckErrors() == 0 && dfile != NULL && params.map.xdim * params.map.ydim == 0)
+    AddError("Map dimension is zero.");
+
+  if (CheckErrors() == 0){
+    if (dfile != NULL)
+      DatasetTrial(dfile, &params, &opts, &stats);
+    else{
+      for (t = 0; t < opts.trials; t++)
+	if (RandomTrial(t, &opts, &stats) && !opts.all)
+	  break;
+    }
+  }
+  if (CheckErrors()){
+    PrintErrors();
+    return 1;
+  }
+
+  fprintf(stderr, "%lu searches and %lu adaptations compared, %lu near ties, %lu divergences\n", stats.searches, stats.adapts, stats.ties, stats.failures);
+  FreeGraphs(params.train);
+  FreeMap(&params.map);
+  free(dfile);
+  return (stats.failures > 0);
+}
+
+/* End of file */
@@ -7,6 +7,22 @@
   to 'markus@artificial-neural.net'
 
   ChangeLog:
+    18/10/2026
+      - The winners of the nodes of a dataset on a map can be saved to a
+        sidecar of the map file, and restored by later runs.
+      - Added training checkpoints (SaveCheckpoint(.), LoadCheckpoint(.),
+        RestoreCheckpoint(.)) which allow to resume a run exactly.
+      - Snapshots are written by a background thread. Files are flushed with
+        fsync() instead of a system wide sync().
+      - Keep a compiled binary copy of each dataset in a cache directory
+        (-cachedir or SOMSD_CACHEDIR), and load that copy instead of parsing
+        the data file while the data file remains unchanged.
+      - New aligned map format: codebooks are stored as one page aligned
+        block followed by a label table, and are mapped into memory on load.
+      - Datasets can be read one graph at a time (OpenGraphStream() etc.)
+        to allow training on datasets which do not fit into memory.
+      - Read files in large blocks. Compressed files (gzip, bzip2, and zstd
+        if built with HAVE_ZSTD) are decompressed by a separate thread.
     24/10/2006
       - Added support to read from gzip compressed files.
  */
@@ -21,12 +37,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <zlib.h>
+#include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "common.h"
 #include "data.h"
 #include "fileio.h"
 #include "system.h"
+#include "trace.h"
 #include "utils.h"
 
 /**************************/
@@ -45,14 +71,384 @@
 #define LABEL       9  /* A symbolic class label for the node           */
 #define STATE       10 /* State of neighbors of a node (undirected gph) */
 
+/* Dataset cache */
+#define CACHE_MAGIC   "SOMSDDC1" /* Magic number of a compiled dataset file */
+#define CACHE_VERSION 2          /* Version of the compiled dataset format   */
+#define CACHE_NOLABEL 0xffffffff /* Stored for nodes with an undefined label */
+
+/* Node to winner mapping files */
+#define MAPPING_MAGIC   "SOMSDWM1" /* Magic number of a mapping file         */
+#define MAPPING_VERSION 1          /* Version of the mapping file format      */
+
+/* Block buffered reading */
+#define DECOMP_BLOCKSIZE 1048576 /* Size of a block of (decompressed) data   */
+
+/* Training checkpoints */
+#define CHECKPOINT_MAGIC   "SOMSDCP1"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_NODEORDER  1  /* Flag: randomized node order   */
+#define CHECKPOINT_GRAPHORDER 2  /* Flag: randomized graph order  */
+
+/* Aligned map files */
+#define MAP_ALIGNMENT 4096       /* Alignment of codebook block in map files */
+
+
+/********************/
+/* Global variables */
+/********************/
+char *CacheDir = NULL;    /* Directory for cache files (NULL: see SetCacheDir) */
+struct SnapWriter *SnapWriter = NULL; /* Background writer for snapshots     */
+
+/* State of a thread which decompresses a file into alternating buffers */
+struct Decompressor{
+  int ctype;                 /* Type of compression                        */
+  void *handle;              /* gzFile, BZFILE, or ZSTD_DStream            */
+  FILE *fptr;                /* Underlying file (bzip2 and zstd)           */
+  char *inbuf;               /* Compressed input (zstd)                    */
+  size_t inpos, avail;       /* Position in and amount of compressed input */
+  char *block[2];            /* Buffers for decompressed data              */
+  size_t size[2];            /* Amount of data in each buffer              */
+  int ready[2];              /* Set while a buffer holds unconsumed data   */
+  int current;               /* Buffer being consumed by the reader        */
+  int error;                 /* Set if decompression failed                */
+  int stop;                  /* Set to ask the thread to terminate         */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* Header of a compiled dataset file. All values are stored in the native
+   byte order of the machine which wrote the file. */
+struct CacheHeader{
+  char magic[8];              /* Always CACHE_MAGIC                         */
+  unsigned version;           /* CACHE_VERSION                              */
+  unsigned sizes;             /* sizeof(FLOAT) and sizeof(UNSIGNED)         */
+  unsigned endian;            /* Byte order of the writing machine          */
+  unsigned numlabels;         /* Number of entries in the label table       */
+  unsigned long long srcsize; /* Size of the source file in bytes           */
+  unsigned long long srcmtime;/* Modification time of source in nanoseconds */
+  unsigned long long srchash; /* Hash value of the source file's contents   */
+  unsigned long long numgraphs;/* Number of graphs in the dataset           */
+  unsigned long long numnodes; /* Total number of nodes in the dataset      */
+};
+
+/* Header of a training checkpoint file. The header is followed by the name
+   of the training data, the table of labels, the codebooks (coordinates and
+   label of each codebook, then all codebook vectors as one block), and the
+   order and state of the nodes of each graph in the training set. */
+struct CheckpointHeader{
+  char magic[8];             /* CHECKPOINT_MAGIC                            */
+  unsigned version;          /* CHECKPOINT_VERSION                          */
+  unsigned sizes;            /* sizeof(FLOAT) | sizeof(UNSIGNED) << 8       */
+  unsigned endian;           /* Byte order of the machine which wrote it    */
+  UNSIGNED xdim, ydim, dim, iter, topology, neighborhood;  /* The map       */
+  UNSIGNED rlen, radius, alphatype, flags;  /* Training parameters          */
+  FLOAT alpha, beta, mu1, mu2, mu3, mu4;
+  UNSIGNED t, tlen;          /* Position in the learning rate schedule      */
+  unsigned short rng[3];     /* State of the random number generator        */
+  UNSIGNED numlabels;        /* Number of labels in the label table         */
+  UNSIGNED numgraphs;        /* Number of graphs with node states           */
+};
+
+/* Header of a file which holds the winner of every node of a dataset on a
+   map. The header is followed by one struct MappedNode for each node, in
+   order of graphs and nodes. */
+struct MappingHeader{
+  char magic[8];             /* MAPPING_MAGIC                               */
+  unsigned version;          /* MAPPING_VERSION                             */
+  unsigned sizes;            /* sizeof(FLOAT) | sizeof(UNSIGNED) << 8       */
+  unsigned endian;           /* Byte order of the machine which wrote it    */
+  unsigned method;           /* How the winners were computed (caller's ID) */
+  unsigned long long maphash;  /* Hash value of the map                     */
+  unsigned long long datahash; /* Hash value of the dataset                 */
+  unsigned long long numnodes; /* Number of nodes in the dataset            */
+  double qerror;             /* Quantization error returned by the method   */
+};
+
+struct MappedNode{
+  int codeno;                /* Winning codebook, or -1 if not mapped       */
+  FLOAT diff;                /* Distance between node and winner            */
+};
+
+/* A snapshot which is to be written to disk */
+struct SnapJob{
+  struct Parameters params;  /* Parameters, with a private copy of the map  */
+  char *fname;               /* File to write the map to (may be NULL)      */
+  char *command;             /* Command to execute afterwards (may be NULL) */
+};
+
+/* State of the thread which writes snapshots in the background */
+struct SnapWriter{
+  struct SnapJob pending;    /* Snapshot waiting to be written              */
+  int haspending;            /* Set while pending holds a snapshot          */
+  int stop;                  /* Set to ask the thread to terminate          */
+  pid_t child;               /* Process executing the snapshot command      */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* State of a dataset which is read one graph at a time */
+struct GraphStream{
+  struct FileInfo *finfo;    /* Source of the data (when parsing text)      */
+  UNSIGNED dformat[MAXFIELDS+1];/* Data format of the source                */
+  struct Graph prime;        /* Prototype for the graphs of the source      */
+  char *cptr;                /* Line of text which starts the next graph    */
+  UNSIGNED gnum;             /* Number of graphs read so far                */
+  FILE *cache;               /* Compiled copy of the dataset (if valid)     */
+  struct CacheHeader header; /* Header of the compiled copy                 */
+  unsigned *lmap;            /* Label numbers used in the compiled copy     */
+};
+
 
 /* Begin functions... */
 
+/******************************************************************************
+Description: Auxiliary function which reads up to size bytes of decompressed
+             data from the compressed stream described by dec into block.
+
+Return value: The number of bytes stored in block, 0 at the end of the stream,
+              or -1 on error.
+******************************************************************************/
+long Decompress(struct Decompressor *dec, char *block, size_t size)
+{
+  int bzerror, num, nunused;
+  void *unused;
+  char remain[BZ_MAX_UNUSED];
+
+  switch(dec->ctype){
+  case GZIP:
+    return gzread((gzFile)dec->handle, block, size);
+  case BZIP:
+    if (dec->handle == NULL)      /* End of last bzip2 stream reached */
+      return 0;
+    num = BZ2_bzRead(&bzerror, (BZFILE*)dec->handle, block, size);
+    if (bzerror == BZ_STREAM_END){/* Files may hold several bzip2 streams  */
+      BZ2_bzReadGetUnused(&bzerror, (BZFILE*)dec->handle, &unused, &nunused);
+      memcpy(remain, unused, nunused);
+      BZ2_bzReadClose(&bzerror, (BZFILE*)dec->handle);
+      dec->handle = NULL;
+      if (nunused > 0 || !feof(dec->fptr))  /* Continue with next stream */
+	dec->handle = BZ2_bzReadOpen(&bzerror, dec->fptr, 0, 0, remain, nunused);
+      if (num == 0 && dec->handle != NULL)
+	return Decompress(dec, block, size);
+      return num;
+    }
+    return (bzerror == BZ_OK) ? num : -1;
+#ifdef HAVE_ZSTD
+  case ZSTD:
+    {
+      ZSTD_outBuffer out = {block, size, 0};
+      ZSTD_inBuffer in;
+      size_t ret;
+
+      while (out.pos == 0){
+	if (dec->inpos >= dec->avail){  /* Need more compressed input */
+	  dec->avail = fread(dec->inbuf, 1, ZSTD_DStreamInSize(), dec->fptr);
+	  dec->inpos = 0;
+	  if (dec->avail == 0)
+	    return ferror(dec->fptr) ? -1 : 0;
+	}
+	in.src = dec->inbuf;
+	in.size = dec->avail;
+	in.pos = dec->inpos;
+	ret = ZSTD_decompressStream((ZSTD_DStream*)dec->handle, &out, &in);
+	dec->inpos = in.pos;
+	if (ZSTD_isError(ret))
+	  return -1;
+      }
+      return out.pos;
+    }
+#endif
+  }
+  return -1;
+}
+
+/******************************************************************************
+Description: The body of the thread which decompresses a file. Blocks of
+             decompressed data are produced alternately in one of two buffers
+             while the other buffer is being parsed by the reading thread.
+
+Return value: This function always returns NULL.
+******************************************************************************/
+void *DecompressThread(void *arg)
+{
+  struct Decompressor *dec = (struct Decompressor*)arg;
+  long num;
+  int i;
+
+  TraceThreadName("decompress");
+  for (i = 0; ; i ^= 1){
+    pthread_mutex_lock(&dec->lock);
+    while (dec->ready[i] && !dec->stop)  /* Wait until buffer was consumed */
+      pthread_cond_wait(&dec->cond, &dec->lock);
+    pthread_mutex_unlock(&dec->lock);
+    if (dec->stop)
+      break;
+
+    TraceBegin("Decompress");
+    num = Decompress(dec, dec->block[i], DECOMP_BLOCKSIZE);
+    TraceEnd();
+
+    pthread_mutex_lock(&dec->lock);
+    dec->size[i] = (num > 0) ? num : 0;
+    dec->error = (num < 0);
+    dec->ready[i] = 1;                  /* Hand buffer to the reader */
+    pthread_cond_broadcast(&dec->cond);
+    pthread_mutex_unlock(&dec->lock);
+    if (num <= 0)                       /* End of stream or error */
+      break;
+  }
+  return NULL;
+}
+
+/******************************************************************************
+Description: Start decompressing the file fname of compression type ctype on
+             a separate thread.
+
+Return value: Pointer to the state of the decompressor, or NULL if the file
+              could not be opened.
+******************************************************************************/
+struct Decompressor *StartDecompressor(char *fname, int ctype)
+{
+  struct Decompressor *dec;
+  int bzerror;
+
+  dec = (struct Decompressor*)MyCalloc(1, sizeof(struct Decompressor));
+  dec->ctype = ctype;
+  switch(ctype){
+  case GZIP:
+    if ((dec->handle = gzopen(fname, "rb")) != NULL)
+      gzbuffer((gzFile)dec->handle, DECOMP_BLOCKSIZE/4);
+    break;
+  case BZIP:
+    if ((dec->fptr = fopen(fname, "rb")) != NULL)
+      dec->handle = BZ2_bzReadOpen(&bzerror, dec->fptr, 0, 0, NULL, 0);
+    break;
+#ifdef HAVE_ZSTD
+  case ZSTD:
+    if ((dec->fptr = fopen(fname, "rb")) != NULL){
+      dec->handle = ZSTD_createDStream();
+      ZSTD_initDStream((ZSTD_DStream*)dec->handle);
+      dec->inbuf = (char*)MyMalloc(ZSTD_DStreamInSize());
+    }
+    break;
+#endif
+  }
+  if (dec->handle == NULL){
+    if (dec->fptr != NULL)
+      fclose(dec->fptr);
+    free(dec);
+    return NULL;
+  }
+
+  dec->block[0] = (char*)MyMalloc(DECOMP_BLOCKSIZE);
+  dec->block[1] = (char*)MyMalloc(DECOMP_BLOCKSIZE);
+  dec->current = -1;
+  pthread_mutex_init(&dec->lock, NULL);
+  pthread_cond_init(&dec->cond, NULL);
+  pthread_create(&dec->thread, NULL, DecompressThread, dec);
+
+  return dec;
+}
+
+/******************************************************************************
+Description: Stop the decompression thread and release all resources used by
+             the decompressor dec.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void StopDecompressor(struct Decompressor *dec)
+{
+  int bzerror;
+
+  pthread_mutex_lock(&dec->lock);
+  dec->stop = 1;
+  pthread_cond_broadcast(&dec->cond);
+  pthread_mutex_unlock(&dec->lock);
+  pthread_join(dec->thread, NULL);
+  pthread_mutex_destroy(&dec->lock);
+  pthread_cond_destroy(&dec->cond);
+
+  switch(dec->ctype){
+  case GZIP:
+    gzclose((gzFile)dec->handle);
+    break;
+  case BZIP:
+    if (dec->handle != NULL)
+      BZ2_bzReadClose(&bzerror, (BZFILE*)dec->handle);
+    break;
+#ifdef HAVE_ZSTD
+  case ZSTD:
+    ZSTD_freeDStream((ZSTD_DStream*)dec->handle);
+    free(dec->inbuf);
+    break;
+#endif
+  }
+  if (dec->fptr != NULL)
+    fclose(dec->fptr);
+  free(dec->block[0]);
+  free(dec->block[1]);
+  free(dec);
+}
+
+/******************************************************************************
+Description: Refill the read buffer of the file finfo with the next block of
+             data. Uncompressed files are read directly. For compressed files
+             the block which was consumed is handed back to the decompression
+             thread, and the next block is taken over once it is ready.
+
+Return value: The number of bytes now available in the buffer, or 0 at the end
+              of the file or on error.
+******************************************************************************/
+size_t RefillBuffer(struct FileInfo *finfo)
+{
+  struct Decompressor *dec = finfo->dec;
+  int next;
+
+  finfo->offset += finfo->len;  /* Keep track of the position in the stream */
+  finfo->pos = finfo->len = 0;
+  if (finfo->fptr == NULL && dec == NULL)
+    return 0;
+
+  if (dec == NULL){             /* Read uncompressed data */
+    if (finfo->buf == NULL)
+      finfo->buf = (char*)MyMalloc(DECOMP_BLOCKSIZE);
+    finfo->len = fread(finfo->buf, 1, DECOMP_BLOCKSIZE, finfo->fptr);
+    return finfo->len;
+  }
+
+  pthread_mutex_lock(&dec->lock);
+  if (dec->current >= 0 && dec->size[dec->current] == 0){
+    pthread_mutex_unlock(&dec->lock);/* End of stream was reached already */
+    return 0;
+  }
+  if (dec->current >= 0){       /* Return consumed buffer to decompressor */
+    dec->ready[dec->current] = 0;
+    pthread_cond_broadcast(&dec->cond);
+  }
+  next = (dec->current + 1) & 1;
+  if (!dec->ready[next]){
+    TraceBegin("WaitForDecompress");
+    while (!dec->ready[next])   /* Wait for the next block */
+      pthread_cond_wait(&dec->cond, &dec->lock);
+    TraceEnd();
+  }
+  if (dec->error)
+    AddError("Error while decompressing file.");
+  dec->current = next;
+  finfo->buf = dec->block[next];
+  finfo->len = dec->size[next];
+  pthread_mutex_unlock(&dec->lock);
+
+  return finfo->len;
+}
+
 /******************************************************************************
 Description: Open a file stream named by fname, and initialize a FileInfo
-             structure. This function has some support for compressed files.
-             This is realized by 'abusing' the FILE pointer and setting the
-             appropriate ctype flag.
+             structure. Files opened for reading are read in large blocks, and
+             compressed files (gzip, bzip2, and zstd if supported) are
+             decompressed by a separate thread while the data is parsed.
 
 Return value: Pointer to a properly initialized FileInfo structure, or
               NULL if the file could not be opened.
@@ -60,30 +456,47 @@ Return value: Pointer to a properly initialized FileInfo structure, or
 struct FileInfo* OpenFile(char *fname, char *mode)
 {
   struct FileInfo* fileinfo;
+  struct Decompressor *dec = NULL;
   FILE *fptr = NULL;
   int ctype = RAW;
 
   if (fname == NULL || mode == NULL)    /* If no file name given       */
     return NULL;
 
-  if (*mode == 'r')                         /* If to open in read mode,    */
+  if (*mode == 'r' && strcmp(fname, "-"))   /* If to open in read mode,    */
     ctype = GetCompressStatus(fname, mode); /* check if file is compressed */
 
   switch(ctype){
   case RAW:                                  /* It is an uncompressed file */
-    if ((fptr = fopen(fname, mode)) == NULL){/* try to open it             */
+    if (!strcmp(fname, "-") && *mode == 'r')
+      fptr = stdin;
+    else if ((fptr = fopen(fname, mode)) == NULL){/* try to open it        */
       AddError("Unable to open RAW file.");
       return NULL;
     }
     break;
   case GZIP:                                         /* gzip compressed file */
-    if ((fptr = (FILE*)gzopen(fname, mode)) == NULL){/* try to open it */
+    if ((dec = StartDecompressor(fname, GZIP)) == NULL){/* try to open it */
       AddError("Unable to open GZIP file.");
       return NULL;
     }
     break;
-  case BZIP:
-    AddError("Bzip2 compressed files not yet suppored by som-sd.");
+  case BZIP:                                        /* bzip2 compressed file */
+    if ((dec = StartDecompressor(fname, BZIP)) == NULL){/* try to open it */
+      AddError("Unable to open BZIP2 file.");
+      return NULL;
+    }
+    break;
+  case ZSTD:                                         /* zstd compressed file */
+#ifdef HAVE_ZSTD
+    if ((dec = StartDecompressor(fname, ZSTD)) == NULL){/* try to open it */
+      AddError("Unable to open ZSTD file.");
+      return NULL;
+    }
+#else
+    AddError("Zstd compressed files are not supported by this build of som-sd.");
+    return NULL;
+#endif
     break;
   default:
     AddError("Unknown file type reported by function GetCompressStatus().");
@@ -93,6 +506,7 @@ struct FileInfo* OpenFile(char *fname, char *mode)
   fileinfo->fname = fname;
   fileinfo->fptr = fptr;
   fileinfo->ctype = ctype;
+  fileinfo->dec = dec;
 
   return fileinfo;
 }
@@ -108,99 +522,76 @@ void CloseFile(struct FileInfo *finfo)
   if (finfo == NULL)      /* If no data given        */
     return;               /* then return immediately */
 
-  if (finfo->fptr){       /* If file is open and    */
-    switch(finfo->ctype){ /* depending on whether or how it was compressed */
-    case RAW:            
+  if (finfo->dec){        /* Stop decompressing a compressed file */
+    StopDecompressor(finfo->dec);
+  }
+  else{                   /* Uncompressed file */
+    if (finfo->fptr && finfo->fptr != stdin)
       fclose(finfo->fptr);/* close RAW file        */
-      break;
-    case GZIP:
-      gzclose((gzFile)finfo->fptr);/* close gzip compressed file */
-      break;
-    case BZIP:            /* close bzip2 compressed file (if supported) */
-      break;
-    default:              /* all other file types are unsupported and ignored*/
-      break;
-    }
+    free(finfo->buf);
   }
 
+  free(finfo->labels);
   free(finfo);            /* Free up memory used by the structure */
 }
 
 /******************************************************************************
-Description: Similar to fgetc but can read a compressed stream depending on
-             the ctype (compression type) of the file.
+Description: Similar to fgetc but reads from the block buffer of the file,
+             which holds decompressed data if the file is compressed.
 
 Return value: An unsigned char cast to an int containing the next character
               read from stream, or EOF on end of file or error.
 ******************************************************************************/
-inline int zgetc(struct FileInfo *finfo)
+static inline int zgetc(struct FileInfo *finfo)
 {
-  switch(finfo->ctype){     /* depending on whether or how it was compressed */
-  case RAW:     
-    return fgetc(finfo->fptr);     /* read from RAW file, or                 */
-  case GZIP:
-    return gzgetc((gzFile)finfo->fptr);/* read from gzip compressed file, or */
-  case BZIP:               /* read from bzip2 compressed file (if supported) */
-    break;
-  }
-  return 0;
+  if (finfo->pos >= finfo->len && RefillBuffer(finfo) == 0)
+    return EOF;
+  return (unsigned char)finfo->buf[finfo->pos++];
 }
 
 /******************************************************************************
-Description: Similar to fungetc but can push c back into a compressed stream
-             depending on the ctype (compression type) of the file.
+Description: Similar to ungetc but pushes c back into the block buffer of the
+             file. Only the character read last can be pushed back.
 
 Return value: c on success, or EOF on error.
 ******************************************************************************/
-inline int zungetc(int c, struct FileInfo *finfo)
+static inline int zungetc(int c, struct FileInfo *finfo)
 {
-  switch(finfo->ctype){     /* depending on whether or how it was compressed */
-  case RAW:     
-    return ungetc(c, finfo->fptr); /* push back into RAW file, or            */
-  case GZIP:
-    return gzungetc(c, (gzFile)finfo->fptr);/* back to gzip compressed file, */
-  case BZIP:            /* or back into bzip2 compressed file (if supported) */
-    break;
-  }
-  return 0;
+  if (c == EOF || finfo->pos == 0)
+    return EOF;
+  finfo->buf[--finfo->pos] = (char)c;
+  return c;
 }
 
 /******************************************************************************
 Description: An auxillary function which reads a value from a possibly
-             compressed ASC-II data stream. This function was written since
-             there is no fscanf equivalent in the zlib or bzlib library. Thus
-             this function is to behaves similarly to fscanf but allows only
-             at most one! format character which can be either f or d.
+             compressed ASC-II data stream. This function behaves similarly
+             to fscanf but allows only at most one! format character which can
+             be either f or d.
 
-Return value: An unsigned char cast to an int containing the next character
-              read from stream, or EOF on end of file or error.
+Return value: The number of values read (1 on success), or 0 if no value could
+              be read.
 ******************************************************************************/
 int zscanf(struct FileInfo *finfo, const char *format, void *target)
 {
-  switch(finfo->ctype){     /* depending on whether or how it was compressed */
-  case RAW:     
-    return fscanf(finfo->fptr, format, target);      /* Read from RAW stream */
-  case GZIP:/* read from gzip compressed file, or     */
-    {
-    char buffer[256];
-    int c, pos = 0;
-
-    for(pos = 0; ; pos++){
-      c = gzgetc((gzFile)finfo->fptr);
-      if ((c == '-' && pos == 0) || isdigit(c) || c == '.')
-	buffer[pos] = c;
-      else{
-	gzungetc(c, (gzFile)finfo->fptr);/* back into gzip compressed file */
-	buffer[pos] = '\0';
-	break;
-      }
-    }
-    return sscanf(buffer, format, target);  /* Read from buffer */
-    }
-  case BZIP:               /* read from bzip2 compressed file (if supported) */
-    break;
+  char buffer[256];
+  int c, pos;
+
+  c = zgetc(finfo);
+  while (c != EOF && isspace(c))/* Skip leading white spaces like fscanf */
+    c = zgetc(finfo);
+
+  /* Collect the characters which can be part of a number */
+  for(pos = 0; pos < 255 && c != EOF; pos++){
+    if (isdigit(c) || c == '.' || ((c == '-' || c == '+') && (pos == 0 || buffer[pos-1] == 'e' || buffer[pos-1] == 'E')) || strchr("eExXaAfFiInNtTyY", c) != NULL)
+      buffer[pos] = c;
+    else
+      break;
+    c = zgetc(finfo);
   }
-  return 0;
+  zungetc(c, finfo);          /* Return the delimiter to the stream */
+  buffer[pos] = '\0';
+  return sscanf(buffer, format, target);  /* Read from buffer */
 }
 
 /******************************************************************************
@@ -219,7 +610,7 @@ char *ReadLine(struct FileInfo *finfo)
   int cval;
 
   /* Clear buffer and return NULL pointer if no more data can be read */
-  if (finfo == NULL || finfo->fptr == NULL || (cval = zgetc(finfo)) == EOF){
+  if (finfo == NULL || (cval = zgetc(finfo)) == EOF){
     free(cptr);
     cptr = NULL;
     clen = 0;
@@ -260,7 +651,7 @@ char *ReadWord(struct FileInfo *finfo)
   int cval;
 
   /* Return NULL pointer if no more data can be read */
-  if (finfo == NULL || finfo->fptr==NULL || (cval = zgetc(finfo)) == EOF)
+  if (finfo == NULL || (cval = zgetc(finfo)) == EOF)
     return NULL;
 
   while (cval != EOF && isspace(cval)){/* Find the first non-white space char*/
@@ -297,8 +688,8 @@ char *ReadWord(struct FileInfo *finfo)
 
 /****************************************************************************
 Description: Like fread but considers the byte order and performs an 
-             appropriate convertion if necessary, and is able to read from
-             a compressed stream.
+             appropriate convertion if necessary, and reads from the block
+             buffer of the file (which may hold decompressed data).
 
 Return value: Same as fread (the number of bytes read)
 ****************************************************************************/
@@ -307,26 +698,21 @@ size_t bo_fread(void *ptr, size_t size, size_t nmemb, struct FileInfo *fi)
   static int endian = 0;
   char *cptr, cval;
   size_t i,j;
-  size_t res;
-  FILE *fp = fi->fptr;
+  size_t res, num, bytes;
 
   if (!endian)
     endian = FindEndian();
 
   //Fill the buffer
-  switch(fi->ctype){
-  case RAW:
-    res = fread(ptr, size, nmemb, fp);
-    break;
-  case GZIP:
-    res = gzread((gzFile)fp, ptr, size*nmemb)/size;
-    break;
-  case BZIP:
-    res = 0;
-    break;
-  default:
-    res = 0;
+  cptr = (char*)ptr;
+  for (bytes = 0; bytes < size * nmemb; bytes += num){
+    if (fi->pos >= fi->len && RefillBuffer(fi) == 0)
+      break;
+    num = min(fi->len - fi->pos, size * nmemb - bytes);
+    memcpy(cptr + bytes, fi->buf + fi->pos, num);
+    fi->pos += num;
   }
+  res = bytes / size;
 
   /* Return immediately if the byteorder in file is the same as on machine,
      or if single bytes are to be read */
@@ -378,6 +764,19 @@ size_t bo_fread(void *ptr, size_t size, size_t nmemb, struct FileInfo *fi)
   return res;
 }
 
+/******************************************************************************
+Description: Similar to ftell but reports the position in the uncompressed
+             data stream if the file is compressed.
+
+Return value: The current read or write position, or -1 on error.
+******************************************************************************/
+long FileTell(struct FileInfo *finfo)
+{
+  if (finfo->buf == NULL)   /* Nothing read, e.g. a file opened for writing */
+    return (finfo->fptr != NULL) ? ftell(finfo->fptr) : -1;
+  return finfo->offset + finfo->pos;
+}
+
 /******************************************************************************
 Description: Reads and ignores all characters in ifile starting from the 
              current file position until the end-of-line character. This
@@ -409,7 +808,7 @@ int ReadAhead(struct FileInfo *finfo)
 {
   int cval;
 
-  if (finfo == NULL || finfo->fptr == NULL)
+  if (finfo == NULL || (finfo->fptr == NULL && finfo->dec == NULL))
     return -1;
 
   cval = zgetc(finfo);
@@ -864,7 +1263,7 @@ char *ReadBinaryLabel(struct FileInfo *finfo)
     AddError("Unexpected end of file.");
   else if (clen != 0){               /* Read label if length is greater zero */
     cptr = MyCalloc(clen+1, sizeof(char));      /* Allocate memory for label */
-    if (fread(cptr, sizeof(char), clen, finfo->fptr) != clen){ /* read label */
+    if (bo_fread(cptr, sizeof(char), clen, finfo) != clen){ /* read label */
       AddError("Unexpected end of file.");  /* if we couldn't read the label */
       free(cptr);                   /* free allocated memory and return NULL */
       cptr = NULL;
@@ -890,6 +1289,7 @@ int ReadCodes(struct FileInfo *finfo, struct Map *map)
   int(*CheckForTrailingData)(struct FileInfo *);
 
   map->codes = (struct Codebook*)MyCalloc(map->xdim*map->ydim, sizeof(struct Codebook));
+  map->block = (FLOAT*)MyMalloc(map->xdim * map->ydim * map->dim * sizeof(FLOAT));
 
   if (finfo->byteorder != 0){
     ReadVector = ReadBinaryVector;
@@ -904,7 +1304,7 @@ int ReadCodes(struct FileInfo *finfo, struct Map *map)
 
   for (y = 0; y < map->ydim; y++){
     for (x = 0; x < map->xdim; x++){
-      fptr = (FLOAT*)MyMalloc(map->dim * sizeof(FLOAT)); 
+      fptr = &map->block[(y*map->xdim+x) * map->dim];
       ReadVector(fptr, map->dim, finfo);
       map->codes[y*map->xdim+x].points = fptr;
       map->codes[y*map->xdim+x].x = x;
@@ -925,6 +1325,116 @@ int ReadCodes(struct FileInfo *finfo, struct Map *map)
   return 0;
 }
 
+/******************************************************************************
+Description: Map the codebook block of an aligned map file into memory. The
+             block starts at byte offset of the file opened by finfo, and is
+             followed by the label table. The file is mapped privately so that
+             pages are shared by all processes which read the same map, and
+             are copied only when they are modified (e.g. during training).
+
+Return value: 1 if the file was mapped, or 0 if the file could not be mapped
+              in which case the caller should read the file instead.
+******************************************************************************/
+int MapAlignedCodes(struct FileInfo *finfo, struct Map *map, long offset)
+{
+  UNSIGNED i, noc;
+  unsigned clen;
+  size_t pos, blocksize;
+  struct stat st;
+  char *base, *label;
+
+  noc = map->xdim * map->ydim;
+  blocksize = (size_t)noc * map->dim * sizeof(FLOAT);
+  if (offset <= 0 || offset % sizeof(FLOAT) != 0 ||
+      fstat(fileno(finfo->fptr), &st) != 0 ||
+      (size_t)st.st_size < (size_t)offset + blocksize)
+    return 0;
+
+  base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(finfo->fptr), 0);
+  if (base == MAP_FAILED)
+    return 0;
+  madvise(base + offset, blocksize, MADV_WILLNEED);
+
+  map->mapping = base;
+  map->mapsize = st.st_size;
+  for (i = 0; i < noc; i++)
+    map->codes[i].points = (FLOAT*)(base + offset) + (size_t)i * map->dim;
+
+  /* Read the label table which follows the codebook block */
+  pos = offset + blocksize;
+  for (i = 0; i < noc; i++){
+    if (pos + sizeof(unsigned) > map->mapsize){
+      AddError("Unexpected end of file.");
+      break;
+    }
+    memcpy(&clen, base + pos, sizeof(unsigned));
+    pos += sizeof(unsigned);
+    if (clen > map->mapsize - pos){
+      AddError("Unexpected end of file.");
+      break;
+    }
+    if (clen > 0){
+      label = strndup(base + pos, clen);
+      map->codes[i].label = AddLabel(label);
+      free(label);
+      pos += clen;
+    }
+  }
+  if (CheckErrors() == 0 && pos != map->mapsize)
+    AddError("Unexpected trailing data found in file.");
+
+  return 1;
+}
+
+/******************************************************************************
+Description: Reads codebook entries of an aligned map file from file finfo and
+             stores them in the given map structure. The codebooks form a
+             single contiguous block of FLOAT values, which is followed by a
+             table of codebook labels. The file is mapped into memory if
+             possible, otherwise it is read.
+
+Return value: The number of errors that occured while reading the codebooks.
+******************************************************************************/
+int ReadAlignedCodes(struct FileInfo *finfo, struct Map *map)
+{
+  UNSIGNED x, y, i, noc;
+  char *label;
+
+  if (finfo->byteorder == 0){
+    AddError("Aligned map files must specify a byteorder.");
+    return CheckErrors();
+  }
+
+  noc = map->xdim * map->ydim;
+  map->codes = (struct Codebook*)MyCalloc(noc, sizeof(struct Codebook));
+  for (y = 0; y < map->ydim; y++){
+    for (x = 0; x < map->xdim; x++){
+      map->codes[y*map->xdim+x].x = x;
+      map->codes[y*map->xdim+x].y = y;
+    }
+  }
+
+  if (finfo->ctype == RAW && finfo->byteorder == FindEndian() &&
+      MapAlignedCodes(finfo, map, FileTell(finfo)))
+    return CheckErrors();
+
+  /* Compressed files, or files in a foreign byte order are read */
+  map->block = (FLOAT*)MyMalloc(noc * map->dim * sizeof(FLOAT));
+  ReadBinaryVector(map->block, noc * map->dim, finfo);
+  for (i = 0; i < noc && CheckErrors() == 0; i++){
+    map->codes[i].points = &map->block[i * map->dim];
+    label = ReadBinaryLabel(finfo);
+    if (label != NULL){
+      map->codes[i].label = AddLabel(label);
+      free(label);
+    }
+  }
+  if (CheckErrors() == 0)
+    SetErrorIfAnyDataAvailable(finfo); /* Check for unexpected trailing data */
+
+  return CheckErrors();
+}
+
 
 /******************************************************************************
 Description: Read a datafile header from file finfo. A header can occur at the
@@ -1023,6 +1533,30 @@ void LinkNodes(struct Graph *gptr)
   }
 }
 
+/******************************************************************************
+Description: Remember the label index label in the list of labels read from
+             finfo, unless the label was read from finfo before. The list
+             holds the labels in the order of their first occurrence in the
+             file, which is the order in which parsing the file registers
+             them.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void NoteLabel(struct FileInfo *finfo, UNSIGNED label)
+{
+  UNSIGNED i;
+
+  if (label == 0 || label == MAX_UNSIGNED)
+    return;
+  for (i = 0; i < finfo->numlabels; i++)
+    if (finfo->labels[i] == label)
+      return;
+
+  if (finfo->numlabels % 16 == 0)
+    finfo->labels = (UNSIGNED*)MyRealloc(finfo->labels, (finfo->numlabels+16) * sizeof(UNSIGNED));
+  finfo->labels[finfo->numlabels++] = label;
+}
+
 /******************************************************************************
 Description: Read the nodes of a graph from file finfo. Store the nodes which
              are expected to be available in the format given by dformat in
@@ -1130,6 +1664,7 @@ int ReadNodes(struct Graph *gptr, UNSIGNED *dformat, struct FileInfo *finfo)
       else if (dformat[i] == LABEL){
 	label = ReadLabel(finfo);
 	node->label = AddLabel(label);  /* Read the symbolic data label */
+	NoteLabel(finfo, node->label);
 	free(label);
       }
     }
@@ -1224,88 +1759,628 @@ char *ReadGraph(char *cptr, UNSIGNED *dformat, struct Graph *gptr, struct FileIn
 }
 
 /******************************************************************************
-Description: Read graph definitions from a file named fname, and return a
-             pointer to a linked list of graphs (read from the given file).
+Description: Set the directory in which compiled dataset files (and other
+             sidecar files) are stored. If dir is NULL, then the directory
+             given by the environment variable SOMSD_CACHEDIR is used, and
+             caching is disabled if that variable is not set either. Caching
+             is also disabled if dir is "none". Nothing is written next to
+             the data or map files, whose directories may be shared or read
+             only.
 
-Return value: Pointer to a linked list of graphs, or NULL if there were no
-              graphs read.
+Return value: This function does not return a value.
 ******************************************************************************/
-struct Graph* LoadData(char *fname)
+void SetCacheDir(char *dir)
 {
-  UNSIGNED dformat[MAXFIELDS+1] = {NODELABEL,CHILDSTATE,LINKS,LABEL,0};
-  UNSIGNED gnum = 0;              /* Provides a unique number to each graph */
-  UNSIGNED numnodes = 0;          /* Counts the total number of nodes       */
-  char *cptr;
-  struct FileInfo *finfo;         /* Structure to hold file status info     */
-  struct Graph prime;             /* Used as a prototype for all graphs     */
-  struct Graph *head = NULL, *prev = NULL, *gptr; /* Handle the graph-list  */
-
-  fprint(stderr, "Reading data.......");       /* Print what is being done */
-  if ((finfo = OpenFile(fname, "rb")) == NULL) /* Try to open data stream  */
-    AddError("No file name given.");
-
-  if (CheckErrors()){                          /* Any errors so far?       */
-    fprintf(stderr, "%55s\n", "[FAILED]");
-    return NULL;
-  }
+  if (CacheDir != NULL)
+    free(CacheDir);
+  CacheDir = (dir != NULL) ? strdup(dir) : NULL;
+}
 
-  memset(&prime, 0, sizeof(struct Graph)); /* Initialize primal graph */
-  InitProgressMeter(-1);             /* Initialize the progress meter */
+/******************************************************************************
+Description: Compose the name of a sidecar file for the file fname in the
+             cache directory. The name is formed from the base name of fname,
+             a hash of its absolute path which makes it unique, and the given
+             suffix.
 
-  /* Read the header */
-  cptr = ReadLine(finfo);                 /* Read first line of data  */
-  cptr = ReadDataHeader(cptr, dformat, &prime, finfo);
-  if (cptr == NULL)         /* Obligatory keyword "graph" not found   */
-    AddError("This doesn't seem to be a valid data file.");
+Return value: Pointer to a dynamically allocated file name, or NULL if caching
+              is disabled or no sidecar can be associated with fname.
+******************************************************************************/
+char *GetCacheFileName(char *fname, char *suffix)
+{
+  char *dir, *base, *path, *cname;
 
-  while (cptr != NULL && CheckErrors() == 0){
-    gptr = MyMalloc(sizeof(struct Graph));
-    memcpy(gptr, &prime, sizeof(struct Graph));
-    gptr->gnum = gnum++;            /* Give this graph a logical number */
-    cptr = ReadGraph(cptr, dformat, gptr, finfo); /* Read graph */
-    if (prev != NULL)               /* Attach to list of graph  */
-      prev->next = gptr;
-    else
-      head = gptr;
-    prev = gptr;
+  if (fname == NULL || suffix == NULL || !strcmp(fname, "-"))
+    return NULL;     /* Streams cannot be cached */
 
-    numnodes += gptr->numnodes;
-    PrintProgress(gnum);  /* Print progress */
-    if (CheckErrors() == 0)
-      cptr = ReadDataHeader(cptr, dformat, &prime, finfo);
-  }
-  CloseFile(finfo);       /* Close data stream */
-  if (CheckErrors() == 0)
-    SetNodeDepth(head);   /* Ensure that depth value of nodes is initialized */
+  dir = (CacheDir != NULL) ? CacheDir : getenv("SOMSD_CACHEDIR");
+  if (dir == NULL || *dir == '\0' || !strcmp(dir, "none"))
+    return NULL;     /* Caching is disabled */
 
-  StopProgressMeter();    /* Stop the progress meter */
-  if (!CheckErrors())     /* If no errors...   */
-    fprintf(stderr, "%d nodes%*s\n", (int)numnodes, 48-(int)(log10(numnodes)), "[OK]");
+  if ((path = realpath(fname, NULL)) == NULL)
+    path = strdup(fname);
+  if ((base = strrchr(fname, '/')) != NULL)
+    base++;
   else
-    fprintf(stderr, "%55s\n", "[FAILED]");
+    base = fname;
+  cname = (char*)MyMalloc(strlen(dir) + strlen(base) + strlen(suffix) + 20);
+  sprintf(cname, "%s/%s.%016llx.%s", dir, base, HashBytes(path, strlen(path), 0), suffix);
+  free(path);
 
-  return head;
+  return cname;
 }
 
 /******************************************************************************
-Description: 
+Description: Compute a hash value over the entire contents of the file fname.
+             Compressed files are hashed as they are stored on disk.
 
-Return value: 
+Return value: The hash value, or 0 if the file could not be read.
 ******************************************************************************/
-void SaveData(FILE *ofile, struct Graph *gptr)
+unsigned long long HashFile(char *fname)
 {
-  UNSIGNED i, n;
-  UNSIGNED ldim, tdim, FanIn, FanOut;
-  UNSIGNED soff, coff, poff;
-  struct Node *node;
+  unsigned long long hash = 0;
+  size_t num;
+  char *buffer;
+  FILE *fptr;
 
-  if (gptr == NULL)
-    return;
+  if ((fptr = fopen(fname, "rb")) == NULL)
+    return 0;
 
-  ldim = INT_MAX;  /* Initialize graph properties with illegal values to  */
-  tdim = INT_MAX;  /* enforce the writing of a data header for the first  */
-  FanIn = INT_MAX; /* graph. Any successife graph will have an own header */
-  FanOut = INT_MAX;/* if a property differs from an earlier graph.        */
+  buffer = (char*)MyMalloc(65536);
+  while ((num = fread(buffer, 1, 65536, fptr)) > 0)
+    hash = HashBytes(buffer, num, hash);
+  free(buffer);
+  fclose(fptr);
+
+  return hash;
+}
+
+/******************************************************************************
+Description: Auxiliary function to fill the source identification fields of a
+             cache header with the size and modification time of file fname.
+
+Return value: 1 on success, 0 if the file could not be inspected.
+******************************************************************************/
+int GetSourceStatus(char *fname, struct CacheHeader *header)
+{
+  struct stat st;
+
+  if (stat(fname, &st) != 0 || !S_ISREG(st.st_mode))
+    return 0;
+
+  header->srcsize = (unsigned long long)st.st_size;
+  header->srcmtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  return 1;
+}
+
+/******************************************************************************
+Description: Write a compiled copy of the graphs in graph, which were read
+             from the file fname through finfo, to the cache. The compiled
+             copy holds the nodes with their vectors, links, depth values,
+             and symbolic labels, so that it can be loaded without parsing
+             the source. The file is written under a temporary name and is
+             renamed once complete. Failures are silently ignored since the
+             cache is only an optimization.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void SaveDataCache(char *fname, struct Graph *graph, struct FileInfo *finfo)
+{
+  struct CacheHeader header;
+  struct Graph *gptr;
+  struct Node *node;
+  char *cname, *tname, *label;
+  unsigned *lmap, ulen, uval;
+  UNSIGNED n, i, numlabels, gvals[8];
+  int link, fail = 0;
+  FILE *ofile;
+
+  if ((cname = GetCacheFileName(fname, "cache")) == NULL)
+    return;
+
+  memset(&header, 0, sizeof(struct CacheHeader));
+  if (!GetSourceStatus(fname, &header)){
+    free(cname);
+    return;
+  }
+  memcpy(header.magic, CACHE_MAGIC, 8);
+  header.version = CACHE_VERSION;
+  header.sizes = sizeof(FLOAT) | (sizeof(UNSIGNED) << 8);
+  header.endian = FindEndian();
+  header.srchash = HashFile(fname);
+
+  /* Number the labels of the dataset in the order in which they occur in the
+     source. The global label index cannot be used for this, as labels of
+     other datasets may have been registered first. Loading the cache then
+     registers the labels in the same order as parsing the source does. */
+  numlabels = GetNumLabels();
+  lmap = (unsigned*)MyCalloc(numlabels+1, sizeof(unsigned));
+  for (i = 0; i < finfo->numlabels; i++)
+    if (finfo->labels[i] <= numlabels)
+      lmap[finfo->labels[i]] = ++header.numlabels;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next){
+    header.numgraphs++;
+    header.numnodes += gptr->numnodes;
+  }
+
+  tname = (char*)MyMalloc(strlen(cname) + 16);
+  sprintf(tname, "%s.tmp%d", cname, (int)getpid());
+  if ((ofile = fopen(tname, "wb")) == NULL){
+    free(tname);
+    free(cname);
+    free(lmap);
+    return;
+  }
+
+  fail |= fwrite(&header, sizeof(struct CacheHeader), 1, ofile) != 1;
+  for (i = 0; i < finfo->numlabels && !fail; i++){ /* Write the label table */
+    if (finfo->labels[i] > numlabels)
+      continue;
+    label = GetLabel(finfo->labels[i]);
+    ulen = strlen(label);
+    fail |= fwrite(&ulen, sizeof(unsigned), 1, ofile) != 1;
+    fail |= fwrite(label, 1, ulen, ofile) != ulen;
+  }
+
+  for (gptr = graph; gptr != NULL && !fail; gptr = gptr->next){
+    gvals[0] = gptr->gnum;
+    gvals[1] = gptr->numnodes;
+    gvals[2] = gptr->ldim;
+    gvals[3] = gptr->dimension;
+    gvals[4] = gptr->FanOut;
+    gvals[5] = gptr->FanIn;
+    gvals[6] = gptr->tdim;
+    gvals[7] = gptr->depth;
+    fail |= fwrite(gvals, sizeof(UNSIGNED), 8, ofile) != 8;
+    ulen = (gptr->gname != NULL) ? strlen(gptr->gname) + 1 : 0;
+    fail |= fwrite(&ulen, sizeof(unsigned), 1, ofile) != 1;
+    if (ulen > 0)
+      fail |= fwrite(gptr->gname, 1, ulen-1, ofile) != ulen-1;
+    uval = (gptr->FanOut > 0 && gptr->numnodes > 0 && gptr->nodes[0]->children != NULL);
+    fail |= fwrite(&uval, sizeof(unsigned), 1, ofile) != 1;
+
+    for (n = 0; n < gptr->numnodes && !fail; n++){
+      node = gptr->nodes[n];
+      fail |= fwrite(&node->nnum, sizeof(UNSIGNED), 1, ofile) != 1;
+      fail |= fwrite(&node->depth, sizeof(UNSIGNED), 1, ofile) != 1;
+      if (node->label == 0)
+	ulen = 0;
+      else if (node->label <= numlabels)
+	ulen = lmap[node->label];
+      else
+	ulen = CACHE_NOLABEL;
+      fail |= fwrite(&ulen, sizeof(unsigned), 1, ofile) != 1;
+      fail |= fwrite(node->points, sizeof(FLOAT), gptr->dimension, ofile) != gptr->dimension;
+      for (i = 0; uval && i < gptr->FanOut; i++){
+	link = (node->children[i] != NULL) ? (int)node->children[i]->nnum : -1;
+	fail |= fwrite(&link, sizeof(int), 1, ofile) != 1;
+      }
+    }
+  }
+
+  if (fclose(ofile) != 0 || fail || rename(tname, cname) != 0)
+    unlink(tname);  /* Do not leave incomplete cache files behind */
+
+  free(tname);
+  free(cname);
+  free(lmap);
+}
+
+/******************************************************************************
+Description: Open the compiled copy of the dataset in file fname, and verify
+             that it is valid for this machine and for the source. The copy
+             is used only if it was written for a source of the same size,
+             and if either the modification time or the hash value of the
+             contents of the source are unchanged. The header is stored in
+             header. The labels of the dataset are registered in the order in
+             which they were first seen, a table which maps the label numbers
+             used in the file to the registered labels is returned in lmap.
+
+Return value: The open file positioned at the first graph, or NULL if there is
+              no valid compiled copy in the cache.
+******************************************************************************/
+FILE *OpenDataCache(char *fname, struct CacheHeader *header, unsigned **lmap)
+{
+  struct CacheHeader source;
+  char *cname, *label;
+  unsigned ulen, i;
+  int fail = 0;
+  FILE *ifile;
+
+  if ((cname = GetCacheFileName(fname, "cache")) == NULL)
+    return NULL;
+  ifile = fopen(cname, "rb");
+  free(cname);
+  if (ifile == NULL)
+    return NULL;
+
+  /* Verify that the cache is valid for this machine and for the source */
+  memset(&source, 0, sizeof(struct CacheHeader));
+  if (fread(header, sizeof(struct CacheHeader), 1, ifile) != 1 ||
+      memcmp(header->magic, CACHE_MAGIC, 8) ||
+      header->version != CACHE_VERSION ||
+      header->sizes != (sizeof(FLOAT) | (sizeof(UNSIGNED) << 8)) ||
+      header->endian != FindEndian() ||
+      !GetSourceStatus(fname, &source) ||
+      header->srcsize != source.srcsize ||
+      (header->srcmtime != source.srcmtime && header->srchash != HashFile(fname))){
+    fclose(ifile);
+    return NULL;
+  }
+
+  /* Register the labels in the same order in which they were first seen */
+  *lmap = (unsigned*)MyCalloc(header->numlabels+1, sizeof(unsigned));
+  for (i = 1; i <= header->numlabels && !fail; i++){
+    if (fread(&ulen, sizeof(unsigned), 1, ifile) != 1 || ulen > 65536){
+      fail = 1;
+      break;
+    }
+    label = (char*)MyCalloc(ulen+1, sizeof(char));
+    if (fread(label, 1, ulen, ifile) != ulen)
+      fail = 1;
+    else
+      (*lmap)[i] = AddLabel(label);
+    free(label);
+  }
+  if (fail){
+    fclose(ifile);
+    free(*lmap);
+    *lmap = NULL;
+    return NULL;
+  }
+  return ifile;
+}
+
+/******************************************************************************
+Description: Read the next graph from the compiled dataset file ifile which
+             was opened by OpenDataCache(). Depth values and links are
+             restored so that the result is identical to what LoadData()
+             produces when parsing the source.
+
+Return value: Pointer to the graph, or NULL if the file is truncated or
+              corrupted.
+******************************************************************************/
+struct Graph *ReadCachedGraph(FILE *ifile, struct CacheHeader *header, unsigned *lmap)
+{
+  struct Graph *gptr;
+  struct Node *node, *child;
+  unsigned ulen, haslinks;
+  UNSIGNED n, j, gvals[8];
+  int link, fail = 0;
+
+  if (fread(gvals, sizeof(UNSIGNED), 8, ifile) != 8 ||
+      fread(&ulen, sizeof(unsigned), 1, ifile) != 1)
+    return NULL;
+
+  gptr = (struct Graph*)MyCalloc(1, sizeof(struct Graph));
+  gptr->gnum = gvals[0];
+  gptr->ldim = gvals[2];
+  gptr->dimension = gvals[3];
+  gptr->FanOut = gvals[4];
+  gptr->FanIn = gvals[5];
+  gptr->tdim = gvals[6];
+  gptr->depth = gvals[7];
+  if (ulen > 0){
+    gptr->gname = (char*)MyCalloc(ulen, sizeof(char));
+    fail |= fread(gptr->gname, 1, ulen-1, ifile) != ulen-1;
+  }
+  fail |= fread(&haslinks, sizeof(unsigned), 1, ifile) != 1;
+  if (fail || gvals[1] > header->numnodes){
+    FreeGraphs(gptr);
+    return NULL;
+  }
+  gptr->nodes = (struct Node **)MyCalloc(gvals[1], sizeof(struct Node *));
+  for (n = 0; n < gvals[1]; n++){
+    gptr->nodes[n] = (struct Node *)MyCalloc(1, sizeof(struct Node));
+    gptr->nodes[n]->points = (FLOAT*)MyMalloc(gptr->dimension * sizeof(FLOAT));
+    if (haslinks)
+      gptr->nodes[n]->children = (struct Node**)MyCalloc(gptr->FanOut, sizeof(struct Node*));
+  }
+  gptr->numnodes = gvals[1];
+
+  for (n = 0; n < gptr->numnodes && !fail; n++){
+    node = gptr->nodes[n];
+    fail |= fread(&node->nnum, sizeof(UNSIGNED), 1, ifile) != 1;
+    fail |= fread(&node->depth, sizeof(UNSIGNED), 1, ifile) != 1;
+    fail |= fread(&ulen, sizeof(unsigned), 1, ifile) != 1;
+    if (ulen == CACHE_NOLABEL)
+      node->label = MAX_UNSIGNED;
+    else if (ulen <= header->numlabels)
+      node->label = lmap[ulen];
+    else
+      fail = 1;
+    fail |= fread(node->points, sizeof(FLOAT), gptr->dimension, ifile) != gptr->dimension;
+
+    /* Restore links in the same order as LinkNodes() does */
+    for (j = 0; haslinks && j < gptr->FanOut && !fail; j++){
+      fail |= fread(&link, sizeof(int), 1, ifile) != 1;
+      if (link < 0)
+	continue;
+      if (link >= gptr->numnodes){
+	fail = 1;
+	break;
+      }
+      child = gptr->nodes[link];
+      node->children[j] = child;
+      child->numparents += 1;
+      child->parents = MyRealloc(child->parents, child->numparents * sizeof(struct Node*));
+      child->parents[child->numparents-1] = node;
+    }
+  }
+  if (fail){
+    FreeGraphs(gptr);
+    return NULL;
+  }
+  return gptr;
+}
+
+/******************************************************************************
+Description: Load the compiled copy of the dataset in file fname from the
+             cache. The total number of nodes is stored in numnodes.
+
+Return value: Pointer to a linked list of graphs, or NULL if there is no valid
+              compiled copy in the cache.
+******************************************************************************/
+struct Graph *LoadDataCache(char *fname, UNSIGNED *numnodes)
+{
+  struct CacheHeader header;
+  struct Graph *head = NULL, *prev = NULL, *gptr;
+  unsigned *lmap;
+  unsigned long long g;
+  FILE *ifile;
+
+  if ((ifile = OpenDataCache(fname, &header, &lmap)) == NULL)
+    return NULL;
+
+  *numnodes = 0;
+  for (g = 0; g < header.numgraphs; g++){
+    if ((gptr = ReadCachedGraph(ifile, &header, lmap)) == NULL){
+      FreeGraphs(head);   /* A truncated or corrupted cache file */
+      head = NULL;        /* is ignored                          */
+      break;
+    }
+    if (prev != NULL)     /* Attach to list of graph  */
+      prev->next = gptr;
+    else
+      head = gptr;
+    prev = gptr;
+    *numnodes += gptr->numnodes;
+  }
+  fclose(ifile);
+  free(lmap);
+
+  return head;
+}
+
+/******************************************************************************
+Description: Open the dataset in file fname for reading one graph at a time.
+             The compiled copy of the dataset is used if there is a valid one
+             in the cache, otherwise the source is parsed.
+
+Return value: Pointer to the state of the stream, or NULL on error (an error
+              is set which can be checked with CheckErrors()).
+******************************************************************************/
+struct GraphStream *OpenGraphStream(char *fname)
+{
+  UNSIGNED dformat[MAXFIELDS+1] = {NODELABEL,CHILDSTATE,LINKS,LABEL,0};
+  struct GraphStream *stream;
+
+  stream = (struct GraphStream*)MyCalloc(1, sizeof(struct GraphStream));
+  if ((stream->cache = OpenDataCache(fname, &stream->header, &stream->lmap)) != NULL)
+    return stream;
+
+  if ((stream->finfo = OpenFile(fname, "rb")) == NULL){
+    AddError("Unable to open data file.");
+    free(stream);
+    return NULL;
+  }
+  memcpy(stream->dformat, dformat, sizeof(dformat));
+  stream->cptr = ReadLine(stream->finfo);     /* Read first line of data */
+  stream->cptr = ReadDataHeader(stream->cptr, stream->dformat, &stream->prime, stream->finfo);
+  if (stream->cptr == NULL)   /* Obligatory keyword "graph" not found */
+    AddError("This doesn't seem to be a valid data file.");
+
+  return stream;
+}
+
+/******************************************************************************
+Description: Read the next graph from a stream opened by OpenGraphStream().
+             The graph is read and initialized in the same way as by
+             LoadData(), but is not attached to any other graph.
+
+Return value: Pointer to the graph, or NULL if there are no more graphs or if
+              an error occured.
+******************************************************************************/
+struct Graph *ReadNextGraph(struct GraphStream *stream)
+{
+  struct Graph *gptr;
+
+  if (stream == NULL)
+    return NULL;
+
+  if (stream->cache != NULL){           /* Read from compiled copy */
+    if (stream->gnum >= stream->header.numgraphs)
+      return NULL;
+    if ((gptr = ReadCachedGraph(stream->cache, &stream->header, stream->lmap)) == NULL)
+      AddError("Compiled dataset file is truncated or corrupted.");
+    stream->gnum++;
+    return gptr;
+  }
+
+  if (stream->cptr == NULL || CheckErrors())
+    return NULL;
+  gptr = MyMalloc(sizeof(struct Graph));
+  memcpy(gptr, &stream->prime, sizeof(struct Graph));
+  gptr->gnum = stream->gnum++;          /* Give graph a logical number */
+  stream->cptr = ReadGraph(stream->cptr, stream->dformat, gptr, stream->finfo);
+  if (CheckErrors()){
+    FreeGraphs(gptr);
+    return NULL;
+  }
+  stream->cptr = ReadDataHeader(stream->cptr, stream->dformat, &stream->prime, stream->finfo);
+  SetNodeDepth(gptr);     /* Ensure that depth value of nodes is initialized */
+
+  return gptr;
+}
+
+/******************************************************************************
+Description: Close a stream opened by OpenGraphStream().
+
+Return value: This function does not return a value.
+******************************************************************************/
+void CloseGraphStream(struct GraphStream *stream)
+{
+  if (stream == NULL)
+    return;
+  if (stream->cache != NULL)
+    fclose(stream->cache);
+  CloseFile(stream->finfo);
+  free(stream->lmap);
+  free(stream);
+}
+
+/******************************************************************************
+Description: Read through the dataset in file fname one graph at a time to
+             count its nodes, and keep the first maxgraphs graphs as a sample
+             of the dataset. The number of nodes is taken from the header of
+             the compiled copy of the dataset if there is one. The total
+             number of nodes is stored in numnodes.
+
+Return value: Pointer to a linked list of at most maxgraphs graphs, or NULL if
+              there were no graphs read.
+******************************************************************************/
+struct Graph *LoadDataSample(char *fname, UNSIGNED maxgraphs, UNSIGNED *numnodes)
+{
+  struct GraphStream *stream;
+  struct Graph *head = NULL, *prev = NULL, *gptr;
+  UNSIGNED numgraphs = 0;
+
+  fprint(stderr, "Scanning data......");       /* Print what is being done */
+  *numnodes = 0;
+  if ((stream = OpenGraphStream(fname)) == NULL || CheckErrors()){
+    CloseGraphStream(stream);
+    fprintf(stderr, "%55s\n", "[FAILED]");
+    return NULL;
+  }
+
+  InitProgressMeter(-1);             /* Initialize the progress meter */
+  while ((gptr = ReadNextGraph(stream)) != NULL){
+    *numnodes += gptr->numnodes;
+    if (numgraphs++ < maxgraphs){   /* Keep graph as part of the sample */
+      if (prev != NULL)
+	prev->next = gptr;
+      else
+	head = gptr;
+      prev = gptr;
+    }
+    else
+      FreeGraphs(gptr);
+
+    if (stream->cache != NULL && numgraphs >= maxgraphs){
+      *numnodes = stream->header.numnodes;  /* Count is known already */
+      break;
+    }
+    PrintProgress(numgraphs);  /* Print progress */
+  }
+  CloseGraphStream(stream);
+
+  StopProgressMeter();    /* Stop the progress meter */
+  if (!CheckErrors() && *numnodes > 0)
+    fprintf(stderr, "%d nodes%*s\n", (int)*numnodes, 48-(int)(log10(*numnodes)), "[OK]");
+  else
+    fprintf(stderr, "%55s\n", "[FAILED]");
+
+  return head;
+}
+
+/******************************************************************************
+Description: Read graph definitions from a file named fname, and return a
+             pointer to a linked list of graphs (read from the given file).
+
+Return value: Pointer to a linked list of graphs, or NULL if there were no
+              graphs read.
+******************************************************************************/
+struct Graph* LoadData(char *fname)
+{
+  UNSIGNED dformat[MAXFIELDS+1] = {NODELABEL,CHILDSTATE,LINKS,LABEL,0};
+  UNSIGNED gnum = 0;              /* Provides a unique number to each graph */
+  UNSIGNED numnodes = 0;          /* Counts the total number of nodes       */
+  char *cptr;
+  struct FileInfo *finfo;         /* Structure to hold file status info     */
+  struct Graph prime;             /* Used as a prototype for all graphs     */
+  struct Graph *head = NULL, *prev = NULL, *gptr; /* Handle the graph-list  */
+
+  fprint(stderr, "Reading data.......");       /* Print what is being done */
+  if ((head = LoadDataCache(fname, &numnodes)) != NULL){/*Use compiled copy*/
+    fprintf(stderr, "%d nodes (cached)%*s\n", (int)numnodes, 40-(int)(log10(numnodes)), "[OK]");
+    return head;
+  }
+  if ((finfo = OpenFile(fname, "rb")) == NULL) /* Try to open data stream  */
+    AddError("No file name given.");
+
+  if (CheckErrors()){                          /* Any errors so far?       */
+    fprintf(stderr, "%55s\n", "[FAILED]");
+    return NULL;
+  }
+
+  memset(&prime, 0, sizeof(struct Graph)); /* Initialize primal graph */
+  InitProgressMeter(-1);             /* Initialize the progress meter */
+
+  /* Read the header */
+  cptr = ReadLine(finfo);                 /* Read first line of data  */
+  cptr = ReadDataHeader(cptr, dformat, &prime, finfo);
+  if (cptr == NULL)         /* Obligatory keyword "graph" not found   */
+    AddError("This doesn't seem to be a valid data file.");
+
+  while (cptr != NULL && CheckErrors() == 0){
+    gptr = MyMalloc(sizeof(struct Graph));
+    memcpy(gptr, &prime, sizeof(struct Graph));
+    gptr->gnum = gnum++;            /* Give this graph a logical number */
+    cptr = ReadGraph(cptr, dformat, gptr, finfo); /* Read graph */
+    if (prev != NULL)               /* Attach to list of graph  */
+      prev->next = gptr;
+    else
+      head = gptr;
+    prev = gptr;
+
+    numnodes += gptr->numnodes;
+    PrintProgress(gnum);  /* Print progress */
+    if (CheckErrors() == 0)
+      cptr = ReadDataHeader(cptr, dformat, &prime, finfo);
+  }
+  if (CheckErrors() == 0){
+    SetNodeDepth(head);   /* Ensure that depth value of nodes is initialized */
+    SaveDataCache(fname, head, finfo); /* Keep a compiled copy for later runs */
+  }
+  CloseFile(finfo);       /* Close data stream */
+
+  StopProgressMeter();    /* Stop the progress meter */
+  if (!CheckErrors())     /* If no errors...   */
+    fprintf(stderr, "%d nodes%*s\n", (int)numnodes, 48-(int)(log10(numnodes)), "[OK]");
+  else
+    fprintf(stderr, "%55s\n", "[FAILED]");
+
+  return head;
+}
+
+/******************************************************************************
+Description: 
+
+Return value: 
+******************************************************************************/
+void SaveData(FILE *ofile, struct Graph *gptr)
+{
+  UNSIGNED i, n;
+  UNSIGNED ldim, tdim, FanIn, FanOut;
+  UNSIGNED soff, coff, poff;
+  struct Node *node;
+
+  if (gptr == NULL)
+    return;
+
+  ldim = INT_MAX;  /* Initialize graph properties with illegal values to  */
+  tdim = INT_MAX;  /* enforce the writing of a data header for the first  */
+  FanIn = INT_MAX; /* graph. Any successife graph will have an own header */
+  FanOut = INT_MAX;/* if a property differs from an earlier graph.        */
   fprintf(ofile, "format=nodenumber,nodelabel,target,links,label\n");
   for(; gptr != NULL; gptr = gptr->next){
 
@@ -1419,7 +2494,8 @@ void SaveData(FILE *ofile, struct Graph *gptr)
     }
   }
 */
-  sync();  /* Ensure data is actually written to disk */
+  fflush(ofile);  /* Ensure data is actually written to disk */
+  fsync(fileno(ofile));
 }
 
 /******************************************************************************
@@ -1433,6 +2509,7 @@ int LoadMap(struct Parameters *params)
   char *cptr;  /* Pointer to text we read from the file */
   char *carg;  /* Pointer used to point at the argument of an parameter */
   UNSIGNED num;
+  int aligned = 0;             /* Set if codebooks form an aligned block */
   struct Map *map;
   struct FileInfo *finfo = NULL; /* File structure */
 
@@ -1464,6 +2541,10 @@ int LoadMap(struct Parameters *params)
     num += satou(GetFileOption(cptr, "byteorder"),&finfo->byteorder);
     num += GetNeighborhoodID(GetFileOption(cptr, "neighborhood"), &map->neighborhood);
     num += GetTopologyID(GetFileOption(cptr, "topology"), &map->topology);
+    if ((carg = GetFileOption(cptr, "layout")) != NULL){
+      aligned = !strncasecmp(carg, "aligned", 7);
+      num++;
+    }
     if (!strncasecmp(cptr, "Train", 5)){/* If info on train params available */
       cptr += 5;  /* Jump over key "Train" */
       num += satof(GetFileOption(cptr, "mu1"), &params->mu1);
@@ -1526,8 +2607,12 @@ int LoadMap(struct Parameters *params)
   if (cptr == NULL)            /* Obligatory keywork "map" not found   */
     AddError("This doesn't seem to be a codebook file.");
 
-  if (!CheckErrors())          /* If no errors...                */
-    ReadCodes(finfo, map);     /* then read the codebook entries */
+  if (!CheckErrors()){         /* If no errors...                */
+    if (aligned)               /* then read the codebook entries */
+      ReadAlignedCodes(finfo, map);
+    else
+      ReadCodes(finfo, map);
+  }
 
   CloseFile(finfo);            /* clean up */
 
@@ -1540,37 +2625,23 @@ int LoadMap(struct Parameters *params)
 }
 
 /******************************************************************************
-Description: Save the Self-Organizing Map data in a given file in a given
-             format. If format is 0, then write data in binary format,
-             otherwise save the map in AscII format.
+Description: Write the Self-Organizing Map data to the open file finfo in a
+             given format (see SaveMapInFormat()).
 
 Return value: 0 if no errors, or a value greater than zero if there were errors
 ******************************************************************************/
-int SaveMapInFormat(struct Parameters *params, char *fname, int format)
+int WriteMap(struct Parameters *params, struct FileInfo *finfo, int format)
 {
   UNSIGNED i;
   UNSIGNED clen;          /* Length of a label */
+  long pos;               /* Position in output file */
   char *label;            /* Pointer to label  */
   struct Map *map;
-  struct FileInfo *finfo = NULL; /* File structure    */
-
-  if (params == NULL)
-    return 0;
 
   map = &params->map;
-  fprintf(stderr, "Saving codebook entries....");/* Print what is being done */
-  if (fname == NULL)                     /* Ensure that there is a file name */
-    AddError("No file name given to save map.");
-  else if ((finfo = OpenFile(fname, "wb")) == NULL) /* open output stream    */
-    AddError("Unable to open file for writing.");
-
-  if (CheckErrors()){                            /* Any errors so far?       */
-    fprintf(stderr, "%47s\n", "[FAILED]");
-    return CheckErrors();
-  }
-
-  if (format == 0 && FindEndian() == UNKNOWN)/* If binary mode was requested */
-    format = 1;/* but Endian of this hardware is unknown switch to AscII mode*/
+  if (format != MAPFORMAT_ASCII && FindEndian() == UNKNOWN)/*If binary mode */
+    format = MAPFORMAT_ASCII;/*was requested but Endian of this hardware is
+				unknown then switch to AscII mode*/
 
   /* Write header */
 #ifdef PROG_VERSION
@@ -1581,8 +2652,10 @@ int SaveMapInFormat(struct Parameters *params, char *fname, int format)
   fprintf(finfo->fptr, "Dim=%u\n", map->dim);
   fprintf(finfo->fptr, "Xdim=%u\n", map->xdim);
   fprintf(finfo->fptr, "Ydim=%u\n", map->ydim);
-  if (format == 0)  /* Write byteorder in binary mode */
+  if (format != MAPFORMAT_ASCII)  /* Write byteorder in binary mode */
     fprintf(finfo->fptr, "Byteorder=%d\n", FindEndian());
+  if (format == MAPFORMAT_ALIGNED)
+    fprintf(finfo->fptr, "Layout=aligned\n");
   fprintf(finfo->fptr, "Neighborhood=%s\n", GetNeighborhoodName(map->neighborhood));
   fprintf(finfo->fptr, "Topology=%s\n", GetTopologyName(map->topology));
   if (params){
@@ -1618,13 +2691,21 @@ int SaveMapInFormat(struct Parameters *params, char *fname, int format)
     if (params->kernel != 0)
       fprintf(finfo->fptr, "TrainKernel=1\n");
   }
-  fprintf(finfo->fptr, "\nmap\n");
+  if (format == MAPFORMAT_ALIGNED){
+    /* Pad the "map" line so that the codebook block starts on a boundary */
+    pos = ftell(finfo->fptr) + 5;
+    fprintf(finfo->fptr, "\nmap%*s\n", (int)((MAP_ALIGNMENT - pos % MAP_ALIGNMENT) % MAP_ALIGNMENT), "");
+    for (i = 0; i < map->xdim * map->ydim && CheckErrors() == 0; i++)
+      WriteBinaryVector(map->codes[i].points, map->dim, finfo);
+  }
+  else
+    fprintf(finfo->fptr, "\nmap\n");
 
   /* Write the codebooks */
-  for (i = 0; i < map->xdim * map->ydim; i++){
-    if (format)
+  for (i = 0; i < map->xdim * map->ydim && CheckErrors() == 0; i++){
+    if (format == MAPFORMAT_ASCII)
       WriteAscIIVector(map->codes[i].points, map->dim, finfo);
-    else
+    else if (format == MAPFORMAT_BINARY)
       WriteBinaryVector(map->codes[i].points, map->dim, finfo);
 
     if (CheckErrors() != 0)
@@ -1633,7 +2714,7 @@ int SaveMapInFormat(struct Parameters *params, char *fname, int format)
     /* Write a codebook's label if available */
     if ((label = GetLabel(map->codes[i].label)) != NULL){
       clen = strlen(GetLabel(map->codes[i].label));
-      if (format == 0){  /* In binary mode */
+      if (format != MAPFORMAT_ASCII){  /* In binary mode */
 	if (fwrite(&clen, sizeof(unsigned), 1, finfo->fptr) != 1){
 	  AddError("Unable to write data. File system full?");
 	  break;
@@ -1651,7 +2732,7 @@ int SaveMapInFormat(struct Parameters *params, char *fname, int format)
       }
     }
     else{ /* No label available */
-      if (format == 0){  /* In binary mode */
+      if (format != MAPFORMAT_ASCII){  /* In binary mode */
 	clen = 0;
 	if (fwrite(&clen, sizeof(unsigned), 1, finfo->fptr) != 1){
 	  AddError("Unable to write data. File system full?");
@@ -1663,17 +2744,88 @@ int SaveMapInFormat(struct Parameters *params, char *fname, int format)
       }
     }
   }
-  CloseFile(finfo);            /* clean up and return */
+  if (fflush(finfo->fptr) != 0 || ferror(finfo->fptr))
+    AddError("Unable to write data. File system full?");
+
+  return CheckErrors();
+}
+
+/******************************************************************************
+Description: Save the Self-Organizing Map data in a given file in a given
+             format. If format is MAPFORMAT_BINARY, then write data in binary
+             format, if format is MAPFORMAT_ALIGNED, then write the codebooks
+             as a single page aligned block followed by a table of labels,
+             otherwise save the map in AscII format. The map is written to a
+             temporary file which is flushed to disk and then replaces fname,
+             so that processes which have fname mapped into memory are not
+             affected.
+
+Return value: 0 if no errors, or a value greater than zero if there were errors
+******************************************************************************/
+int SaveMapInFormat(struct Parameters *params, char *fname, int format)
+{
+  char *tname = NULL;     /* Name of temporary file */
+  struct FileInfo *finfo = NULL; /* File structure    */
+
+  if (params == NULL)
+    return 0;
+
+  fprintf(stderr, "Saving codebook entries....");/* Print what is being done */
+  if (fname == NULL)                     /* Ensure that there is a file name */
+    AddError("No file name given to save map.");
+  else{
+    tname = (char*)MyMalloc(strlen(fname) + 16);
+    sprintf(tname, "%s.tmp%d", fname, (int)getpid());
+    if ((finfo = OpenFile(tname, "wb")) == NULL) /* open output stream    */
+      AddError("Unable to open file for writing.");
+  }
+
+  if (CheckErrors()){                            /* Any errors so far?       */
+    fprintf(stderr, "%47s\n", "[FAILED]");
+    free(tname);
+    return CheckErrors();
+  }
+
+  WriteMap(params, finfo, format);
+  if (!CheckErrors() && fsync(fileno(finfo->fptr)) != 0)/* Only this file is */
+    AddError("Unable to write data. File system full?");/* flushed to disk   */
+  CloseFile(finfo);            /* clean up */
+
+  if (!CheckErrors() && rename(tname, fname) != 0)/* Replace file atomically */
+    AddError("Unable to rename temporary file.");
+  if (CheckErrors())
+    unlink(tname);             /* Remove incomplete file */
+  free(tname);
 
   if (!CheckErrors())          /* If no errors...                */
     fprintf(stderr, "%47s\n", "[OK]");
   else
     fprintf(stderr, "%47s\n", "[FAILED]");
 
-  sync();  /* Ensure data is actually written to disk */
   return CheckErrors();
 }
 
+/******************************************************************************
+Description: Convert the name of a map file format into its ID value.
+
+Return value: MAPFORMAT_BINARY, MAPFORMAT_ASCII, or MAPFORMAT_ALIGNED if name
+              is "binary", "ascii", or "aligned" respectively, or -1 if the
+              name is not recognized.
+******************************************************************************/
+int GetMapFormat(char *name)
+{
+  if (name == NULL)
+    return -1;
+  else if (!strncasecmp(name, "binary", 3))
+    return MAPFORMAT_BINARY;
+  else if (!strncasecmp(name, "ascii", 3))
+    return MAPFORMAT_ASCII;
+  else if (!strncasecmp(name, "aligned", 3))
+    return MAPFORMAT_ALIGNED;
+  else
+    return -1;
+}
+
 /******************************************************************************
 Description: Save the Self-Organizing Map data to a given file in AscII format.
 
@@ -1685,12 +2837,13 @@ int SaveMapAscII(struct Parameters *params)
     AddError("No file name given to save map.");
     return 1;
   }
-  return SaveMapInFormat(params, params->onetfile, 1);
+  return SaveMapInFormat(params, params->onetfile, MAPFORMAT_ASCII);
 }
 
 /******************************************************************************
 Description: Save the Self-Organizing Map data to a given file in the
-             default binary format.
+             format selected in params (the default binary format unless
+             another format was requested).
 
 Return value: 0 if no errors, or a value greater than zero if there were errors
 ******************************************************************************/
@@ -1700,23 +2853,796 @@ int SaveMap(struct Parameters *params)
     AddError("No file name given to save map.");
     return 1;
   }
-  return SaveMapInFormat(params, params->onetfile, 0);
+  return SaveMapInFormat(params, params->onetfile, params->mapformat);
+}
+
+/******************************************************************************
+Description: Write size bytes of data to the file fname. The data is written
+             to a temporary file which is flushed to disk, and which then
+             replaces fname.
+
+Return value: 0 on success, or nonzero on error.
+******************************************************************************/
+int WriteFileAtomically(char *fname, char *data, size_t size)
+{
+  char *tname;
+  ssize_t num;
+  size_t done;
+  int fd, fail = 0;
+
+  tname = (char*)MyMalloc(strlen(fname) + 16);
+  sprintf(tname, "%s.tmp%d", fname, (int)getpid());
+  if ((fd = open(tname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0){
+    free(tname);
+    return 1;
+  }
+  for (done = 0; done < size; done += num){
+    if ((num = write(fd, data + done, size - done)) <= 0){
+      fail = 1;
+      break;
+    }
+  }
+  fail |= fsync(fd) != 0;        /* Flush this file only to disk */
+  fail |= close(fd) != 0;
+  if (fail || rename(tname, fname) != 0){
+    unlink(tname);               /* Remove incomplete file */
+    fail = 1;
+  }
+  free(tname);
+  return fail;
 }
 
 /******************************************************************************
-Description: Save the snapshot of the Self-Organizing Map data to file in the
-             default binary format.
+Description: Execute the snapshot command of the writer sw in the background
+             unless the previous command is still running.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void StartSnapCommand(struct SnapWriter *sw, char *command)
+{
+  pid_t pid;
+
+  if (sw->child > 0 && waitpid(sw->child, NULL, WNOHANG) == 0){
+    fprintf(stderr, "\nWarning: Previous snapshot command still running. Skipping '%s'.\n", command);
+    return;
+  }
+  sw->child = 0;
+  if ((pid = fork()) == 0){
+    execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+    _exit(127);
+  }
+  else if (pid > 0)
+    sw->child = pid;
+  else
+    fprintf(stderr, "\nWarning: Unable to execute snapshot command '%s'.\n", command);
+}
+
+/******************************************************************************
+Description: Copy the codebooks of the map src into a new map dst which has
+             its own codebook entries and vectors, so that dst can be written
+             while the training continues to adapt src.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void CopySnapMap(struct Map *dst, struct Map *src)
+{
+  UNSIGNED i, noc;
+
+  noc = src->xdim * src->ydim;
+  memcpy(dst, src, sizeof(struct Map));
+  dst->codes = (struct Codebook*)memdup(src->codes, noc * sizeof(struct Codebook));
+  dst->block = (FLOAT*)MyMalloc(noc * src->dim * sizeof(FLOAT) + 1);
+  for (i = 0; i < noc; i++){
+    dst->codes[i].points = &dst->block[i * src->dim];
+    memcpy(dst->codes[i].points, src->codes[i].points, src->dim * sizeof(FLOAT));
+  }
+  dst->mapping = NULL;
+  dst->mapsize = 0;
+  dst->memo = NULL;
+}
+
+/******************************************************************************
+Description: Release the copy of the map held by the snapshot job.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void FreeSnapJob(struct SnapJob *job)
+{
+  free(job->params.map.codes);
+  free(job->params.map.block);
+  job->params.map.codes = NULL;
+  job->params.map.block = NULL;
+}
+
+/******************************************************************************
+Description: Format the map of the snapshot job into memory, in the format
+             selected in its parameters, and write it to the snapshot file.
+
+Return value: 0 on success, or nonzero on error.
+******************************************************************************/
+int WriteSnapJob(struct SnapJob *job)
+{
+  struct FileInfo finfo;
+  char *data = NULL;
+  size_t size = 0;
+  int fail;
+
+  memset(&finfo, 0, sizeof(struct FileInfo));
+  finfo.fname = job->fname;
+  if ((finfo.fptr = open_memstream(&data, &size)) == NULL)
+    return 1;
+  WriteMap(&job->params, &finfo, job->params.mapformat);
+  fail = fclose(finfo.fptr) != 0;
+  if (!fail)
+    fail = WriteFileAtomically(job->fname, data, size);
+  free(data);
+  return fail;
+}
+
+/******************************************************************************
+Description: The body of the thread which writes snapshots to disk. Each
+             snapshot is written as soon as it is handed over, and the
+             snapshot command (if any) is executed once the file is written.
+
+Return value: This function always returns NULL.
+******************************************************************************/
+void *SnapWriterThread(void *arg)
+{
+  struct SnapWriter *sw = (struct SnapWriter*)arg;
+  struct SnapJob job;
+
+  TraceThreadName("snapshot writer");
+  pthread_mutex_lock(&sw->lock);
+  for(;;){
+    while (!sw->haspending && !sw->stop)  /* Wait for the next snapshot */
+      pthread_cond_wait(&sw->cond, &sw->lock);
+    if (!sw->haspending)
+      break;
+    job = sw->pending;                    /* Take over the pending buffer */
+    sw->haspending = 0;
+    pthread_mutex_unlock(&sw->lock);
+
+    PROFILE_BEGIN(twrite);
+    TraceBegin("WriteSnapshot");
+    if (job.fname != NULL && WriteSnapJob(&job))
+      fprintf(stderr, "\nWarning: Unable to write snapshot '%s'.\n", job.fname);
+    else if (job.command != NULL)
+      StartSnapCommand(sw, job.command);
+    TraceEnd();
+    PROFILE_END(PHASE_SNAPSHOT, twrite);
+    FreeSnapJob(&job);
+
+    pthread_mutex_lock(&sw->lock);
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+/******************************************************************************
+Description: Take a snapshot of the Self-Organizing Map. The codebooks are
+             copied, and a background thread formats the copy in the format
+             selected in params and writes it to the snapshot file, so that
+             training is held up by neither formatting nor disk access. If a
+             snapshot is still waiting to be written when the next one is
+             taken, then the older one is dropped. The snapshot command is
+             executed in the background after the snapshot was written.
 
 Return value: 0 if no errors, or a value greater than zero if there were errors
 ******************************************************************************/
 int SaveSnapShot(struct Parameters *params)
 {
-  if (params->snap.file == NULL){    /* Ensure that there is a file name */
-    AddError("No file name given to save snapshot.");
+  struct SnapWriter *sw;
+  struct SnapJob job;
+
+  if (params->snap.file == NULL && params->snap.command == NULL)
+    return 0;
+
+  if ((sw = SnapWriter) == NULL){  /* Start writer on first snapshot */
+    sw = SnapWriter = (struct SnapWriter*)MyCalloc(1, sizeof(struct SnapWriter));
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->cond, NULL);
+    pthread_create(&sw->thread, NULL, SnapWriterThread, sw);
+  }
+
+  memset(&job, 0, sizeof(struct SnapJob));
+  job.fname = params->snap.file;
+  job.command = params->snap.command;
+  memcpy(&job.params, params, sizeof(struct Parameters));
+  if (job.fname != NULL)           /* Copy the codebooks to be written */
+    CopySnapMap(&job.params.map, &params->map);
+  else
+    memset(&job.params.map, 0, sizeof(struct Map));
+
+  pthread_mutex_lock(&sw->lock);
+  if (sw->haspending)              /* Drop a snapshot not yet written */
+    FreeSnapJob(&sw->pending);
+  sw->pending = job;
+  sw->haspending = 1;
+  pthread_cond_broadcast(&sw->cond);
+  pthread_mutex_unlock(&sw->lock);
+
+  return 0;
+}
+
+/******************************************************************************
+Description: Wait until all snapshots are written and the last snapshot
+             command completed, then stop the snapshot writer thread.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void FinishSnapShots()
+{
+  struct SnapWriter *sw = SnapWriter;
+
+  if (sw == NULL)
+    return;
+
+  pthread_mutex_lock(&sw->lock);
+  sw->stop = 1;
+  pthread_cond_broadcast(&sw->cond);
+  pthread_mutex_unlock(&sw->lock);
+  pthread_join(sw->thread, NULL);      /* Pending snapshot is written first */
+  if (sw->child > 0)
+    waitpid(sw->child, NULL, 0);
+  pthread_mutex_destroy(&sw->lock);
+  pthread_cond_destroy(&sw->cond);
+  free(sw);
+  SnapWriter = NULL;
+}
+
+/******************************************************************************
+Description: Save a checkpoint of the training run described by params to
+             the file params->checkpoint.file. Besides the codebooks, the
+             checkpoint holds the state of the random number generator, the
+             position t within the schedule of tlen update steps, and the
+             order and state of the nodes of the training data, so that a run
+             resumed from the checkpoint continues exactly as the original
+             run would have. In streaming mode the order of the data is not
+             kept in memory and is not saved.
+
+Return value: 0 if no errors, or nonzero if the checkpoint could not be saved
+              (a warning is printed).
+******************************************************************************/
+int SaveCheckpoint(struct Parameters *params, UNSIGNED t, UNSIGNED tlen)
+{
+  struct CheckpointHeader header;
+  struct Map *map = &params->map;
+  struct Graph *gptr;
+  struct Node *node;
+  unsigned short seed[3] = {0, 0, 0}, *state;
+  UNSIGNED i, n, noc, cdim, gvals[3];
+  unsigned ulen;
+  char *data = NULL, *label;
+  size_t size = 0;
+  int fail = 0;
+  FILE *ofile;
+
+  if (params->checkpoint.file == NULL)
+    return 0;
+
+  memset(&header, 0, sizeof(struct CheckpointHeader));
+  memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+  header.version = CHECKPOINT_VERSION;
+  header.sizes = sizeof(FLOAT) | (sizeof(UNSIGNED) << 8);
+  header.endian = FindEndian();
+  header.xdim = map->xdim;
+  header.ydim = map->ydim;
+  header.dim = map->dim;
+  header.iter = map->iter;
+  header.topology = map->topology;
+  header.neighborhood = map->neighborhood;
+  header.rlen = params->rlen;
+  header.radius = params->radius;
+  header.alphatype = params->alphatype;
+  header.flags = (params->nodeorder ? CHECKPOINT_NODEORDER : 0) | (params->graphorder ? CHECKPOINT_GRAPHORDER : 0);
+  header.alpha = params->alpha;
+  header.beta = params->beta;
+  header.mu1 = params->mu1;
+  header.mu2 = params->mu2;
+  header.mu3 = params->mu3;
+  header.mu4 = params->mu4;
+  header.t = t;
+  header.tlen = tlen;
+  state = seed48(seed);         /* Obtain the state of drand48() and */
+  memcpy(header.rng, state, sizeof(header.rng));
+  seed48(header.rng);           /* put it back in place              */
+  header.numlabels = GetNumLabels();
+  if (!params->streaming)
+    for (gptr = params->train; gptr != NULL; gptr = gptr->next)
+      header.numgraphs++;
+
+  if ((ofile = open_memstream(&data, &size)) == NULL){
+    fprintf(stderr, "\nWarning: Unable to allocate memory for checkpoint.\n");
     return 1;
   }
-  fputc('\r', stderr);
-  return SaveMapInFormat(params, params->snap.file, 0);
+  fail |= fwrite(&header, sizeof(struct CheckpointHeader), 1, ofile) != 1;
+  ulen = (params->datafile != NULL) ? strlen(params->datafile) : 0;
+  fail |= fwrite(&ulen, sizeof(unsigned), 1, ofile) != 1;
+  fail |= fwrite(params->datafile, 1, ulen, ofile) != ulen;
+  for (i = 1; i <= header.numlabels; i++){ /* Label table in index order */
+    label = GetLabel(i);
+    ulen = strlen(label);
+    fail |= fwrite(&ulen, sizeof(unsigned), 1, ofile) != 1;
+    fail |= fwrite(label, 1, ulen, ofile) != ulen;
+  }
+
+  noc = map->xdim * map->ydim;
+  for (i = 0; i < noc; i++){
+    fail |= fwrite(&map->codes[i].x, sizeof(int), 2, ofile) != 2;
+    fail |= fwrite(&map->codes[i].label, sizeof(UNSIGNED), 1, ofile) != 1;
+  }
+  for (i = 0; i < noc; i++)
+    fail |= fwrite(map->codes[i].points, sizeof(FLOAT), map->dim, ofile) != map->dim;
+
+  /* Save the order of graphs and nodes, and the state of each node */
+  for (gptr = params->train; gptr != NULL && header.numgraphs > 0; gptr = gptr->next){
+    cdim = 2 * (gptr->FanOut + gptr->FanIn);
+    gvals[0] = gptr->gnum;
+    gvals[1] = gptr->numnodes;
+    gvals[2] = cdim;
+    fail |= fwrite(gvals, sizeof(UNSIGNED), 3, ofile) != 3;
+    for (n = 0; n < gptr->numnodes; n++){
+      node = gptr->nodes[n];
+      fail |= fwrite(&node->nnum, sizeof(UNSIGNED), 1, ofile) != 1;
+      fail |= fwrite(&node->x, sizeof(int), 2, ofile) != 2;
+      fail |= fwrite(&node->points[gptr->ldim], sizeof(FLOAT), cdim, ofile) != cdim;
+    }
+  }
+  fail |= fclose(ofile) != 0;
+
+  if (fail || WriteFileAtomically(params->checkpoint.file, data, size)){
+    fprintf(stderr, "\nWarning: Unable to write checkpoint '%s'.\n", params->checkpoint.file);
+    fail = 1;
+  }
+  free(data);
+  return fail;
+}
+
+/******************************************************************************
+Description: Open the checkpoint file fname and read its header.
+
+Return value: The open file positioned after the header, or NULL on error (an
+              error is set).
+******************************************************************************/
+FILE *OpenCheckpoint(char *fname, struct CheckpointHeader *header)
+{
+  FILE *ifile;
+
+  if (fname == NULL || (ifile = fopen(fname, "rb")) == NULL){
+    AddError("Unable to open checkpoint file for reading.");
+    return NULL;
+  }
+  if (fread(header, sizeof(struct CheckpointHeader), 1, ifile) != 1 ||
+      memcmp(header->magic, CHECKPOINT_MAGIC, 8) ||
+      header->version != CHECKPOINT_VERSION){
+    AddError("This doesn't seem to be a checkpoint file.");
+    fclose(ifile);
+    return NULL;
+  }
+  if (header->sizes != (sizeof(FLOAT) | (sizeof(UNSIGNED) << 8)) ||
+      header->endian != FindEndian()){
+    AddError("Checkpoint was written on an incompatible machine.");
+    fclose(ifile);
+    return NULL;
+  }
+  return ifile;
+}
+
+/******************************************************************************
+Description: Load the map and the training parameters from the checkpoint
+             file params->checkpoint.resume. This replaces LoadMap() when a
+             training run is resumed. The remaining state is restored by
+             RestoreCheckpoint() once the training data is loaded.
+
+Return value: 0 if no errors, or a value greater than zero if there were errors
+******************************************************************************/
+int LoadCheckpoint(struct Parameters *params)
+{
+  struct CheckpointHeader header;
+  struct Map *map = &params->map;
+  UNSIGNED i, noc;
+  unsigned ulen;
+  char *label;
+  int fail = 0;
+  FILE *ifile;
+
+  fprintf(stderr, "Reading checkpoint..........");/* Print What is being done*/
+  memset(map, 0, sizeof(struct Map));    /* Initialize Map structure         */
+  if ((ifile = OpenCheckpoint(params->checkpoint.resume, &header)) == NULL){
+    fprintf(stderr, "%46s\n", "[FAILED]");
+    return CheckErrors();
+  }
+
+  map->xdim = header.xdim;
+  map->ydim = header.ydim;
+  map->dim = header.dim;
+  map->iter = header.iter;
+  map->topology = header.topology;
+  map->neighborhood = header.neighborhood;
+  params->rlen = header.rlen;
+  params->radius = header.radius;
+  params->alphatype = header.alphatype;
+  params->nodeorder = (header.flags & CHECKPOINT_NODEORDER) != 0;
+  params->graphorder = (header.flags & CHECKPOINT_GRAPHORDER) != 0;
+  params->alpha = header.alpha;
+  params->beta = header.beta;
+  params->mu1 = header.mu1;
+  params->mu2 = header.mu2;
+  params->mu3 = header.mu3;
+  params->mu4 = header.mu4;
+
+  fail |= fread(&ulen, sizeof(unsigned), 1, ifile) != 1 || ulen > PATH_MAX;
+  if (!fail && ulen > 0){           /* Name of the training data */
+    free(params->datafile);
+    params->datafile = (char*)MyCalloc(ulen+1, sizeof(char));
+    fail |= fread(params->datafile, 1, ulen, ifile) != ulen;
+  }
+  for (i = 0; i < header.numlabels && !fail; i++){ /* Restore label indices */
+    if (fread(&ulen, sizeof(unsigned), 1, ifile) != 1 || ulen > 65536){
+      fail = 1;
+      break;
+    }
+    label = (char*)MyCalloc(ulen+1, sizeof(char));
+    if (fread(label, 1, ulen, ifile) != ulen)
+      fail = 1;
+    else
+      AddLabel(label);
+    free(label);
+  }
+
+  noc = map->xdim * map->ydim;
+  if (!fail && noc > 0 && map->dim > 0){
+    map->codes = (struct Codebook*)MyCalloc(noc, sizeof(struct Codebook));
+    map->block = (FLOAT*)MyMalloc(noc * map->dim * sizeof(FLOAT));
+    for (i = 0; i < noc && !fail; i++){
+      map->codes[i].points = &map->block[i * map->dim];
+      fail |= fread(&map->codes[i].x, sizeof(int), 2, ifile) != 2;
+      fail |= fread(&map->codes[i].label, sizeof(UNSIGNED), 1, ifile) != 1;
+    }
+    fail |= fread(map->block, sizeof(FLOAT), noc * map->dim, ifile) != noc * map->dim;
+  }
+  else
+    fail = 1;
+  fclose(ifile);
+
+  if (fail)
+    AddError("Checkpoint file is truncated or corrupted.");
+  if (!CheckErrors())          /* If no errors...                */
+    fprintf(stderr, "%d codes%*s\n", noc, 39-(int)(log10(noc)), "[OK]");
+  else
+    fprintf(stderr, "%46s\n", "[FAILED]");
+
+  return CheckErrors();
+}
+
+/******************************************************************************
+Description: Restore the state of the random number generator, the order of
+             graphs and nodes, and the state of each node from the checkpoint
+             file params->checkpoint.resume. The position in the learning rate
+             schedule is stored in t and tlen unless the number of training
+             iterations was changed.
+
+Return value: 0 if no errors, or a value greater than zero if there were errors
+******************************************************************************/
+int RestoreCheckpoint(struct Parameters *params, UNSIGNED *t, UNSIGNED *tlen)
+{
+  struct CheckpointHeader header;
+  struct Graph **graphs, *gptr, *prev;
+  struct Node **nodes, *node;
+  UNSIGNED i, g, n, numgraphs, gvals[3], nnum;
+  unsigned ulen;
+  int fail = 0;
+  FILE *ifile;
+
+  if ((ifile = OpenCheckpoint(params->checkpoint.resume, &header)) == NULL)
+    return CheckErrors();
+
+  seed48(header.rng);             /* Continue the same random sequence */
+  if (header.rlen == params->rlen){
+    *t = header.t;
+    *tlen = header.tlen;
+  }
+  else
+    fprintf(stderr, "\nWarning: Number of iterations differs from checkpoint. Learning rate schedule restarts.\n");
+
+  /* Skip over data file name, label table, and codebooks */
+  fail |= fread(&ulen, sizeof(unsigned), 1, ifile) != 1;
+  fail |= fseek(ifile, ulen, SEEK_CUR) != 0;
+  for (i = 0; i < header.numlabels && !fail; i++){
+    fail |= fread(&ulen, sizeof(unsigned), 1, ifile) != 1;
+    fail |= fseek(ifile, ulen, SEEK_CUR) != 0;
+  }
+  fail |= fseek(ifile, (long)header.xdim * header.ydim * (2*sizeof(int) + sizeof(UNSIGNED) + header.dim * sizeof(FLOAT)), SEEK_CUR) != 0;
+
+  numgraphs = 0;
+  for (gptr = params->train; gptr != NULL; gptr = gptr->next)
+    numgraphs++;
+  if (header.numgraphs == 0 || params->streaming){
+    fclose(ifile);
+    if (fail)
+      AddError("Checkpoint file is truncated or corrupted.");
+    return CheckErrors();
+  }
+  if (header.numgraphs != numgraphs){
+    fclose(ifile);
+    AddError("Checkpoint does not match the training data.");
+    return CheckErrors();
+  }
+
+  /* Index graphs by their logical number */
+  graphs = (struct Graph**)MyCalloc(numgraphs, sizeof(struct Graph*));
+  for (gptr = params->train; gptr != NULL; gptr = gptr->next)
+    if (gptr->gnum < numgraphs)
+      graphs[gptr->gnum] = gptr;
+
+  prev = NULL;
+  for (g = 0; g < numgraphs && !fail; g++){
+    if (fread(gvals, sizeof(UNSIGNED), 3, ifile) != 3 || gvals[0] >= numgraphs ||
+	(gptr = graphs[gvals[0]]) == NULL || gptr->numnodes != gvals[1] ||
+	2 * (gptr->FanOut + gptr->FanIn) != gvals[2]){
+      fail = 1;
+      break;
+    }
+    graphs[gvals[0]] = NULL;      /* Each graph occurs once */
+    if (prev != NULL)             /* Restore order of graphs */
+      prev->next = gptr;
+    else
+      params->train = gptr;
+    prev = gptr;
+
+    /* Index nodes by their logical number, then restore their order */
+    nodes = (struct Node**)MyCalloc(gptr->numnodes, sizeof(struct Node*));
+    for (n = 0; n < gptr->numnodes; n++)
+      if (gptr->nodes[n]->nnum < gptr->numnodes)
+	nodes[gptr->nodes[n]->nnum] = gptr->nodes[n];
+    for (n = 0; n < gptr->numnodes && !fail; n++){
+      if (fread(&nnum, sizeof(UNSIGNED), 1, ifile) != 1 ||
+	  nnum >= gptr->numnodes || (node = nodes[nnum]) == NULL){
+	fail = 1;
+	break;
+      }
+      nodes[nnum] = NULL;
+      gptr->nodes[n] = node;
+      fail |= fread(&node->x, sizeof(int), 2, ifile) != 2;
+      fail |= fread(&node->points[gptr->ldim], sizeof(FLOAT), gvals[2], ifile) != gvals[2];
+    }
+    free(nodes);
+  }
+  if (prev != NULL)
+    prev->next = NULL;
+  free(graphs);
+  fclose(ifile);
+
+  if (fail)
+    AddError("Checkpoint does not match the training data.");
+  return CheckErrors();
+}
+
+/******************************************************************************
+Description: Compute a hash value over the codebooks and the geometry of the
+             map.
+
+Return value: The hash value.
+******************************************************************************/
+static unsigned long long HashMap(struct Map *map)
+{
+  unsigned long long hash;
+  UNSIGNED n, vals[4];
+
+  vals[0] = map->xdim;
+  vals[1] = map->ydim;
+  vals[2] = map->dim;
+  vals[3] = map->topology;
+  hash = HashBytes(vals, sizeof(vals), 0);
+  for (n = 0; n < map->xdim * map->ydim; n++)
+    hash = HashBytes(map->codes[n].points, map->dim * sizeof(FLOAT), hash);
+  return hash;
+}
+
+/******************************************************************************
+Description: Compute a hash value over everything in the dataset which
+             decides the winners of its nodes: the labels, targets, and
+             weights of the nodes, and the links between them. The states of
+             the offsprings are not included since they are the result of
+             mapping the dataset, except where an offspring is missing. The
+             hash does thus not change when the dataset is mapped.
+
+Return value: The hash value.
+******************************************************************************/
+static unsigned long long HashDataset(struct Graph *graph)
+{
+  unsigned long long hash = 0;
+  struct Graph *gptr;
+  struct Node *node;
+  UNSIGNED n, i, off, vals[6];
+  int link;
+
+  for (gptr = graph; gptr != NULL; gptr = gptr->next){
+    vals[0] = gptr->numnodes;
+    vals[1] = gptr->ldim;
+    vals[2] = gptr->dimension;
+    vals[3] = gptr->FanOut;
+    vals[4] = gptr->FanIn;
+    vals[5] = gptr->tdim;
+    hash = HashBytes(vals, sizeof(vals), hash);
+    off = gptr->ldim + 2 * (gptr->FanOut + gptr->FanIn);
+    for (n = 0; n < gptr->numnodes; n++){
+      node = gptr->nodes[n];
+      hash = HashBytes(&node->nnum, sizeof(UNSIGNED), hash);
+      hash = HashBytes(node->points, gptr->ldim * sizeof(FLOAT), hash);
+      hash = HashBytes(&node->points[off], gptr->tdim * sizeof(FLOAT), hash);
+      if (node->mu != NULL)
+	hash = HashBytes(node->mu, gptr->dimension * sizeof(FLOAT), hash);
+      for (i = 0; i < gptr->FanOut && node->children != NULL; i++){
+	if (node->children[i] != NULL){
+	  link = (int)node->children[i]->nnum;
+	  hash = HashBytes(&link, sizeof(int), hash);
+	}
+	else
+	  hash = HashBytes(&node->points[gptr->ldim + 2*i], 2 * sizeof(FLOAT), hash);
+      }
+      for (i = 0; i < node->numparents && gptr->FanIn > 0; i++){
+	link = (int)node->parents[i]->nnum;
+	hash = HashBytes(&link, sizeof(int), hash);
+      }
+    }
+  }
+  return hash;
+}
+
+/******************************************************************************
+Description: Compose the name of the file which holds the winners of the
+             nodes of graph on the map which was read from the file mapfile.
+             There is one such file in the cache directory for each map and
+             dataset.
+
+Return value: Pointer to a dynamically allocated file name, or NULL if no
+              cache directory is configured.
+******************************************************************************/
+static char *GetMappingFileName(char *mapfile, unsigned long long datahash)
+{
+  char suffix[32];
+
+  sprintf(suffix, "%016llx.winners", datahash);
+  return GetCacheFileName(mapfile, suffix);
+}
+
+/******************************************************************************
+Description: Write the winner and the distance to the winner of every node of
+             graph on the map which was read from the file mapfile, so that
+             LoadMapping() can restore them without searching the map. The
+             winners are taken from the coordinates (or winner ID in VQ mode)
+             of the nodes. diffs holds the distances in order of graphs and
+             nodes, method identifies how the winners were computed, and
+             qerror is the quantization error which was obtained. The file is
+             written under a temporary name and is renamed once complete.
+             Failures are silently ignored since the file is only an
+             optimization.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void SaveMapping(char *mapfile, struct Map *map, struct Graph *graph, unsigned method, FLOAT qerror, FLOAT *diffs)
+{
+  struct MappingHeader header;
+  struct MappedNode rec;
+  struct Graph *gptr;
+  struct Node *node;
+  char *cname, *tname;
+  UNSIGNED n, num;
+  int fail = 0;
+  FILE *ofile;
+
+  memset(&header, 0, sizeof(struct MappingHeader));
+  header.datahash = HashDataset(graph);
+  if ((cname = GetMappingFileName(mapfile, header.datahash)) == NULL)
+    return;
+  memcpy(header.magic, MAPPING_MAGIC, 8);
+  header.version = MAPPING_VERSION;
+  header.sizes = sizeof(FLOAT) | (sizeof(UNSIGNED) << 8);
+  header.endian = FindEndian();
+  header.method = method;
+  header.maphash = HashMap(map);
+  header.qerror = qerror;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    header.numnodes += gptr->numnodes;
+
+  tname = (char*)MyMalloc(strlen(cname) + 16);
+  sprintf(tname, "%s.tmp%d", cname, (int)getpid());
+  if ((ofile = fopen(tname, "wb")) == NULL){
+    free(tname);
+    free(cname);
+    return;
+  }
+
+  fail |= fwrite(&header, sizeof(struct MappingHeader), 1, ofile) != 1;
+  num = 0;
+  for (gptr = graph; gptr != NULL && !fail; gptr = gptr->next){
+    for (n = 0; n < gptr->numnodes && !fail; n++, num++){
+      node = gptr->nodes[n];
+      memset(&rec, 0, sizeof(struct MappedNode));
+      if (map->topology == TOPOL_VQ)
+	rec.codeno = (node->winner >= 0 && node->winner < map->xdim * map->ydim) ? node->winner : -1;
+      else if (node->x >= 0 && node->x < map->xdim && node->y >= 0 && node->y < map->ydim)
+	rec.codeno = node->y * map->xdim + node->x;
+      else
+	rec.codeno = -1;
+      rec.diff = diffs[num];
+      fail |= fwrite(&rec, sizeof(struct MappedNode), 1, ofile) != 1;
+    }
+  }
+
+  if (fclose(ofile) != 0 || fail || rename(tname, cname) != 0)
+    unlink(tname);  /* Do not leave incomplete files behind */
+
+  free(tname);
+  free(cname);
+}
+
+/******************************************************************************
+Description: Read the winners of all nodes of graph on the map which was
+             read from the file mapfile from a file written by SaveMapping().
+             The file is mapped into memory, and is used only if it was
+             written on this kind of machine for the same map, the same
+             dataset, and the same method. The ID of the winning codebook of
+             every node is stored in codeno, and if diffs is not NULL, then
+             the distance of every node to its winner is stored in diffs,
+             both in order of graphs and nodes. The nodes are not changed;
+             the caller decides in which order states are updated.
+
+Return value: 1 if the winners were read, and the quantization error is
+              returned in qerror. 0 if there is no valid mapping file.
+******************************************************************************/
+int LoadMapping(char *mapfile, struct Map *map, struct Graph *graph, unsigned method, FLOAT *qerror, int *codeno, FLOAT *diffs)
+{
+  struct MappingHeader *header;
+  struct MappedNode *rec;
+  struct Graph *gptr;
+  struct stat st;
+  unsigned long long datahash, num, n;
+  char *cname;
+  void *base;
+  int fd, valid;
+
+  datahash = HashDataset(graph);
+  if ((cname = GetMappingFileName(mapfile, datahash)) == NULL)
+    return 0;
+  fd = open(cname, O_RDONLY);
+  free(cname);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct MappingHeader) ||
+      (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+    close(fd);
+    return 0;
+  }
+  close(fd);
+
+  num = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    num += gptr->numnodes;
+  header = (struct MappingHeader*)base;
+  valid = !memcmp(header->magic, MAPPING_MAGIC, 8) &&
+    header->version == MAPPING_VERSION &&
+    header->sizes == (sizeof(FLOAT) | (sizeof(UNSIGNED) << 8)) &&
+    header->endian == FindEndian() &&
+    header->method == method &&
+    header->numnodes == num &&
+    (unsigned long long)st.st_size == sizeof(struct MappingHeader) + num * sizeof(struct MappedNode) &&
+    header->datahash == datahash &&
+    header->maphash == HashMap(map);
+
+  if (valid){
+    rec = (struct MappedNode*)((char*)base + sizeof(struct MappingHeader));
+    for (n = 0; n < num; n++){
+      codeno[n] = (rec[n].codeno < map->xdim * map->ydim) ? rec[n].codeno : -1;
+      if (diffs != NULL)
+	diffs[n] = rec[n].diff;
+    }
+    *qerror = header->qerror;
+  }
+  munmap(base, st.st_size);
+
+  return valid;
 }
 
 /* End of file */
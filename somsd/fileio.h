@@ -1,19 +1,46 @@
 #ifndef FILEIO_H_DEFINED
 #define FILEIO_H_DEFINED
 
+/* Formats in which a map can be saved */
+#define MAPFORMAT_BINARY  0  /* Binary codebooks with interleaved labels  */
+#define MAPFORMAT_ASCII   1  /* AscII codebooks with interleaved labels   */
+#define MAPFORMAT_ALIGNED 2  /* Page aligned codebook block, label table  */
+
 struct FileInfo{
   char *fname;        /* Name of the file      */
   UNSIGNED lineno;    /* Line number we are on */
   unsigned byteorder; /* Byte order (nonzero value indicates a binary file) */
   int   ctype;        /* Type of compression (if file is compressed)        */
-  FILE *fptr;         /* File pointer          */
+  FILE *fptr;         /* File pointer (uncompressed files only)             */
+  char *buf;          /* Block of (decompressed) data being read            */
+  size_t pos, len;    /* Read position in, and amount of data in buf        */
+  long offset;        /* Position of the start of buf within the stream     */
+  struct Decompressor *dec; /* Decompression thread (compressed files only) */
+  UNSIGNED *labels;   /* Labels in the order in which they were first read  */
+  UNSIGNED numlabels; /* Number of entries in labels                        */
 };
 
+struct GraphStream;     /* A dataset which is read one graph at a time */
+
 struct Graph* LoadData(char *fname);
+struct Graph *LoadDataSample(char *fname, UNSIGNED maxgraphs, UNSIGNED *numnodes);
+struct GraphStream *OpenGraphStream(char *fname);
+struct Graph *ReadNextGraph(struct GraphStream *stream);
+void CloseGraphStream(struct GraphStream *stream);
+void SetCacheDir(char *dir);
+char *GetCacheFileName(char *fname, char *suffix);
 void SaveData(FILE *ofile, struct Graph *graph);
 int LoadMap(struct Parameters *params);
 int SaveMap(struct Parameters *);
 int SaveMapAscII(struct Parameters *);
+int SaveMapInFormat(struct Parameters *params, char *fname, int format);
+int GetMapFormat(char *name);
 int SaveSnapShot(struct Parameters *);
+void FinishSnapShots();
+int SaveCheckpoint(struct Parameters *params, UNSIGNED t, UNSIGNED tlen);
+int LoadCheckpoint(struct Parameters *params);
+int RestoreCheckpoint(struct Parameters *params, UNSIGNED *t, UNSIGNED *tlen);
+void SaveMapping(char *mapfile, struct Map *map, struct Graph *graph, unsigned method, FLOAT qerror, FLOAT *diffs);
+int LoadMapping(char *mapfile, struct Map *map, struct Graph *graph, unsigned method, FLOAT *qerror, int *codeno, FLOAT *diffs);
 
 #endif
@@ -0,0 +1,472 @@
+/*
+  Contents: Generator of synthetic datasets in the file format of the somsd
+            package, built by 'make gendata'. It writes trees, sequences
+            or DAGs of a given size, depth and outdegree, so that the
+            package can be studied on datasets of any size. Node labels are
+            drawn uniformly or from Gaussian clusters. With -classes, every
+            graph is given a class whose symbolic label is carried by the
+            root node. With clusters, the share -purity of the node labels
+            of a graph is drawn from the cluster of its class, so that the
+            classification and retrieval modes of testsom have something
+            to find. All output is reproducible from -seed.
+
+  Author: Markus Hagenbuchner
+
+  Comments and questions concerning this program package may be sent
+  to 'markus@artificial-neural.net'
+ */
+
+
+/************/
+/* Includes */
+/************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "system.h"
+#include "utils.h"
+
+/* Shapes of the generated graphs */
+#define SHAPE_TREE     1  /* Trees                                       */
+#define SHAPE_SEQUENCE 2  /* Sequences (every node has at most one child) */
+#define SHAPE_DAG      3  /* Directed acyclic graphs                     */
+
+struct GenOptions{
+  UNSIGNED numgraphs;          /* Number of graphs                          */
+  UNSIGNED minnodes, maxnodes; /* Range of the number of nodes of a graph   */
+  UNSIGNED mindepth, maxdepth; /* Range of the depth of a graph             */
+  UNSIGNED fanout;             /* Maximum outdegree                         */
+  UNSIGNED fanin;              /* Maximum indegree (DAGs only)              */
+  UNSIGNED ldim;               /* Dimension of the node labels              */
+  UNSIGNED clusters;           /* Number of clusters of node labels (0: none)*/
+  FLOAT spread;                /* Standard deviation of a cluster           */
+  UNSIGNED classes;            /* Number of symbolic classes (0: unlabelled)*/
+  FLOAT purity;                /* Share of labels from the class's cluster  */
+  FLOAT share;                 /* Probability of a node having extra parents*/
+  int shape;                   /* SHAPE_TREE, SHAPE_SEQUENCE, or SHAPE_DAG  */
+  int binary;                  /* Write in binary format                    */
+  UNSIGNED seed;               /* Seed for the random number generator      */
+};
+
+struct GenGraph{  /* Structure of the graph being generated */
+  UNSIGNED *depth;       /* Distance of each node from the root           */
+  UNSIGNED *numchildren; /* Number of children of each node               */
+  UNSIGNED *children;    /* fanout IDs of the children of each node       */
+  UNSIGNED *numparents;  /* Number of parents of each node                */
+  UNSIGNED *open;        /* Nodes which can take another child            */
+  UNSIGNED numopen;      /* Number of entries in open                     */
+};
+
+
+/* Begin functions... */
+
+/******************************************************************************
+Description: Print usage information to the screen
+
+Return value: The function does not return.
+******************************************************************************/
+void Usage()
+{
+  fprintf(stderr, "\n\
+Usage: gendata [options]\n\n\
+Writes a synthetic dataset in somsd format to stdout or to a file.\n\n\
+Options are:\n\
+    -graphs <num>      Number of graphs. (default 100)\n\
+    -nodes <min>[:max] Number of nodes of each graph, drawn uniformly from\n\
+                       the range. (default 10:30)\n\
+    -depth <min>[:max] Depth of each graph, drawn uniformly from the range.\n\
+                       The depth is limited by the number of nodes. By\n\
+                       default, nodes are attached at random positions.\n\
+    -shape <shape>     Shape of the graphs, which can be\n\
+                       tree         Trees. (the default)\n\
+                       sequence     Sequences (outdegree is 1).\n\
+                       dag          Directed acyclic graphs.\n\
+    -outdegree <num>   Maximum number of children of a node. (default 2)\n\
+    -indegree <num>    Maximum number of parents of a node in a DAG, and the\n\
+                       indegree written to the file. (default 0, or 2 for dag)\n\
+    -share <float>     Probability of a node in a DAG to be given an\n\
+                       additional parent. (default 0.2)\n\
+    -ldim <num>        Dimension of the node labels. (default 2)\n\
+    -clusters <num>    Draw node labels from <num> Gaussian clusters with\n\
+                       centers in the unit cube. (default 0: uniformly)\n\
+    -spread <float>    Standard deviation of a cluster. (default 0.05)\n\
+    -classes <num>     Give root nodes one of <num> symbolic class labels.\n\
+                       (default 0: no labels)\n\
+    -purity <float>    Share of the node labels of a graph which are drawn\n\
+                       from the cluster of the graph's class. (default 0.8)\n\
+    -binary            Write the nodes in binary format.\n\
+    -o <fname>         Write the dataset to <fname>. (default: stdout)\n\
+    -seed <int>        Seed for the random number generator. (default 1)\n\
+    -help              Print this help.\n\
+ \n");
+  exit(0);
+}
+
+/******************************************************************************
+Description: Parse a range of the form min[:max].
+
+Return value: 1 on success, 0 on error.
+******************************************************************************/
+int GetRange(char *str, UNSIGNED *min, UNSIGNED *max)
+{
+  char *end;
+
+  if (str == NULL)
+    return 0;
+  *min = (UNSIGNED)strtoul(str, &end, 10);
+  if (end == str)
+    return 0;
+  if (*end == ':'){
+    str = end + 1;
+    *max = (UNSIGNED)strtoul(str, &end, 10);
+    if (end == str)
+      return 0;
+  }
+  else
+    *max = *min;
+  return (*end == '\0' && *min <= *max);
+}
+
+/******************************************************************************
+Description: Draw an integer uniformly from the range [min,max].
+
+Return value: The random integer.
+******************************************************************************/
+UNSIGNED RandRange(UNSIGNED min, UNSIGNED max)
+{
+  return min + (UNSIGNED)(drand48() * (max - min + 1));
+}
+
+/******************************************************************************
+Description: Draw a value from a normal distribution (Box-Muller transform).
+
+Return value: The random value.
+******************************************************************************/
+double RandNormal(double mean, double sigma)
+{
+  double u;
+
+  do{
+    u = drand48();
+  }while(u <= 0.0);
+  return mean + sigma * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * drand48());
+}
+
+/******************************************************************************
+Description: Add node n as a child of node p.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void AddChild(struct GenGraph *g, struct GenOptions *opts, UNSIGNED p, UNSIGNED n)
+{
+  g->children[p * opts->fanout + g->numchildren[p]++] = n;
+  g->numparents[n]++;
+}
+
+/******************************************************************************
+Description: Generate the links of a graph with the given number of nodes.
+             Node 0 is the root. A chain of chain nodes below the root ensures
+             the depth of the graph, all other nodes are attached to random
+             nodes which have a free child slot and which are less than
+             maxdepth links away from the root. In DAG mode, some nodes are
+             then given further parents which are closer to the root, which
+             ensures that the graph remains acyclic.
+
+Return value: The number of nodes of the graph, which is smaller than
+              numnodes if there were no more free child slots.
+******************************************************************************/
+UNSIGNED GenerateLinks(struct GenGraph *g, struct GenOptions *opts, UNSIGNED numnodes, UNSIGNED chain, UNSIGNED maxdepth)
+{
+  UNSIGNED n, i = 0, k, p;
+
+  memset(g->numchildren, 0, numnodes * sizeof(UNSIGNED));
+  memset(g->numparents, 0, numnodes * sizeof(UNSIGNED));
+  g->depth[0] = 0;
+  g->numopen = 0;
+  if (opts->fanout == 0)           /* Graphs of a single node */
+    return 1;
+  if (chain == 0 && maxdepth > 0)  /* Root takes children */
+    g->open[g->numopen++] = 0;
+
+  for (n = 1; n < numnodes; n++){
+    if (n <= chain)                /* Build the chain which sets the depth */
+      p = n - 1;
+    else{
+      if (g->numopen == 0)         /* All nodes are full */
+	break;
+      i = (UNSIGNED)(drand48() * g->numopen);
+      p = g->open[i];
+    }
+    AddChild(g, opts, p, n);
+    g->depth[n] = g->depth[p] + 1;
+    if (n <= chain){
+      if (g->numchildren[p] < opts->fanout)  /* Chain node takes children */
+	g->open[g->numopen++] = p;
+    }
+    else{
+      if (g->numchildren[p] == opts->fanout) /* Remove full node */
+	g->open[i] = g->open[--g->numopen];
+      if (g->depth[n] < maxdepth)  /* Nodes at maximum depth stay leaves */
+	g->open[g->numopen++] = n;
+    }
+  }
+  numnodes = n;
+
+  if (opts->shape != SHAPE_DAG)
+    return numnodes;
+
+  for (n = 1; n < numnodes; n++){  /* Give some nodes further parents */
+    if (g->numparents[n] >= opts->fanin || drand48() >= opts->share)
+      continue;
+    for (k = 0; k < 8 && g->numopen > 0; k++){ /* A few attempts to find one*/
+      p = g->open[(UNSIGNED)(drand48() * g->numopen)];
+      if (g->depth[p] >= g->depth[n] || g->numchildren[p] == opts->fanout)
+	continue;
+      for (i = 0; i < g->numchildren[p] && g->children[p*opts->fanout+i] != n; i++);
+      if (i == g->numchildren[p]){ /* Not yet a child of p */
+	AddChild(g, opts, p, n);
+	break;
+      }
+    }
+  }
+  return numnodes;
+}
+
+/******************************************************************************
+Description: Write the header of the dataset.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void WriteHeader(FILE *ofile, struct GenOptions *opts)
+{
+  fprintf(ofile, "# Synthetic dataset generated by gendata\n");
+  fprintf(ofile, "# %d graphs of %d to %d nodes, shape %s, seed %d\n", opts->numgraphs, opts->minnodes, opts->maxnodes, (opts->shape == SHAPE_DAG) ? "dag" : (opts->shape == SHAPE_SEQUENCE) ? "sequence" : "tree", opts->seed);
+  fprintf(ofile, "\nformat=nodenumber,nodelabel,links%s\n", (opts->classes > 0) ? ",label" : "");
+  fprintf(ofile, "indegree=%d\n", opts->fanin);
+  fprintf(ofile, "outdegree=%d\n", opts->fanout);
+  fprintf(ofile, "dim_label=%d\n", opts->ldim);
+  if (opts->binary)
+    fprintf(ofile, "byteorder=%d\n", FindEndian());
+  fprintf(ofile, "\n");
+}
+
+/******************************************************************************
+Description: Write a graph to the file. Labels of nodes are drawn from the
+             given clusters. The root node is given the symbolic label of the
+             class of the graph, all other nodes are labelled '*'.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void WriteGraph(FILE *ofile, struct GenOptions *opts, struct GenGraph *g, UNSIGNED gnum, UNSIGNED numnodes, FLOAT *centers, FLOAT *label)
+{
+  UNSIGNED n, i, c, cls = 0;
+  char cname[32];
+  int ival;
+
+  if (opts->classes > 0){
+    cls = (UNSIGNED)(drand48() * opts->classes);
+    sprintf(cname, "c%d", cls);
+  }
+  fprintf(ofile, "graph:g%d\n", gnum);
+  if (opts->binary)
+    fwrite(&numnodes, sizeof(UNSIGNED), 1, ofile);
+
+  for (n = 0; n < numnodes; n++){
+    if (opts->clusters > 0){       /* Draw label from a cluster */
+      if (opts->classes > 0 && drand48() < opts->purity)
+	c = cls % opts->clusters;
+      else
+	c = (UNSIGNED)(drand48() * opts->clusters);
+      for (i = 0; i < opts->ldim; i++)
+	label[i] = RandNormal(centers[c * opts->ldim + i], opts->spread);
+    }
+    else{
+      for (i = 0; i < opts->ldim; i++)
+	label[i] = drand48();
+    }
+
+    if (opts->binary){
+      ival = n;
+      fwrite(&ival, sizeof(int), 1, ofile);
+      fwrite(label, sizeof(FLOAT), opts->ldim, ofile);
+      for (i = 0; i < opts->fanout; i++){
+	ival = (i < g->numchildren[n]) ? (int)g->children[n * opts->fanout + i] : -1;
+	fwrite(&ival, sizeof(int), 1, ofile);
+      }
+      if (opts->classes > 0){
+	c = (n == 0) ? strlen(cname) : 1;
+	fwrite(&c, sizeof(UNSIGNED), 1, ofile);
+	fwrite((n == 0) ? cname : "*", sizeof(char), c, ofile);
+      }
+    }
+    else{
+      fprintf(ofile, "%d", n);
+      for (i = 0; i < opts->ldim; i++)
+	fprintf(ofile, " %.6g", label[i]);
+      for (i = 0; i < opts->fanout; i++){
+	if (i < g->numchildren[n])
+	  fprintf(ofile, " %d", g->children[n * opts->fanout + i]);
+	else
+	  fprintf(ofile, " -");
+      }
+      if (opts->classes > 0)
+	fprintf(ofile, " %s", (n == 0) ? cname : "*");
+      fprintf(ofile, "\n");
+    }
+  }
+}
+
+/******************************************************************************
+Description: main
+
+Return value: zero on success, nonzero otherwise.
+******************************************************************************/
+int main(int argc, char **argv)
+{
+  struct GenOptions opts;
+  struct GenGraph g;
+  FLOAT *centers = NULL, *label;
+  UNSIGNED gnum, numnodes, depth, i;
+  unsigned long long total = 0;
+  char *ofname = NULL, *cptr;
+  int fanin = -1, depthset = 0;
+  FILE *ofile;
+
+  memset(&opts, 0, sizeof(struct GenOptions));
+  opts.numgraphs = 100;
+  opts.minnodes = 10;
+  opts.maxnodes = 30;
+  opts.fanout = 2;
+  opts.ldim = 2;
+  opts.spread = 0.05;
+  opts.purity = 0.8;
+  opts.share = 0.2;
+  opts.shape = SHAPE_TREE;
+  opts.seed = 1;
+  for (i = 1; i < argc; i++){
+    if (!strcmp(argv[i], "-graphs"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.numgraphs);
+    else if (!strcmp(argv[i], "-nodes")){
+      if (!GetRange((i+1 < argc) ? argv[++i] : NULL, &opts.minnodes, &opts.maxnodes))
+	AddError("Invalid range for option -nodes.");
+    }
+    else if (!strcmp(argv[i], "-depth")){
+      if (!GetRange((i+1 < argc) ? argv[++i] : NULL, &opts.mindepth, &opts.maxdepth))
+	AddError("Invalid range for option -depth.");
+      depthset = 1;
+    }
+    else if (!strcmp(argv[i], "-shape")){
+      cptr = (i+1 < argc) ? argv[++i] : "";
+      if (!strncasecmp(cptr, "tree", 4))
+	opts.shape = SHAPE_TREE;
+      else if (!strncasecmp(cptr, "seq", 3))
+	opts.shape = SHAPE_SEQUENCE;
+      else if (!strncasecmp(cptr, "dag", 3))
+	opts.shape = SHAPE_DAG;
+      else
+	AddError("Unrecognized value for option -shape.");
+    }
+    else if (!strcmp(argv[i], "-outdegree"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.fanout);
+    else if (!strcmp(argv[i], "-indegree"))
+      GetArg(TYPE_INT, argc, argv, i++, &fanin);
+    else if (!strcmp(argv[i], "-share"))
+      GetArg(TYPE_FLOAT, argc, argv, i++, &opts.share);
+    else if (!strcmp(argv[i], "-ldim"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.ldim);
+    else if (!strcmp(argv[i], "-clusters"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.clusters);
+    else if (!strcmp(argv[i], "-spread"))
+      GetArg(TYPE_FLOAT, argc, argv, i++, &opts.spread);
+    else if (!strcmp(argv[i], "-classes"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.classes);
+    else if (!strcmp(argv[i], "-purity"))
+      GetArg(TYPE_FLOAT, argc, argv, i++, &opts.purity);
+    else if (!strcmp(argv[i], "-binary"))
+      opts.binary = 1;
+    else if (!strcmp(argv[i], "-o"))
+      GetArg(TYPE_STRING, argc, argv, i++, &ofname);
+    else if (!strcmp(argv[i], "-seed"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &opts.seed);
+    else if (!strcmp(argv[i], "-help") || !strcmp(argv[i], "-h") || !strcmp(argv[i], "-?"))
+      Usage();
+    else
+      fprintf(stderr, "Warning: Ignoring unrecognized command line option '%s'\n", argv[i]);
+
+    if (CheckErrors() != 0)
+      break;
+  }
+
+  if (CheckErrors() == 0){
+    if (opts.shape == SHAPE_SEQUENCE)
+      opts.fanout = 1;
+    if (fanin >= 0)
+      opts.fanin = fanin;
+    else
+      opts.fanin = (opts.shape == SHAPE_DAG) ? 2 : 0;
+    if (opts.minnodes == 0)
+      AddError("Graphs must have at least one node.");
+    if (opts.ldim + opts.fanout + opts.fanin == 0)
+      AddError("Overall dimension of data is zero.");
+    if (opts.shape == SHAPE_DAG && opts.fanin < 2)
+      AddError("Option -indegree must be at least 2 for shape dag.");
+  }
+  if (CheckErrors()){
+    PrintErrors();
+    return 1;
+  }
+
+  srand48(opts.seed);
+  if (opts.clusters > 0){          /* Place the cluster centers */
+    centers = (FLOAT*)MyMalloc(opts.clusters * opts.ldim * sizeof(FLOAT));
+    for (i = 0; i < opts.clusters * opts.ldim; i++)
+      centers[i] = drand48();
+  }
+  label = (FLOAT*)MyMalloc((opts.ldim + 1) * sizeof(FLOAT));
+  g.depth = (UNSIGNED*)MyMalloc(opts.maxnodes * sizeof(UNSIGNED));
+  g.numchildren = (UNSIGNED*)MyMalloc(opts.maxnodes * sizeof(UNSIGNED));
+  g.numparents = (UNSIGNED*)MyMalloc(opts.maxnodes * sizeof(UNSIGNED));
+  g.open = (UNSIGNED*)MyMalloc(opts.maxnodes * sizeof(UNSIGNED));
+  g.children = (UNSIGNED*)MyMalloc((opts.maxnodes * opts.fanout + 1) * sizeof(UNSIGNED));
+
+  ofile = MyFopen((ofname != NULL) ? ofname : "-", opts.binary ? "wb" : "w");
+  WriteHeader(ofile, &opts);
+  for (gnum = 0; gnum < opts.numgraphs; gnum++){
+    numnodes = RandRange(opts.minnodes, opts.maxnodes);
+    if (opts.shape == SHAPE_SEQUENCE)
+      numnodes = GenerateLinks(&g, &opts, numnodes, numnodes-1, numnodes-1);
+    else if (depthset){
+      depth = min(RandRange(opts.mindepth, opts.maxdepth), numnodes - 1);
+      numnodes = GenerateLinks(&g, &opts, numnodes, depth, depth);
+    }
+    else                           /* No chain, attach nodes anywhere */
+      numnodes = GenerateLinks(&g, &opts, numnodes, 0, MAX_UNSIGNED);
+    WriteGraph(ofile, &opts, &g, gnum, numnodes, centers, label);
+    total += numnodes;
+  }
+  if (ferror(ofile) || (ofile != stdout && MyFclose(ofile) != 0))
+    AddError("Unable to write the dataset. File system full?");
+  else if (ofile == stdout)
+    fflush(stdout);
+
+  fprintf(stderr, "Wrote %d graphs with %llu nodes.\n", opts.numgraphs, total);
+  free(centers);
+  free(label);
+  free(g.depth);
+  free(g.numchildren);
+  free(g.numparents);
+  free(g.open);
+  free(g.children);
+  free(ofname);
+
+  if (CheckErrors()){
+    PrintErrors();
+    return 1;
+  }
+  return 0;
+}
+
+/* End of file */
@@ -21,6 +21,7 @@
 #include "data.h"
 #include "fileio.h"
 #include "system.h"
+#include "trace.h"
 #include "train.h"
 #include "utils.h"
 
@@ -37,6 +38,9 @@ void Usage()
   fprintf(stderr, "\n\
 Usage: initsom [options]\n\n\
 Options are:\n\
+    -cachedir <dir>    Store compiled copies of datasets in <dir>. (default\n\
+                       $SOMSD_CACHEDIR, or no caching if that is not set;\n\
+                       'none' disables it)\n\
     -din <fname>       The file which holds the training data\n\
     -cout <fname>      The newly initialized map will be saved in filename.\n\
     -topol <type>      Specify the topology type of the map. Type can be\n\
@@ -44,11 +48,16 @@ Options are:\n\
                        hexagonal    Neurons are 6-connected. (the default)\n\
                        octagonal    Neurons are 8-connected.\n\
                        vq           VQ mode (no topology).\n\
+    -mapformat <fmt>   Format of the map file: binary (default), ascii, or\n\
+                       aligned (codebooks as one block that can be mapped\n\
+                       into memory when loaded).\n\
     -neigh <type>      The neighborhood type which can be\n\
                        bubble       Limit neighborhood relationship\n\
                        gaussian     Gaussian bell relationship (default)\n\
     -seed <int>        Use int as the seed for the random number generator.\n\
                        Default seed is current system time.\n\
+    -trace <fname>     Write a timeline of the run to <fname> in Chrome trace\n\
+                       event format (view with chrome://tracing or Perfetto).\n\
     -linear            Use linear initialization. Codebook vectors with values\n\
                        linearily increasing with the distance from the origin.\n\
     -xdim <xdim>       Horizontal extension of the map.\n\
@@ -66,6 +75,8 @@ Return value: zero
 int main(int argc, char **argv)
 {
   UNSIGNED i, mode;
+  int format;
+  char *cptr = NULL;
   struct Graph *data = NULL;
   struct Map *map;
   struct Parameters parameter;
@@ -75,10 +86,23 @@ int main(int argc, char **argv)
   mode = INIT_DEFAULT;
   map = &parameter.map;
   for (i = 1; i < argc; i++){
-    if (!strncmp(argv[i], "-cout", 2))
+    if (!strcmp(argv[i], "-cachedir")){
+      GetArg(TYPE_STRING, argc, argv, i++, &cptr);
+      SetCacheDir(cptr);
+      free(cptr);
+    }
+    else if (!strcmp(argv[i], "-trace"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameter.tracefile);
+    else if (!strncmp(argv[i], "-cout", 2))
       GetArg(TYPE_STRING, argc, argv, i++, &parameter.onetfile);
     else if (!strncmp(argv[i], "-din", 2))
       GetArg(TYPE_STRING, argc, argv, i++, &parameter.datafile);
+    else if (!strcmp(argv[i], "-mapformat")){
+      if ((format = GetMapFormat(argv[++i])) < 0)
+	AddError("Unrecognized value for option -mapformat.");
+      else
+	parameter.mapformat = format;
+    }
     else if (!strncmp(argv[i], "-neigh", 2))
       map->neighborhood = GetNeighborhoodID(argv[++i], NULL);
     else if (!strncmp(argv[i], "-seed", 2))
@@ -125,20 +149,27 @@ int main(int argc, char **argv)
       AddError("Network dimension not specified, or is zero.");
   }
 
+  TraceOpen(parameter.tracefile);          /* Record a timeline if requested */
+  TraceBegin("LoadData");
   if (CheckErrors() == 0)                /* No errors so far ... */
     data = LoadData(parameter.datafile); /* Load the dataset     */
+  TraceEnd();
 
   if (CheckErrors() == 0){     /* If there were no errors so far then      */
     fprintf(stderr, "Initializing network...."); /* Print what's happening */
     srand48(parameter.seed);   /* Initialize random number generator       */
+    TraceBegin("InitCodes");
     InitCodes(map, data, mode);/* Allocate and initialize the map          */
+    TraceEnd();
     if (CheckErrors() == 0)
       fprintf(stderr, "%50s\n", "[OK]");    /* print confirmation          */
     else
       fprintf(stderr, "%50s\n", "[FAILED]");/*Network initialization failed*/
   }
+  TraceBegin("SaveMap");
   if (CheckErrors() == 0)       /* If there are still no errors then   */
     SaveMap(&parameter);        /* save the map to a file    */
+  TraceEnd();
 
   if (CheckErrors()){           /* If there were errors then */
     PrintErrors();              /* print them.               */
@@ -7,6 +7,18 @@
   to 'markus@artificial-neural.net'
 
   ChangeLog:
+    18/10/2026
+      - Added option -compress to merge identical substructures of the
+        training data.
+      - Added option -trace to write a timeline of the run.
+      - Added option -perf to count hardware events in the training kernels.
+      - Added option -metrics to write metrics of each iteration as JSON.
+      - Added option -control to change parameters of a running training
+        process. SIGUSR1 takes a snapshot, SIGUSR2 prints statistics.
+      - Added options -checkpoint, -checkpointinterval, and -resume to write
+        checkpoints of the training state and to resume from them.
+      - Added option -stream to train on datasets which do not fit into
+        memory, and option -shufflewindow.
     03/10/2006
       - Port to CYGWIN complete.
       - Be more verbose about bad command line parameters, and attempts to
@@ -36,9 +48,13 @@
 #include "data.h"
 #include "fileio.h"
 #include "system.h"
+#include "trace.h"
 #include "train.h"
 #include "utils.h"
 
+/* Number of graphs held in memory in streaming mode to check parameters */
+#define SAMPLESIZE 1024
+
 extern int TrainMapThread(struct Parameters *parameters);
 
 
@@ -56,6 +72,9 @@ Usage: somsd [options]\n\n\
 Options are:\n\
     -alpha <float>        initial learning rate alpha value\n\
     -cin <filename>       initial codebook file\n\
+    -cachedir <dir>       Store compiled copies of datasets in <dir> to speed\n\
+                          up later runs. (default $SOMSD_CACHEDIR, or no\n\
+                          caching if that is not set; 'none' disables it)\n\
     -cout <filename>      the trained map will be saved in filename.\n\
     -din <filename>       The file which holds the training data\n\
     -iter <int>           The number of training iterations.\n\
@@ -63,11 +82,38 @@ Options are:\n\
     -seed <int>           seed for random number generator. 0 is current time\n\
     -batch                use batch mode training\n\
     -contextual           Contextual mode (single map).\n\
+    -mapformat <format>   Format in which maps and snapshots are saved:\n\
+                          binary   (default) binary codebooks and labels.\n\
+                          ascii    human readable text.\n\
+                          aligned  codebooks as one page aligned block which\n\
+                                   can be mapped into memory when loaded.\n\
     -log <filename>       Print loging information to <filename>. If <filename>\n\
                           is '-' then print to stdout. At current, only the\n\
                           running quantization error is logged.\n\
     -simple_kernel        Use a simple kernel SOM.\n\
     -kernel               Use a full kernel SOM.\n\
+    -checkpoint <file>    Write checkpoints of the training state to <file>.\n\
+                          A checkpoint is also written when training is\n\
+                          interrupted or terminated.\n\
+    -checkpointinterval <int> interval between checkpoints. Default is 1.\n\
+    -compress             Merge identical substructures of all training graphs\n\
+                          into a single shared graph, and train each distinct\n\
+                          node once per iteration, with a learning rate which\n\
+                          approximates as many updates as it occurs in the\n\
+                          data. This is faster, but the resulting map differs\n\
+                          from that of training without -compress. Not for\n\
+                          contextual mode, undirected graphs, or -stream.\n\
+    -control <file>       Read commands from <file> (a file or a FIFO) at the\n\
+                          end of each iteration. Commands are: 'cpu <n>',\n\
+                          'nice on|off', 'snapshot', 'checkpoint', 'stats',\n\
+                          and 'stop'. A running process also takes a snapshot\n\
+                          on SIGUSR1, and prints statistics on SIGUSR2.\n\
+    -metrics <file>       Write metrics of each iteration to <file>, one line\n\
+                          of JSON per iteration: time, nodes/sec, qerror,\n\
+                          alpha, radius, mean number of vector components\n\
+                          compared per codebook, codebooks changed per\n\
+                          update, time taken by snapshots since the previous\n\
+                          line, and the error on the validation data (-vin).\n\
     -momentum <float>     use momentum term (implies -batch)\n\
     -nice                 Be nice, sleep while system load is high.\n\
     -alpha_type <type>    Type of alpha decrease. Type can be either:\n\
@@ -75,14 +121,30 @@ Options are:\n\
                           linear       linear decrease.\n\
                           exponential  exponential decrease.\n\
                           constant     no decrease. Alpha remains constant.\n\
+    -perf                 Count CPU cycles, instructions, cache misses, and TLB\n\
+                          misses in winner search, adaptation, and K-step.\n\
+                          Counts are written to the -metrics file for each\n\
+                          iteration and a summary is printed at the end.\n\
+                          Requires Linux perf_event_open(2). Slows training.\n\
     -randomize <entity>   Randomize the order of an entity. Valid entities are:\n\
                           nodes, graphs. By default, the order of graphs is\n\
                           maintained as read from a datafile while nodes are\n\
                           sorted in an inverse topological order. This option\n\
                           allows to change this behaviour.\n\
+    -resume <file>        Resume training from the checkpoint <file> instead of\n\
+                          loading a map with -cin. Training continues exactly\n\
+                          where the checkpoint was taken.\n\
+    -shufflewindow <int>  In streaming mode, the number of graphs from which the\n\
+                          next graph is drawn when graphs are randomized.\n\
+                          Default is 1024.\n\
     -snapfile <filename>  snapshot filename\n\
     -snapinterval <int>   interval between snapshots\n\
     -exec <command>       Execute the <command> every <snapinterval>.\n\
+    -stream               Read the training data from disk at every iteration\n\
+                          rather than holding it in memory. Allows to train\n\
+                          on datasets which are larger than the available\n\
+                          memory. Default weight values are computed from the\n\
+                          first 1024 graphs. Not available in contextual mode.\n\
     -super <mode>         Enable supervised training in a given mode which can\n\
                           be either of the following:\n\
                           kohonen : supervised training Kohonen like. Kohonen\n\
@@ -95,6 +157,8 @@ Options are:\n\
                           localreject: supervised training using a local\n\
                               rejection term. Requires symbolic targets.\n\
     -beta <float>         rejection rate in conjunction with -super only.\n\
+    -trace <file>         Write a timeline of the run to <file> in Chrome trace\n\
+                          event format (view with chrome://tracing or Perfetto).\n\
     -vin <filename>       validation data set.\n\
     -mu1 float            Weight for the label component.\n\
     -mu2 float            Weight for the position component.\n\
@@ -150,17 +214,45 @@ Return value: A pointer to a dynamically allocated Parameters structure which
 ******************************************************************************/
 struct Parameters* GetParameters(struct Parameters *parameters, int argc, char **argv)
 {
-  int i;
+  int i, format;
+  char *cptr = NULL;
 
   for (i = 1; i < argc; i++){
     if (!strcmp(argv[i], "-cin"))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters->inetfile);
+    else if (!strcmp(argv[i], "-checkpoint"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameters->checkpoint.file);
+    else if (!strcmp(argv[i], "-checkpointinterval"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &parameters->checkpoint.interval);
+    else if (!strcmp(argv[i], "-resume"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameters->checkpoint.resume);
+    else if (!strcmp(argv[i], "-trace"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameters->tracefile);
+    else if (!strcmp(argv[i], "-perf"))
+      parameters->perf = 1;
+    else if (!strcmp(argv[i], "-compress"))
+      parameters->compress = 1;
+    else if (!strcmp(argv[i], "-metrics"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameters->metricsfile);
+    else if (!strcmp(argv[i], "-control"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameters->control);
+    else if (!strcmp(argv[i], "-cachedir")){
+      GetArg(TYPE_STRING, argc, argv, i++, &cptr);
+      SetCacheDir(cptr);
+      free(cptr);
+    }
     else if (!strcmp(argv[i], "-din"))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters->datafile);
     else if (!strcmp(argv[i], "-vin"))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters->validfile);
     else if (!strcmp(argv[i], "-cout"))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters->onetfile);
+    else if (!strcmp(argv[i], "-mapformat")){
+      if ((format = GetMapFormat(argv[++i])) < 0)
+	AddError("Unrecognized value for option -mapformat.");
+      else
+	parameters->mapformat = format;
+    }
     else if (!strcmp(argv[i], "-log"))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters->logfile);
     else if (!strcmp(argv[i], "-iter"))
@@ -205,6 +297,10 @@ struct Parameters* GetParameters(struct Parameters *parameters, int argc, char *
 	fprintf(stderr, "Warning: Ignoring unrecognized value '%s' for option -randomize.\n", argv[i]);
       }
     }
+    else if (!strcmp(argv[i], "-shufflewindow"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &parameters->stream.window);
+    else if (!strcmp(argv[i], "-stream"))
+      parameters->streaming = 1;
     else if (!strcmp(argv[i], "-snapfile"))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters->snap.file);
     else if (!strcmp(argv[i], "-snapinterval"))
@@ -313,6 +409,16 @@ void CheckParameters(struct Parameters* parameters)
     AddMessage("         Will proceed in default unsupervised mode.");
   }
 
+  if (parameters->streaming && parameters->contextual)
+    AddError("Contextual mode requires all data in memory. Do not use -stream.");
+
+  if (parameters->compress && (parameters->streaming || parameters->contextual || parameters->undirected)){
+    AddMessage("WARNING: Option -compress is not available with -stream, in");
+    AddMessage("         contextual mode, or with undirected graphs. Will");
+    AddMessage("         proceed without compression.");
+    parameters->compress = 0;
+  }
+
   if (parameters->kernel != 0){
     AddMessage("WARNING: Kernel mode processing not yet implemented!");
     AddMessage("         Will proceed in default SOM-SD mode.");
@@ -333,6 +439,13 @@ void CheckParameters(struct Parameters* parameters)
     AddMessage("Note: Will save a snapshots at every iteration");
   }
 
+  if (parameters->checkpoint.interval > 0 && parameters->checkpoint.file == NULL)
+    AddError("Option -checkpointinterval requires option -checkpoint.");
+  else if (parameters->checkpoint.interval == 0 && parameters->checkpoint.file != NULL){
+    parameters->checkpoint.interval = 1;
+    AddMessage("Note: Will write a checkpoint at every iteration");
+  }
+
   SuggestMu(parameters);/* Compute optimal weight parameters */
 
   /* Print error and warning messages if there are any */
@@ -364,6 +477,7 @@ int main(int argc, char **argv)
   starttime = time(NULL);
   memset(&parameters, 0, sizeof(struct Parameters));
   parameters.alpha = 1.0; /* Default learning rate */
+  parameters.stream.window = 1024; /* Default size of the shuffle window */
   GetParameters(&parameters, argc, argv);
 
   if (parameters.verbose){
@@ -371,17 +485,28 @@ int main(int argc, char **argv)
     PrintSystemInfo(stderr);   /* hardware information */
   }
 
-  if (CheckErrors() == 0)
+  TraceOpen(parameters.tracefile);  /* Record a timeline if requested */
+  PROFILE_BEGIN(tload);
+  TraceBegin("LoadMap");
+  if (CheckErrors() == 0 && parameters.checkpoint.resume != NULL)
+    LoadCheckpoint(&parameters);  /* Load map and state of training run */
+  else if (CheckErrors() == 0)
     LoadMap(&parameters);  /* Load the map */
+  TraceEnd();
 
   if (CheckErrors() == 0)
     GetParameters(&parameters, argc, argv);  /* Overwrite network parameters*/
 
-  if (CheckErrors() == 0)
+  TraceBegin("LoadData");
+  if (CheckErrors() == 0 && parameters.streaming) /* Keep a sample only */
+    parameters.train = LoadDataSample(parameters.datafile, SAMPLESIZE, &parameters.stream.numnodes);
+  else if (CheckErrors() == 0)
     parameters.train = LoadData(parameters.datafile); /* Load training data */
 
   if (CheckErrors() == 0 && parameters.validfile != NULL)
     parameters.valid = LoadData(parameters.validfile);/*Load validation data*/
+  TraceEnd();
+  PROFILE_END(PHASE_LOAD, tload);
 
   if (CheckErrors() == 0)
     CheckParameters(&parameters);       /* Check for parameter consistancy  */
@@ -389,17 +514,30 @@ int main(int argc, char **argv)
   if (CheckErrors() == 0 && parameters.undirected)      /* treat undirected */
     ConvertToUndirectedLinks(parameters.train);
 
-  if (CheckErrors() == 0)
+  if (CheckErrors() == 0){
+    PROFILE_BEGIN(tprep);
+    TraceBegin("PrepareData");
     PrepareData(&parameters);/* Prepare data for training phase */
+    TraceEnd();
+    PROFILE_END(PHASE_PREPARE, tprep);
+  }
 
   if (CheckErrors() == 0){
+    TraceBegin("TrainMap");
     TrainMap(&parameters); /* Train the network                 */ 
-    SaveMap(&parameters);  /* Save the trained map              */
+    TraceEnd();
+    TraceBegin("SaveMap");
+    if (CheckErrors() == 0)
+      SaveMap(&parameters);  /* Save the trained map            */
+    TraceEnd();
   }
 
   if (CheckErrors())       /* If there were errors then         */
     PrintErrors();         /* print them.                       */
   else{
+#ifdef PROFILE
+    PrintProfile(stderr);  /* Print time spent in each phase */
+#endif
     fprintf(stderr, "Total time: %s\n", PrintTime(time(NULL) - starttime));
     fprintf(stderr, "all done.\n");
   }
@@ -5,6 +5,13 @@
 
   Comments and questions concerning this program package may be sent
   to 'markus@artificial-neural.net'
+
+  ChangeLog:
+    18/10/2026
+      - rdtsc(.) works on x86 and x86-64, and is now defined in system.h.
+      - Added a profiler of the phases of training (PrintProfile(.) etc.),
+        enabled when compiled with -DPROFILE.
+      - Added access to hardware performance counters (PerfOpen(.) etc.).
  */
 
 
@@ -13,12 +20,19 @@
 /************/
 #define _BSD_SOURCE
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #ifndef __CYGWIN__
 #include <sys/sysinfo.h>
 #endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 #include <sys/statvfs.h>
 #include <sys/time.h>
 #include <sys/utsname.h>
@@ -29,6 +43,18 @@
 #include "utils.h"
 
 
+#ifdef PROFILE
+/********************/
+/* Global variables */
+/********************/
+__thread struct Profile *_profile_ = NULL; /* Counters of this thread  */
+struct Profile *ProfileList = NULL;        /* Counters of all threads  */
+pthread_mutex_t ProfileLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long ProfileStartCycles;     /* To calibrate clock rate  */
+struct timeval ProfileStartTime;
+#endif
+
+
 /* Begin functions... */
 
 /******************************************************************************
@@ -102,25 +128,6 @@ void ListDataTypes()
   }
 }
 
-/******************************************************************************
-Description: Get the number of clock cycles since last reboot. This works on
-             Pentium based systems ONLY!
-
-Return value: Number of clock cycles since last reboot, or 0 if the system is
-              not a Pentium PC.
-******************************************************************************/
-extern __inline__ unsigned long long int rdtsc()
-{
-#if #cpu(i386)
-  unsigned long long int x;
-  __asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
-  return x;
-#else
-  return 0LL;
-#endif
-}
-
-
 /******************************************************************************
 Description: Obtain approx. write-speed for the local disc in (KB/sec.)
 
@@ -438,3 +445,246 @@ void SleepOnHiLoad()
       fprintf(stderr, "\b \b"); 
   }
 }
+
+/******************************************************************************
+Description: Open the hardware performance counters of a counter group for
+             the calling thread: cycles, instructions, last level cache
+             misses, and data TLB misses. Only user space events are counted.
+             The counters are opened disabled, and are counting only between
+             PerfStart() and PerfStop(). Counters which are not supported are
+             left out. This requires Linux perf_event_open(2).
+
+Return value: The number of counters available, or 0 if there are none (errno
+              tells why).
+******************************************************************************/
+int PerfOpen(struct PerfGroup *grp)
+{
+  int i, num = 0;
+#ifdef __linux__
+  struct perf_event_attr attr;
+  static const unsigned type[NUM_PERF_EVENTS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+  };
+  static const unsigned long long config[NUM_PERF_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+  };
+  int err = 0;
+#endif
+
+  memset(grp, 0, sizeof(struct PerfGroup));
+  for (i = 0; i < NUM_PERF_EVENTS; i++)
+    grp->fd[i] = -1;
+  grp->leader = -1;
+
+#ifdef __linux__
+  for (i = 0; i < NUM_PERF_EVENTS; i++){
+    memset(&attr, 0, sizeof(struct perf_event_attr));
+    attr.size = sizeof(struct perf_event_attr);
+    attr.type = type[i];
+    attr.config = config[i];
+    attr.disabled = (grp->leader < 0); /* Group is enabled via its leader */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    grp->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, grp->leader, 0);
+    if (grp->fd[i] < 0){
+      if (!err)
+	err = errno;
+      continue;
+    }
+    if (grp->leader < 0)
+      grp->leader = grp->fd[i];
+    num++;
+  }
+  if (num == 0)
+    errno = err;
+#else
+  errno = ENOSYS;
+#endif
+  return num;
+}
+
+/******************************************************************************
+Description: Start counting events in the given counter group. Does nothing
+             if grp is NULL or has no counters.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PerfStart(struct PerfGroup *grp)
+{
+#ifdef __linux__
+  if (grp != NULL && grp->leader >= 0)
+    ioctl(grp->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+/******************************************************************************
+Description: Stop counting events in the given counter group. Does nothing
+             if grp is NULL or has no counters.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PerfStop(struct PerfGroup *grp)
+{
+#ifdef __linux__
+  if (grp != NULL && grp->leader >= 0)
+    ioctl(grp->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+/******************************************************************************
+Description: Read the counters of a group, and compute the number of events
+             counted since the previous call. Counts are scaled up if the
+             kernel had to share the hardware counters with other groups. The
+             counts are also added to the totals of the group.
+
+Return value: The counts since the previous call are returned in delta. The
+              entry of a counter which is not available is set to -1.
+******************************************************************************/
+void PerfRead(struct PerfGroup *grp, long long *delta)
+{
+  unsigned long long value[3], count;
+  int i;
+
+  for (i = 0; i < NUM_PERF_EVENTS; i++){
+    delta[i] = -1;
+    if (grp->fd[i] < 0 || read(grp->fd[i], value, sizeof(value)) != sizeof(value))
+      continue;
+    count = value[0];
+    if (value[2] > 0 && value[2] < value[1]) /* Counter was multiplexed */
+      count = (unsigned long long)((double)count * value[1] / value[2]);
+    delta[i] = count - grp->last[i];
+    grp->last[i] = count;
+    grp->total[i] += delta[i];
+  }
+}
+
+/******************************************************************************
+Description: Close the counters of a counter group.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PerfClose(struct PerfGroup *grp)
+{
+  int i;
+
+  for (i = 0; i < NUM_PERF_EVENTS; i++){
+    if (grp->fd[i] >= 0)
+      close(grp->fd[i]);
+    grp->fd[i] = -1;
+  }
+  grp->leader = -1;
+}
+
+#ifdef PROFILE
+/******************************************************************************
+Description: Allocate the profile counters of the calling thread and add them
+             to the list of all counters. Called once per thread, when the
+             thread times its first phase. The counters remain valid after the
+             thread terminated.
+
+Return value: Pointer to the counters of the calling thread.
+******************************************************************************/
+struct Profile *RegisterProfile()
+{
+  struct Profile *prof;
+
+  prof = (struct Profile*)MyCalloc(1, sizeof(struct Profile));
+  pthread_mutex_lock(&ProfileLock);
+  if (ProfileList == NULL){   /* First thread: start clock rate calibration */
+    ProfileStartCycles = rdtsc();
+    gettimeofday(&ProfileStartTime, NULL);
+  }
+  prof->next = ProfileList;
+  ProfileList = prof;
+  pthread_mutex_unlock(&ProfileLock);
+  _profile_ = prof;
+
+  return prof;
+}
+
+/******************************************************************************
+Description: Sum the counters of all threads, and estimate the clock rate from
+             the cycles elapsed since the first thread registered.
+
+Return value: The clock rate in cycles per second, or 0 if unknown.
+******************************************************************************/
+static double SumProfiles(unsigned long long *cycles, unsigned long long *calls)
+{
+  struct Profile *prof;
+  struct timeval now;
+  double seconds;
+  int i;
+
+  memset(cycles, 0, NUM_PHASES * sizeof(unsigned long long));
+  memset(calls, 0, NUM_PHASES * sizeof(unsigned long long));
+  pthread_mutex_lock(&ProfileLock);
+  for (prof = ProfileList; prof != NULL; prof = prof->next){
+    for (i = 0; i < NUM_PHASES; i++){
+      cycles[i] += prof->cycles[i];
+      calls[i] += prof->calls[i];
+    }
+  }
+  pthread_mutex_unlock(&ProfileLock);
+
+  if (ProfileList == NULL)
+    return 0.0;
+  gettimeofday(&now, NULL);
+  seconds = (now.tv_sec - ProfileStartTime.tv_sec) + (now.tv_usec - ProfileStartTime.tv_usec) * 1e-6;
+  return (seconds > 0.01) ? (rdtsc() - ProfileStartCycles) / seconds : 0.0;
+}
+
+static const char *PhaseNames[NUM_PHASES] = {
+  "load", "prepare", "state", "search", "adapt", "kstep", "snapshot"
+};
+
+/******************************************************************************
+Description: Print a table with the cycles spent in each phase, summed over
+             all threads.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintProfile(FILE *ofile)
+{
+  unsigned long long cycles[NUM_PHASES], calls[NUM_PHASES], total;
+  double rate;
+  int i;
+
+  rate = SumProfiles(cycles, calls);
+  total = 0;
+  for (i = 0; i < NUM_PHASES; i++)
+    total += cycles[i];
+  if (total == 0)
+    return;
+
+  fprintf(ofile, "\nPhase           Calls            Cycles   Share   Seconds  Cycles/call\n");
+  for (i = 0; i < NUM_PHASES; i++){
+    if (calls[i] == 0)
+      continue;
+    fprintf(ofile, "%-9s %11llu %17llu %6.1f%% %9.3f %12.0f\n", PhaseNames[i], calls[i], cycles[i], 100.0 * cycles[i] / total, (rate > 0.0) ? cycles[i] / rate : 0.0, (double)cycles[i] / calls[i]);
+  }
+}
+
+/******************************************************************************
+Description: Write the number of calls and cycles of each phase as a single
+             line of JSON, in the format of the metrics stream.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void WriteProfileJSON(FILE *ofile)
+{
+  unsigned long long cycles[NUM_PHASES], calls[NUM_PHASES];
+  double rate;
+  int i;
+
+  rate = SumProfiles(cycles, calls);
+  fprintf(ofile, "{\"profile\":{\"cycles_per_sec\":%.0f", rate);
+  for (i = 0; i < NUM_PHASES; i++)
+    fprintf(ofile, ",\"%s\":{\"calls\":%llu,\"cycles\":%llu}", PhaseNames[i], calls[i], cycles[i]);
+  fprintf(ofile, "}}\n");
+  fflush(ofile);
+}
+#endif
@@ -19,7 +19,6 @@
 
 int FindEndian();       /* Find endian type of system */
 void ListDataTypes();   /* List size of common data types */
-extern __inline__ unsigned long long int rdtsc();/* Clock cycles since reboot*/
 int GetWriteSpeed();    /* Approximate write speed to local disc */
 unsigned long long FreeDiskSpace(char *); /* Get user usable free disk space */
 char *GetMachineArch(); /* Get processor type */
@@ -31,4 +30,99 @@ void PrintSoftwareInfo(FILE *ofile); /* Prints current software info */
 void PrintSystemInfo(FILE *ofile);   /* Prints local hardware info   */
 void SleepOnHiLoad();   /* Sleep while system load is high           */
 
+/******************************************************************************
+Description: Get the number of clock cycles since last reboot from the time
+             stamp counter of x86 processors. On other processors, the time
+             in nanoseconds is returned instead. Defined here so that it can
+             be inlined into code which is being timed.
+
+Return value: Number of clock cycles since last reboot (or nanoseconds).
+******************************************************************************/
+#if defined(__i386__) || defined(__x86_64__)
+static __inline__ unsigned long long int rdtsc()
+{
+  unsigned int lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((unsigned long long int)hi << 32) | lo;
+}
+#else
+#include <time.h>
+static __inline__ unsigned long long int rdtsc()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long int)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+/* Hardware performance counters */
+enum PerfEvent{
+  PERF_CYCLES,       /* CPU cycles                    */
+  PERF_INSTRUCTIONS, /* Instructions retired          */
+  PERF_LLC_MISSES,   /* Last level cache misses       */
+  PERF_DTLB_MISSES,  /* Data TLB read misses          */
+  NUM_PERF_EVENTS
+};
+
+struct PerfGroup{    /* Counters which are enabled and disabled together */
+  int leader;                                /* Descriptor of the group  */
+  int fd[NUM_PERF_EVENTS];                   /* -1 if not available      */
+  unsigned long long last[NUM_PERF_EVENTS];  /* Count at previous read   */
+  unsigned long long total[NUM_PERF_EVENTS]; /* Sum of all reads         */
+};
+
+int PerfOpen(struct PerfGroup *grp);
+void PerfStart(struct PerfGroup *grp);
+void PerfStop(struct PerfGroup *grp);
+void PerfRead(struct PerfGroup *grp, long long *delta);
+void PerfClose(struct PerfGroup *grp);
+
+/* Phase profiler. When compiled with -DPROFILE, the time spent in each phase
+   of a run is accumulated in clock cycles. Every thread has its own counters,
+   so the timed code does not share any data between threads. Without
+   -DPROFILE the macros expand to nothing. */
+enum ProfilePhase{
+  PHASE_LOAD,      /* Reading maps and data files          */
+  PHASE_PREPARE,   /* PrepareData(), PrepareGraph()        */
+  PHASE_STATE,     /* Update of node states                */
+  PHASE_SEARCH,    /* Search for the winning codebook      */
+  PHASE_ADAPT,     /* Adaptation of codebooks              */
+  PHASE_KSTEP,     /* K_Step_Approximation()               */
+  PHASE_SNAPSHOT,  /* Taking and writing snapshots and checkpoints */
+  NUM_PHASES
+};
+
+#ifdef PROFILE
+struct Profile{    /* Counters of a single thread */
+  unsigned long long cycles[NUM_PHASES];
+  unsigned long long calls[NUM_PHASES];
+  struct Profile *next;
+};
+
+extern __thread struct Profile *_profile_;
+struct Profile *RegisterProfile();
+void PrintProfile(FILE *ofile);
+void WriteProfileJSON(FILE *ofile);
+
+#define PROFILE_BEGIN(var) unsigned long long int var = rdtsc()
+#define PROFILE_END(phase, var) do{ \
+    struct Profile *_p = (_profile_ != NULL) ? _profile_ : RegisterProfile(); \
+    _p->cycles[phase] += rdtsc() - (var); \
+    _p->calls[phase]++; \
+  } while(0)
+#define PROFILE_LAP(phase, var) do{ /* End phase, and restart timing */ \
+    struct Profile *_p = (_profile_ != NULL) ? _profile_ : RegisterProfile(); \
+    unsigned long long int _now = rdtsc(); \
+    _p->cycles[phase] += _now - (var); \
+    _p->calls[phase]++; \
+    (var) = _now; \
+  } while(0)
+#else
+#define PROFILE_BEGIN(var)
+#define PROFILE_END(phase, var)
+#define PROFILE_LAP(phase, var)
+#endif
+
 #endif
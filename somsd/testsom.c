@@ -18,13 +18,16 @@
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include "common.h"
 #include "data.h"
 #include "fileio.h"
 #include "system.h"
+#include "trace.h"
 #include "train.h"
 #include "utils.h"
 
@@ -48,26 +51,95 @@
 #define DISTANCES      0x00004000
 #define WEBSOM         0x00008000
 #define TRUNCATE       0x00010000
+#define TOPOGRAPHIC    0x00020000
 #define QUIET          0x01000000
 #define MAPNODETEST    0x10000000
 
 struct VMap{
   UNSIGNED max;
+  UNSIGNED hits;      /* Number of activated neurons                */
+  UNSIGNED numroots;  /* Number of root nodes which were counted    */
   UNSIGNED **activation;
   UNSIGNED numclasses;
   UNSIGNED ***classes;
   UNSIGNED **winnerclass;
 };
 
+struct ActiveMap{        /* Codebooks of the activated neurons of a map  */
+  UNSIGNED num;          /* Number of activated neurons                  */
+  UNSIGNED dim;          /* Dimension of the codebooks                   */
+  FLOAT *block;          /* Codebooks by dimension: block[i*num + n]     */
+  UNSIGNED *codeno;      /* ID of the codebook of every activated neuron */
+  UNSIGNED *winnerclass; /* Winner class of every activated neuron       */
+};
+
 struct AllHits{
   struct Graph *graph;
   struct Node *node;
-  char *structID;
-  char *substructID;
-  struct AllHits *next;
+  struct Signature structID;    /* Signature of the graph's root */
+  struct Signature substructID; /* Signature of the node         */
+};
+
+struct NodeIndex{       /* Nodes grouped by the neuron they are mapped to   */
+  UNSIGNED noc;         /* Number of neurons                                */
+  UNSIGNED *start;      /* Entries of neuron n are start[n] to start[n+1]-1 */
+  struct Node **node;   /* Mapped nodes, in order of graphs and nodes       */
+  struct Graph **graph; /* Graph of each mapped node                        */
+  UNSIGNED *seq;        /* Position of each mapped node in the dataset      */
+};
+
+struct Evaluation{           /* State shared by the metrics of one evaluation */
+  struct Parameters *params;
+  struct Graph *test;        /* Test set, or the training set if none given */
+  FLOAT qerror;              /* Quantization error of the training set      */
+  struct NodeIndex index;    /* Nodes of the training set by neuron         */
+  struct Signature *sigs;    /* Signatures of the nodes of the training set */
+  UNSIGNED *rootpos;         /* Position of the root of the graph of a node */
+  UNSIGNED maxhits;          /* Max. number of nodes mapped to one neuron   */
+  FLOAT *si, *ssi;           /* Precision E and e of every neuron           */
+  struct VMap vmap, tvmap;   /* Root hits and classes of training/test set  */
+  struct ActiveMap active;   /* Neurons activated by roots of training set  */
+  UNSIGNED numroots;         /* Number of root nodes in the test set        */
+  struct Node **roots;       /* Root nodes of the test set                  */
+  struct Graph **rgraphs;    /* Graph of every root node                    */
+  int *rpos;                 /* Winner of every root node in active, or -1  */
+  UNSIGNED *rcode;           /* Codebook ID of the winner of every root     */
+  UNSIGNED numnodes;         /* Number of nodes in the test set             */
+  struct Node **nodes;       /* Nodes of the test set                       */
+  struct Graph **ngraphs;    /* Graph of every node                         */
+  struct Winner *top;        /* NUM_WINNERS best matches of every node      */
+  UNSIGNED numthreads;       /* Number of threads to use                    */
+  UNSIGNED next, numwork;    /* Next work item handed out, number of items  */
+  pthread_mutex_t lock;      /* Protects next                               */
+};
+
+struct StreamSlot{          /* A graph of a streamed test set in flight    */
+  struct Graph *graph;      /* The graph, or NULL if the slot is free      */
+  UNSIGNED numroots;        /* Number of root nodes of the graph           */
+  struct Node **roots;      /* Root nodes of the graph                     */
+  int *rpos;                /* Winner of every root node in active, or -1  */
+  UNSIGNED *rcode;          /* Codebook ID of the winner of every root     */
+  int done;                 /* Nonzero once the graph was classified       */
 };
 
+struct ClassifyStream{      /* State shared by the threads of -stream      */
+  struct Evaluation *ev;    /* Map, and neurons activated by training set  */
+  struct StreamSlot *slots; /* Ring buffer of graphs in flight             */
+  UNSIGNED qsize;           /* Number of slots                             */
+  UNSIGNED nextread;        /* Sequence number of the next graph read      */
+  UNSIGNED nextwork;        /* Next graph handed to a worker               */
+  UNSIGNED nextprint;       /* Next graph to be printed                    */
+  int eof;                  /* Nonzero once all graphs were read           */
+  pthread_mutex_t lock;
+  pthread_cond_t work, done;/* Signal new graphs, and classified graphs    */
+};
+
+#define EVAL_BLOCKSIZE 64  /* Work items handed to a thread at a time */
+#define DIST_BLOCKROWS 64  /* Nodes per block in mode distances       */
+#define STREAM_QUEUE    4  /* Graphs in flight per thread with -stream */
+
 int KstepEnabled = 0;
+char *MappingFile = NULL; /* Map file whose sidecars hold winners of datasets */
 
 /* Begin functions... */
 
@@ -81,8 +153,15 @@ void Usage()
   fprintf(stderr, "\n\
 Usage: testsom [options]\n\n\
 Options are:\n\
+    -cachedir <dir>     Store compiled copies of datasets in <dir>. (default\n\
+                        $SOMSD_CACHEDIR, or no caching if that is not set;\n\
+                        'none' disables it)\n\
     -cin <fname>        Codebook file\n\
+    -cpu <n>            Number of threads used to compute the precision, the\n\
+                        retrieval performance and the topographic error.\n\
+                        Default is the number of CPUs.\n\
     -din <fname>        The file which holds the training data set.\n\
+    -dout <fname>       File to which mode distances writes the distances.\n\
     -tin <fname>        The file which holds the test data set.\n\
     -mode <mode>        Test mode, which can be:\n\
                         context   Writes a data set suitable for further\n\
@@ -107,17 +186,45 @@ Options are:\n\
                                   performance.\n\
                         classify  Classify a given set of data. A labelled\n\
                                   training set needs to be available.\n\
+                        topographic Compute the topographic error of the\n\
+                                  map, and the confidence of the winners of\n\
+                                  the root nodes.\n\
                         analyse   Statistically analyse a given dataset.\n\
                         balance   Produce a balanced dataset\n\
                         truncate <n>  Truncate outdegree of graphs in a given\n\
                                   dataset to at most n.\n\
-                        distances List for every node in the dataset distances\n\
-                                  to every codebook in the map.\n\
+                        distances Write the distance of every node in the\n\
+                                  dataset to every codebook in the map to\n\
+                                  the .npy file given by -dout.\n\
+    -knn <k>            Let mode distances write only the k nearest codebooks\n\
+                        of every node, with their IDs. (default all)\n\
+    -memo <MB>          Remember the winners of up to <MB> megabytes of distinct\n\
+                        node vectors, so that nodes with identical vectors and\n\
+                        offspring states are mapped without searching the map.\n\
+                        Worthwhile for datasets with many repeated\n\
+                        substructures. (default 0, disabled)\n\
     -mu1 float[:float]  Weight(range) for the label component.\n\
     -mu2 float[:float]  Weight(range) for the child state component.\n\
     -mu3 float[:float]  Weight(range) for the parents position component.\n\
     -mu4 float[:float]  Weight(range) for the class label component.\n\
+    -nosidecar          Do not save or reuse the winners of the nodes. When a\n\
+                        cache directory is set (-cachedir or SOMSD_CACHEDIR),\n\
+                        the winners are otherwise saved to a file there, and\n\
+                        later runs with the same map and dataset read them\n\
+                        back. Nothing is saved without a cache directory.\n\
     -quiet              Restrict amount of text printed to screen.\n\
+    -stream             Classify the test set while it is read, one graph at a\n\
+                        time, instead of loading it first. The test set may\n\
+                        be read from stdin (-tin -). Results are printed in\n\
+                        the order of the input, one line per graph, and\n\
+                        are followed by the classification performance and\n\
+                        the confusion matrix of mode classify. The hits of\n\
+                        the test set are not printed, as they are known only\n\
+                        after the whole set was read. Requires mode\n\
+                        classify, which may be combined with mode precision\n\
+                        only.\n\
+    -trace <fname>      Write a timeline of the run to <fname> in Chrome trace\n\
+                        event format (view with chrome://tracing or Perfetto).\n\
     -help               Print this help.\n\
  \n");
   exit(0);
@@ -482,6 +589,19 @@ void DrawXfigGraphAt(FILE *ofile, struct Graph* gptr, struct Node *root, int x,
   free(gmatrix);
 }
 
+/******************************************************************************
+Description: Print the number of neurons activated in vmap, as computed by
+             GetHits().
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintHits(struct VMap *vmap)
+{
+  fprintf(stdout, "Neurons activated: %d\n", vmap->hits);
+  fprintf(stdout, "Compression ratio: %f (root nodes only)\n",(float)vmap->numroots/vmap->hits);
+  fflush(stdout);
+}
+
 //Compute activation of every node of the map, and the maximum activation of any node on the map. Result is stored in vmap.activation[y][x], and vmap.max
 struct VMap GetHits(int xdim, int ydim, struct Graph *graph, int mode)
 {
@@ -531,26 +651,229 @@ struct VMap GetHits(int xdim, int ydim, struct Graph *graph, int mode)
 	hits++;
     }
   }
-  if (!(mode & QUIET)){
-    fprintf(stdout, "Neurons activated: %d\n", hits);
-    fprintf(stdout, "Compression ratio: %f (root nodes only)\n",(float)N/hits);
-    fflush(stdout);
-  }
+  vmap.hits = hits;
+  vmap.numroots = N;
+  if (!(mode & QUIET))
+    PrintHits(&vmap);
 
   return vmap;
 }
+
+/******************************************************************************
+Description: Release the memory of a vmap computed by GetHits() and
+             GetClusterID() or GetClusterIDFromIndex().
+
+Return value: This function does not return a value.
+******************************************************************************/
+void FreeVMap(int xdim, int ydim, struct VMap *vmap)
+{
+  int x, y;
+
+  for (y = 0; y < ydim; y++){
+    if (vmap->classes != NULL){
+      for (x = 0; x < xdim; x++)
+	free(vmap->classes[y][x]);
+      free(vmap->classes[y]);
+    }
+    if (vmap->winnerclass != NULL)
+      free(vmap->winnerclass[y]);
+    free(vmap->activation[y]);
+  }
+  free(vmap->classes);
+  free(vmap->winnerclass);
+  free(vmap->activation);
+  memset(vmap, 0, sizeof(struct VMap));
+}
+/******************************************************************************
+Description: Get the ID of the neuron a node is mapped to. If bywinner is
+             set and the map is in VQ mode, then this is the winner as set by
+             MapDataset(). Otherwise it is the neuron at the node's
+             coordinates, which is how the hits, classes and mappings of
+             neurons have always been computed, in VQ mode too.
+
+Return value: ID of the neuron, or -1 if the node is not mapped.
+******************************************************************************/
+int GetNeuronID(struct Map *map, struct Node *node, int bywinner)
+{
+  if (bywinner && map->topology == TOPOL_VQ)
+    return (node->winner >= 0 && node->winner < map->xdim * map->ydim) ? node->winner : -1;
+  if (node->x < 0 || node->x >= map->xdim || node->y < 0 || node->y >= map->ydim)
+    return -1;
+  return node->y * map->xdim + node->x;
+}
+
+/******************************************************************************
+Description: Group the nodes of all graphs by the neuron they are mapped to,
+             as given by GetNeuronID() for bywinner. This is a counting sort,
+             so that the evaluation modes can visit the nodes of every neuron
+             in O(N + noc) instead of rescanning the dataset for every
+             neuron. The nodes of a neuron are kept in order of graphs and
+             nodes.
+
+Return value: The index. Release with FreeNodeIndex().
+******************************************************************************/
+struct NodeIndex BuildNodeIndex(struct Map *map, struct Graph *graph, int bywinner)
+{
+  struct NodeIndex index;
+  struct Graph *gptr;
+  UNSIGNED n, num, pos, *fill;
+  int id;
+
+  index.noc = map->xdim * map->ydim;
+  index.start = (UNSIGNED*)MyCalloc(index.noc + 1, sizeof(UNSIGNED));
+  num = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    for (n = 0; n < gptr->numnodes; n++)
+      if ((id = GetNeuronID(map, gptr->nodes[n], bywinner)) >= 0){
+	index.start[id+1]++;
+	num++;
+      }
+  for (n = 0; n < index.noc; n++)
+    index.start[n+1] += index.start[n];
+
+  index.node = (struct Node**)MyMalloc(num * sizeof(struct Node*) + 1);
+  index.graph = (struct Graph**)MyMalloc(num * sizeof(struct Graph*) + 1);
+  index.seq = (UNSIGNED*)MyMalloc(num * sizeof(UNSIGNED) + 1);
+  fill = (UNSIGNED*)memdup(index.start, index.noc * sizeof(UNSIGNED) + 1);
+  pos = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    for (n = 0; n < gptr->numnodes; n++, pos++)
+      if ((id = GetNeuronID(map, gptr->nodes[n], bywinner)) >= 0){
+	index.node[fill[id]] = gptr->nodes[n];
+	index.seq[fill[id]] = pos;
+	index.graph[fill[id]++] = gptr;
+      }
+  free(fill);
+  return index;
+}
+
+/******************************************************************************
+Description: Release the memory of an index built by BuildNodeIndex().
+
+Return value: This function does not return a value.
+******************************************************************************/
+void FreeNodeIndex(struct NodeIndex *index)
+{
+  free(index->start);
+  free(index->node);
+  free(index->graph);
+  free(index->seq);
+  memset(index, 0, sizeof(struct NodeIndex));
+}
+
+/******************************************************************************
+Description: Compute the winner of every node in the dataset graph, using the
+             K-step approximation for contextual data. The winners and their
+             distances are saved to a sidecar of the map file, so that later
+             calls on the same map and the same dataset restore the winners
+             from the sidecar instead of searching the map. The restored
+             winners are assigned in the same order in which they were found,
+             so that the states of offsprings (and parents) in the node vectors
+             come out exactly as if the map was searched, also for graphs with
+             cycles. Sidecars exist only in a configured cache directory
+             (-cachedir or SOMSD_CACHEDIR). Without one, the map is always
+             searched.
+
+Return value: The quantization error.
+******************************************************************************/
+FLOAT MapDataset(struct Map *map, struct Graph *graph)
+{
+  struct Graph *gptr;
+  struct Node *node;
+  struct Winner winner;
+  FLOAT qerr, diff, *diffs, *codebook;
+  UNSIGNED n, i, num;
+  int id, *codeno;
+  void (*UpdateStates)(struct Graph *gptr, struct Node *node);
+
+  if (KstepEnabled)
+    UpdateStates = UpdateChildrenAndParentLocation;
+  else if (map->topology == TOPOL_VQ)
+    UpdateStates = UpdateChildrensLocationVQ;
+  else
+    UpdateStates = UpdateChildrensLocation;
+
+  num = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    num += gptr->numnodes;
+  codeno = (int*)MyMalloc(num * sizeof(int) + 1);
+  if (MappingFile != NULL && LoadMapping(MappingFile, map, graph, KstepEnabled, &qerr, codeno, NULL)){
+    /* Replay the assignments of GetNodeCoordinates() or K-step */
+    num = 0;
+    for (gptr = graph; gptr != NULL; gptr = gptr->next){
+      for (n = 0; n < gptr->numnodes; n++, num++){
+	node = gptr->nodes[n];
+	if (!KstepEnabled)
+	  UpdateStates(gptr, node);
+	if (map->topology == TOPOL_VQ)
+	  node->winner = codeno[num];
+	else if (codeno[num] >= 0){
+	  node->x = map->codes[codeno[num]].x;
+	  node->y = map->codes[codeno[num]].y;
+	}
+      }
+    }
+    for (gptr = graph; gptr != NULL && KstepEnabled; gptr = gptr->next)
+      for (n = 0; n < gptr->numnodes; n++)
+	UpdateStates(gptr, gptr->nodes[n]);
+    free(codeno);
+    return qerr;
+  }
+  free(codeno);
+
+  if (KstepEnabled)
+    qerr = K_Step_Approximation(map, graph, 1);
+  else
+    qerr = GetNodeCoordinates(map, graph);
+  if (MappingFile == NULL)
+    return qerr;
+
+  /* Distance of every node to its winner */
+  diffs = (FLOAT*)MyMalloc(num * sizeof(FLOAT) + 1);
+  num = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next){
+    for (n = 0; n < gptr->numnodes; n++, num++){
+      node = gptr->nodes[n];
+      if (map->topology == TOPOL_VQ){
+	FindWinnerMemo(map, node, gptr, &winner, VQFindWinnerEucledian);
+	diffs[num] = winner.diff;
+      }
+      else if ((id = GetNeuronID(map, node, 0)) >= 0){
+	codebook = map->codes[id].points;
+	diffs[num] = 0.0;
+	for (i = 0; i < gptr->dimension; i++){
+	  diff = codebook[i] - node->points[i];
+	  diffs[num] += diff * diff * node->mu[i];
+	}
+      }
+      else
+	diffs[num] = -1.0;
+    }
+  }
+  SaveMapping(MappingFile, map, graph, KstepEnabled, qerr, diffs);
+  free(diffs);
+
+  return qerr;
+}
+
 //plot "x" u 1:2:3:4 w e, "x" u 1:2 w l lt 2, "x" u 1:3 w l lt 2, "x" u 1:4 w l lt 2
 //plot "x" u 1:5:6:7 w e, "x" u 1:5 w l lt 2, "x" u 1:6 w l lt 2, "x" u 1:7 w l lt 2
 //plot "x" u 1:8:9:10 w e, "x" u 1:8 w l lt 2, "x" u 1:9 w l lt 2, "x" u 1:10 w l lt 2
 //plot "x" u 1:11:12:13 w e, "x" u 1:11 w l lt 2, "x" u 1:12 w l lt 2, "x" u 1:13 w l lt 2
 
-void GetClusterID(struct Map map, struct Graph *graph, struct VMap *vmap)
+/******************************************************************************
+Description: Compute the class histogram and the winner class of every
+             activated neuron from the nodes grouped by neuron in index. If
+             index is NULL, then only the tables are allocated.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void GetClusterIDFromIndex(struct Map map, struct NodeIndex *index, struct VMap *vmap)
 {
-  UNSIGNED *frequency;
+  UNSIGNED *frequency, k;
   int numlabels;
   int n, max, id, x, y;
   struct Node *node;
-  struct Graph *gptr;
   int xdim, ydim;
   int noactive = 0;
 
@@ -563,7 +886,7 @@ void GetClusterID(struct Map map, struct Graph *graph, struct VMap *vmap)
     vmap->classes[n] = (UNSIGNED**)MyCalloc(xdim, sizeof(UNSIGNED*));
   }
 
-  if (graph == NULL)
+  if (index == NULL)
     return;
 
   numlabels = GetNumLabels();
@@ -575,15 +898,11 @@ void GetClusterID(struct Map map, struct Graph *graph, struct VMap *vmap)
 	continue;
 
       frequency = MyCalloc(numlabels, sizeof(UNSIGNED));
-      for(gptr = graph; gptr != NULL; gptr = gptr->next){
-	for (n = 0; n < gptr->numnodes; n++){
-	  node = gptr->nodes[n];
-	  if (node->x == x && node->y == y)
-	    if (GetLabel(node->label) != NULL)
-	      	      if (strcmp(GetLabel(node->label), "*"))
-		frequency[node->label-1]++;
-	  
-	}
+      for (k = index->start[y*xdim+x]; k < index->start[y*xdim+x+1]; k++){
+	node = index->node[k];
+	if (GetLabel(node->label) != NULL)
+	  if (strcmp(GetLabel(node->label), "*"))
+	    frequency[node->label-1]++;
       }
       id = -1;
       max = 0;
@@ -612,6 +931,25 @@ void GetClusterID(struct Map map, struct Graph *graph, struct VMap *vmap)
     fprintf(stderr, "There were %d activated neurons without label\n", noactive);
 }
 
+/******************************************************************************
+Description: Compute the class histogram and the winner class of every
+             activated neuron from the nodes of graph.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void GetClusterID(struct Map map, struct Graph *graph, struct VMap *vmap)
+{
+  struct NodeIndex index;
+
+  if (graph == NULL){
+    GetClusterIDFromIndex(map, NULL, vmap);
+    return;
+  }
+  index = BuildNodeIndex(&map, graph, 0);
+  GetClusterIDFromIndex(map, &index, vmap);
+  FreeNodeIndex(&index);
+}
+
 /*****************************************************************************
 Description:
 
@@ -619,11 +957,11 @@ Return value:
 *****************************************************************************/
 void MapNodeLabel(struct Map map, struct Graph *graph)
 {
-  UNSIGNED n, cnt;
-  UNSIGNED x, y;
+  UNSIGNED n, cnt, id, k;
   UNSIGNED *flags;
   struct Node *node;
   struct Graph *gptr;
+  struct NodeIndex index;
 
   if (graph == NULL)
     return;
@@ -634,10 +972,7 @@ void MapNodeLabel(struct Map map, struct Graph *graph)
   flags = (UNSIGNED*)MyMalloc(GetNumLabels() * sizeof(UNSIGNED));
 
   /* initialize node location */
-  if (KstepEnabled)
-    K_Step_Approximation(&map, graph, 1);
-  else
-    GetNodeCoordinates(&map, graph);
+  MapDataset(&map, graph);
 
   cnt = 0;
   for(gptr = graph; gptr != NULL; gptr = gptr->next)
@@ -646,29 +981,27 @@ void MapNodeLabel(struct Map map, struct Graph *graph)
 	cnt++;
   fprintf(stderr, "%d roots\n", cnt);
 
-  for (y = 0; y < map.ydim; y++){
-    for (x = 0; x < map.xdim; x++){
-      cnt = 0;
-      memset(flags, 0, GetNumLabels() * sizeof(UNSIGNED));
-      for(gptr = graph; gptr != NULL; gptr = gptr->next){
-	for (n = 0; n < gptr->numnodes; n++){
-	  node = gptr->nodes[n];
-	  if (node->x == x && node->y == y && IsRoot(node) && GetLabel(node->label) != NULL){
-	    flags[node->label-1]++;
-	    cnt = 1;
-	  }
-	}
+  index = BuildNodeIndex(&map, graph, 0);
+  for (id = 0; id < index.noc; id++){
+    cnt = 0;
+    memset(flags, 0, GetNumLabels() * sizeof(UNSIGNED));
+    for (k = index.start[id]; k < index.start[id+1]; k++){
+      node = index.node[k];
+      if (IsRoot(node) && GetLabel(node->label) != NULL){
+	flags[node->label-1]++;
+	cnt = 1;
       }
+    }
 
-      if (cnt > 0){
-	printf("%d %d", x, y);
-	for (n = 0; n < GetNumLabels(); n++){
-	  printf(" %d", flags[n]);
-	}
-	printf("\n");
+    if (cnt > 0){
+      printf("%d %d", id % map.xdim, id / map.xdim);
+      for (n = 0; n < GetNumLabels(); n++){
+	printf(" %d", flags[n]);
       }
+      printf("\n");
     }
   }
+  FreeNodeIndex(&index);
   free(flags);
 }
 
@@ -679,10 +1012,8 @@ Return value:
 *****************************************************************************/
 void MapNode(struct Map map, struct Graph *graph)
 {
-  UNSIGNED n;
-  UNSIGNED x, y;
-  struct Node *node;
-  struct Graph *gptr;
+  UNSIGNED id, k;
+  struct NodeIndex index;
 
   if (graph == NULL)
     return;
@@ -691,23 +1022,13 @@ void MapNode(struct Map map, struct Graph *graph)
     return;
 
   /* initialize node location */
-  if (KstepEnabled)
-    K_Step_Approximation(&map, graph, 1);
-  else
-    GetNodeCoordinates(&map, graph);
+  MapDataset(&map, graph);
 
-  for (y = 0; y < map.ydim; y++){
-    for (x = 0; x < map.xdim; x++){
-      for(gptr = graph; gptr != NULL; gptr = gptr->next){
-	for (n = 0; n < gptr->numnodes; n++){
-	  node = gptr->nodes[n];
-	  if (node->x == x && node->y == y){
-	    fprintf(stdout, "%d %d: %d %d\n", x, y, gptr->gnum, node->nnum);
-	  }
-	}
-      }
-    }
-  }
+  index = BuildNodeIndex(&map, graph, 0);
+  for (id = 0; id < index.noc; id++)
+    for (k = index.start[id]; k < index.start[id+1]; k++)
+      fprintf(stdout, "%d %d: %d %d\n", id % map.xdim, id / map.xdim, index.graph[k]->gnum, index.node[k]->nnum);
+  FreeNodeIndex(&index);
 }
 
 
@@ -727,10 +1048,7 @@ void ClassifyAndWriteDatafileWithParents(struct Map map, struct Graph *gptr)
     return;
 
   /* initialize node location */
-  if (KstepEnabled)
-    K_Step_Approximation(&map, gptr, 1);
-  else
-    GetNodeCoordinates(&map, gptr);
+  MapDataset(&map, gptr);
 
   ldim = INT_MAX;  /* Initialize graph properties with illegal values to  */
   tdim = INT_MAX;  /* enforce the writing of a data header for the first  */
@@ -826,10 +1144,7 @@ void ClassifyAndWriteDatafile(struct Map map, struct Graph *gptr)
     return;
 
   /* initialize node location */
-  if (KstepEnabled)
-    K_Step_Approximation(&map, gptr, 1);
-  else
-    GetNodeCoordinates(&map, gptr);
+  MapDataset(&map, gptr);
 
   ldim = INT_MAX;  /* Initialize graph properties with illegal values to  */
   tdim = INT_MAX;  /* enforce the writing of a data header for the first  */
@@ -935,10 +1250,7 @@ void MapGraph(struct Parameters parameters, int x, int y)
   map = &parameters.map;
 
   /* Find the winners for all nodes */
-  if (KstepEnabled)
-    qerr = K_Step_Approximation(map, parameters.train, 1);
-  else
-    qerr = GetNodeCoordinates(map, parameters.train);
+  qerr = MapDataset(map, parameters.train);
   fprintf(stderr, "Qerror:%f\n", qerr);
 
   if (x >= 0 && y >= 0){
@@ -1003,10 +1315,7 @@ void VisualizeGraph(struct Parameters parameters)
   struct Node *node;
   struct VMap vmap;
 
-  if (KstepEnabled)
-    K_Step_Approximation(&parameters.map, parameters.train, 1);
-  else
-    GetNodeCoordinates(&parameters.map, parameters.train);
+  MapDataset(&parameters.map, parameters.train);
 
   vmap = GetHits(parameters.map.xdim, parameters.map.ydim, parameters.train, LEAF | INTERMEDIATE | ROOT | QUIET);
   PrintXfigHeader(stdout);
@@ -1054,10 +1363,7 @@ void VisualizeSubGraphs(struct Parameters parameters)
   struct VMap vmap;
 
   /* Find the winners for all nodes */
-  if (KstepEnabled)
-    qerr = K_Step_Approximation(&parameters.map, parameters.train, 1);
-  else
-    qerr = GetNodeCoordinates(&parameters.map, parameters.train);
+  qerr = MapDataset(&parameters.map, parameters.train);
   fprintf(stderr, "Qerror:%f\n", qerr);
 
   vmap = GetHits(parameters.map.xdim, parameters.map.ydim, parameters.train, LEAF | INTERMEDIATE | ROOT);
@@ -1102,10 +1408,7 @@ void VisualizeClustering(struct Parameters parameters)
   struct Node *node;
   struct VMap vmap;
 
-  if (KstepEnabled)
-    K_Step_Approximation(&parameters.map, parameters.train, 1);
-  else
-    GetNodeCoordinates(&parameters.map, parameters.train);
+  MapDataset(&parameters.map, parameters.train);
 
   vmap = GetHits(parameters.map.xdim, parameters.map.ydim, parameters.train, LEAF | INTERMEDIATE | ROOT);
 
@@ -1141,40 +1444,36 @@ void VisualizeClustering(struct Parameters parameters)
 
 
 /******************************************************************************
-Description: 
+Description: Get the position of the root of every graph. If a graph has
+             several roots, the first one is used.
 
-Return value: 
+Return value: An array holding for every node of every graph the position
+              of the root of its graph, both counted in order of graphs and
+              nodes as by GetSignatures().
 ******************************************************************************/
-char *GetStructID2(int FanOut, struct Node *node, char *StructID)
+UNSIGNED *GetRootPositions(struct Graph *graph)
 {
-  int c;
-
-  memmove(StructID+2, StructID, strlen(StructID)+1);
-  StructID[0] = '(';
-  StructID[1] = ')';
-
-  for (c = 0; c < FanOut; c++){
-    if (node->children[c] != NULL)
-      GetStructID2(FanOut, node->children[c], StructID+1);
-  }
-  return NULL;
-}
-
-/******************************************************************************
-Description: 
+  UNSIGNED *rootpos;
+  struct Graph *gptr;
+  UNSIGNED n, r, num, offset;
 
-Return value: 
-******************************************************************************/
-char *GetStructID(int FanOut, struct Node *node, char *StructID)
-{
-  if (FanOut == 0)
-    return NULL;
-  else if (FanOut == 1){  //sequences
-    sprintf(StructID, "(%d)", node->depth+1);
-    return NULL;
+  num = 0;
+  for (gptr = graph; gptr != NULL; gptr = gptr->next)
+    num += gptr->numnodes;
+  rootpos = (UNSIGNED*)MyMalloc(num * sizeof(UNSIGNED) + 1);
+  offset = 0;
+  for (gptr = graph; gptr != NULL; offset += gptr->numnodes, gptr = gptr->next){
+    for (r = 0; r < gptr->numnodes; r++)
+      if (IsRoot(gptr->nodes[r]))
+	break;
+    if (r == gptr->numnodes){
+      fprintf(stderr, "No root found in graph %s\n", gptr->gname);
+      r = 0;
+    }
+    for (n = 0; n < gptr->numnodes; n++)
+      rootpos[offset + n] = offset + r;
   }
-  else
-    return GetStructID2(FanOut, node, StructID);
+  return rootpos;
 }
 
 int comparStructID(const void *v1, const void *v2)
@@ -1184,7 +1483,7 @@ int comparStructID(const void *v1, const void *v2)
   a1 = (struct AllHits*)v1;
   a2 = (struct AllHits*)v2;
 
-  return strcmp(a1->structID, a2->structID);
+  return CompareSignatures(&a1->structID, &a2->structID);
 }
 
 int comparsubStructID(const void *v1, const void *v2)
@@ -1194,7 +1493,7 @@ int comparsubStructID(const void *v1, const void *v2)
   a1 = (struct AllHits*)v1;
   a2 = (struct AllHits*)v2;
 
-  return strcmp(a2->substructID, a1->substructID);
+  return CompareSignatures(&a2->substructID, &a1->substructID);
 }
 
 int comparFloat(const void *v1, const void *v2)
@@ -1210,19 +1509,18 @@ Return value:
 ******************************************************************************/
 void AnalyseDataset(struct Parameters parameters)
 {
-  int i, j, n, r;
+  int i, n, r;
   int ni, nG, N;
   int nsub, nsdsub;
-  char *buffer, *rbuf, *bigbuf;
   struct Graph *graph;
   struct Node *node;
   struct AllHits *harray;
+  struct Signature *sigs, *sig;
   int minnodes, maxnodes;
   int V = 0, Vn = 0;
   FLOAT *labelval;
   int l, nl = 0, no, o, tmpo;
   int maxO = 0, minO, totalO;
-  int olen;
   char *ctmp;
   int nlinks, yme;
   int roots, lroots;
@@ -1270,20 +1568,11 @@ void AnalyseDataset(struct Parameters parameters)
   fprintf(stderr, "Size of graphs: min %d nodes, ", minnodes);
   fprintf(stderr, "max %d nodes, avg %.2f nodes\n", maxnodes, (float)N/nG);
 
-  if (parameters.train->FanOut == 1){/* Sequences */
-    buffer = MyCalloc((maxnodes*3+1), sizeof(char));
-    bigbuf = MyCalloc(parameters.train->ldim * 12 + (maxnodes*3+1), sizeof(char));
-  }
-  else{
-    buffer = MyCalloc((maxnodes*2+1), sizeof(char));
-    bigbuf = MyCalloc(parameters.train->ldim * 12+ (maxnodes*2+1), sizeof(char));
-  }
+  sigs = GetSignatures(parameters.train, SIG_STRUCT);
   harray = (struct AllHits*)MyCalloc(N, sizeof(struct AllHits));
   labelval = (FLOAT*)MyCalloc(N, sizeof(FLOAT));
 
   ni = 0;
-  rbuf = NULL;
-  olen = 0;
   nlinks = 0;
   totalO = 0;
   yme = 0;
@@ -1301,22 +1590,14 @@ void AnalyseDataset(struct Parameters parameters)
       exit(0);
     }
 
-    memset(buffer, 0, olen);
-    GetStructID(graph->FanOut, graph->nodes[r], buffer);
-    olen = strlen(buffer);
-    rbuf = memdup(buffer, olen+1);
-
     minO = INT_MAX;
     tmpo = 0;
     for (n = 0; n < graph->numnodes; n++){
       node = graph->nodes[n];
       harray[ni].graph = graph;
       harray[ni].node = node;
-      harray[ni].structID = rbuf;
-      memset(buffer, 0, olen);
-      GetStructID(graph->FanOut, node, buffer);
-      olen = strlen(buffer);
-      harray[ni].substructID =(char*)memdup(buffer, olen+1);
+      harray[ni].structID = sigs[ni - n + r];
+      harray[ni].substructID = sigs[ni];
 
       for (l = 0; l < graph->ldim; l++)
 	labelval[ni] += node->points[l] * node->points[l];
@@ -1350,32 +1631,28 @@ void AnalyseDataset(struct Parameters parameters)
     V=1;
     Vn = harray[0].graph->numnodes;
     for (i = 1; i < N; i++){
-      if (strcmp(harray[i-1].structID, harray[i].structID)){
+      if (CompareSignatures(&harray[i-1].structID, &harray[i].structID)){
 	Vn += harray[i].graph->numnodes;
 	V++;
       }
-      //      printf("%s\n", harray[i].structID);
     }
     qsort(harray, N, sizeof(struct AllHits), comparsubStructID);
     nsub = 1;
     for (i = 1; i < N; i++){
-      if (strcmp(harray[i-1].substructID, harray[i].substructID))
+      if (CompareSignatures(&harray[i-1].substructID, &harray[i].substructID))
 	nsub++;
     }
-    //    printf("#\n");
 
+    /* Add the data label of the node itself to its signature */
     for (i = 0; i < N; i++){
-      *bigbuf = '\0';
-      for (j = 0; j < parameters.train->ldim; j++)
-	sprintf(&bigbuf[strlen(bigbuf)], " %f", harray[i].node->points[j]);
-      sprintf(&bigbuf[strlen(bigbuf)], " %s", harray[i].substructID);
-      free(harray[i].substructID);
-      harray[i].substructID = strdup(bigbuf);
+      sig = &harray[i].substructID;
+      sig->h1 = HashBytes(harray[i].node->points, harray[i].graph->ldim * sizeof(FLOAT), sig->h1);
+      sig->h2 = HashBytes(harray[i].node->points, harray[i].graph->ldim * sizeof(FLOAT), sig->h2);
     }
     qsort(harray, N, sizeof(struct AllHits), comparsubStructID);
     nsdsub = 1;
     for (i = 1; i < N; i++){
-      if (strcmp(harray[i-1].substructID, harray[i].substructID))
+      if (CompareSignatures(&harray[i-1].substructID, &harray[i].substructID))
 	nsdsub++;
     }
 
@@ -1401,206 +1678,135 @@ void AnalyseDataset(struct Parameters parameters)
   fprintf(stderr, "%s %d\n", ctmp, yme);
 
   /* Cleanup */
-  for (i = 0; i < N; i++)
-    free(harray[i].substructID);
   free(harray);
-  free(buffer);
+  free(sigs);
   free(labelval);
 }
 
 /******************************************************************************
-Description: 
-
-Return value: 
+Description: Pack the codebooks of all neurons for which
+             vmap->activation[y][x] != 0 into one contiguous matrix, with the
+             winner class of every neuron attached. If vmap is NULL, then all
+             neurons are packed, with winner class 0. The matrix is stored by
+             dimension, so that ComputeDistanceBlock() computes the distances
+             to all packed neurons in a dense loop which the compiler can
+             vectorise.
+
+Return value: The packed codebooks. Release with FreeActiveMap().
 ******************************************************************************/
-void ComputePrecision(struct Parameters parameters)
+struct ActiveMap BuildActiveMap(struct Map *map, struct VMap *vmap)
 {
-  int i, n, x, y, r;
-  int flag, ni, mi, N;
-  FLOAT qerr, Si, sSi;
-  char *buffer;
-  int olen;
-  struct Graph *graph;
-  struct Node *node;
-  struct Map *map;
-  struct AllHits *hits = NULL, *hptr, *hprev, *harray;
-
-  if (parameters.train == NULL)
-    return;
-
-  map = &parameters.map;
+  struct ActiveMap active;
+  UNSIGNED n, i, noc;
 
-  /* Find the winners for all nodes */
-  if (parameters.map.topology == TOPOL_VQ)
-    VQSet_ab(&parameters);
+  noc = map->xdim * map->ydim;
+  memset(&active, 0, sizeof(struct ActiveMap));
+  active.dim = map->dim;
+  active.codeno = (UNSIGNED*)MyMalloc(noc * sizeof(UNSIGNED) + 1);
+  active.winnerclass = (UNSIGNED*)MyMalloc(noc * sizeof(UNSIGNED) + 1);
+  for (n = 0; n < noc; n++){
+    if (vmap != NULL && vmap->activation[map->codes[n].y][map->codes[n].x] == 0)
+      continue;
+    active.codeno[active.num] = n;
+    active.winnerclass[active.num] = (vmap != NULL) ? vmap->winnerclass[map->codes[n].y][map->codes[n].x] : 0;
+    active.num++;
+  }
 
-  if (KstepEnabled)
-    qerr = K_Step_Approximation(map, parameters.train, 1);
-  else
-    qerr = GetNodeCoordinates(map, parameters.train);
-  
-  fprintf(stdout, "Qerror:%E\n", qerr);
-  //  return;
+  active.block = (FLOAT*)MyMalloc(active.num * active.dim * sizeof(FLOAT) + 1);
+  for (n = 0; n < active.num; n++)
+    for (i = 0; i < active.dim; i++)
+      active.block[i * active.num + n] = map->codes[active.codeno[n]].points[i];
 
-  N = 0;
-  Si = sSi = 0.0;
-  olen = 0;
-  buffer = MyCalloc(1024*1024, sizeof(char));
-  for (y = 0; y < parameters.map.ydim; y++){
-    for (x = 0; x < parameters.map.xdim; x++){
-      ni = 0;
-      for (graph = parameters.train; graph != NULL; graph = graph->next){
-	for (n = 0; n < graph->numnodes; n++){
-	  node = graph->nodes[n];
-	  if (map->topology == TOPOL_VQ)            /* In VQ mode...   */
-	    flag = (y*parameters.map.xdim+x == node->winner);
-	  else
-	    flag = (x == node->x && y == node->y);
-	  if (flag){
-	    hptr = (struct AllHits*)MyCalloc(1, sizeof(struct AllHits));
-
-	    for (r = 0; r < graph->numnodes; r++)
-	      if (IsRoot(graph->nodes[r]))
-		break;
-	    if (!IsRoot(graph->nodes[r]))
-	      fprintf(stderr, "No root found\n");
-	    hptr->graph = graph;
-	    hptr->node = node;
-	    memset(buffer, 0, olen);
-	    GetStructID(hptr->graph->FanOut, graph->nodes[r], buffer);
-	    olen = strlen(buffer);
-	    hptr->structID = (char*)memdup(buffer, olen+1);
-
-	    memset(buffer, 0, olen);
-	    GetStructID(hptr->graph->FanOut, hptr->node, buffer);
-	    olen = strlen(buffer);
-	    hptr->substructID =(char*)memdup(buffer, olen+1);
-
-	    hptr->next = hits;
-	    hits = hptr;
-	    ni++;
-	    // printf("%d %d %d %d\n", x, y, graph->gnum, node->nnum);
-	    //  fprintf(stderr, "%s\n", graph->gname);
-	  }
-	}
-      }
-
-      //Sort list by structID
-      if (ni > 0){
-	harray = malloc(ni * sizeof(struct AllHits));
-	for (i = 0, hptr = hits; hptr != NULL; hptr = hptr->next, i++)
-	  memcpy(&harray[i], hptr, sizeof(struct AllHits));
-
-	qsort(harray, ni, sizeof(struct AllHits), comparStructID);
-
-	mi = 1;
-	n = 1;
-	hprev = &harray[0];
-	for (i = 1; i < ni; i++){
-	  if (!strcmp(harray[i].structID, hprev->structID))
-	    n++;
-	  else{
-	    if (mi < n)
-	      mi = n;
-	    n = 1;
-	    hprev = &harray[i];
-	  }
-	}
-	if (mi < n)
-	  mi = n;
-	Si += (FLOAT)mi/ni;
-      }
+  return active;
+}
 
-      //Sort list by substructID
-      if (ni > 0){
-	qsort(harray, ni, sizeof(struct AllHits), comparsubStructID);
-
-	mi = 1;
-	n = 1;
-	hprev = &harray[0];
-	for (i = 1; i < ni; i++){
-	  if (!strcmp(harray[i].substructID, hprev->substructID))
-	    n++;
-	  else{
-	    if (mi < n)
-	      mi = n;
-	    n = 1;
-	    hprev = &harray[i];
-	  }
-	}
-	if (mi < n)
-	  mi = n;
-	sSi += (FLOAT)mi/ni;
-	free(harray);
-	harray = NULL;
-      }
+/******************************************************************************
+Description: Release the memory of packed codebooks built by BuildActiveMap().
 
+Return value: This function does not return a value.
+******************************************************************************/
+void FreeActiveMap(struct ActiveMap *active)
+{
+  free(active->codeno);
+  free(active->winnerclass);
+  free(active->block);
+  memset(active, 0, sizeof(struct ActiveMap));
+}
 
-      //Delete list
-      while(hits != NULL){
-	hptr = hits->next;
-	free(hits->structID);
-	free(hits->substructID);
-	free(hits);
-	hits = hptr;
+/******************************************************************************
+Description: Compute the weighted squared distances of a block of num nodes
+             to all neurons packed by BuildActiveMap(). Each row of the packed
+             codebooks (one dimension of all neurons) is used for all nodes
+             of the block while it is in cache. The distances are accumulated
+             one dimension at a time, in the same order as
+             FindWinnerEucledian() does. The distance of node b to packed
+             neuron n is returned in dist[b*active->num + n].
+
+Return value: This function does not return a value.
+******************************************************************************/
+void ComputeDistanceBlock(struct ActiveMap *active, struct Node **nodes, struct Graph **graphs, UNSIGNED num, FLOAT *dist)
+{
+  FLOAT *row, *d;
+  FLOAT diff, s, w;
+  UNSIGNED n, i, b, nn, dim;
+
+  nn = active->num;
+  dim = 0;
+  for (b = 0; b < num; b++)
+    dim = max(dim, graphs[b]->dimension);
+  for (n = 0; n < num * nn; n++)
+    dist[n] = 0.0;
+  for (i = 0; i < dim; i++){
+    row = &active->block[i * nn];
+    for (b = 0; b < num; b++){  /* A dense loop over the neurons */
+      if (i >= graphs[b]->dimension)
+	continue;
+      s = nodes[b]->points[i];
+      w = nodes[b]->mu[i];
+      d = &dist[b * nn];
+      for (n = 0; n < nn; n++){
+	diff = row[n] - s;
+	d[n] += diff * diff * w;
       }
-      if (ni > 0)
-	N++;
-    } //End x-loop
-  } //End y-loop
-  fprintf(stdout, "Struct mapping performance (E): %f\n", Si/N);
-  fprintf(stdout, "SubStruct mapping performance (e): %f\n", sSi/N);
+    }
+  }
 }
 
-
-
 /******************************************************************************
-Description: Compute best matching codebook for which
-             vmap->activation[y][x] != 0
-
-
-Return value: 
+Description: Compute the best matching codebook among the active neurons
+             packed by BuildActiveMap(). The distances to all active neurons
+             are computed by ComputeDistanceBlock(), so that the result is
+             identical to a search of the active neurons of the full map. As
+             there, a tie is won by the neuron which comes last on the map.
+             dist is scratch space for active->num distances, so that several
+             threads can search the same packed codebooks.
+
+Return value: Position of the winner in the packed codebooks, or -1 if there
+              are no active neurons. The ID of the winning codebook and the
+              distance are returned in winner.
 ******************************************************************************/
-void FindWinnerEucledianOnActiveOnly(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winner, struct VMap *vmap)
+int FindWinnerOnActive(struct ActiveMap *active, struct Node *node, struct Graph *gptr, struct Winner *winner, FLOAT *dist)
 {
-  FLOAT *mu;
-  UNSIGNED tend;
-  UNSIGNED noc;  /* Number of codebooks in the map */
-  FLOAT *codebook, *sample;
-  UNSIGNED n, i;
-  FLOAT diffsf, diff, difference;
-
-  tend = gptr->dimension;
-  mu = node->mu;
-
-  noc = map->xdim * map->ydim;
-  diffsf = FLT_MAX;
-  sample = node->points;
-  for (n = 0; n < noc; n++){  /* For every codebook of the map */
-
-    if (vmap->activation[map->codes[n].y][map->codes[n].x] == 0)
-      continue;
+  FLOAT best;
+  UNSIGNED n, num;
+  int pos;
 
-    codebook = map->codes[n].points;
-    difference = 0.0;
+  num = active->num;
+  ComputeDistanceBlock(active, &node, &gptr, 1, dist);
 
-    /* Compute the difference between codebook and input entry */
-    for (i = 0; i < tend; i++){
-      diff = codebook[i] - sample[i];
-      difference += diff * diff * mu[i];
-      if (difference > diffsf)
-      	goto big_difference;
+  pos = -1;
+  best = FLT_MAX;
+  for (n = 0; n < num; n++){
+    if (dist[n] <= best){
+      best = dist[n];
+      pos = n;
     }
-
-    /* Distance is smaller than previous distances */
-    winner->codeno = n;
-    diffsf         = difference;
-  big_difference:
-    continue;
   }
-  winner->diff   = diffsf;
+  if (pos >= 0)
+    winner->codeno = active->codeno[pos];
+  winner->diff = best;
 
-  return;
+  return pos;
 }
 
 float ComputeClassificationConfusion(int x, int y, struct VMap *vmap)
@@ -1755,93 +1961,690 @@ float GetClusteringPerformance(struct Parameters parameters, struct VMap vmap)
 }
 
 /******************************************************************************
-Description: 
+Description: Hand the next block of work items of an evaluation to a thread.
 
-Return value: 
+Return value: 1 if items first to last-1 were assigned, 0 if there is no work
+              left.
 ******************************************************************************/
-void ComputeRetrievalPerformance(struct Parameters parameters, int classifyflag)
+int GetEvaluationWork(struct Evaluation *ev, UNSIGNED *first, UNSIGNED *last)
 {
-  int flag = 0;
-  struct VMap vmap;
-  struct VMap tvmap; //for the test set
-  float R, P;
-  int C, n, nnum;
-  int winnerx, winnery;
-  struct Graph *gptr;
-  struct Node *node;
+  pthread_mutex_lock(&ev->lock);
+  *first = ev->next;
+  *last = min(ev->next + EVAL_BLOCKSIZE, ev->numwork);
+  ev->next = *last;
+  pthread_mutex_unlock(&ev->lock);
+  return *first < *last;
+}
+
+/******************************************************************************
+Description: Run Worker on numwork items in ev->numthreads threads. Items are
+             handed out in blocks, and every worker stores its results per
+             item, so that they can be combined in a fixed order afterwards.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void RunEvaluationWorkers(struct Evaluation *ev, UNSIGNED numwork, void *(*Worker)(void *arg))
+{
+  pthread_t *threads;
+  UNSIGNED n, num;
+
+  ev->next = 0;
+  ev->numwork = numwork;
+  num = min(ev->numthreads, (numwork + EVAL_BLOCKSIZE - 1) / EVAL_BLOCKSIZE);
+  if (num <= 1){
+    Worker(ev);
+    return;
+  }
+  threads = (pthread_t*)MyMalloc(num * sizeof(pthread_t));
+  for (n = 0; n < num; n++)
+    if (pthread_create(&threads[n], NULL, Worker, ev) != 0)
+      break;
+  if (n == 0)   /* No threads available: do the work here */
+    Worker(ev);
+  while (n > 0)
+    pthread_join(threads[--n], NULL);
+  free(threads);
+}
+
+/******************************************************************************
+Description: Count the members of the largest group of entries in a sorted
+             array of hits. Entries are in one group if they have the same
+             signature of the root (substruct = 0) or of the node itself
+             (substruct = 1).
+
+Return value: Size of the largest group.
+******************************************************************************/
+int GetLargestGroup(struct AllHits *harray, int ni, int substruct)
+{
+  struct Signature *prev, *sig;
+  int i, n, mi;
+
+  mi = 1;
+  n = 1;
+  prev = substruct ? &harray[0].substructID : &harray[0].structID;
+  for (i = 1; i < ni; i++){
+    sig = substruct ? &harray[i].substructID : &harray[i].structID;
+    if (!CompareSignatures(sig, prev))
+      n++;
+    else{
+      if (mi < n)
+	mi = n;
+      n = 1;
+      prev = sig;
+    }
+  }
+  if (mi < n)
+    mi = n;
+  return mi;
+}
+
+/******************************************************************************
+Description: Thread which computes the mapping precision of the neurons
+             handed to it. The precision of neuron id is the share of the
+             nodes mapped there which belong to the largest group of nodes
+             with the same structure (E: of the graph, e: of the node).
+
+Return value: NULL.
+******************************************************************************/
+void *PrecisionWorker(void *arg)
+{
+  struct Evaluation *ev = (struct Evaluation*)arg;
+  struct NodeIndex *index = &ev->index;
+  struct AllHits *harray;
+  UNSIGNED id, k, first, last;
+  int ni;
+
+  harray = (struct AllHits*)MyMalloc(ev->maxhits * sizeof(struct AllHits) + 1);
+  while (GetEvaluationWork(ev, &first, &last)){
+    for (id = first; id < last; id++){
+      ni = 0;
+      for (k = index->start[id]; k < index->start[id+1]; k++){
+	harray[ni].graph = index->graph[k];
+	harray[ni].node = index->node[k];
+	harray[ni].structID = ev->sigs[ev->rootpos[index->seq[k]]];
+	harray[ni].substructID = ev->sigs[index->seq[k]];
+	ni++;
+      }
+      if (ni == 0)
+	continue;
+
+      qsort(harray, ni, sizeof(struct AllHits), comparStructID);
+      ev->si[id] = (FLOAT)GetLargestGroup(harray, ni, 0)/ni;
+      qsort(harray, ni, sizeof(struct AllHits), comparsubStructID);
+      ev->ssi[id] = (FLOAT)GetLargestGroup(harray, ni, 1)/ni;
+    }
+  }
+  free(harray);
+  return NULL;
+}
+
+/******************************************************************************
+Description: Thread which finds the winners of the root nodes of the test set
+             handed to it among the neurons activated by the training set.
+
+Return value: NULL.
+******************************************************************************/
+void *RetrievalWorker(void *arg)
+{
+  struct Evaluation *ev = (struct Evaluation*)arg;
   struct Winner winner = {0};
-  struct Map *map;
+  UNSIGNED r, first, last;
+  FLOAT *dist;
+
+  dist = (FLOAT*)MyMalloc(ev->active.num * sizeof(FLOAT) + 1);
+  while (GetEvaluationWork(ev, &first, &last)){
+    for (r = first; r < last; r++){
+      ev->rpos[r] = FindWinnerOnActive(&ev->active, ev->roots[r], ev->rgraphs[r], &winner, dist);
+      ev->rcode[r] = winner.codeno;
+    }
+  }
+  free(dist);
+  return NULL;
+}
+
+/******************************************************************************
+Description: Thread which finds the NUM_WINNERS best matching codebooks of the
+             nodes of the test set handed to it, in one search of the map.
 
-  if (parameters.test == NULL){
+Return value: NULL.
+******************************************************************************/
+void *TopographicWorker(void *arg)
+{
+  struct Evaluation *ev = (struct Evaluation*)arg;
+  struct Map *map = &ev->params->map;
+  UNSIGNED n, first, last;
+
+  while (GetEvaluationWork(ev, &first, &last)){
+    for (n = first; n < last; n++){
+      if (map->topology == TOPOL_VQ)
+	VQFindWinnersEucledian(map, ev->nodes[n], ev->ngraphs[n], &ev->top[n*NUM_WINNERS], NUM_WINNERS);
+      else
+	FindWinnersEucledian(map, ev->nodes[n], ev->ngraphs[n], &ev->top[n*NUM_WINNERS], NUM_WINNERS);
+    }
+  }
+  return NULL;
+}
+
+/******************************************************************************
+Description: Compute the topographic error of the map on the test set, i.e.
+             the share of nodes whose best and second best matching codebooks
+             are not neighbours on the map, once over all nodes and once over
+             the root nodes. Also compute the confidence of the winner of
+             every root node as the relative margin 1-d1/d2 between the
+             distances to the best (d1) and second best (d2) codebook. It is
+             0 if the two codebooks match equally well. The topographic error
+             is not defined in VQ mode, where codebooks have no location.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintTopographicError(struct Evaluation *ev)
+{
+  struct Map *map = &ev->params->map;
+  struct Graph *gptr;
+  struct Winner *top;
+  struct Codebook *c1, *c2;
+  UNSIGNED n, nerr, rerr, numroots;
+  FLOAT conf;
+
+  ev->numnodes = 0;
+  for (gptr = ev->test; gptr != NULL; gptr = gptr->next)
+    ev->numnodes += gptr->numnodes;
+  ev->nodes = (struct Node**)MyMalloc(ev->numnodes * sizeof(struct Node*) + 1);
+  ev->ngraphs = (struct Graph**)MyMalloc(ev->numnodes * sizeof(struct Graph*) + 1);
+  ev->top = (struct Winner*)MyCalloc(ev->numnodes * NUM_WINNERS + 1, sizeof(struct Winner));
+  ev->numnodes = 0;
+  for (gptr = ev->test; gptr != NULL; gptr = gptr->next){
+    for (n = 0; n < gptr->numnodes; n++){
+      ev->nodes[ev->numnodes] = gptr->nodes[n];
+      ev->ngraphs[ev->numnodes] = gptr;
+      ev->numnodes++;
+    }
+  }
+  if (ev->numnodes == 0 || map->xdim * map->ydim < 2)
+    return;
+  RunEvaluationWorkers(ev, ev->numnodes, TopographicWorker);
+
+  /* Sum up in order of nodes, so that results do not depend on threads */
+  nerr = rerr = numroots = 0;
+  conf = 0.0;
+  for (n = 0; n < ev->numnodes; n++){
+    top = &ev->top[n*NUM_WINNERS];
+    c1 = &map->codes[top[0].codeno];
+    c2 = &map->codes[top[1].codeno];
+    if (map->topology != TOPOL_VQ && ComputeHexaDistance(c1->x, c1->y, c2->x, c2->y) > 1.0){
+      nerr++;
+      if (IsRoot(ev->nodes[n]))
+	rerr++;
+    }
+    if (!IsRoot(ev->nodes[n]))
+      continue;
+    numroots++;
+    if (top[1].diff > 0.0)
+      conf += 1.0 - top[0].diff / top[1].diff;
+  }
+
+  if (ev->params->test == NULL)
     printf("Warning: No test file given. Will use training data for testing.\n");
-    parameters.test = parameters.train;
-    flag = 1;
+  if (map->topology != TOPOL_VQ){
+    printf("Topographic error: %f\n", (float)nerr/ev->numnodes);
+    printf("Topographic error: %f (root nodes only)\n", (float)rerr/max(numroots, 1));
   }
+  printf("Winner confidence: %f (root nodes only)\n", conf/max(numroots, 1));
+}
 
-  map = &parameters.map;
-  /* Compute the mapping of nodes in the training and the test dataset */
-  if (KstepEnabled){
-    K_Step_Approximation(map, parameters.train, 1);
-    if (!flag)
-      K_Step_Approximation(map, parameters.test, 1);
+/******************************************************************************
+Description: Compute the mapping precision (E and e) of the map on the
+             training set, and print it with the quantization error. The
+             signatures and per-neuron results are released when done.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintPrecision(struct Evaluation *ev)
+{
+  struct Graph *train = ev->params->train;
+  UNSIGNED id;
+  FLOAT Si, sSi;
+  int N;
+
+  fprintf(stdout, "Qerror:%E\n", ev->qerror);
+
+  ev->sigs = GetSignatures(train, SIG_STRUCT);
+  ev->rootpos = GetRootPositions(train);
+  ev->si = (FLOAT*)MyCalloc(ev->index.noc + 1, sizeof(FLOAT));
+  ev->ssi = (FLOAT*)MyCalloc(ev->index.noc + 1, sizeof(FLOAT));
+  ev->maxhits = 0;
+  for (id = 0; id < ev->index.noc; id++)
+    ev->maxhits = max(ev->maxhits, ev->index.start[id+1] - ev->index.start[id]);
+  RunEvaluationWorkers(ev, ev->index.noc, PrecisionWorker);
+
+  /* Sum up in order of neurons, so that results do not depend on threads */
+  N = 0;
+  Si = sSi = 0.0;
+  for (id = 0; id < ev->index.noc; id++){
+    if (ev->index.start[id+1] == ev->index.start[id])
+      continue;
+    Si += ev->si[id];
+    sSi += ev->ssi[id];
+    N++;
   }
-  else{
-    GetNodeCoordinates(map, parameters.train);
-    if (!flag)
-      GetNodeCoordinates(map, parameters.test);
+  fprintf(stdout, "Struct mapping performance (E): %f\n", Si/N);
+  fprintf(stdout, "SubStruct mapping performance (e): %f\n", sSi/N);
+
+  free(ev->sigs);
+  free(ev->rootpos);
+  free(ev->si);
+  free(ev->ssi);
+  ev->sigs = NULL;
+  ev->rootpos = NULL;
+  ev->si = ev->ssi = NULL;
+}
+
+/******************************************************************************
+Description: Find the winners of the root nodes of the test set among the
+             neurons which were activated by root nodes of the training set,
+             and compute the class histograms of the neurons. The index of
+             the training set is released once the histograms are known.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void ClassifyTestRoots(struct Evaluation *ev)
+{
+  struct Parameters *params = ev->params;
+  struct Graph *gptr;
+  struct NodeIndex index;
+  UNSIGNED n;
+
+  ev->vmap = GetHits(params->map.xdim, params->map.ydim, params->train, ROOT | QUIET);
+  if (params->map.topology == TOPOL_VQ){ /* Classes are by coordinates */
+    index = BuildNodeIndex(&params->map, params->train, 0);
+    GetClusterIDFromIndex(params->map, &index, &ev->vmap);
+    FreeNodeIndex(&index);
+  }
+  else
+    GetClusterIDFromIndex(params->map, &ev->index, &ev->vmap);
+  FreeNodeIndex(&ev->index); /* Not used by the remaining metrics */
+  if (ev->test != params->train){
+    ev->tvmap = GetHits(params->map.xdim, params->map.ydim, ev->test, ROOT | QUIET);
+    GetClusterID(params->map, ev->test, &ev->tvmap);
   }
+  ev->active = BuildActiveMap(&params->map, &ev->vmap);
 
-  vmap = GetHits(parameters.map.xdim, parameters.map.ydim, parameters.train, ROOT);
-  GetClusterID(parameters.map, parameters.train, &vmap);
-  if (!flag){
-    tvmap = GetHits(parameters.map.xdim, parameters.map.ydim, parameters.test, ROOT);
-    GetClusterID(parameters.map, parameters.test, &tvmap);
+  ev->numroots = 0;
+  for (gptr = ev->test; gptr != NULL; gptr = gptr->next)
+    for (n = 0; n < gptr->numnodes; n++)
+      if (IsRoot(gptr->nodes[n]))
+	ev->numroots++;
+  ev->roots = (struct Node**)MyMalloc(ev->numroots * sizeof(struct Node*) + 1);
+  ev->rgraphs = (struct Graph**)MyMalloc(ev->numroots * sizeof(struct Graph*) + 1);
+  ev->rpos = (int*)MyMalloc(ev->numroots * sizeof(int) + 1);
+  ev->rcode = (UNSIGNED*)MyMalloc(ev->numroots * sizeof(UNSIGNED) + 1);
+  ev->numroots = 0;
+  for (gptr = ev->test; gptr != NULL; gptr = gptr->next){
+    for (n = 0; n < gptr->numnodes; n++){
+      if (!IsRoot(gptr->nodes[n]))
+	continue;
+      ev->roots[ev->numroots] = gptr->nodes[n];
+      ev->rgraphs[ev->numroots] = gptr;
+      ev->numroots++;
+    }
   }
+  RunEvaluationWorkers(ev, ev->numroots, RetrievalWorker);
+}
+
+/******************************************************************************
+Description: Print the retrieval, classification, and clustering performance
+             on the test set (classifyflag = 0), or the class of every root
+             node of the test set (classifyflag = 1), followed by the
+             confusion matrix of the training set.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintRetrieval(struct Evaluation *ev, int classifyflag)
+{
+  struct Map *map = &ev->params->map;
+  struct Node *node;
+  float R, P;
+  int C, n, winnerx, winnery;
+  UNSIGNED r;
+  int **matrix;
+
+  if (ev->params->test == NULL)
+    printf("Warning: No test file given. Will use training data for testing.\n");
+  PrintHits(&ev->vmap);  /* As if computed for this mode alone */
+  if (ev->test != ev->params->train)
+    PrintHits(&ev->tvmap);
 
   R = 0.0;
   C = 0;
   n = 0;
-  //For (every node in the test set){
-  for (gptr = parameters.test;gptr != NULL; gptr = gptr->next){
-    for (nnum = 0; nnum < gptr->numnodes; nnum++){
-      node = gptr->nodes[nnum];
-      if (!IsRoot(node))
-	continue;
-      FindWinnerEucledianOnActiveOnly(map, node, gptr, &winner, &vmap);
-      winnerx = map->codes[winner.codeno].x;
-      winnery = map->codes[winner.codeno].y;
-      n++;
-      R += ComputeClassificationConfusion(winnerx, winnery, &vmap);
-      if (classifyflag != 0)
-	fprintf(stdout, "Graph:%s %s (%d,%s)", gptr->gname, GetLabel(vmap.winnerclass[winnery][winnerx]), node->label, GetLabel(node->label));
-      if (node->label == vmap.winnerclass[winnery][winnerx]){
-	//	fprintf(stdout, "G\n");
-	C++;
-      }
-      //      else
-      //	fprintf(stdout, "B:%E\n", winner.diff);
-    }
+  for (r = 0; r < ev->numroots; r++){
+    if (ev->rpos[r] < 0)  /* No activated neurons */
+      continue;
+    node = ev->roots[r];
+    winnerx = map->codes[ev->rcode[r]].x;
+    winnery = map->codes[ev->rcode[r]].y;
+    n++;
+    R += ComputeClassificationConfusion(winnerx, winnery, &ev->vmap);
+    if (classifyflag != 0)
+      fprintf(stdout, "Graph:%s %s (%d,%s)", ev->rgraphs[r]->gname, GetLabel(ev->active.winnerclass[ev->rpos[r]]), node->label, GetLabel(node->label));
+    if (node->label == ev->active.winnerclass[ev->rpos[r]])
+      C++;
   }
-  if (flag)
-    P = GetClusteringPerformance(parameters, vmap);
-  else
-    P = GetClusteringPerformance(parameters, tvmap);
 
   if (classifyflag == 0){
+    if (ev->test == ev->params->train)
+      P = GetClusteringPerformance(*ev->params, ev->vmap);
+    else
+      P = GetClusteringPerformance(*ev->params, ev->tvmap);
     printf("Retrieval performance: %f\n", 100.0*R/n);
     printf("Classification performance: %f\n", (float)100.0*C/n);
     printf("Clustering performance: %f\n", P);
   }
 
-  //  for (n = 0; n < vmap.numclasses; n++)
-  //    fprintf(stdout, "%s\n", GetLabel(n+1));
+  matrix = ComputeConfusionMatrix(map->xdim, map->ydim, &ev->vmap);
+  for (n = 0; n < ev->vmap.numclasses; n++)
+    free(matrix[n]);
+  free(matrix);
+}
+
+/******************************************************************************
+Description: Compute the metrics of the modes PRECISION, RETRIEVALPERF,
+             CLASSIFY, and TOPOGRAPHIC given in mode in a single pass. The
+             training and the test set are mapped once, the nodes of the
+             training set are grouped by neuron once, and the class
+             histograms and the winners of the test roots are computed once
+             for all modes. The per neuron precision and the searches of the
+             map for the test nodes run in parallel in params->ncpu threads.
+             The output is the same as if the modes were evaluated one after
+             another.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void Evaluate(struct Parameters *params, UNSIGNED mode)
+{
+  struct Evaluation ev;
+
+  if (params->train == NULL)
+    return;
+
+  memset(&ev, 0, sizeof(struct Evaluation));
+  ev.params = params;
+  ev.numthreads = (params->ncpu > 0) ? params->ncpu : 1;
+  ev.test = (params->test != NULL) ? params->test : params->train;
+  pthread_mutex_init(&ev.lock, NULL);
+
+  /* Map the datasets, and group the nodes of the training set by neuron */
+  if ((mode & (PRECISION | TOPOGRAPHIC)) && params->map.topology == TOPOL_VQ)
+    VQSet_ab(params);
+  TraceBegin("MapDataset");
+  ev.qerror = MapDataset(&params->map, params->train);
+  if (ev.test != params->train && (mode & (RETRIEVALPERF | CLASSIFY | TOPOGRAPHIC)))
+    MapDataset(&params->map, ev.test);
+  if (mode & (PRECISION | RETRIEVALPERF | CLASSIFY))
+    ev.index = BuildNodeIndex(&params->map, params->train, 1);
+  TraceEnd();
+
+  if (mode & PRECISION){
+    TraceBegin("Precision");
+    PrintPrecision(&ev);
+    TraceEnd();
+  }
+  if (mode & (RETRIEVALPERF | CLASSIFY)){
+    TraceBegin("Retrieval");
+    ClassifyTestRoots(&ev);
+    if (mode & RETRIEVALPERF)
+      PrintRetrieval(&ev, 0);
+    if (mode & CLASSIFY)
+      PrintRetrieval(&ev, 1);
+    TraceEnd();
+    FreeActiveMap(&ev.active);
+  }
+  if (mode & TOPOGRAPHIC){
+    TraceBegin("Topographic");
+    PrintTopographicError(&ev);
+    TraceEnd();
+  }
+
+  pthread_mutex_destroy(&ev.lock);
+  FreeNodeIndex(&ev.index);
+  if (ev.vmap.activation != NULL)
+    FreeVMap(params->map.xdim, params->map.ydim, &ev.vmap);
+  if (ev.tvmap.activation != NULL)
+    FreeVMap(params->map.xdim, params->map.ydim, &ev.tvmap);
+  free(ev.roots);
+  free(ev.rgraphs);
+  free(ev.rpos);
+  free(ev.rcode);
+  free(ev.nodes);
+  free(ev.ngraphs);
+  free(ev.top);
+}
+
+
+/******************************************************************************
+Description: Thread which maps the graphs of a streamed test set against the
+             frozen map, and finds the winners of their root nodes among the
+             neurons activated by the training set. Graphs are taken in the
+             order in which they were read. The map is used without the cache
+             of winners, which is not shared between threads.
+
+Return value: NULL.
+******************************************************************************/
+void *StreamWorker(void *arg)
+{
+  struct ClassifyStream *cs = (struct ClassifyStream*)arg;
+  struct Evaluation *ev = cs->ev;
+  struct StreamSlot *slot;
+  struct Map map;
+  struct Winner winner = {0};
+  struct Graph *gptr;
+  UNSIGNED n, r;
+  FLOAT *dist;
+
+  map = ev->params->map;
+  map.memo = NULL;
+  dist = (FLOAT*)MyMalloc(ev->active.num * sizeof(FLOAT) + 1);
+  for (;;){
+    pthread_mutex_lock(&cs->lock);
+    while (cs->nextwork == cs->nextread && !cs->eof)
+      pthread_cond_wait(&cs->work, &cs->lock);
+    if (cs->nextwork == cs->nextread){   /* All graphs were handed out */
+      pthread_mutex_unlock(&cs->lock);
+      break;
+    }
+    slot = &cs->slots[cs->nextwork % cs->qsize];
+    cs->nextwork++;
+    pthread_mutex_unlock(&cs->lock);
+
+    gptr = slot->graph;
+    if (KstepEnabled)
+      K_Step_Approximation(&map, gptr, 1);
+    else
+      GetNodeCoordinates(&map, gptr);
+    slot->numroots = 0;
+    for (n = 0; n < gptr->numnodes; n++)
+      if (IsRoot(gptr->nodes[n]))
+	slot->numroots++;
+    slot->roots = (struct Node**)MyMalloc(slot->numroots * sizeof(struct Node*) + 1);
+    slot->rpos = (int*)MyMalloc(slot->numroots * sizeof(int) + 1);
+    slot->rcode = (UNSIGNED*)MyMalloc(slot->numroots * sizeof(UNSIGNED) + 1);
+    for (n = 0, r = 0; n < gptr->numnodes; n++){
+      if (!IsRoot(gptr->nodes[n]))
+	continue;
+      slot->roots[r] = gptr->nodes[n];
+      slot->rpos[r] = FindWinnerOnActive(&ev->active, gptr->nodes[n], gptr, &winner, dist);
+      slot->rcode[r] = winner.codeno;
+      r++;
+    }
+
+    pthread_mutex_lock(&cs->lock);
+    slot->done = 1;
+    pthread_cond_broadcast(&cs->done);
+    pthread_mutex_unlock(&cs->lock);
+  }
+  free(dist);
+  return NULL;
+}
+
+/******************************************************************************
+Description: Print the classification of the root nodes of the graph in the
+             next slot of the reorder buffer, once it is classified, and free
+             the slot. If wait is zero, then nothing is done if the graph is
+             not classified yet.
+
+Return value: 1 if a graph was printed, 0 otherwise.
+******************************************************************************/
+int PrintStreamSlot(struct ClassifyStream *cs, int wait, UNSIGNED *N, UNSIGNED *C)
+{
+  struct StreamSlot *slot;
+  struct Node *node;
+  UNSIGNED r, wclass;
+  int done;
 
-  ComputeConfusionMatrix(parameters.map.xdim, parameters.map.ydim, &vmap);
+  pthread_mutex_lock(&cs->lock);
+  if (cs->nextprint == cs->nextread){
+    pthread_mutex_unlock(&cs->lock);
+    return 0;
+  }
+  slot = &cs->slots[cs->nextprint % cs->qsize];
+  if (!slot->done && wait){
+    fflush(stdout);    /* Pass on what is done while waiting */
+    while (!slot->done)
+      pthread_cond_wait(&cs->done, &cs->lock);
+  }
+  done = slot->done;
+  pthread_mutex_unlock(&cs->lock);
+  if (!done)
+    return 0;
 
-  if (flag)
-    parameters.test = NULL;  /* Restore test pointer */
+  for (r = 0; r < slot->numroots; r++){
+    if (slot->rpos[r] < 0)  /* No activated neurons */
+      continue;
+    node = slot->roots[r];
+    wclass = cs->ev->active.winnerclass[slot->rpos[r]];
+    fprintf(stdout, "Graph:%s %s (%d,%s)\n", slot->graph->gname, GetLabel(wclass), node->label, GetLabel(node->label));
+    (*N)++;
+    if (node->label == wclass)
+      (*C)++;
+  }
+  FreeGraphs(slot->graph);
+  free(slot->roots);
+  free(slot->rpos);
+  free(slot->rcode);
+  memset(slot, 0, sizeof(struct StreamSlot));
+
+  pthread_mutex_lock(&cs->lock);
+  cs->nextprint++;
+  pthread_mutex_unlock(&cs->lock);
+  return 1;
 }
 
+/******************************************************************************
+Description: Classify the root nodes of the test set in file
+             params->testfile ('-' for stdin) without loading it. Graphs are
+             read one at a time and mapped by params->ncpu worker threads.
+             The results are printed in the order of the input through a
+             reorder buffer of STREAM_QUEUE graphs per thread, which also
+             limits the number of graphs in memory. Graphs are mapped and
+             classified in the same way as by mode classify, and the label
+             table is only used by this thread, which reads the graphs and
+             prints the results.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void StreamClassify(struct Parameters *params)
+{
+  struct Evaluation ev;
+  struct ClassifyStream cs;
+  struct GraphStream *stream;
+  struct Graph *gptr;
+  pthread_t *threads;
+  UNSIGNED n, numthreads, N, C;
+  int **matrix;
+
+  if (params->train == NULL)
+    return;
+
+  /* Winner classes of the neurons activated by the training set */
+  memset(&ev, 0, sizeof(struct Evaluation));
+  ev.params = params;
+  MapDataset(&params->map, params->train);
+  ev.index = BuildNodeIndex(&params->map, params->train, 0);
+  ev.vmap = GetHits(params->map.xdim, params->map.ydim, params->train, ROOT | QUIET);
+  GetClusterIDFromIndex(params->map, &ev.index, &ev.vmap);
+  ev.active = BuildActiveMap(&params->map, &ev.vmap);
+  PrintHits(&ev.vmap);
+
+  if ((stream = OpenGraphStream(params->testfile)) == NULL || CheckErrors()){
+    CloseGraphStream(stream);
+    FreeActiveMap(&ev.active);
+    FreeNodeIndex(&ev.index);
+    FreeVMap(params->map.xdim, params->map.ydim, &ev.vmap);
+    return;
+  }
+
+  memset(&cs, 0, sizeof(struct ClassifyStream));
+  cs.ev = &ev;
+  numthreads = (params->ncpu > 0) ? params->ncpu : 1;
+  cs.qsize = STREAM_QUEUE * numthreads;
+  cs.slots = (struct StreamSlot*)MyCalloc(cs.qsize, sizeof(struct StreamSlot));
+  pthread_mutex_init(&cs.lock, NULL);
+  pthread_cond_init(&cs.work, NULL);
+  pthread_cond_init(&cs.done, NULL);
+  threads = (pthread_t*)MyMalloc(numthreads * sizeof(pthread_t));
+  for (n = 0; n < numthreads; n++)
+    if (pthread_create(&threads[n], NULL, StreamWorker, &cs) != 0)
+      break;
+  numthreads = n;
+  if (numthreads == 0)
+    AddError("Unable to start threads for classification.");
+
+  N = C = 0;
+  while (numthreads > 0 && (gptr = ReadNextGraph(stream)) != NULL){
+    if (gptr->dimension != params->train->dimension){
+      AddError("Dimension of test graphs differs from the training set.");
+      FreeGraphs(gptr);
+      break;
+    }
+    PrepareGraph(params, gptr);
+
+    /* Wait for a free slot, print what is classified */
+    while (cs.nextread - cs.nextprint == cs.qsize)
+      PrintStreamSlot(&cs, 1, &N, &C);
+    while (PrintStreamSlot(&cs, 0, &N, &C));
+
+    pthread_mutex_lock(&cs.lock);
+    cs.slots[cs.nextread % cs.qsize].graph = gptr;
+    cs.nextread++;
+    pthread_cond_signal(&cs.work);
+    pthread_mutex_unlock(&cs.lock);
+  }
+  pthread_mutex_lock(&cs.lock);
+  cs.eof = 1;
+  pthread_cond_broadcast(&cs.work);
+  pthread_mutex_unlock(&cs.lock);
+  while (PrintStreamSlot(&cs, 1, &N, &C));
+  while (numthreads > 0)
+    pthread_join(threads[--numthreads], NULL);
+  CloseGraphStream(stream);
+
+  if (N > 0)
+    printf("Classification performance: %f\n", (float)100.0*C/N);
+  matrix = ComputeConfusionMatrix(params->map.xdim, params->map.ydim, &ev.vmap);
+  for (n = 0; n < ev.vmap.numclasses; n++)
+    free(matrix[n]);
+  free(matrix);
+  fflush(stdout);
+
+  pthread_mutex_destroy(&cs.lock);
+  pthread_cond_destroy(&cs.work);
+  pthread_cond_destroy(&cs.done);
+  free(threads);
+  free(cs.slots);
+  FreeActiveMap(&ev.active);
+  FreeNodeIndex(&ev.index);
+  FreeVMap(params->map.xdim, params->map.ydim, &ev.vmap);
+}
 
 /******************************************************************************
 Description: 
@@ -2348,98 +3151,173 @@ void Truncate(struct Parameters parameters, int maxout)
 
 
 /******************************************************************************
-Description: 
+Description: Select the k smallest of num distances, in order of increasing
+             distance. Among equal distances the lower index comes first.
 
-Return value: 
+Return value: The indices and distances are returned to nearest[0..k-1].
 ******************************************************************************/
-void ListDistances(struct Parameters parameters)
+void SelectNearest(FLOAT *dist, UNSIGNED num, struct Winner *nearest, UNSIGNED k)
 {
-  int n, nc;
-  FLOAT qerr;
-  struct Graph *graph;
-  struct Node *node;
+  UNSIGNED n, j;
+
+  for (j = 0; j < k; j++)
+    nearest[j].diff = FLT_MAX;
+  for (n = 0; n < num; n++){
+    if (dist[n] >= nearest[k-1].diff)
+      continue;
+    for (j = k-1; j > 0 && nearest[j-1].diff > dist[n]; j--)
+      nearest[j] = nearest[j-1];
+    nearest[j].codeno = n;
+    nearest[j].diff = dist[n];
+  }
+}
+
+/******************************************************************************
+Description: Write the header of a .npy file (format version 1.0) for an
+             array of the given shape and numpy type descriptor descr. The
+             header is padded so that the data starts at a multiple of 64
+             bytes.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void WriteNpyHeader(FILE *ofile, char *descr, UNSIGNED rows, UNSIGNED cols)
+{
+  char header[256];
+  unsigned char len[2];
+  int n;
+
+  n = snprintf(header, sizeof(header), "{'descr': %s, 'fortran_order': False, 'shape': (%lu, %lu), }", descr, (unsigned long)rows, (unsigned long)cols);
+  while ((10 + n + 1) % 64 != 0)
+    header[n++] = ' ';
+  header[n++] = '\n';
+  len[0] = n & 0xff;
+  len[1] = (n >> 8) & 0xff;
+  fwrite("\x93NUMPY\x01\x00", 1, 8, ofile);
+  fwrite(len, 1, 2, ofile);
+  fwrite(header, 1, n, ofile);
+}
+
+/******************************************************************************
+Description: Compute the weighted squared distance of every node in the
+             dataset to every codebook of the map, and write them to the .npy
+             file fname, one row per node in the order of graphs and nodes in
+             the dataset. The nodes are processed in blocks of
+             DIST_BLOCKROWS rows, so that memory use does not depend on the
+             size of the dataset. If knn > 0, then only the knn nearest
+             codebooks of every node are written, in order of increasing
+             distance, as records of the codebook ID and the distance. Among
+             codebooks at the same distance the one with the lower ID comes
+             first.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void ListDistances(struct Parameters parameters, char *fname, UNSIGNED knn)
+{
+  struct Graph *gptr;
   struct Map *map;
-  struct Winner winner;
+  struct ActiveMap all;
+  struct Node **nodes;
+  struct Graph **graphs;
+  struct Winner *nearest;
+  FLOAT *dist;
+  unsigned char *rec;
+  char descr[128], endian;
+  UNSIGNED n, n2, b, num, numnodes, noc, reclen;
+  FILE *ofile;
   time_t t;
-  FLOAT *mu;
-  UNSIGNED tend;
-  UNSIGNED noc;  /* Number of codebooks in the map */
-  FLOAT *codebook, *sample;
-  UNSIGNED i;
-  FLOAT diff, difference, dist;
+  int32_t id;
 
   if (parameters.train == NULL)
     return;
-
   map = &parameters.map;
+  if (map->topology == TOPOL_VQ){
+    fprintf(stderr, "Warning: Mode distances is not available in VQ mode.\n");
+    return;
+  }
+  if (fname == NULL){
+    fprintf(stderr, "Error: Mode distances needs an output file (option -dout).\n");
+    return;
+  }
+  if ((ofile = fopen(fname, "wb")) == NULL){
+    fprintf(stderr, "Error: Unable to open '%s' for writing.\n", fname);
+    return;
+  }
 
-  /* Find the winners for all nodes */
-  if (KstepEnabled)
-    qerr = K_Step_Approximation(map, parameters.train, 1);
-  else
-    qerr = GetNodeCoordinates(map, parameters.train);
+  /* Find the winners for all nodes, which sets the states of offsprings */
+  MapDataset(map, parameters.train);
+
+  noc = map->xdim * map->ydim;
+  knn = min(knn, noc);
+  numnodes = 0;
+  for (gptr = parameters.train; gptr != NULL; gptr = gptr->next)
+    numnodes += gptr->numnodes;
+
+  endian = (FindEndian() == BIG_ENDIAN) ? '>' : '<';
+  if (knn == 0){
+    sprintf(descr, "'%cf%d'", endian, (int)sizeof(FLOAT));
+    WriteNpyHeader(ofile, descr, numnodes, noc);
+  }
+  else{
+    sprintf(descr, "[('codeno', '%ci4'), ('distance', '%cf%d')]", endian, endian, (int)sizeof(FLOAT));
+    WriteNpyHeader(ofile, descr, numnodes, knn);
+  }
 
   t = time(NULL);
   printf("#Generated: %s", ctime(&t));
   printf("#Dataset: %s\n", parameters.datafile);
   printf("#Network: %s\n", parameters.inetfile);
-  printf("#Network is of size: %d x %d = %d\n", map->xdim, map->ydim, map->xdim*map->ydim);
+  printf("#Network is of size: %d x %d = %d\n", map->xdim, map->ydim, noc);
   printf("#Note: All distances are squared values\n");
+  if (knn == 0)
+    printf("#Written: %s (%d nodes x %d codebooks)\n", fname, numnodes, noc);
+  else
+    printf("#Written: %s (%d nodes x %d nearest codebooks)\n", fname, numnodes, knn);
 
-  for (graph = parameters.train; graph != NULL; graph = graph->next){
-    printf("\ngraph:%s\n", graph->gname);
-    for (n = 0; n < graph->numnodes; n++)
-      if (IsRoot(graph->nodes[n]))
-	break;
-    printf("class:%s\n", GetLabel(graph->nodes[n]->label));
-    for (n = 0; n < graph->numnodes; n++){
-      node = graph->nodes[n];
-      FindWinnerEucledian(map, node, graph, &winner);  //Find best match at location
-      printf("  node:%d\n", node->nnum);
-      if (node->x != map->codes[winner.codeno].x && node->y != map->codes[winner.codeno].y)
-	fprintf(stderr, "Internal error\n");
-      printf("  Coordinate of best winner:%d %d\n", map->codes[winner.codeno].x, map->codes[winner.codeno].y);
-      printf("  Distance to best winner:%lE\n", winner.diff);
-      printf("  Distances to direct neighbors (x y distance):\n");
-      //      printf("  # Listing data as follows: Coords of        \n");
-      //      printf("  # neighbor, distance between node and codebook\n");
-      //      printf("  #---------------------------------------------\n");
-
-      tend = graph->dimension;
-      mu = node->mu;
-
-      noc = map->xdim * map->ydim;
-      sample = node->points;
-
-
+  all = BuildActiveMap(map, NULL);
+  nodes = (struct Node**)MyMalloc(DIST_BLOCKROWS * sizeof(struct Node*));
+  graphs = (struct Graph**)MyMalloc(DIST_BLOCKROWS * sizeof(struct Graph*));
+  dist = (FLOAT*)MyMalloc(DIST_BLOCKROWS * noc * sizeof(FLOAT));
+  reclen = sizeof(int32_t) + sizeof(FLOAT);
+  nearest = (struct Winner*)MyMalloc((knn + 1) * sizeof(struct Winner));
+  rec = (unsigned char*)MyMalloc(DIST_BLOCKROWS * (knn + 1) * reclen);
 
-      for (nc = 0; nc < noc; nc++){  /* For every codebook of the map */
-	dist  = ComputeHexaDistance(25, 76, map->codes[nc].x, map->codes[nc].y);
-	if (dist > 1.1 ||  dist < 0.9)
-	  continue;
-	printf("    %d %d \n", map->codes[nc].x, map->codes[nc].y);
+  for (gptr = parameters.train; gptr != NULL && gptr->numnodes == 0; gptr = gptr->next);
+  n = 0;
+  while (gptr != NULL){
+    /* Collect the next block of nodes */
+    for (num = 0; num < DIST_BLOCKROWS && gptr != NULL; num++){
+      nodes[num] = gptr->nodes[n];
+      graphs[num] = gptr;
+      if (++n >= gptr->numnodes){
+	for (gptr = gptr->next; gptr != NULL && gptr->numnodes == 0; gptr = gptr->next);
+	n = 0;
       }
-      exit(0);
-
-
-      for (nc = 0; nc < noc; nc++){  /* For every codebook of the map */
-
-	dist  = ComputeHexaDistance(node->x, node->y, map->codes[nc].x, map->codes[nc].y);
-	if (dist > 1.1 ||  dist < 0.9)
-	  continue;
-
-	codebook = map->codes[nc].points;
-	difference = 0.0;
+    }
+    ComputeDistanceBlock(&all, nodes, graphs, num, dist);
 
-	/* Compute the difference between codebook and input entry */
-	for (i = 0; i < tend; i++){
-	  diff = codebook[i] - sample[i];
-	  difference += diff * diff * mu[i];
-	}
-	printf("    %d %d %lE\n", map->codes[nc].x, map->codes[nc].y,difference);
+    if (knn == 0){
+      fwrite(dist, sizeof(FLOAT), num * noc, ofile);
+      continue;
+    }
+    for (b = 0; b < num; b++){
+      SelectNearest(&dist[b * noc], noc, nearest, knn);
+      for (n2 = 0; n2 < knn; n2++){
+	id = (int32_t)nearest[n2].codeno;
+	memcpy(&rec[(b * knn + n2) * reclen], &id, sizeof(int32_t));
+	memcpy(&rec[(b * knn + n2) * reclen + sizeof(int32_t)], &nearest[n2].diff, sizeof(FLOAT));
       }
     }
+    fwrite(rec, reclen, num * knn, ofile);
   }
+  if (fclose(ofile) != 0)
+    fprintf(stderr, "Error: Unable to write '%s'.\n", fname);
+
+  FreeActiveMap(&all);
+  free(nodes);
+  free(graphs);
+  free(dist);
+  free(nearest);
+  free(rec);
 }
 
 
@@ -2469,10 +3347,7 @@ void CreateWebSOMOutput(struct Parameters parameters)
   fprintf(stderr, ">>>>%d %d %d %d\n", (int)ceil(10.1), (int)ceil(10.0), (int)ceil(10.7), dimlabel);
 
   /* Find the winners for all nodes */
-  if (KstepEnabled)
-    qerr = K_Step_Approximation(map, parameters.train, 1);
-  else
-    qerr = GetNodeCoordinates(map, parameters.train);
+  qerr = MapDataset(map, parameters.train);
 
   hits = (int*)MyMalloc(map->xdim*map->ydim*sizeof(int));
   t = time(NULL);
@@ -2523,15 +3398,29 @@ Return value: zero
 ******************************************************************************/
 int main(int argc, char **argv)
 {
-  UNSIGNED i, mode, maxout;
+  UNSIGNED i, mode, maxout, memo = 0, knn = 0;
+  int sidecar = 1, stream = 0;
+  char *distfile = NULL;
   int x = -1, y = -1;
+  char *cptr = NULL;
   struct Parameters parameters;
 
   mode = 0;
   memset(&parameters, 0, sizeof(struct Parameters));
   for (i = 1; i < argc; i++){
-    if (!strncmp(argv[i], "-cin", 2))
+    if (!strcmp(argv[i], "-cachedir")){
+      GetArg(TYPE_STRING, argc, argv, i++, &cptr);
+      SetCacheDir(cptr);
+      free(cptr);
+    }
+    else if (!strcmp(argv[i], "-cpu"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &parameters.ncpu);
+    else if (!strcmp(argv[i], "-trace"))
+      GetArg(TYPE_STRING, argc, argv, i++, &parameters.tracefile);
+    else if (!strncmp(argv[i], "-cin", 2))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters.inetfile);
+    else if (!strcmp(argv[i], "-dout"))
+      GetArg(TYPE_STRING, argc, argv, i++, &distfile);
     else if (!strncmp(argv[i], "-din", 2))
       GetArg(TYPE_STRING, argc, argv, i++, &parameters.datafile);
     else if (!strncmp(argv[i], "-tin", 2))
@@ -2564,6 +3453,8 @@ int main(int argc, char **argv)
 	mode |= RETRIEVALPERF;
       else if (!strcmp(argv[i], "classify"))
 	mode |= CLASSIFY;
+      else if (!strcmp(argv[i], "topographic"))
+	mode |= TOPOGRAPHIC;
       else if (!strcmp(argv[i], "analyse"))
 	mode |= ANALYSE;
       else if (!strcmp(argv[i], "balance"))
@@ -2590,6 +3481,12 @@ int main(int argc, char **argv)
       GetArg(TYPE_INT, argc, argv, i++, &x);
     else if (!strcmp(argv[i], "-y"))
       GetArg(TYPE_INT, argc, argv, i++, &y);
+    else if (!strcmp(argv[i], "-knn"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &knn);
+    else if (!strcmp(argv[i], "-memo"))
+      GetArg(TYPE_UNSIGNED, argc, argv, i++, &memo);
+    else if (!strcmp(argv[i], "-nosidecar"))
+      sidecar = 0;
     else if (!strcmp(argv[i], "-mu1"))
       GetArg(TYPE_FLOAT, argc, argv, i++, &parameters.mu1);
     else if (!strcmp(argv[i], "-mu2"))
@@ -2602,6 +3499,8 @@ int main(int argc, char **argv)
       parameters.verbose = 1;
     else if (!strcmp(argv[i], "-undirected"))
       parameters.undirected = 1;
+    else if (!strcmp(argv[i], "-stream"))
+      stream = 1;
     else if (!strcmp(argv[i], "-help") || !strcmp(argv[i], "-h") || !strcmp(argv[i], "-?")){
       Usage();
     }
@@ -2620,27 +3519,50 @@ int main(int argc, char **argv)
   /* Check that we have useful initial data */
   if (mode == 0)
     AddError("No test mode given. Nothing to do.");
-
+  if (stream && parameters.testfile == NULL)
+    AddError("Option -stream needs a test set (-tin, '-' for stdin).");
+  if (stream && !(mode & CLASSIFY))
+    AddError("Option -stream requires mode classify.");
+  else if (stream && (mode & ~(CLASSIFY | PRECISION)))
+    AddError("Option -stream can only be combined with mode precision.");
+  if (parameters.ncpu == 0)
+    parameters.ncpu = GetNumCPU();
+
+  TraceOpen(parameters.tracefile);  /* Record a timeline if requested */
+  TraceBegin("LoadMap");
   if (CheckErrors() == 0 && parameters.inetfile)    /* No errors so far ... */
     LoadMap(&parameters);      /* Load map data */
+  TraceEnd();
+
+  /* The map does not change from here on, so winners can be remembered */
+  if (CheckErrors() == 0 && memo > 0)
+    parameters.map.memo = NewWinnerCache((size_t)memo * 1048576);
 
+  TraceBegin("LoadData");
   if (CheckErrors() == 0 && parameters.datafile)    /* No errors so far ... */
     parameters.train = LoadData(parameters.datafile); /* Load the dataset */
 
-  if (CheckErrors() == 0 && parameters.testfile != NULL)
+  if (CheckErrors() == 0 && parameters.testfile != NULL && !stream)
     parameters.test = LoadData(parameters.testfile); /* Load the test set */
+  TraceEnd();
 
   if (CheckErrors() == 0 && parameters.undirected) /* treat as undirected */
     ConvertToUndirectedLinks(parameters.train);
 
+  TraceBegin("PrepareData");
   if (CheckErrors() == 0)      /* No errors so far ... */
     PrepareData(&parameters); /* Prepare data for processing*/
+  TraceEnd();
 
-  if (parameters.train->FanIn > 0){
+  if (parameters.train != NULL && parameters.train->FanIn > 0){
     fprintf(stderr, "Contextual data detected. K-step approximation enabled.\n");
     KstepEnabled = 1;
   }
 
+  if (sidecar)  /* Save and reuse the winners of the nodes */
+    MappingFile = parameters.inetfile;
+
+  TraceBegin("Evaluate");
   if (CheckErrors() == 0){     /* If there were no errors so far then      */
     if (mode & CONTEXTUAL)
       ClassifyAndWriteDatafile(parameters.map, parameters.train);
@@ -2662,26 +3584,27 @@ int main(int argc, char **argv)
       VisualizeClustering(parameters);
     if (mode & SHOWSUBGRAPHS)
       VisualizeSubGraphs(parameters);
-    if (mode & PRECISION)
-      ComputePrecision(parameters);
-    if (mode & RETRIEVALPERF)
-      ComputeRetrievalPerformance(parameters, 0);
-    if (mode & CLASSIFY)
-      ComputeRetrievalPerformance(parameters, 1);
+    if ((mode & (PRECISION | RETRIEVALPERF | TOPOGRAPHIC)) || (!stream && (mode & CLASSIFY)))
+      Evaluate(&parameters, stream ? (mode & ~CLASSIFY) : mode);  /* All in one pass */
+    if (stream && (mode & CLASSIFY))
+      StreamClassify(&parameters);
     if (mode & ANALYSE)
       AnalyseDataset(parameters);
     //      AnalyseGraphs(parameters);
     if (mode & BALANCE)
       BalanceGraphs(parameters);
     if (mode & DISTANCES)
-      ListDistances(parameters);
+      ListDistances(parameters, distfile, knn);
     if (mode & TRUNCATE)
       Truncate(parameters, maxout);
     if (mode & WEBSOM)
       CreateWebSOMOutput(parameters);
   }
+  TraceEnd();
 
+  PrintWinnerCacheStats(stderr, parameters.map.memo);
   Cleanup(&parameters);         /* Free allocated memory and flush errors */
+  free(distfile);
 
   if (parameters.verbose != 0)
     fprintf(stderr, "all done.\n");
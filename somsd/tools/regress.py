@@ -0,0 +1,354 @@
+#!/usr/bin/env python3
+"""
+  Contents: End-to-end benchmark and regression suite of the somsd package.
+            Every bundled dataset is processed by initsom, somsd and testsom
+            with fixed seeds. Load time, training throughput, evaluation
+            time, peak memory use, and the quality measures are recorded, and
+            compared against a stored baseline.
+
+  Author: Markus Hagenbuchner
+
+  Comments and questions concerning this program package may be sent
+  to 'markus@artificial-neural.net'
+
+  ChangeLog:
+    18/10/2026
+      - Initial version.
+      - Added dataset alkanes-compress, which trains with somsd -compress.
+      - Dataset circles is evaluated with mode precision.
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+TOOLDIR = os.path.dirname(os.path.abspath(__file__))
+SRCDIR = os.path.dirname(TOOLDIR)
+
+# The datasets and the parameters with which they are processed. Paths are
+# relative to the data directory. Key "somsd" holds additional options of
+# somsd: alkanes-compress tracks the results of training with -compress,
+# which differ from those of plain training. testsom mode
+# retrievalperformance requires labelled root nodes, so the datasets which
+# lack them are evaluated with mode precision only. The graphs of circles
+# are cycles without a root node, and there the first node of a graph
+# stands for its root.
+DATASETS = [
+    {"name": "alkanes", "train": "alkanes/alkane.txt", "test": "alkanes/alkane.txt",
+     "xdim": 12, "ydim": 10, "iter": 20, "modes": ["precision", "retrievalperformance"]},
+    {"name": "alkanes-compress", "train": "alkanes/alkane.txt", "test": "alkanes/alkane.txt",
+     "xdim": 12, "ydim": 10, "iter": 20, "modes": ["precision", "retrievalperformance"],
+     "somsd": ["-compress"]},
+    {"name": "policeman", "train": "policeman/policeman.txt", "test": "policeman/policemantest.txt",
+     "xdim": 12, "ydim": 10, "iter": 20, "modes": ["precision"]},
+    {"name": "essen", "train": "essen/essen.txt", "test": "essen/essentest.txt",
+     "xdim": 12, "ydim": 10, "iter": 20, "modes": ["precision"]},
+    {"name": "digits", "train": "digits/digits.txt", "test": "digits/digits.txt",
+     "xdim": 12, "ydim": 10, "iter": 10, "modes": ["precision", "retrievalperformance"]},
+    {"name": "ships", "train": "ships/ships.txt", "test": "ships/shipstest.txt",
+     "xdim": 12, "ydim": 10, "iter": 10, "modes": ["precision", "retrievalperformance"]},
+    {"name": "mirex", "train": "mirex.txt", "test": "mirex.txt",
+     "xdim": 12, "ydim": 10, "iter": 20, "modes": ["precision"]},
+    {"name": "circles", "train": "circles.txt", "test": None,
+     "xdim": 6, "ydim": 5, "iter": 20, "modes": ["precision"]},
+]
+ALPHA = "0.9"
+INITSEED = "3"
+TRAINSEED = "1"
+
+# Measures reported by testsom, and the keys under which they are recorded
+QUALITY = [
+    (r"^Qerror:\s*(\S+)", "qerror"),
+    (r"^Struct mapping performance \(E\):\s*(\S+)", "E"),
+    (r"^SubStruct mapping performance \(e\):\s*(\S+)", "e"),
+    (r"^Retrieval performance:\s*(\S+)", "retrieval"),
+    (r"^Classification performance:\s*(\S+)", "classification"),
+    (r"^Clustering performance:\s*(\S+)", "clustering"),
+]
+
+# Measures compared against the baseline. Speed measures where larger is
+# better are marked with +1, those where smaller is better with -1.
+SPEED = {"load_sec": -1, "train_sec": -1, "train_nodes_per_sec": +1,
+         "eval_sec": -1}
+MEMORY = ["train_rss_kb", "eval_rss_kb"]
+TIME_OF = {"load_sec": "load_sec", "train_sec": "train_sec",
+           "train_nodes_per_sec": "train_sec", "eval_sec": "eval_sec"}
+
+
+def peak_rss(pid):
+    """Peak resident set size of a running process in KiB, read from /proc.
+    Unlike the resource usage returned by wait4(), this excludes the memory
+    of this script which the child had before it executed the program.
+
+    Return value: Peak RSS in KiB, or 0 if not available."""
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except (OSError, ValueError):
+        pass
+    return 0
+
+
+def run(cmd, logfile):
+    """Run cmd, append its output to logfile, and measure the wall clock
+    time and the peak resident set size of the process.
+
+    Return value: (exit status, stdout, seconds, peak RSS in KiB)."""
+    rss = 0
+    with open(logfile, "a") as log, tempfile.TemporaryFile() as outf:
+        log.write("$ " + " ".join(cmd) + "\n")
+        log.flush()
+        start = time.monotonic()
+        proc = subprocess.Popen(cmd, stdout=outf, stderr=log)
+        while True:
+            pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+            if pid != 0:
+                break
+            rss = max(rss, peak_rss(proc.pid))
+            time.sleep(0.001)
+        seconds = time.monotonic() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        outf.seek(0)
+        out = outf.read().decode(errors="replace")
+        log.write(out)
+    if rss == 0:                        # No /proc, or too short to sample
+        rss = usage.ru_maxrss           # KiB on Linux, bytes on macOS
+        if sys.platform == "darwin":
+            rss //= 1024
+    return proc.returncode, out, seconds, rss
+
+
+def span_seconds(tracefile, name):
+    """Sum of the durations of all spans called name in a trace file."""
+    try:
+        with open(tracefile) as f:
+            events = json.load(f)["traceEvents"]
+    except (OSError, ValueError, KeyError):
+        return None
+    return sum(e["dur"] for e in events
+               if e.get("ph") == "X" and e.get("name") == name) * 1e-6
+
+
+def run_dataset(ds, args, workdir):
+    """Process a single dataset and collect its measures.
+
+    Return value: Dictionary of measures, with key "error" set on failure."""
+    res = {}
+    train = os.path.join(args.data, ds["train"])
+    log = os.path.join(workdir, ds["name"] + ".log")
+    init = os.path.join(workdir, ds["name"] + "-init.net")
+    net = os.path.join(workdir, ds["name"] + ".net")
+    metrics = os.path.join(workdir, ds["name"] + "-metrics.json")
+    trace = os.path.join(workdir, ds["name"] + "-train.json")
+    etrace = os.path.join(workdir, ds["name"] + "-eval.json")
+    initsom = os.path.join(args.bindir, "initsom")
+    somsd = os.path.join(args.bindir, "somsd")
+    testsom = os.path.join(args.bindir, "testsom")
+
+    status, _, _, _ = run([initsom, "-din", train, "-cout", init,
+                           "-xdim", str(ds["xdim"]), "-ydim", str(ds["ydim"]),
+                           "-seed", INITSEED], log)
+    if status != 0:
+        return {"error": "initsom failed with status %d" % status}
+
+    status, _, seconds, rss = run([somsd, "-cin", init, "-din", train,
+                                   "-cout", net, "-iter", str(ds["iter"]),
+                                   "-alpha", ALPHA, "-seed", TRAINSEED,
+                                   "-metrics", metrics, "-trace", trace]
+                                  + ds.get("somsd", []), log)
+    if status != 0:
+        return {"error": "somsd failed with status %d" % status}
+    res["train_rss_kb"] = rss
+    res["load_sec"] = span_seconds(trace, "LoadData")
+    res["train_sec"] = span_seconds(trace, "TrainMap")
+    nodes = 0
+    with open(metrics) as f:
+        for line in f:
+            rec = json.loads(line)
+            if "iter" in rec:
+                nodes += rec["nodes"]
+                res["train_qerror"] = rec["qerror"]
+    if res["train_sec"]:
+        res["train_nodes_per_sec"] = nodes / res["train_sec"]
+
+    if ds["modes"] is None:             # No evaluation for this dataset
+        return res
+    cmd = [testsom, "-cin", net, "-din", train, "-trace", etrace]
+    if ds["test"] is not None:
+        cmd += ["-tin", os.path.join(args.data, ds["test"])]
+    for mode in ds["modes"]:
+        cmd += ["-mode", mode]
+    status, out, seconds, rss = run(cmd, log)
+    if status != 0:
+        return dict(res, error="testsom failed with status %d" % status)
+    res["eval_sec"] = seconds
+    res["eval_rss_kb"] = rss
+    for line in out.splitlines():
+        for pattern, key in QUALITY:
+            m = re.match(pattern, line.strip())
+            if m and key not in res:   # First occurrence is the train set
+                res[key] = float(m.group(1))
+
+    return res
+
+
+def compare(name, new, old, args):
+    """Compare the measures of a dataset against the baseline.
+
+    Return value: List of messages, one for each regression found."""
+    flags = []
+    if "error" in new:
+        return ["%s: %s" % (name, new["error"])]
+    if old is None:
+        return []
+    for key, sign in SPEED.items():
+        if new.get(key) is None or not old.get(key):
+            continue
+        tkey = TIME_OF[key]             # Differences too small to measure
+        if abs(new.get(tkey, 0.0) - old.get(tkey, 0.0)) < args.min_sec:
+            continue
+        ratio = new[key] / old[key]
+        if (sign < 0 and ratio > 1.0 + args.speed_tol) or \
+           (sign > 0 and ratio < 1.0 / (1.0 + args.speed_tol)):
+            flags.append("%s: speed regression in %s: %.4g -> %.4g (%+.1f%%)"
+                         % (name, key, old[key], new[key], 100.0 * (ratio - 1.0)))
+    for key in MEMORY:
+        if new.get(key) is None or not old.get(key):
+            continue
+        if new[key] > old[key] * (1.0 + args.mem_tol):
+            flags.append("%s: memory regression in %s: %d -> %d KiB"
+                         % (name, key, old[key], new[key]))
+    for key in ["train_qerror"] + [k for _, k in QUALITY]:
+        if key not in old:
+            continue
+        if key not in new:
+            flags.append("%s: %s is no longer reported" % (name, key))
+        elif abs(new[key] - old[key]) > args.quality_tol * max(1e-12, abs(old[key])):
+            flags.append("%s: accuracy drift in %s: %.6g -> %.6g"
+                         % (name, key, old[key], new[key]))
+    return flags
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run the bundled datasets through initsom, somsd and "
+        "testsom, and compare the results against a stored baseline.")
+    parser.add_argument("--bindir", default=SRCDIR,
+                        help="directory of the executables (default: %(default)s)")
+    parser.add_argument("--data", default=os.path.join(os.path.dirname(SRCDIR), "data"),
+                        help="directory of the datasets (default: %(default)s)")
+    parser.add_argument("--baseline", default=os.path.join(TOOLDIR, "baseline.json"),
+                        help="baseline file (default: %(default)s)")
+    parser.add_argument("--update", action="store_true",
+                        help="write the results as the new baseline")
+    parser.add_argument("--output", help="also write the results to this file")
+    parser.add_argument("--datasets", help="comma separated list of datasets to run")
+    parser.add_argument("--speed-tol", type=float, default=0.25,
+                        help="tolerated relative slowdown (default: %(default)s)")
+    parser.add_argument("--min-sec", type=float, default=0.05,
+                        help="ignore speed differences of less than this many "
+                        "seconds (default: %(default)s)")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="run each dataset this many times, and keep the "
+                        "fastest timings (default: %(default)s)")
+    parser.add_argument("--mem-tol", type=float, default=0.10,
+                        help="tolerated relative growth of peak RSS (default: %(default)s)")
+    parser.add_argument("--quality-tol", type=float, default=1e-3,
+                        help="tolerated relative change of quality measures (default: %(default)s)")
+    parser.add_argument("--keep", action="store_true",
+                        help="keep the maps, logs, and traces that were written")
+    args = parser.parse_args()
+
+    datasets = DATASETS
+    if args.datasets:
+        names = args.datasets.split(",")
+        datasets = [ds for ds in DATASETS if ds["name"] in names]
+        unknown = set(names) - set(ds["name"] for ds in datasets)
+        if unknown:
+            parser.error("unknown dataset(s): " + ", ".join(sorted(unknown)))
+
+    baseline = {}
+    if not args.update:
+        try:
+            with open(args.baseline) as f:
+                baseline = json.load(f)
+        except OSError:
+            print("Note: No baseline found at %s, nothing to compare with."
+                  % args.baseline, file=sys.stderr)
+    if baseline.get("host") and baseline["host"] != platform.node():
+        print("Note: Baseline was recorded on '%s', speed comparisons may not "
+              "be meaningful." % baseline["host"], file=sys.stderr)
+
+    os.environ["SOMSD_CACHEDIR"] = "none"   # Time the parser, not the cache
+    workdir = tempfile.mkdtemp(prefix="somsd-regress-")
+    results = {"host": platform.node(), "machine": platform.machine(),
+               "date": time.strftime("%Y-%m-%d %H:%M:%S"), "datasets": {}}
+    flags = []
+    print("%-16s %8s %8s %12s %8s %9s %10s %9s %9s" %
+          ("dataset", "load_s", "train_s", "nodes/s", "eval_s", "rss_MiB",
+           "qerror", "E", "retrieval"))
+    for ds in datasets:
+        res = run_dataset(ds, args, workdir)
+        for _ in range(1, args.repeat):
+            if "error" in res:
+                break
+            rep = run_dataset(ds, args, workdir)
+            if "error" in rep:
+                res = rep
+                break
+            for key, sign in SPEED.items():   # Keep the best timings
+                if rep.get(key) is not None and res.get(key) is not None:
+                    res[key] = (min if sign < 0 else max)(res[key], rep[key])
+            for key in MEMORY:
+                if rep.get(key) is not None and res.get(key) is not None:
+                    res[key] = min(res[key], rep[key])
+        res = {k: float("%.6g" % v) if isinstance(v, float) else v
+               for k, v in res.items()}
+        results["datasets"][ds["name"]] = res
+        if "error" in res:
+            print("%-16s %s" % (ds["name"], res["error"]))
+        else:
+            def fmt(key, spec):
+                return spec % res[key] if res.get(key) is not None else "-"
+            rss = max(res.get("train_rss_kb", 0), res.get("eval_rss_kb", 0))
+            print("%-16s %8s %8s %12s %8s %9.1f %10s %9s %9s" %
+                  (ds["name"], fmt("load_sec", "%.3f"), fmt("train_sec", "%.3f"),
+                   fmt("train_nodes_per_sec", "%.0f"), fmt("eval_sec", "%.3f"),
+                   rss / 1024.0, fmt("qerror", "%.4g"), fmt("E", "%.4f"),
+                   fmt("retrieval", "%.2f")))
+        flags += compare(ds["name"], res, baseline.get("datasets", {}).get(ds["name"]), args)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=1, sort_keys=True)
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print("Baseline written to %s" % args.baseline)
+    if args.keep:
+        print("Output of the runs kept in %s" % workdir)
+    else:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    if flags:
+        print("\n%d regression(s):" % len(flags))
+        for msg in flags:
+            print("  " + msg)
+        return 1
+    if baseline:
+        print("\nNo regressions.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
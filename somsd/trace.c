@@ -0,0 +1,232 @@
+/*
+  Contents: Recording of a timeline of a run in Chrome trace event format,
+            used by option -trace of initsom, somsd and testsom. Spans are
+            opened and closed with TraceBegin() and TraceEnd() of trace.h
+            and kept in a ring buffer per thread. A lock is taken only when
+            a thread records its first span. TraceClose() writes all
+            buffers as one JSON file, and TraceOpen() arranges for it to be
+            called at exit. Unless TraceOpen() was called, recording a span
+            only tests a flag.
+
+  Author: Markus Hagenbuchner
+
+  Comments and questions concerning this program package may be sent
+  to 'markus@artificial-neural.net'
+ */
+
+
+/************/
+/* Includes */
+/************/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+#include "utils.h"
+
+
+/**************/
+/* Structures */
+/**************/
+struct TraceSpan{       /* A completed span                              */
+  const char *name;     /* Name of the span (a string constant)          */
+  long arg;             /* Numeric argument, or TRACE_NOARG              */
+  double start, dur;    /* Start time and duration in microseconds       */
+};
+
+struct TraceBuffer{     /* The spans recorded by a single thread         */
+  int tid;              /* Thread number, in order of first use          */
+  const char *tname;    /* Name of the thread, or NULL                   */
+  struct TraceSpan *spans;  /* Ring buffer of spans                      */
+  unsigned long size;   /* Capacity, grows up to TRACE_BUFSIZE spans     */
+  unsigned long count;  /* Number of spans recorded (including dropped)  */
+  struct TraceSpan open[TRACE_DEPTH]; /* Spans begun but not ended       */
+  int depth;            /* Number of open spans                          */
+  struct TraceBuffer *next;
+};
+
+
+/********************/
+/* Global variables */
+/********************/
+int TraceEnabled = 0;           /* Set when recording a trace         */
+static char *TraceFile = NULL;  /* Name of the trace file             */
+static double TraceStart;       /* Time at which recording started    */
+static __thread struct TraceBuffer *TraceLocal = NULL; /* This thread */
+static struct TraceBuffer *TraceList = NULL;  /* Buffers of all threads */
+static int TraceThreads = 0;    /* Number of buffers                  */
+static pthread_mutex_t TraceLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Begin functions... */
+
+/******************************************************************************
+Description: Get the time of a monotonic clock in microseconds.
+
+Return value: Time in microseconds.
+******************************************************************************/
+static double TraceNow()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+/******************************************************************************
+Description: Get the buffer of the calling thread, and allocate and register
+             it on the first call of a thread. Buffers are kept until the
+             trace is written, even if the thread terminated.
+
+Return value: Pointer to the buffer of the calling thread.
+******************************************************************************/
+static struct TraceBuffer *GetTraceBuffer()
+{
+  struct TraceBuffer *buf;
+
+  if ((buf = TraceLocal) != NULL)
+    return buf;
+
+  buf = (struct TraceBuffer*)MyCalloc(1, sizeof(struct TraceBuffer));
+  buf->size = 256;           /* Most threads record only a few spans */
+  buf->spans = (struct TraceSpan*)MyMalloc(buf->size * sizeof(struct TraceSpan));
+  pthread_mutex_lock(&TraceLock);
+  buf->tid = ++TraceThreads;
+  buf->next = TraceList;
+  TraceList = buf;
+  pthread_mutex_unlock(&TraceLock);
+  TraceLocal = buf;
+
+  return buf;
+}
+
+/******************************************************************************
+Description: Start recording a trace which is written to fname at exit (or
+             when TraceClose() is called). The calling thread is named "main".
+
+Return value: This function does not return a value.
+******************************************************************************/
+void TraceOpen(char *fname)
+{
+  if (fname == NULL || TraceFile != NULL)
+    return;
+
+  TraceFile = strdup(fname);
+  TraceStart = TraceNow();
+  TraceEnabled = 1;
+  TraceThreadName("main");
+  atexit(TraceClose);        /* Also write the trace on early exits */
+}
+
+/******************************************************************************
+Description: Set the name under which the spans of the calling thread are
+             shown. name must be a string constant.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void TraceThreadName(const char *name)
+{
+  if (TraceEnabled)
+    GetTraceBuffer()->tname = name;
+}
+
+/******************************************************************************
+Description: Begin a span of the calling thread. Use macros TraceBegin() or
+             TraceBeginNum() instead of calling this function directly.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void TraceBeginSpan(const char *name, long arg)
+{
+  struct TraceBuffer *buf = GetTraceBuffer();
+  struct TraceSpan *span;
+
+  if (buf->depth < TRACE_DEPTH){
+    span = &buf->open[buf->depth];
+    span->name = name;
+    span->arg = arg;
+    span->start = TraceNow();
+  }
+  buf->depth++;              /* Spans nested too deeply are not recorded */
+}
+
+/******************************************************************************
+Description: End the most recently begun span of the calling thread, and add
+             it to the ring buffer of the thread. Use macro TraceEnd()
+             instead of calling this function directly.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void TraceEndSpan()
+{
+  struct TraceBuffer *buf = GetTraceBuffer();
+  struct TraceSpan *span;
+
+  if (buf->depth == 0)       /* Unbalanced call */
+    return;
+  buf->depth--;
+  if (buf->depth >= TRACE_DEPTH)
+    return;
+
+  if (buf->count == buf->size && buf->size < TRACE_BUFSIZE){ /* Grow */
+    buf->size = (2 * buf->size < TRACE_BUFSIZE) ? 2 * buf->size : TRACE_BUFSIZE;
+    buf->spans = (struct TraceSpan*)MyRealloc(buf->spans, buf->size * sizeof(struct TraceSpan));
+  }
+  span = &buf->spans[buf->count % buf->size];
+  *span = buf->open[buf->depth];
+  span->dur = TraceNow() - span->start;
+  buf->count++;
+}
+
+/******************************************************************************
+Description: Write all recorded spans to the trace file as a JSON object in
+             Chrome trace event format, and stop recording. Other threads
+             must have stopped recording when this is called.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void TraceClose()
+{
+  struct TraceBuffer *buf;
+  struct TraceSpan *span;
+  unsigned long i, first;
+  int pid, comma = 0;
+  FILE *ofile;
+
+  if (!TraceEnabled)
+    return;
+  TraceEnabled = 0;
+
+  if ((ofile = fopen(TraceFile, "w")) == NULL){
+    fprintf(stderr, "\nWarning: Unable to write trace file '%s'\n", TraceFile);
+    return;
+  }
+  pid = (int)getpid();
+  fprintf(ofile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  pthread_mutex_lock(&TraceLock);
+  for (buf = TraceList; buf != NULL; buf = buf->next){
+    if (buf->tname != NULL){
+      fprintf(ofile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", comma ? ",\n" : "", pid, buf->tid, buf->tname);
+      comma = 1;
+    }
+    if (buf->count > buf->size)       /* Oldest spans were overwritten */
+      fprintf(stderr, "\nWarning: Trace buffer of thread %d overflowed, %lu oldest spans dropped\n", buf->tid, buf->count - buf->size);
+    first = (buf->count > buf->size) ? buf->count - buf->size : 0;
+    for (i = first; i < buf->count; i++){
+      span = &buf->spans[i % buf->size];
+      fprintf(ofile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", comma ? ",\n" : "", span->name, pid, buf->tid, span->start - TraceStart, span->dur);
+      if (span->arg != TRACE_NOARG)
+	fprintf(ofile, ",\"args\":{\"n\":%ld}", span->arg);
+      fprintf(ofile, "}");
+      comma = 1;
+    }
+  }
+  pthread_mutex_unlock(&TraceLock);
+  fprintf(ofile, "\n]}\n");
+  fclose(ofile);
+}
+
+/* End of file */
@@ -0,0 +1,28 @@
+#ifndef TRACE_H_DEFINED
+#define TRACE_H_DEFINED
+
+/* Timeline of a run in Chrome trace event format (chrome://tracing, Perfetto).
+   Each thread records the spans it completed into its own ring buffer,
+   which grows up to TRACE_BUFSIZE spans. When a buffer is full, the oldest
+   spans are overwritten. All buffers are written to the trace file at exit.
+   Span names must be string constants. Recording is a no-op unless
+   TraceOpen() was called. */
+
+#define TRACE_BUFSIZE 65536  /* Number of spans kept per thread  */
+#define TRACE_DEPTH   32     /* Maximum nesting depth of spans   */
+#define TRACE_NOARG   -1     /* Span without a numeric argument  */
+
+extern int TraceEnabled;
+
+void TraceOpen(char *fname);           /* Start recording to fname         */
+void TraceThreadName(const char *name);/* Name the calling thread          */
+void TraceBeginSpan(const char *name, long arg);
+void TraceEndSpan();
+void TraceClose();                     /* Write the trace file             */
+
+/* Begin and end a span. Spans of a thread must be properly nested. */
+#define TraceBegin(name) do{ if (TraceEnabled) TraceBeginSpan(name, TRACE_NOARG); } while(0)
+#define TraceBeginNum(name, num) do{ if (TraceEnabled) TraceBeginSpan(name, (long)(num)); } while(0)
+#define TraceEnd() do{ if (TraceEnabled) TraceEndSpan(); } while(0)
+
+#endif
@@ -8,6 +8,27 @@
 
 
   ChangeLog:
+    18/10/2026:
+    - Speed improvement: FindWinnersEucledian(.) and VQFindWinnersEucledian(.)
+      find the k best matching codebooks in a single pass over the map.
+    - New feature: A node which stands for several identical nodes (option
+      -compress) is trained with a rate which approximates as many updates
+      as it occurs in the data.
+    - Speed improvement: Winners of known inputs are memoised while a map is
+      frozen.
+    - New feature: Count hardware events in winner search, adaptation, and
+      K-step with perf_event_open (option -perf).
+    - New feature: TrainMap(.) times the phases of training when compiled
+      with -DPROFILE.
+    - New feature: Write a line of JSON with metrics of each iteration
+      (option -metrics).
+    - New feature: SIGUSR1 takes a snapshot and SIGUSR2 prints training
+      statistics without interrupting training. A control file or FIFO
+      (option -control) is read at the end of each iteration to change
+      parameters of a running process.
+    - New feature: Checkpoints of the training state are written periodically
+      and when training is interrupted or terminated. TrainMap(.) can resume
+      from them.
     03/10/2006:
     - BugFix: File name for interrupted training runs was not unique if several
               processes terminated within one second.
@@ -28,6 +49,8 @@
 /* Includes */
 /************/
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <float.h>
 #include <limits.h>
 #include <math.h>
@@ -35,6 +58,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -42,6 +67,7 @@
 #include "data.h"
 #include "fileio.h"
 #include "system.h"
+#include "trace.h"
 #include "train.h"
 #include "utils.h"
 
@@ -50,6 +76,44 @@
 /* Global variables */
 /********************/
 int _save_then_exit_ = 0; /* Indicate if an interrupt was caught */
+volatile sig_atomic_t _snapshot_request_ = 0; /* SIGUSR1 was caught */
+volatile sig_atomic_t _stats_request_ = 0;    /* SIGUSR2 was caught */
+
+
+/* Regions of the training loop measured with hardware counters (-perf) */
+enum{ REGION_SEARCH, REGION_ADAPT, REGION_KSTEP, NUM_REGIONS };
+static const char *RegionNames[NUM_REGIONS] = { "search", "adapt", "kstep" };
+
+
+/**************/
+/* Structures */
+/**************/
+struct TrainStatus{   /* Progress of a training run, reported on request */
+  double start;       /* Time at which training started (seconds)       */
+  UNSIGNED iter;      /* Current training iteration                     */
+  UNSIGNED t, tlen;   /* Update steps done, and total number of steps   */
+  unsigned long long nodes; /* Nodes processed in completed iterations  */
+  int counter;        /* Number of nodes processed in current iteration */
+  FLOAT terror;       /* Accumulated quantization error of iteration    */
+  FLOAT lasterror;    /* Quantization error of the previous iteration   */
+  FLOAT alpha, radius;/* Current learning rate and neighborhood radius  */
+  double iterstart;   /* Time at which the current iteration started    */
+  unsigned long long searches;  /* Winner searches done in iteration   */
+  unsigned long long evaluated; /* Vector components compared in search */
+  unsigned long long touched;   /* Codebooks changed by adaptation      */
+  double snaptime;    /* Time spent taking snapshots since last metrics */
+  struct PerfGroup *perf; /* Hardware counters of each region, or NULL  */
+  long long perfdelta[NUM_REGIONS][NUM_PERF_EVENTS]; /* Counts in iteration */
+};
+
+struct Control{       /* A control file or FIFO read between iterations */
+  char *fname;        /* Name of the control file                       */
+  int fd;             /* Open descriptor if the file is a FIFO, else -1 */
+  time_t mtime;       /* Modification time of a regular control file    */
+  off_t size;         /* Size of a regular control file                 */
+  char buf[256];      /* Incomplete line read from a FIFO               */
+  int len;            /* Number of characters in buf                    */
+};
 
 
 
@@ -195,6 +259,23 @@ inline void AdaptVector(FLOAT *codebook, FLOAT *sample, UNSIGNED dim, FLOAT alph
     codebook[i] += alpha * (sample[i] - codebook[i]);
 }
 
+/******************************************************************************
+Description: Compute the learning rate which moves a codebook as far as k
+             consecutive updates towards the same sample with rate alpha.
+             This is used to train a node which stands for k identical nodes
+             (see CompressGraphs()). It only approximates training on the
+             uncompressed data: there, the k updates are spread over the
+             iteration, with changing rates, neighbourhoods and winners.
+
+Return value: The learning rate of k updates.
+******************************************************************************/
+static inline FLOAT RepeatedRate(FLOAT alpha, UNSIGNED k)
+{
+  if (k <= 1)
+    return alpha;
+  return 1.0 - powf(1.0 - alpha, (FLOAT)k);
+}
+
 /******************************************************************************
 Description: Find best matching codebook using the Eucledian distance meassure.
 
@@ -206,7 +287,7 @@ void FindWinnerEucledian(struct Map *map, struct Node *node, struct Graph *gptr,
   UNSIGNED vdim;
   UNSIGNED noc;  /* Number of codebooks in the map */
   FLOAT *codebook, *sample;
-  UNSIGNED n, i;
+  UNSIGNED n, i, evaluated;
   FLOAT diffsf, diff, difference;
 
   vdim = gptr->dimension;
@@ -214,6 +295,7 @@ void FindWinnerEucledian(struct Map *map, struct Node *node, struct Graph *gptr,
   noc = map->xdim * map->ydim;
   diffsf = FLT_MAX;
   sample = node->points;
+  evaluated = 0;
   for (n = 0; n < noc; n++){  /* For every codebook of the map */
     codebook = map->codes[n].points;
     difference = 0.0;
@@ -225,6 +307,7 @@ void FindWinnerEucledian(struct Map *map, struct Node *node, struct Graph *gptr,
       if (difference > diffsf)
 	break;
     }
+    evaluated += (i < vdim) ? i+1 : vdim;
     /* If distance is smaller than previous distances */
     if (difference < diffsf){
       winner->codeno = n;
@@ -232,6 +315,7 @@ void FindWinnerEucledian(struct Map *map, struct Node *node, struct Graph *gptr,
     }
   }
   winner->diff   = diffsf;
+  winner->evaluated = evaluated;
 
   return;
 }
@@ -311,10 +395,334 @@ void VQFindWinnerEucledian(struct Map *map, struct Node *node, struct Graph *gpt
     continue;
   }
   winner->diff   = diffsf;
+  winner->evaluated = 0;   /* Not counted in VQ mode */
+
+  return;
+}
+
+/******************************************************************************
+Description: Insert a codebook with distance difference into the list of the
+             k best matches found so far. The list is sorted by increasing
+             distance, which for the small k used is the cheapest bounded
+             priority queue. Among codebooks with the same distance the one
+             found first ranks higher, as in FindWinnerEucledian().
+
+Return value: The distance of the k-th best match, i.e. the bound beyond
+              which a codebook cannot enter the list.
+******************************************************************************/
+static inline FLOAT InsertWinner(struct Winner *winners, UNSIGNED k, UNSIGNED codeno, FLOAT difference)
+{
+  UNSIGNED j;
+
+  for (j = k-1; j > 0 && winners[j-1].diff > difference; j--){
+    winners[j].codeno = winners[j-1].codeno;
+    winners[j].diff   = winners[j-1].diff;
+  }
+  winners[j].codeno = codeno;
+  winners[j].diff   = difference;
+
+  return winners[k-1].diff;
+}
+
+/******************************************************************************
+Description: Find the k best matching codebooks using the Eucledian distance
+             meassure. This is the search of FindWinnerEucledian(), but the
+             computation of a distance is abandoned as soon as it exceeds the
+             k-th best distance found so far instead of the best one. k is
+             limited to the number of codebooks in the map.
+
+Return value: The k best matching codebooks are returned to winners[0..k-1]
+              in order of increasing distance. winners[0] is the codebook
+              which FindWinnerEucledian() finds.
+******************************************************************************/
+void FindWinnersEucledian(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winners, UNSIGNED k)
+{
+  FLOAT *mu;
+  UNSIGNED vdim;
+  UNSIGNED noc;  /* Number of codebooks in the map */
+  FLOAT *codebook, *sample;
+  UNSIGNED n, i, evaluated;
+  FLOAT bound, diff, difference;
+
+  vdim = gptr->dimension;
+  mu = node->mu;
+  noc = map->xdim * map->ydim;
+  k = min(k, noc);
+  if (k == 0)
+    return;
+  for (n = 0; n < k; n++){
+    winners[n].codeno = 0;
+    winners[n].diff   = FLT_MAX;
+  }
+  bound = FLT_MAX;
+  sample = node->points;
+  evaluated = 0;
+  for (n = 0; n < noc; n++){  /* For every codebook of the map */
+    codebook = map->codes[n].points;
+    difference = 0.0;
+
+    /* Compute the difference between codebook and input entry */
+    for (i = 0; i < vdim; i++){
+      diff = codebook[i] - sample[i];
+      difference += diff * diff * mu[i];
+      if (difference > bound)
+	break;
+    }
+    evaluated += (i < vdim) ? i+1 : vdim;
+    /* If distance is smaller than the k-th best distance */
+    if (difference < bound)
+      bound = InsertWinner(winners, k, n, difference);
+  }
+  winners[0].evaluated = evaluated;
+
+  return;
+}
+
+/******************************************************************************
+Description: Find the k best matching codebooks in VQ mode. This is the
+             search of VQFindWinnerEucledian(), with the computation of a
+             distance abandoned once it reaches the k-th best distance found
+             so far. k is limited to the number of codebooks in the map.
+
+Return value: The k best matching codebooks are returned to winners[0..k-1]
+              in order of increasing distance.
+******************************************************************************/
+void VQFindWinnersEucledian(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winners, UNSIGNED k)
+{
+  FLOAT *mu;
+  UNSIGNED ldim, fanout, fanin, tend;
+  UNSIGNED noc;  /* Number of codebooks in the map */
+  FLOAT *codebook, *sample;
+  UNSIGNED n, i;
+  int id;
+
+  FLOAT bound, diff, difference;
+
+  ldim = gptr->ldim;            /* Offset for label component         */
+  fanout = gptr->FanOut;        /* Offset for child state component   */
+  fanin = gptr->FanIn;          /* Offset for parent state component  */
+  tend = ldim+2*(fanin+fanout)+gptr->tdim; /* End of target vector component */
+
+  mu = node->mu;
+
+  noc = map->xdim * map->ydim;
+  k = min(k, noc);
+  if (k == 0)
+    return;
+  for (n = 0; n < k; n++){
+    winners[n].codeno = 0;
+    winners[n].diff   = FLT_MAX;
+  }
+  bound = FLT_MAX;
+  sample = node->points;
+  for (n = 0; n < noc; n++){  /* For every codebook of the map */
+    codebook = map->codes[n].points;
+    difference = 0.0;
+
+    /* Compute the difference between codebook and input entry label */
+    for (i = 0; i < ldim; i++){
+      diff = codebook[i] - sample[i];
+      difference += diff * diff * mu[i];
+      if (difference >= bound)
+      	goto big_difference;
+    }
+
+    /* Consider children coordinate vector */
+    diff = map->codes[n].a;
+    for (i = 0; i < fanout; i++){
+      id = (int)sample[ldim + i*2];
+      if (id >= 0)
+	diff += (1.0 - 2 * codebook[ldim+noc*i+id]);
+    }
+    difference += diff * mu[i-1];
+    if (difference >= bound)
+      goto big_difference;
+
+    /* Difference to parent coordinate vector */
+    diff = map->codes[n].b;
+    for (i = 0; i < fanin; i++){  
+      id = (int)sample[ldim + 2+ fanout + i*2];
+      if (id >= 0)
+	diff += (1.0 - 2 * codebook[ldim+noc*fanout+noc*i+id]);
+    }
+    difference += diff * mu[i-1];
+    if (difference >= bound)
+      goto big_difference;
+
+    /* Difference to target vector component */
+    for (i = ldim + 2*fanin + 2*fanout; i < tend; i++){
+      diff = codebook[i] - sample[i];
+      difference += diff * diff * mu[i];
+      if (difference >= bound)
+      	goto big_difference;
+    }
+
+    /* Distance is smaller than the k-th best distance */
+    bound = InsertWinner(winners, k, n, difference);
+  big_difference:
+    continue;
+  }
+  winners[0].evaluated = 0;   /* Not counted in VQ mode */
 
   return;
 }
 
+#define MALLOC_ALIGN 16  /* Granularity of blocks returned by malloc */
+
+struct CachedWinner{   /* An entry of a WinnerCache */
+  unsigned long long hash;  /* Hash value of the key                      */
+  FLOAT *key;               /* Vector and weights of the input, or NULL   */
+  UNSIGNED dim;             /* Dimension of the vector                    */
+  UNSIGNED codeno;          /* Best matching codebook                     */
+  FLOAT diff;               /* Distance to the best matching codebook     */
+};
+
+/******************************************************************************
+Description: Create an empty cache of winners. When the codebooks of a map do
+             not change, as in testsom, the winner of a node depends only on
+             its vector (label, states of offsprings and parents, target) and
+             its weights. Datasets often hold many nodes with identical
+             vectors, e.g. leaves with the same label, and a cache attached
+             to map->memo then avoids searching the map for those nodes. The
+             cache must be released before the map is adapted. No further
+             winners are added once this would take the memory used by the
+             cache, including its table, beyond maxbytes.
+
+Return value: Pointer to the cache. Release with FreeWinnerCache().
+******************************************************************************/
+struct WinnerCache *NewWinnerCache(size_t maxbytes)
+{
+  struct WinnerCache *cache;
+
+  cache = (struct WinnerCache*)MyCalloc(1, sizeof(struct WinnerCache));
+  cache->size = 1024;
+  cache->slots = (struct CachedWinner*)MyCalloc(cache->size, sizeof(struct CachedWinner));
+  cache->bytes = cache->size * sizeof(struct CachedWinner);
+  cache->maxbytes = maxbytes;
+  return cache;
+}
+
+/******************************************************************************
+Description: Double the number of slots of a cache of winners.
+
+Return value: This function does not return a value.
+******************************************************************************/
+static void GrowWinnerCache(struct WinnerCache *cache)
+{
+  struct CachedWinner *old;
+  UNSIGNED n, i, size;
+
+  old = cache->slots;
+  size = cache->size;
+  cache->size *= 2;
+  cache->slots = (struct CachedWinner*)MyCalloc(cache->size, sizeof(struct CachedWinner));
+  cache->bytes += size * sizeof(struct CachedWinner);
+  for (n = 0; n < size; n++){
+    if (old[n].key == NULL)
+      continue;
+    i = (UNSIGNED)old[n].hash & (cache->size - 1);
+    while (cache->slots[i].key != NULL)
+      i = (i + 1) & (cache->size - 1);
+    cache->slots[i] = old[n];
+  }
+  free(old);
+}
+
+/******************************************************************************
+Description: Find the best matching codebook of a node using the cache of
+             winners attached to the map. If the map has no cache, or the
+             node's vector and weights are not in the cache, FindWinner
+             searches the map and the result is added to the cache. Inputs
+             are compared exactly, so that the winner is the same as that
+             of FindWinner.
+
+Return value: The best matching codebook is returned to parameter "winner".
+******************************************************************************/
+void FindWinnerMemo(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winner, FindWinnerFunc FindWinner)
+{
+  struct WinnerCache *cache = map->memo;
+  struct CachedWinner *entry;
+  unsigned long long hash;
+  UNSIGNED i, dim;
+  size_t len, keybytes;
+  int grow;
+
+  if (cache == NULL){
+    FindWinner(map, node, gptr, winner);
+    return;
+  }
+
+  dim = gptr->dimension;
+  len = dim * sizeof(FLOAT);
+  hash = HashBytes(node->points, len, 0);
+  hash = HashBytes(node->mu, len, hash);
+  for (i = (UNSIGNED)hash & (cache->size - 1); (entry = &cache->slots[i])->key != NULL; i = (i + 1) & (cache->size - 1)){
+    if (entry->hash == hash && entry->dim == dim &&
+	!memcmp(entry->key, node->points, len) && !memcmp(entry->key + dim, node->mu, len)){
+      winner->codeno = entry->codeno;
+      winner->diff = entry->diff;
+      winner->evaluated = 0;
+      cache->hits++;
+      return;
+    }
+  }
+
+  FindWinner(map, node, gptr, winner);
+  cache->misses++;
+
+  /* Memory taken by the key including the allocator's header and rounding,
+     and by the slots added if the table must grow to keep its load factor
+     below 1/2 */
+  keybytes = (2 * len + sizeof(size_t) + MALLOC_ALIGN - 1) / MALLOC_ALIGN * MALLOC_ALIGN;
+  grow = (cache->count + 1) * 2 > cache->size;
+  if (cache->bytes + keybytes + (grow ? cache->size * sizeof(struct CachedWinner) : 0) > cache->maxbytes)
+    return;                              /* Cache is full */
+
+  entry->hash = hash;
+  entry->key = (FLOAT*)MyMalloc(2 * len);
+  memcpy(entry->key, node->points, len);
+  memcpy(entry->key + dim, node->mu, len);
+  entry->dim = dim;
+  entry->codeno = winner->codeno;
+  entry->diff = winner->diff;
+  cache->bytes += keybytes;
+  cache->count++;
+  if (grow)
+    GrowWinnerCache(cache);
+}
+
+/******************************************************************************
+Description: Print the number of hits and misses of a cache of winners.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintWinnerCacheStats(FILE *ofile, struct WinnerCache *cache)
+{
+  unsigned long long lookups;
+
+  if (cache == NULL || (lookups = cache->hits + cache->misses) == 0)
+    return;
+  fprintf(ofile, "Winner cache: %llu hits, %llu misses (%.1f%% hits), %u inputs cached in %.1f MB\n", cache->hits, cache->misses, 100.0 * cache->hits / lookups, cache->count, cache->bytes / 1048576.0);
+}
+
+/******************************************************************************
+Description: Release the memory of a cache of winners.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void FreeWinnerCache(struct WinnerCache *cache)
+{
+  UNSIGNED n;
+
+  if (cache == NULL)
+    return;
+  for (n = 0; n < cache->size; n++)
+    if (cache->slots[n].key != NULL)
+      free(cache->slots[n].key);
+  free(cache->slots);
+  free(cache);
+}
+
 /******************************************************************************
 Description: Adapt all codebook vectors which are located within a fixed
              radius around the winning codebook.
@@ -323,7 +731,7 @@ Return value: none
 ******************************************************************************/
 void BubbleAdapt(struct Graph *gptr,struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha)
 {
-  UNSIGNED n, noc;
+  UNSIGNED n, noc, touched;
   FLOAT dist;
   FLOAT (*ComputeDistance)(int bx, int by, int tx, int ty);
 
@@ -333,13 +741,18 @@ void BubbleAdapt(struct Graph *gptr,struct Map *map, struct Node *node, struct W
   node->x = map->codes[winner->codeno].x;
   node->y = map->codes[winner->codeno].y;
   radius *= radius;  /* Distance computation is squared, thus square radius */
+  alpha = RepeatedRate(alpha, MULTIPLICITY(gptr, node));
+  touched = 0;
   for (n = 0; n < noc; n++){  /* For every codebook of the map */
 
     /* Compute distance to winner */
     dist = ComputeDistance(node->x, node->y, map->codes[n].x, map->codes[n].y);
-    if (dist <= radius)
+    if (dist <= radius){
       AdaptVector(map->codes[n].points, node->points, map->dim,alpha);/*Update step*/
+      touched++;
+    }
   }
+  winner->touched = touched;
 }
 
 /******************************************************************************
@@ -350,7 +763,7 @@ Return value: none
 ******************************************************************************/
 void GaussianAdapt(struct Graph *gptr,struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha)
 {
-  UNSIGNED n, noc;
+  UNSIGNED n, noc, k;
   //UNSIGNED off;
   FLOAT dist;
   FLOAT (*ComputeDistance)(int bx, int by, int tx, int ty);
@@ -360,6 +773,7 @@ void GaussianAdapt(struct Graph *gptr,struct Map *map, struct Node *node, struct
   noc = map->xdim * map->ydim;
   node->x = map->codes[winner->codeno].x;
   node->y = map->codes[winner->codeno].y;
+  k = MULTIPLICITY(gptr, node);
   for (n = 0; n < noc; n++){  /* For every codebook of the map */
 
     /* Compute distance to winner */
@@ -376,8 +790,9 @@ void GaussianAdapt(struct Graph *gptr,struct Map *map, struct Node *node, struct
     adapt(&map->codes[n].points[off], &node->points[off], gptr->tdim, node->mu4*alpha * expf((dist/(-2.0 * radius))));
     */
     /* Update the codebook */
-    AdaptVector(map->codes[n].points, node->points, map->dim, alpha * expf((dist/(-2.0 * radius * radius))));
+    AdaptVector(map->codes[n].points, node->points, map->dim, RepeatedRate(alpha * expf((dist/(-2.0 * radius * radius))), k));
   }
+  winner->touched = noc;
 }
 
 /******************************************************************************
@@ -392,6 +807,8 @@ void VQAdapt(struct Graph *gptr,struct Map *map, struct Node *node, struct Winne
   UNSIGNED noc, ldim, offset;
 
   node->winner = winner->codeno;
+  winner->touched = 1;
+  alpha = RepeatedRate(alpha, MULTIPLICITY(gptr, node));
   ldim = gptr->ldim;
   noc = map->xdim * map->ydim;
 
@@ -469,9 +886,26 @@ void SigHandler(int arg)
   flag++;
 }
 
+/****************************************************************************
+Description: Signal handler for requests which do not interrupt training.
+             SIGUSR1 requests a snapshot, SIGUSR2 requests statistics. The
+             requests are served by the training loop after the current
+             graph was processed.
+
+Return value: This function does not return a value.
+****************************************************************************/
+void RequestHandler(int arg)
+{
+  if (arg == SIGUSR1)
+    _snapshot_request_ = 1;
+  else if (arg == SIGUSR2)
+    _stats_request_ = 1;
+}
+
 /****************************************************************************
 Description: Installs a signal handler which will catch interrupt signals such
-             as those initiated by ctrl-c of a kill command.
+             as those initiated by ctrl-c of a kill command, and handlers for
+             SIGUSR1 and SIGUSR2.
 
 Return value: This function does not return a value.
 ****************************************************************************/
@@ -482,6 +916,393 @@ void InstallHandlers()
   memset(&act, 0, sizeof(struct sigaction));
   act.sa_handler =  SigHandler;
   sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+
+  act.sa_handler = RequestHandler;
+  act.sa_flags = SA_RESTART;   /* Do not disturb reading of data files */
+  sigaction(SIGUSR1, &act, NULL);
+  sigaction(SIGUSR2, &act, NULL);
+}
+
+/****************************************************************************
+Description: Get the current time in seconds with sub-second resolution.
+
+Return value: Seconds since the epoch.
+****************************************************************************/
+static double GetSeconds()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/****************************************************************************
+Description: Print the progress of a training run to stderr: the iteration,
+             the fraction of update steps done, the number of nodes processed
+             per second, the quantization error so far in the current
+             iteration and of the previous iteration, and the current
+             learning rate and neighborhood radius.
+
+Return value: This function does not return a value.
+****************************************************************************/
+void PrintTrainingStats(struct Parameters *params, struct TrainStatus *status)
+{
+  double elapsed;
+  time_t mytime;
+
+  elapsed = GetSeconds() - status->start;
+  mytime = time(NULL);
+  fprintf(stderr, "\nStatus on %s", ctime(&mytime));
+  fprintf(stderr, "  Iteration:     %d of %d (%.1f%% of updates done)\n", status->iter+1, params->rlen, (status->tlen > 0) ? 100.0*status->t/status->tlen : 0.0);
+  fprintf(stderr, "  Elapsed time:  %s\n", PrintTime((time_t)elapsed));
+  fprintf(stderr, "  Throughput:    %.0f nodes/sec\n", (elapsed > 0.0) ? (status->nodes + status->counter) / elapsed : 0.0);
+  if (status->counter > 0)
+    fprintf(stderr, "  Qerror:        %E (current), ", status->terror / status->counter);
+  else
+    fprintf(stderr, "  Qerror:        n/a (current), ");
+  if (status->lasterror >= 0.0)
+    fprintf(stderr, "%E (last iteration)\n", status->lasterror);
+  else
+    fprintf(stderr, "n/a (last iteration)\n");
+  fprintf(stderr, "  Alpha, radius: %f, %f\n", status->alpha, status->radius);
+  fprintf(stderr, "  CPUs, nice:    %d, %s\n", params->ncpu, params->nice ? "on" : "off");
+}
+
+/****************************************************************************
+Description: Serve the requests made through SIGUSR1 and SIGUSR2. A snapshot
+             is written to the snapshot file, or to 'snapshot.net' if no
+             snapshot file was given.
+
+Return value: This function does not return a value.
+****************************************************************************/
+void ServeRequests(struct Parameters *params, struct TrainStatus *status)
+{
+  if (_snapshot_request_){
+    _snapshot_request_ = 0;
+    if (params->snap.file == NULL)
+      params->snap.file = strdup("snapshot.net");
+    fprintf(stderr, "\nSaving snapshot to '%s'\n", params->snap.file);
+    status->snaptime -= GetSeconds();
+    PROFILE_BEGIN(tsnap);
+    TraceBegin("Snapshot");
+    SaveSnapShot(params);      /* Written in the background */
+    TraceEnd();
+    PROFILE_END(PHASE_SNAPSHOT, tsnap);
+    status->snaptime += GetSeconds();
+  }
+  if (_stats_request_){
+    _stats_request_ = 0;
+    PrintTrainingStats(params, status);
+  }
+}
+
+/****************************************************************************
+Description: Open the control file fname. A FIFO is opened without blocking
+             and is kept open, a regular file is read whenever it changes.
+             The file does not need to exist yet.
+
+Return value: A pointer to the control structure, or NULL if fname is NULL.
+****************************************************************************/
+struct Control *OpenControl(char *fname)
+{
+  struct Control *ctrl;
+  struct stat st;
+
+  if (fname == NULL)
+    return NULL;
+
+  ctrl = (struct Control*)MyCalloc(1, sizeof(struct Control));
+  ctrl->fname = fname;
+  ctrl->fd = -1;
+  if (stat(fname, &st) == 0){
+    if (S_ISFIFO(st.st_mode))
+      ctrl->fd = open(fname, O_RDONLY | O_NONBLOCK);
+    else{                  /* Commands already in the file are not applied */
+      ctrl->mtime = st.st_mtime;
+      ctrl->size = st.st_size;
+    }
+  }
+  return ctrl;
+}
+
+/****************************************************************************
+Description: Execute a single control command. Recognized commands are:
+               cpu <n>     set the number of parallel tasks
+               nice on|off switch nice mode on or off
+               snapshot    take a snapshot
+               checkpoint  write a checkpoint (requires -checkpoint)
+               stats       print training statistics
+               stop        save the map and stop training (same as ctrl-c)
+             Empty lines and lines starting with '#' are ignored.
+
+Return value: This function does not return a value.
+****************************************************************************/
+void ControlCommand(struct Parameters *params, struct TrainStatus *status, char *line)
+{
+  char cmd[32], arg[32];
+  int n, ncpu;
+
+  n = sscanf(line, "%31s %31s", cmd, arg);
+  if (n < 1 || cmd[0] == '#')
+    return;
+
+  if (!strcmp(cmd, "cpu") && n == 2 && sscanf(arg, "%d", &ncpu) == 1 && ncpu > 0){
+    params->ncpu = ncpu;
+    fprintf(stderr, "\nControl: Using %d CPUs\n", ncpu);
+  }
+  else if (!strcmp(cmd, "nice") && n == 2 && (!strcmp(arg, "on") || !strcmp(arg, "off"))){
+    params->nice = !strcmp(arg, "on");
+    fprintf(stderr, "\nControl: Nice mode %s\n", arg);
+  }
+  else if (!strcmp(cmd, "snapshot"))
+    _snapshot_request_ = 1;
+  else if (!strcmp(cmd, "checkpoint") && params->checkpoint.file != NULL)
+    SaveCheckpoint(params, status->t, status->tlen);
+  else if (!strcmp(cmd, "stats"))
+    _stats_request_ = 1;
+  else if (!strcmp(cmd, "stop"))
+    SigHandler(SIGINT);
+  else
+    fprintf(stderr, "\nWarning: Ignoring unrecognized control command '%s'.\n", cmd);
+}
+
+/****************************************************************************
+Description: Read new commands from the control file and execute them. From a
+             FIFO, all complete lines available are read. A regular file is
+             read in full when its modification time or size changed since it
+             was last read.
+
+Return value: This function does not return a value.
+****************************************************************************/
+void PollControl(struct Parameters *params, struct TrainStatus *status, struct Control *ctrl)
+{
+  struct stat st;
+  char *cptr, *line;
+  ssize_t n;
+  FILE *ifile;
+  char buf[256];
+
+  if (ctrl == NULL)
+    return;
+
+  if (ctrl->fd < 0){
+    if (stat(ctrl->fname, &st) != 0)
+      return;
+    if (S_ISFIFO(st.st_mode)){  /* FIFO was created after training started */
+      ctrl->fd = open(ctrl->fname, O_RDONLY | O_NONBLOCK);
+      ctrl->len = 0;
+    }
+    else if (st.st_mtime != ctrl->mtime || st.st_size != ctrl->size){
+      ctrl->mtime = st.st_mtime;
+      ctrl->size = st.st_size;
+      if ((ifile = fopen(ctrl->fname, "r")) == NULL)
+	return;
+      while (fgets(buf, sizeof(buf), ifile) != NULL)
+	ControlCommand(params, status, buf);
+      fclose(ifile);
+      return;
+    }
+  }
+  if (ctrl->fd < 0)
+    return;
+
+  while ((n = read(ctrl->fd, ctrl->buf + ctrl->len, sizeof(ctrl->buf) - 1 - ctrl->len)) > 0){
+    ctrl->len += n;
+    ctrl->buf[ctrl->len] = '\0';
+    line = ctrl->buf;
+    while ((cptr = strchr(line, '\n')) != NULL){ /* Execute complete lines */
+      *cptr = '\0';
+      ControlCommand(params, status, line);
+      line = cptr + 1;
+    }
+    ctrl->len -= line - ctrl->buf;
+    memmove(ctrl->buf, line, ctrl->len);
+    if (ctrl->len == sizeof(ctrl->buf) - 1) /* Discard overlong line */
+      ctrl->len = 0;
+  }
+  if (n < 0 && errno != EAGAIN && errno != EINTR){
+    close(ctrl->fd);
+    ctrl->fd = -1;
+  }
+}
+
+/****************************************************************************
+Description: Close the control file and free the control structure.
+
+Return value: This function does not return a value.
+****************************************************************************/
+void CloseControl(struct Control *ctrl)
+{
+  if (ctrl == NULL)
+    return;
+  if (ctrl->fd >= 0)
+    close(ctrl->fd);
+  free(ctrl);
+}
+
+/******************************************************************************
+Description: Open a group of hardware performance counters for each of the
+             timed regions of the training loop. Prints a warning if there
+             are no counters, which is common in containers and virtual
+             machines.
+
+Return value: An array of NUM_REGIONS counter groups, or NULL if hardware
+              performance counters are not available.
+******************************************************************************/
+struct PerfGroup *OpenPerfCounters()
+{
+  struct PerfGroup *perf;
+  int i;
+
+  perf = (struct PerfGroup*)MyCalloc(NUM_REGIONS, sizeof(struct PerfGroup));
+  for (i = 0; i < NUM_REGIONS; i++){
+    if (PerfOpen(&perf[i]) == 0){
+      fprintf(stderr, "Warning: Hardware performance counters are not available (%s).\n", (errno == EACCES || errno == EPERM) ? "permission denied, see /proc/sys/kernel/perf_event_paranoid" : strerror(errno));
+      fprintf(stderr, "         Will proceed without option -perf.\n");
+      while (i > 0)
+	PerfClose(&perf[--i]);
+      free(perf);
+      return NULL;
+    }
+  }
+  return perf;
+}
+
+/******************************************************************************
+Description: Print the hardware events counted in each region of the training
+             loop during the whole training run.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void PrintPerfSummary(FILE *ofile, struct PerfGroup *perf)
+{
+  unsigned long long *total;
+  int i;
+
+  if (perf == NULL)
+    return;
+
+  fprintf(ofile, "\nRegion          Cycles     Instructions    IPC      LLC misses     dTLB misses\n");
+  for (i = 0; i < NUM_REGIONS; i++){
+    total = perf[i].total;
+    if (total[PERF_CYCLES] == 0 && total[PERF_INSTRUCTIONS] == 0)
+      continue;     /* Region was not executed */
+    fprintf(ofile, "%-8s %14llu %16llu %6.2f %15llu %15llu\n", RegionNames[i], total[PERF_CYCLES], total[PERF_INSTRUCTIONS], (total[PERF_CYCLES] > 0) ? (double)total[PERF_INSTRUCTIONS] / total[PERF_CYCLES] : 0.0, total[PERF_LLC_MISSES], total[PERF_DTLB_MISSES]);
+  }
+}
+
+/******************************************************************************
+Description: Close the hardware performance counters opened by
+             OpenPerfCounters().
+
+Return value: This function does not return a value.
+******************************************************************************/
+void ClosePerfCounters(struct PerfGroup *perf)
+{
+  int i;
+
+  if (perf == NULL)
+    return;
+  for (i = 0; i < NUM_REGIONS; i++)
+    PerfClose(&perf[i]);
+  free(perf);
+}
+
+/******************************************************************************
+Description: Compute the quantization error of the validation data on the
+             current map. The states of the nodes are updated bottom up as
+             during training, but the map is not changed.
+
+Return value: The mean quantization error of the validation nodes, or a
+              negative value if there is no validation data or if the error
+              cannot be computed in contextual mode.
+******************************************************************************/
+FLOAT ValidationError(struct Parameters *params, void (*FindWinner)(struct Map*, struct Node*, struct Graph*, struct Winner*), void (*UpdateOffspringStates)(struct Graph*, struct Node*))
+{
+  struct Map *map = &params->map;
+  struct Graph *gptr;
+  struct Node *node;
+  struct Winner winner;
+  UNSIGNED nnum, counter;
+  FLOAT verror;
+
+  if (params->valid == NULL || params->contextual)
+    return -1.0;
+
+  counter = 0;
+  verror = 0.0;
+  for (gptr = params->valid; gptr != NULL; gptr = gptr->next){
+    for (nnum = 0; nnum < gptr->numnodes; nnum++){
+      node = gptr->nodes[nnum];
+      UpdateOffspringStates(gptr, node);  /* Update child-state-vector   */
+      FindWinner(map, node, gptr, &winner); /* Find best matching codebook */
+      if (map->topology == TOPOL_VQ)
+	node->winner = winner.codeno;
+      else{
+	node->x = map->codes[winner.codeno].x;
+	node->y = map->codes[winner.codeno].y;
+      }
+      verror += winner.diff;
+      counter++;
+    }
+  }
+  return (counter > 0) ? verror / counter : -1.0;
+}
+
+/******************************************************************************
+Description: Write the metrics of the iteration just completed as a single
+             line of JSON to ofile. Values which are not available are
+             written as null. Nodes and errors are weighted by multiplicity,
+             while dims_evaluated and codebooks_touched are averages over
+             the searches, which are done once for every merged node.
+
+Return value: This function does not return a value.
+******************************************************************************/
+void WriteMetrics(FILE *ofile, struct Parameters *params, struct TrainStatus *status, int counter, FLOAT terror, FLOAT verror)
+{
+  static const char *EventNames[NUM_PERF_EVENTS] = {
+    "cycles", "instructions", "llc_misses", "dtlb_misses"
+  };
+  double now, elapsed;
+  UNSIGNED noc;
+  int i, j;
+
+  if (ofile == NULL)
+    return;
+
+  now = GetSeconds();
+  elapsed = now - status->iterstart;
+  noc = params->map.xdim * params->map.ydim;
+  fprintf(ofile, "{\"iter\":%d,\"time\":%.6f,\"elapsed\":%.6f,\"nodes\":%d", status->iter, elapsed, now - status->start, counter);
+  fprintf(ofile, ",\"nodes_per_sec\":%.1f", (elapsed > 0.0) ? counter / elapsed : 0.0);
+  fprintf(ofile, ",\"qerror\":%E,\"alpha\":%g,\"radius\":%g", (counter > 0) ? terror/counter : 0.0, status->alpha, status->radius);
+  if (status->evaluated > 0 && status->searches > 0)
+    fprintf(ofile, ",\"dims_evaluated\":%.3f", (double)status->evaluated / ((double)status->searches * noc));
+  else
+    fprintf(ofile, ",\"dims_evaluated\":null");
+  fprintf(ofile, ",\"codebooks_touched\":%.3f", (status->searches > 0) ? (double)status->touched / status->searches : 0.0);
+  fprintf(ofile, ",\"snapshot_ms\":%.3f", status->snaptime * 1000.0);
+  if (verror >= 0.0)
+    fprintf(ofile, ",\"validation_error\":%E", verror);
+  else
+    fprintf(ofile, ",\"validation_error\":null");
+  if (status->perf != NULL){  /* Hardware events of each region */
+    fprintf(ofile, ",\"perf\":{");
+    for (i = 0; i < NUM_REGIONS; i++){
+      fprintf(ofile, "%s\"%s\":{", (i > 0) ? "," : "", RegionNames[i]);
+      for (j = 0; j < NUM_PERF_EVENTS; j++){
+	if (status->perfdelta[i][j] >= 0)
+	  fprintf(ofile, "%s\"%s\":%lld", (j > 0) ? "," : "", EventNames[j], status->perfdelta[i][j]);
+	else
+	  fprintf(ofile, "%s\"%s\":null", (j > 0) ? "," : "", EventNames[j]);
+      }
+      fprintf(ofile, "}");
+    }
+    fprintf(ofile, "}");
+  }
+  fprintf(ofile, "}\n");
+  fflush(ofile);
 }
 
 /******************************************************************************
@@ -518,6 +1339,28 @@ void (*SetAdapt(UNSIGNED neighborhood))(struct Graph*, struct Map*, struct Node*
     return GaussianAdapt;    /* Default neighborhood  */
 }
 
+/******************************************************************************
+Description: Return the graph which is to be trained after gptr, or the first
+             graph of an iteration if gptr is NULL. In streaming mode graphs
+             are taken from the prefetch thread, and are discarded once they
+             were trained.
+
+Return value: Pointer to the next graph, or NULL at the end of an iteration.
+******************************************************************************/
+struct Graph *GetNextGraph(struct Parameters *parameters, struct Prefetch *prefetch, struct Graph *gptr)
+{
+  if (prefetch == NULL)
+    return (gptr == NULL) ? parameters->train : gptr->next;
+
+  FreeGraphs(gptr);              /* Graph was trained, no longer needed */
+  if ((gptr = GetPrefetchedGraph(prefetch)) != NULL){
+    PROFILE_BEGIN(tprep);
+    PrepareGraph(parameters, gptr);
+    PROFILE_END(PHASE_PREPARE, tprep);
+  }
+  return gptr;
+}
+
 /******************************************************************************
 Description: 
 
@@ -540,6 +1383,12 @@ int TrainMap(struct Parameters *parameters)
   UNSIGNED tlen, t;
   int counter;
   FLOAT terror;
+  struct Prefetch *prefetch = NULL;
+  struct TrainStatus status;
+  struct Control *control;
+  FILE *metrics = NULL;
+  struct PerfGroup *perf, *psearch, *padapt, *pkstep;
+  int r;
 
   /* Sanity check */
   if (parameters->train == NULL){
@@ -548,7 +1397,14 @@ int TrainMap(struct Parameters *parameters)
   }
 
   InstallHandlers();                           /* Install interrupt handler */
-  logfile = MyFopen(parameters->logfile, "w"); /* Open log-file   */
+  t = tlen = 0;
+  if (parameters->checkpoint.resume != NULL){ /* Continue an earlier run     */
+    if (RestoreCheckpoint(parameters, &t, &tlen))
+      return 0;
+    logfile = MyFopen(parameters->logfile, "a"); /* Append to the log-file  */
+  }
+  else
+    logfile = MyFopen(parameters->logfile, "w"); /* Open log-file   */
 
   /* Set the appropriate function for computing the learning rate */
   GetAlpha = SetAlpha(parameters->alphatype);
@@ -585,46 +1441,123 @@ int TrainMap(struct Parameters *parameters)
   else
     UpdateOffspringStates = UpdateChildrensLocation;   /* Use coordinates */
 
+  psearch = padapt = pkstep = perf = NULL;
+  if (parameters->perf && (perf = OpenPerfCounters()) != NULL){
+    psearch = &perf[REGION_SEARCH];  /* Count hardware events per region */
+    padapt = &perf[REGION_ADAPT];
+    pkstep = &perf[REGION_KSTEP];
+  }
+
   InitProgressMeter(parameters->rlen);   /* Initialize the progress meter */
   fprint(stderr, "Training map......");  /* Print what is being done      */
   map = &parameters->map;
 
-  tlen = 0;                   /* Compute the total number of update steps */
-  for (gptr = parameters->train; gptr != NULL; gptr = gptr->next)
-    tlen += gptr->numnodes;
-  tlen = tlen * (parameters->rlen - map->iter);
+  if (parameters->streaming) /* Only a sample of the data is in memory */
+    prefetch = StartPrefetch(parameters->datafile, parameters->rlen - map->iter, parameters->stream.window, (parameters->graphorder == 1) ? parameters->stream.window : 1);
+  if (tlen == 0){  /* Compute the total number of update steps unless known */
+    for (gptr = parameters->train; gptr != NULL; gptr = gptr->next)
+      for (nnum = 0; nnum < gptr->numnodes; nnum++)
+	tlen += MULTIPLICITY(gptr, gptr->nodes[nnum]);
+    if (parameters->streaming)
+      tlen = parameters->stream.numnodes;
+    tlen = tlen * (parameters->rlen - map->iter);
+  }
+
+  memset(&status, 0, sizeof(struct TrainStatus));
+  status.start = GetSeconds();
+  status.tlen = tlen;
+  status.lasterror = -1.0;     /* No iteration completed yet */
+  alpha_t = parameters->alpha;
+  radius_t = parameters->radius;
+  status.perf = perf;
+  control = OpenControl(parameters->control);
+  if (parameters->metricsfile != NULL)  /* Open metrics stream */
+    metrics = MyFopen(parameters->metricsfile, (parameters->checkpoint.resume != NULL) ? "a" : "w");
 
-  t = 0;
   for (i = map->iter; i < parameters->rlen; i++){
-    if (parameters->graphorder == 1)
+    if (parameters->graphorder == 1 && prefetch == NULL)
       parameters->train = RandomizeGraphOrder(parameters->train);
 
     counter = 0;
     terror = 0.0;
-    for (gptr = parameters->train; gptr != NULL; gptr = gptr->next){
+    status.iterstart = GetSeconds();
+    TraceBeginNum("Epoch", i);
+    status.searches = status.evaluated = status.touched = 0;
+    for (gptr = GetNextGraph(parameters, prefetch, NULL); gptr != NULL; gptr = GetNextGraph(parameters, prefetch, gptr)){
       for (nnum = 0; nnum < gptr->numnodes; nnum++){
+	PROFILE_BEGIN(tphase);
 	node = gptr->nodes[nnum];
 	alpha_t = GetAlpha(t, tlen, parameters->alpha);
 	radius_t = 1.0 + (parameters->radius - 1.0) * (float)(tlen - t)/(float)tlen;
-	t++;
+	t += MULTIPLICITY(gptr, node);
 	if (!parameters->contextual)
 	  UpdateOffspringStates(gptr, node);  /* Update child-state-vector   */
+	PROFILE_LAP(PHASE_STATE, tphase);
+	PerfStart(psearch);
 	FindWinner(map, node, gptr, &winner); /* Find best matching codebook */
+	PerfStop(psearch);
+	PROFILE_LAP(PHASE_SEARCH, tphase);
+	PerfStart(padapt);
 	Adapt(gptr, map, node, &winner, radius_t, alpha_t);/* update codebook*/
-	terror += winner.diff;
-	counter++;
+	PerfStop(padapt);
+	PROFILE_END(PHASE_ADAPT, tphase);
+	terror += winner.diff * MULTIPLICITY(gptr, node);
+	status.searches++;   /* A merged node is searched and adapted once */
+	status.evaluated += winner.evaluated;
+	status.touched += winner.touched;
+	counter += MULTIPLICITY(gptr, node);
+      }
+      if (_snapshot_request_ || _stats_request_){/* Signal caught */
+	status.iter = i;
+	status.t = t;
+	status.counter = counter;
+	status.terror = terror;
+	status.alpha = alpha_t;
+	status.radius = radius_t;
+	ServeRequests(parameters, &status);
       }
     }
 
-    if (parameters->contextual)
+    if (parameters->contextual){
+      PROFILE_BEGIN(tkstep);
+      PerfStart(pkstep);
+      TraceBegin("K-step");
       K_Step_Approximation(&parameters->map, parameters->train, kstepmode);
+      TraceEnd();
+      PerfStop(pkstep);
+      PROFILE_END(PHASE_KSTEP, tkstep);
+    }
+
+    TraceEnd();
+    if (prefetch != NULL && CheckErrors())  /* Failed to read the data */
+      break;
 
     map->iter++;
     fprintf(logfile, "%f\n", terror/counter);  /* Print normalized q-error */
     fflush(logfile);
 
+    status.iter = map->iter;
+    status.alpha = alpha_t;
+    status.radius = radius_t;
+    for (r = 0; r < NUM_REGIONS && status.perf != NULL; r++)
+      PerfRead(&status.perf[r], status.perfdelta[r]); /* Events of iteration */
+    if (metrics != NULL){
+      TraceBegin("Metrics");
+      WriteMetrics(metrics, parameters, &status, counter, terror, ValidationError(parameters, FindWinner, UpdateOffspringStates));
+      TraceEnd();
+    }
+    status.snaptime = 0.0;   /* Snapshots taken after this count next time */
+    status.t = t;
+    status.nodes += counter;
+    status.counter = 0;
+    status.terror = 0.0;
+    status.lasterror = terror/counter;
+    PollControl(parameters, &status, control); /* Apply control commands */
+    ServeRequests(parameters, &status);
+
     if (_save_then_exit_){ /* Save and exit if a interrupt signal was caught */
       char fname[32];
+      SaveCheckpoint(parameters, t, tlen);
       sprintf(fname, "interrupted%d.net", (int)getpid());
       free(parameters->onetfile);
       parameters->onetfile = strdup(fname);     /* Assign alternate filename */
@@ -632,12 +1565,24 @@ int TrainMap(struct Parameters *parameters)
       break;                                    /* Break the training cycle  */
     }
 
+    /* Write a checkpoint if required */
+    if (parameters->checkpoint.interval > 0 && !(map->iter % parameters->checkpoint.interval)){
+      PROFILE_BEGIN(tcheck);
+      TraceBegin("Checkpoint");
+      SaveCheckpoint(parameters, t, tlen);
+      TraceEnd();
+      PROFILE_END(PHASE_SNAPSHOT, tcheck);
+    }
+
     /* Create a snapshot if required */
     if (parameters->snap.interval>0 &&!(map->iter %parameters->snap.interval)){
-      if (parameters->snap.file != NULL)
-	SaveSnapShot(parameters);
-      if (parameters->snap.command != NULL)
-	system(parameters->snap.command);
+      status.snaptime -= GetSeconds();
+      PROFILE_BEGIN(tsnap);
+      TraceBegin("Snapshot");
+      SaveSnapShot(parameters);  /* Written in the background */
+      TraceEnd();
+      PROFILE_END(PHASE_SNAPSHOT, tsnap);
+      status.snaptime += GetSeconds();
     }
 
     if (parameters->nice)
@@ -645,12 +1590,25 @@ int TrainMap(struct Parameters *parameters)
 
     PrintProgress(map->iter);  /* Print Progress */
   }
+  CloseControl(control);
+  StopPrefetch(prefetch);
+  FinishSnapShots();           /* Wait for outstanding snapshots */
   StopProgressMeter();
-  if (!_save_then_exit_)
+  if (CheckErrors())
+    fprintf(stderr, "%56s\n", "[FAILED]");
+  else if (!_save_then_exit_)
     fprintf(stderr, "%56s\n", "[OK]");
+  PrintPerfSummary(stderr, status.perf);
+  ClosePerfCounters(status.perf);
 
   if (logfile != stdout)
     MyFclose(logfile);
+#ifdef PROFILE
+  if (metrics != NULL)
+    WriteProfileJSON(metrics);  /* Cycles spent in each phase so far */
+#endif
+  if (metrics != NULL && metrics != stdout)
+    MyFclose(metrics);
 
   return 0;
 }
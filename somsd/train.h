@@ -1,9 +1,31 @@
 #ifndef TRAIN_H_DEFINED
 #define TRAIN_H_DEFINED
 
+struct WinnerCache{  /* Winners of input vectors for a map which is frozen */
+  struct CachedWinner *slots;  /* Open addressing hash table             */
+  UNSIGNED size;               /* Number of slots, a power of 2         */
+  UNSIGNED count;              /* Number of cached winners              */
+  size_t bytes, maxbytes;      /* Memory used, and the limit            */
+  unsigned long long hits;     /* Lookups answered from the cache       */
+  unsigned long long misses;   /* Lookups which searched the map        */
+};
+
+#define NUM_WINNERS 2  /* Default number of best matches FindWinners*() track */
+
+typedef void (*FindWinnerFunc)(struct Map*, struct Node*, struct Graph*, struct Winner*);
+
 void FindWinnerEucledian(struct Map*,struct Node*,struct Graph*,struct Winner*);
 void VQFindWinnerEucledian(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winner);
+void FindWinnersEucledian(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winners, UNSIGNED k);
+void VQFindWinnersEucledian(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winners, UNSIGNED k);
+void BubbleAdapt(struct Graph *gptr, struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha);
+void GaussianAdapt(struct Graph *gptr, struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha);
+void VQAdapt(struct Graph *gptr, struct Map *map, struct Node *node, struct Winner *winner, FLOAT radius, FLOAT alpha);
 int TrainMap(struct Parameters *parameters);
 FLOAT ComputeHexaDistance(int bx, int by, int tx, int ty);
+struct WinnerCache *NewWinnerCache(size_t maxbytes);
+void FindWinnerMemo(struct Map *map, struct Node *node, struct Graph *gptr, struct Winner *winner, FindWinnerFunc FindWinner);
+void PrintWinnerCacheStats(FILE *ofile, struct WinnerCache *cache);
+void FreeWinnerCache(struct WinnerCache *cache);
 
 #endif
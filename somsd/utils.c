@@ -770,6 +770,38 @@ int BitCount(int *array, int size)
   return count;
 }
 
+/*****************************************************************************
+Description: Compute a 64-bit hash value over len bytes starting at data. The
+             hash is seeded with seed so that a sequence of blocks can be
+             hashed by passing the result of one call as the seed of the next.
+             This is not a cryptographic hash, but it mixes well enough to
+             identify the contents of files, vectors, or structures.
+
+Return value: The 64-bit hash value.
+*****************************************************************************/
+unsigned long long HashBytes(const void *data, size_t len, unsigned long long seed)
+{
+  const unsigned char *cptr = (const unsigned char *)data;
+  unsigned long long hash, k;
+
+  hash = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+  for (; len >= 8; len -= 8, cptr += 8){ /* Process 8 bytes at a time */
+    memcpy(&k, cptr, 8);
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 32;
+    hash = (hash ^ k) * 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 29;
+  }
+  for (k = 0; len > 0; len--)            /* Process remaining bytes */
+    k = (k << 8) | cptr[len-1];
+  hash = (hash ^ k) * 0xc4ceb9fe1a85ec53ULL;
+
+  hash ^= hash >> 33;                    /* Final avalanche */
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
 
 
 /* File handling functions */
@@ -792,7 +824,7 @@ FILE *MyFopen(const char *path, const char *mode)
   else if (!strcmp(path, "-")){
     if (*mode == 'r')
       return stdin;
-    else if (*mode == 'w')
+    else if (*mode == 'w' || *mode == 'a')
       return stdout;
   }
   if ((stream = fopen(path, mode)) == NULL){
@@ -822,25 +854,28 @@ Description: Returns the compress status of a existing file pointed to by
 
 Return value: GZIP if file is gzip compressed.
               BZIP if file is bzip2 compressed.
+              ZSTD if file is zstd compressed.
               RAW  else.
 *****************************************************************************/
 int GetCompressStatus(const char *path, char *mode)
 {
   FILE *myfile;
-  unsigned int buf = 0;
+  unsigned char buf[4];
 
   myfile = MyFopen(path, mode);
-  if (fread(&buf, 1, 2, myfile) < 2){ /* Attempt to get the magic number */
+  if (fread(buf, 1, 4, myfile) < 2){ /* Attempt to get the magic number */
     MyFclose(myfile);    /* Empty or very small files are */
     return RAW;          /* assumed RAW                   */ 
   }
   MyFclose(myfile);
 
-  if (buf == 0x8b1f)     /* Magic number of a gzip file  */   
+  if (buf[0] == 0x1f && buf[1] == 0x8b)     /* Magic number of a gzip file  */
     return GZIP;
-  else if (buf == 0x5a42)/* Magic number of a bzip2 file */    
+  else if (buf[0] == 'B' && buf[1] == 'Z')  /* Magic number of a bzip2 file */
     return BZIP;
+  else if (buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f && buf[3] == 0xfd)
+    return ZSTD;         /* Magic number of a zstd file  */
   else                                  
-    return RAW;          /* Neither BZIP2 nor GZIP */ 
-  }
+    return RAW;          /* Neither of the above */ 
+}
 /* End of file */
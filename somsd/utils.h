@@ -15,6 +15,7 @@
 #define RAW  0
 #define GZIP 1
 #define BZIP 2
+#define ZSTD 3
 
 /* Memory management utilities */
 void *MyMalloc(size_t size);               /* Fail safe malloc */
@@ -66,6 +67,7 @@ void StopProgressMeter();          /* Stop the progress meter       */
 int approx(float v1, float v2, float deviation);  /*Are two values about same*/
 int similar(float val1, float val2, float threshold);/*Are two values similar*/
 int BitCount(int *array, int size); /* Count number of bits in array */
+unsigned long long HashBytes(const void *data, size_t len, unsigned long long seed); /* 64-bit hash */
 
 /* File handling functions */
 FILE *MyFopen(const char *path, const char *mode);